@@ -0,0 +1,73 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "memory.h"
+
+// Batch environment API: N independent machines stepped together across
+// a thread pool (see runner.h), for driving the game from a training loop.
+// Every step applies one action per machine, runs frame_skip frames with
+// it held, and writes each machine's observation and reward into
+// caller-provided arrays laid out machine after machine. Stepping never
+// allocates; everything is set up by pacman_batch_create().
+//
+// An action is the set of input port 1 bits held down (INPUT_P1_UP ...
+// INPUT_COIN, INPUT_P1_START, see input.h), e.g. INPUT_P1_LEFT. The reward
+// is the change in player 1's score over the step.
+
+// What pacman_batch_step() writes for each machine
+typedef enum {
+    BATCH_OBS_MEMORY = 0,   // RAM, VRAM and CRAM, back to back
+    BATCH_OBS_PIXELS,       // Grayscale screen, downsampled (one byte per pixel)
+    BATCH_OBS_NONE          // Rewards only
+} BatchObsType;
+
+// Size of a BATCH_OBS_MEMORY observation
+#define BATCH_MEMORY_OBS_SIZE   (RAM_SIZE + VRAM_SIZE + CRAM_SIZE)
+
+// Batch settings
+typedef struct {
+    const char *rom_path;   // ROM file or MAME set directory, as for the emulator
+    int count;              // Machines in the batch
+    int threads;            // Runner threads (0 = one per CPU)
+    int frame_skip;         // Frames per step, the action held throughout (>= 1)
+    BatchObsType obs;       // Observation to write each step
+    int downsample;         // BATCH_OBS_PIXELS: 1, 2 or 4 (224x288, 112x144, 56x72)
+    CpuEngine engine;       // Z80 engine for every machine
+} BatchConfig;
+
+typedef struct PacmanBatch PacmanBatch;
+
+// Create the machines, load the ROMs and save their starting state (used
+// by pacman_batch_reset()). Returns NULL on invalid settings or if a ROM
+// cannot be loaded.
+PacmanBatch* pacman_batch_create(const BatchConfig *config);
+
+// Release the batch and all its machines (NULL is ignored)
+void pacman_batch_destroy(PacmanBatch *batch);
+
+// Machines in the batch, and bytes of observation per machine
+int pacman_batch_count(const PacmanBatch *batch);
+size_t pacman_batch_obs_size(const PacmanBatch *batch);
+
+// Advance every machine by one step. actions holds one byte per machine.
+// obs_out (count * pacman_batch_obs_size() bytes) and rewards_out (count
+// floats) may be NULL when not needed; pixel observations are only
+// rendered when obs_out is given, and only on the last frame of the step.
+void pacman_batch_step(PacmanBatch *batch, const uint8_t *actions, uint8_t *obs_out,
+                       float *rewards_out);
+
+// Write the current observations without stepping
+void pacman_batch_observe(PacmanBatch *batch, uint8_t *obs_out);
+
+// Put one machine (or all of them, index < 0) back in the starting state
+void pacman_batch_reset(PacmanBatch *batch, int index);
+
+// Player 1's score on one machine
+uint32_t pacman_batch_score(const PacmanBatch *batch, int index);
+
+#endif // BATCH_H
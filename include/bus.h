@@ -0,0 +1,80 @@
+#ifndef BUS_H
+#define BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "machine.h"
+#include "perf.h"
+
+// The Pac-Man Z80 bus as inline functions. memory.c uses these for
+// memory_read_byte()/memory_write_byte(), and z80.c binds to them directly
+// when built with Z80_STATIC_BUS, so the common case (a page with a direct
+// pointer) is a table lookup with no function call at all.
+
+// The CPU is the first member of the machine, so the core can get from its
+// z80 state to the machine without going through userdata
+#define BUS_MACHINE(z) ((PacmanMachine *)(z))
+_Static_assert(offsetof(PacmanMachine, cpu) == 0, "cpu must be the first member of PacmanMachine");
+
+// The Z80 dispatch loops are too big for GCC to inline these into them on
+// its own, so the two hot accessors are forced inline
+#if defined(__GNUC__) || defined(__clang__)
+#define BUS_INLINE static inline __attribute__((always_inline))
+#else
+#define BUS_INLINE static inline
+#endif
+
+// Slow paths for pages without a direct pointer (I/O, ROM writes, unmapped)
+uint8_t memory_read_handler(PacmanMachine *m, uint16_t address);
+void memory_write_handler(PacmanMachine *m, uint16_t address, uint8_t value);
+
+// Read a byte from the bus
+BUS_INLINE uint8_t bus_read_byte(PacmanMachine *m, uint16_t address) {
+    PERF_COUNT_READ(m, address);
+    const uint8_t *page = m->read_pages[address >> MEM_PAGE_SHIFT];
+    if (page) {
+        return page[address & MEM_PAGE_MASK];
+    }
+    return memory_read_handler(m, address);
+}
+
+// Write to video or color RAM, marking the tile dirty if it changed
+static inline void bus_write_tile_ram(PacmanMachine *m, uint16_t address, uint8_t value) {
+    uint16_t offset = address - VRAM_START;
+    uint8_t *cell = (offset < VRAM_SIZE) ? &m->vram[offset] : &m->cram[offset - VRAM_SIZE];
+    
+    if (*cell != value) {
+        *cell = value;
+        
+        // VRAM and CRAM share the tile index
+        uint16_t tile = offset & (VRAM_SIZE - 1);
+        m->tile_dirty[tile >> 6] |= 1ULL << (tile & 63);
+    }
+}
+
+// Write a byte to the bus
+BUS_INLINE void bus_write_byte(PacmanMachine *m, uint16_t address, uint8_t value) {
+    PERF_COUNT_WRITE(m, address);
+    uint8_t *page = m->write_pages[address >> MEM_PAGE_SHIFT];
+    if (page) {
+        page[address & MEM_PAGE_MASK] = value;
+        return;
+    }
+    if ((uint16_t)(address - VRAM_START) < VRAM_SIZE + CRAM_SIZE) {
+        bus_write_tile_ram(m, address, value);
+        return;
+    }
+    memory_write_handler(m, address, value);
+}
+
+// Z80 IN and OUT instructions
+static inline uint8_t bus_port_in(PacmanMachine *m, uint8_t port) {
+    return io_read_byte(m, port);
+}
+
+static inline void bus_port_out(PacmanMachine *m, uint8_t port, uint8_t value) {
+    io_write_byte(m, port, value);
+}
+
+#endif // BUS_H
@@ -71,12 +71,32 @@ typedef struct {
 #define FLAG_Z  0x40  // Zero (bit 6)
 #define FLAG_S  0x80  // Sign (bit 7)
 
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Z80 execution engines, selectable per machine at runtime. Both produce
+// identical results; the interpreter doubles as the reference the block
+// cache is tested against.
+typedef enum {
+    CPU_ENGINE_INTERP = 0,  // z80_run(): threaded interpreter
+    CPU_ENGINE_BLOCKS,      // z80_run_blocks(): pre-decoded ROM basic blocks
+    CPU_ENGINE_COUNT
+} CpuEngine;
+
 // Function prototypes
-void cpu_init(void);
-void cpu_reset(void);
-void cpu_execute_frame(void);
-uint8_t cpu_read_byte(uint16_t address);
-void cpu_write_byte(uint16_t address, uint8_t value);
-void cpu_interrupt(void);
+void cpu_init(PacmanMachine *m);
+void cpu_reset(PacmanMachine *m);
+void cpu_execute_frame(PacmanMachine *m);
+uint8_t cpu_read_byte(PacmanMachine *m, uint16_t address);
+void cpu_write_byte(PacmanMachine *m, uint16_t address, uint8_t value);
+void cpu_interrupt(PacmanMachine *m);
+
+// Select the engine used by cpu_execute_frame(). Returns false if it is not
+// available in this build (the block cache needs computed goto support).
+bool cpu_set_engine(PacmanMachine *m, CpuEngine engine);
+
+// Look up an engine by name ("interp" or "blocks"). Returns false if unknown.
+bool cpu_parse_engine(const char *name, CpuEngine *engine);
+const char* cpu_engine_name(CpuEngine engine);
 
 #endif // CPU_H
\ No newline at end of file
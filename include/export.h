@@ -0,0 +1,102 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Frame export: publishes every shown frame, with a little of the board
+// state, into a named shared memory block (POSIX shm_open, or a named file
+// mapping on Windows), for a separate process such as a stream encoder.
+//
+// The block is an ExportHeader followed by EXPORT_SLOTS slots, each an
+// ExportFrameInfo followed by the pixels. It is a triple buffer with one
+// writer and one reader: the writer fills the slot it owns, then swaps it
+// with the one in header.middle, tagged EXPORT_FRESH. The reader swaps its
+// own slot with middle whenever EXPORT_FRESH is set. Neither side ever
+// waits or copies on behalf of the other, and the reader sees the newest
+// whole frame (frames it is too slow for are skipped, never torn).
+//
+// export_attach() and export_acquire() implement the reader side and are
+// also meant as a reference for readers written in other languages. One
+// reader may be attached at a time; a new one carries on with the slot in
+// header.reader_slot.
+
+#define EXPORT_MAGIC        0x58464D50u     // "PMFX" little endian
+#define EXPORT_VERSION      1
+#define EXPORT_SLOTS        3
+
+// header.middle: slot index in the low bits, set when not yet acquired
+#define EXPORT_SLOT_MASK    0x3u
+#define EXPORT_FRESH        0x4u
+
+// header.pixel_format: 32-bit words 0xAARRGGBB in native byte order
+#define EXPORT_FORMAT_ARGB8888  1
+
+// Start of the shared block. Written once by export_create() except for
+// middle and published.
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;       // sizeof(ExportHeader)
+    uint32_t slot_count;        // EXPORT_SLOTS
+    uint32_t slot_size;         // Bytes from one slot to the next
+    uint32_t slots_offset;      // Offset of slot 0 from the block start
+    uint32_t pixels_offset;     // Offset of the pixels from the slot start
+    uint16_t width;
+    uint16_t height;
+    uint32_t pitch;             // Bytes per pixel row
+    uint32_t pixel_format;      // EXPORT_FORMAT_*
+    _Atomic uint32_t middle;    // Slot between writer and reader, see above
+    uint32_t reader_slot;       // Slot the reader holds (only the reader writes it)
+    _Atomic uint64_t published; // Frames published so far
+} ExportHeader;
+
+// Start of each slot
+typedef struct {
+    uint64_t frame;             // Frames shown by the emulator, this one included
+    uint64_t time_ns;           // timer_now_ns() when it was published
+    uint8_t io_ports[256];
+    uint8_t interrupt_enable;
+    uint8_t sound_enable;
+    uint8_t flip_screen;
+    uint8_t lamp1;              // Player start lamps
+    uint8_t lamp2;
+    uint8_t coin_lockout;
+    uint8_t coin_counter;
+    uint8_t input_port1;        // IN0/IN1, active low
+    uint8_t input_port2;
+    uint8_t reserved[7];
+} ExportFrameInfo;
+
+typedef struct FrameExport FrameExport;
+typedef struct ExportReader ExportReader;
+
+// Create (or replace) the shared block called name. POSIX names get a
+// leading '/' if they lack one. Returns NULL if it cannot be created.
+FrameExport* export_create(const char *name);
+
+// Unmap and remove the shared block (NULL is ignored). Readers still
+// attached keep their mapping.
+void export_destroy(FrameExport *e);
+
+// Publish m's current framebuffer (see video_get_framebuffer()) and board
+// state as the given frame number
+void export_publish(FrameExport *e, PacmanMachine *m, uint64_t frame);
+
+// Reader side: map an existing block. Returns NULL if there is none or its
+// layout is not this version's.
+ExportReader* export_attach(const char *name);
+void export_detach(ExportReader *r);
+
+// Take the newest published frame. Returns true if it is newer than the
+// one returned last time; either way info and pixels point at the newest
+// frame the reader holds (all zeros before any frame), valid until the
+// next call.
+bool export_acquire(ExportReader *r, const ExportFrameInfo **info, const uint32_t **pixels);
+
+#endif // EXPORT_H
@@ -0,0 +1,37 @@
+#ifndef GFX_H
+#define GFX_H
+
+#include <stdint.h>
+
+// Pre-decoded graphics. The character and sprite ROMs are expanded once at
+// load time into one pen byte per pixel (0 = background/transparent,
+// 1 = foreground), and sprites are stored in all four flip variants, so
+// the per-frame blitters copy whole clipped rows without bit tests.
+
+#define GFX_TILE_COUNT      256     // 8x8 characters
+#define GFX_TILE_PIXELS     (8 * 8)
+#define GFX_SPRITE_COUNT    64      // 16x16 sprites
+#define GFX_SPRITE_PIXELS   (16 * 16)
+#define GFX_FLIP_VARIANTS   4
+
+// Index of a sprite flip variant
+#define GFX_FLIP(flip_x, flip_y) (((flip_x) ? 1 : 0) | ((flip_y) ? 2 : 0))
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Rebuild the decoded caches from the machine's charset and sprite data
+// (call whenever those change)
+void gfx_decode(PacmanMachine *m);
+
+// Both blitters clip to SCREEN_WIDTH x SCREEN_HEIGHT; rows of dst are
+// pitch pixels apart (SCREEN_WIDTH for the software buffers, the texture
+// pitch when drawing straight into a locked SDL texture).
+
+// Draw an opaque 8x8 tile: pen 1 pixels get fg, pen 0 pixels get black
+void gfx_draw_tile(uint32_t *dst, int pitch, int x, int y, const uint8_t *pens, uint32_t fg);
+
+// Draw a transparent 16x16 sprite: only pen 1 pixels are written
+void gfx_draw_sprite(uint32_t *dst, int pitch, int x, int y, const uint8_t *pens, uint32_t fg);
+
+#endif // GFX_H
@@ -0,0 +1,43 @@
+#ifndef GFX_KERNELS_H
+#define GFX_KERNELS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pen-to-RGBA block kernels used by the gfx blitters, and the row kernels
+// of the output scaler (see scaler.h). The scalar set is always available;
+// SIMD sets (SSE2, AVX2, NEON) are compiled in when the compiler targets
+// that architecture and picked at runtime from what the host CPU supports.
+// All sets produce bit-identical output.
+
+typedef struct {
+    const char *name;
+    
+    // Opaque 8x8 tile: pen != 0 -> fg, pen 0 -> black
+    void (*tile)(uint32_t *dst, int stride, const uint8_t *pens, uint32_t fg);
+    
+    // Transparent 16-pixel-wide sprite rows: pen != 0 -> fg, pen 0 keeps dst.
+    // pens points at the first row to draw, rows is how many to draw.
+    void (*sprite)(uint32_t *dst, int stride, const uint8_t *pens, int rows, uint32_t fg);
+    
+    // Integer upscale of one row: every src pixel written factor (>= 2)
+    // times, count * factor pixels in all
+    void (*widen)(uint32_t *dst, const uint32_t *src, int count, int factor);
+    
+    // Scale each byte of count pixels by the matching byte of weights:
+    // dst = src * (weight + 1) >> 8, so 255 keeps a channel and 0 clears it.
+    // dst may be src.
+    void (*modulate)(uint32_t *dst, const uint32_t *src, const uint32_t *weights, int count);
+} GfxKernels;
+
+// Kernels currently in use (selected on first use if none was chosen)
+const GfxKernels* gfx_kernels(void);
+
+// Use the named kernel set ("scalar", "sse2", "avx2", "neon", or "auto" for
+// the best one the CPU supports). Returns false if it is not available.
+bool gfx_use_kernels(const char *name);
+
+// Kernel sets available on this CPU, best last
+int gfx_available_kernels(const GfxKernels **list, int max);
+
+#endif // GFX_KERNELS_H
@@ -1,9 +1,7 @@
 #ifndef INPUT_H
 #define INPUT_H
 
-#ifdef _WIN32
-    #include <SDL2/SDL.h>
-#else
+#ifndef NO_SDL
     #include <SDL2/SDL.h>
 #endif
 #include <stdbool.h>
@@ -28,11 +26,16 @@
 #define INPUT_DIP5      0x40
 #define INPUT_DIP6      0x80
 
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
 // Function prototypes
-void input_init(void);
-void input_process_event(SDL_Event *event);
-uint8_t input_read_port1(void);
-uint8_t input_read_port2(void);
-void input_reset(void);
+void input_init(PacmanMachine *m);
+#ifndef NO_SDL
+void input_process_event(PacmanMachine *m, SDL_Event *event);
+#endif
+uint8_t input_read_port1(PacmanMachine *m);
+uint8_t input_read_port2(PacmanMachine *m);
+void input_reset(PacmanMachine *m);
 
 #endif // INPUT_H
\ No newline at end of file
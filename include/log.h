@@ -0,0 +1,78 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Leveled, categorized logging. The level check happens before any
+// formatting; enabled records are formatted into a lock-free ring buffer
+// and written to debug.log (and stdout) by a background thread, so logging
+// never blocks the emulation thread on I/O.
+
+// Log levels (lower = more important)
+typedef enum {
+    LOG_LEVEL_OFF = 0,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_TRACE
+} LogLevel;
+
+// Log categories, each with its own runtime level
+typedef enum {
+    LOG_CAT_MAIN = 0,
+    LOG_CAT_CPU,
+    LOG_CAT_MEMORY,
+    LOG_CAT_VIDEO,
+    LOG_CAT_INPUT,
+    LOG_CAT_RUNNER,
+    LOG_CAT_SOUND,
+    LOG_CAT_NET,
+    LOG_CAT_COUNT
+} LogCategory;
+
+// Calls above this level are removed at compile time
+// (e.g. make LOG_MAX_LEVEL=3 keeps only error, warn and info)
+#ifndef LOG_COMPILE_LEVEL
+    #define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#endif
+
+// Runtime level per category (default LOG_LEVEL_INFO)
+extern uint8_t log_levels[LOG_CAT_COUNT];
+
+// Check whether a record would be emitted
+#define LOG_ENABLED(cat, level) \
+    ((level) <= LOG_COMPILE_LEVEL && (level) <= log_levels[(cat)])
+
+// Emit a record if its level is enabled. Arguments are not evaluated when
+// the level is disabled.
+#define LOG_AT(cat, level, ...) \
+    do { \
+        if (LOG_ENABLED(cat, level)) { \
+            log_write((cat), (level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(cat, ...) LOG_AT(cat, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(cat, ...)  LOG_AT(cat, LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(cat, ...)  LOG_AT(cat, LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(cat, ...) LOG_AT(cat, LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_TRACE(cat, ...) LOG_AT(cat, LOG_LEVEL_TRACE, __VA_ARGS__)
+
+// Format and queue one record (use the LOG_* macros instead)
+void log_write(LogCategory cat, LogLevel level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Set runtime levels from a spec such as "debug" or "info,video=trace,cpu=off".
+// A bare level applies to all categories. Returns false on a malformed spec.
+bool log_configure(const char *spec);
+
+// Echo records to stdout as well as debug.log (default on)
+void log_set_console(bool enable);
+
+// Drain the ring, stop the writer thread and close debug.log. Also runs at
+// exit; records logged afterwards are dropped.
+void log_shutdown(void);
+
+#endif // LOG_H
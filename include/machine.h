@@ -0,0 +1,145 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "scheduler.h"
+#include "sound.h"
+#include "memory.h"
+#include "gfx.h"
+#include "perf.h"
+#include "../src/z80/z80.h"
+
+// SDL objects are only held by pointer, so this header does not need SDL
+struct SDL_Renderer;
+struct SDL_Texture;
+
+// Sizes of the graphics and palette buffers
+#define CHARSET_SIZE    (256 * 8)   // 256 characters, 8 bytes per character
+#define SPRITEDATA_SIZE (64 * 16)   // 64 sprites, 16 bytes per sprite
+#define PALETTE_SIZE    256         // 256 colors
+
+// One complete Pacman board. Every cpu_*, memory_*, io_*, video_* and
+// input_* function works on the machine passed to it, so any number of
+// machines can live in one process (and run on different threads).
+//
+// All emulated state comes first, from cpu up to state_end, so a snapshot
+// is one memcpy of that range (see state.h). The z80 struct's host
+// bindings (bus callbacks, profile, trace) are the only pointers in it, and
+// state_load() restores the loading machine's own. Anything else that holds
+// pointers or is rebuilt from the ROMs goes after state_end.
+struct PacmanMachine {
+    // Z80 CPU instance (cpu.userdata points back to this machine)
+    z80 cpu;
+    Scheduler sched;                    // Timed events (VBLANK, watchdog, sound), see cpu.c
+
+    // Memory segments
+    uint8_t ram[RAM_SIZE];
+    uint8_t vram[VRAM_SIZE];
+    uint8_t cram[CRAM_SIZE];
+
+    // I/O ports and hardware registers
+    uint8_t io_ports[256];
+    uint8_t interrupt_enable;
+    uint8_t sound_enable;
+    uint8_t flip_screen;
+    uint8_t lamp1;
+    uint8_t lamp2;
+    uint8_t coin_lockout;
+    uint8_t coin_counter;
+    uint8_t watchdog_counter;           // Frames since the last watchdog write
+
+    // Input state (active low logic: 0 = pressed, 1 = released)
+    uint8_t input_port1;
+    uint8_t input_port2;
+
+    // Namco WSG sound (see sound.h)
+    uint8_t sound_regs[SOUND_REG_COUNT];    // Last nibble written to each register
+    SoundVoice voices[SOUND_VOICES];
+
+    // Demo display state used by cpu_execute_frame()
+    bool demo_vram_initialized;
+    bool demo_screen_created;
+    bool first_execution_done;
+    bool executed_rom;
+    int frame_counter;
+    int demo_frame_counter;
+
+    uint8_t state_end;                  // Marks the end of the snapshot range
+
+    // Host configuration and resources
+    CpuEngine cpu_engine;               // See cpu_set_engine()
+    z80_blocks *cpu_blocks;             // Block cache, created on first use
+    z80_profile *cpu_profile;           // Execution profile, see profile.h (NULL = off)
+    z80_trace *cpu_trace;               // Execution trace ring, see trace.h (NULL = off)
+    char *trace_prefix;                 // Saved traces are named after this
+    int trace_dumps;                    // Traces saved so far
+    bool watchdog_enabled;              // Reset the CPU when the watchdog expires
+    bool rewind_held;                   // Rewind hotkey is down (see input.c)
+    struct SoundOutput *audio;          // Audio device and ring, NULL when silent
+
+    // ROM contents
+    uint8_t rom[ROM_SIZE];
+    uint8_t charset[CHARSET_SIZE];      // Character ROM
+    uint8_t sprites[SPRITEDATA_SIZE];   // Sprite ROM
+    uint32_t palette[PALETTE_SIZE];     // Color palette
+    uint8_t sound_prom[SOUND_PROM_SIZE];  // WSG waveforms, low nibble only
+
+    // Decoded graphics (see gfx.h), rebuilt by gfx_decode()
+    uint8_t tile_pens[GFX_TILE_COUNT][GFX_TILE_PIXELS];
+    uint8_t sprite_pens[GFX_FLIP_VARIANTS][GFX_SPRITE_COUNT][GFX_SPRITE_PIXELS];
+    bool memory_initialized;
+    uint16_t rom_flags;                 // ROM_IMAGE_* flags of the loaded ROMs (see memory.h)
+
+    // Z80 bus page tables (see memory_map_pages). A NULL entry means the
+    // page is not plain memory and goes through the bus handlers instead.
+    uint8_t *read_pages[MEM_PAGE_COUNT];
+    uint8_t *write_pages[MEM_PAGE_COUNT];
+
+    // Video state
+    struct SDL_Renderer *renderer;
+    struct SDL_Texture *screen_texture;
+    uint32_t *pixel_buffer;
+    int scale;
+    struct Scaler *scaler;                  // CPU output scaler, NULL = none (see video_set_filter)
+    struct SDL_Texture *scaled_texture;     // Output of the CPU scaler, presented 1:1
+    struct SDL_Texture *mask_texture;       // Filter mask blended over screen_texture
+    bool debug_mode;
+    bool keep_framebuffer;                  // Compose in pixel_buffer even with a window
+
+    // Incremental background renderer (see video_render). Tile RAM writes
+    // mark tiles dirty; only those are redrawn into bg_buffer each frame.
+    uint32_t *bg_buffer;                    // Cached tile layer, no sprites
+    uint64_t tile_dirty[VRAM_SIZE / 64];    // One bit per VRAM/CRAM offset
+    uint16_t palette_dirty;                 // Tile palette entries (0-15) changed
+    bool bg_full_redraw;                    // Redraw every tile next frame
+    bool bg_vram_empty;                     // Cached "VRAM is all zeros" check
+    bool bg_flip;                           // Flip state bg_buffer was drawn with
+
+    // Frame being composed by video_render: the locked streaming texture in
+    // windowed mode, pixel_buffer otherwise (or with keep_framebuffer)
+    uint32_t *frame;
+    int frame_pitch;                        // Pixels per row of frame
+    uint64_t frame_hash;                    // Hash of what the last frame was drawn from
+    bool frame_valid;                       // frame_hash describes the texture/pixel_buffer
+    bool present_pending;                   // Frame changed (or window exposed) since last present
+    
+#ifdef PERF_ENABLED
+    PerfStats perf;                         // Frame instrumentation (see perf.h)
+#endif
+};
+
+// Bytes of emulated state at the start of the machine (see state.h)
+#define MACHINE_STATE_SIZE offsetof(PacmanMachine, state_end)
+
+// Allocate a machine with all state cleared. Call memory_init(), cpu_init(),
+// input_init() and (optionally) video_init() on it before running frames.
+PacmanMachine* machine_create(void);
+
+// Release a machine and all resources owned by it
+void machine_destroy(PacmanMachine *m);
+
+#endif // MACHINE_H
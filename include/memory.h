@@ -4,8 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-// Debug logging
-void debug_log(const char *format, ...);
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
 
 // Pacman memory map constants
 #define ROM_SIZE        0x4000  // 16KB ROM (multiple chips)
@@ -49,6 +49,12 @@ void debug_log(const char *format, ...);
 #define COIN_LOCKOUT    0x5006  // Coin lockout
 #define COIN_COUNTER    0x5007  // Coin counter
 
+// Bus page tables: the 64KB address space is split into 256-byte pages
+#define MEM_PAGE_SHIFT  8
+#define MEM_PAGE_SIZE   (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK   (MEM_PAGE_SIZE - 1)
+#define MEM_PAGE_COUNT  (0x10000 >> MEM_PAGE_SHIFT)
+
 // MAME ROM filenames
 typedef struct {
     const char *program1;     // pacman.6e
@@ -59,42 +65,80 @@ typedef struct {
     const char *gfx2;         // pacman.5f - Sprite data
     const char *palette;      // 82s123.7f - Color palette
     const char *colortable;   // 82s126.4a - Color lookup
-    const char *charmap;      // 82s126.1m - Character lookup
+    const char *sound;        // 82s126.1m - Sound waveforms
 } MameRomSet;
 
+// Packed ROM images (--write-pack) and decoded ROM cache files
+// (--rom-cache): a RomImageHeader, then the machine's ROM contents as
+// loaded and decoded (rom up to the decoded sprite pens, host layout), so
+// that loading one is a single mapping and copy. Images only load in a
+// build with the same machine layout; bump ROM_IMAGE_VERSION when what is
+// decoded changes without the layout changing.
+#define ROM_IMAGE_MAGIC     0x4D524D50u     // "PMRM" little endian
+#define ROM_IMAGE_VERSION   1
+
+// Image flags
+#define ROM_IMAGE_MAME_SET  0x0001      // From a MAME set, memory_reset() after loading
+
+// Image header
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;             // ROM_IMAGE_*
+    uint32_t header_size;
+    uint32_t payload_size;      // Bytes of ROM contents after the header
+    uint32_t key;               // Cache files: CRC of the set's file CRCs (0 for packs)
+    uint32_t reserved;
+} RomImageHeader;
+
 // Getter functions for hardware flags and registers
-uint8_t memory_get_interrupt_enable(void);
-uint8_t memory_get_sound_enable(void);
-uint8_t memory_get_flip_screen(void);
-uint8_t memory_get_lamp1(void);
-uint8_t memory_get_lamp2(void);
-uint8_t memory_get_coin_lockout(void);
-uint8_t memory_get_coin_counter(void);
+uint8_t memory_get_interrupt_enable(PacmanMachine *m);
+uint8_t memory_get_sound_enable(PacmanMachine *m);
+uint8_t memory_get_flip_screen(PacmanMachine *m);
+uint8_t memory_get_lamp1(PacmanMachine *m);
+uint8_t memory_get_lamp2(PacmanMachine *m);
+uint8_t memory_get_coin_lockout(PacmanMachine *m);
+uint8_t memory_get_coin_counter(PacmanMachine *m);
 
 // Function prototypes
-bool memory_init(const char *rom_path);
-bool memory_init_mame_set(const char *rom_dir);
-void memory_cleanup(void);
-void memory_reset(void);
+bool memory_init(PacmanMachine *m, const char *rom_path);
+bool memory_init_mame_set(PacmanMachine *m, const char *rom_dir);  // Directory or .zip
+void memory_cleanup(PacmanMachine *m);
+void memory_reset(PacmanMachine *m);
+
+// Keep decoded MAME sets in dir (created if missing), keyed by the CRCs of
+// their files: the first load of a set writes its cache file, later loads,
+// by any process, map it instead of reading and decoding the set. NULL
+// turns the cache off. Applies to every machine loaded afterwards.
+void memory_set_rom_cache(const char *dir);
+
+// Write the loaded ROMs of m as a packed image, which memory_init() loads
+// like the original ROMs. Returns false if it cannot be written.
+bool memory_write_pack(const PacmanMachine *m, const char *path);
+
+// Point the bus page tables at this machine's memory (done by memory_init,
+// call again after the machine has been copied or moved)
+void memory_map_pages(PacmanMachine *m);
 
-uint8_t memory_read_byte(uint16_t address);
-void memory_write_byte(uint16_t address, uint8_t value);
+uint8_t memory_read_byte(PacmanMachine *m, uint16_t address);
+void memory_write_byte(PacmanMachine *m, uint16_t address, uint8_t value);
 
-uint16_t memory_read_word(uint16_t address);
-void memory_write_word(uint16_t address, uint16_t value);
+uint16_t memory_read_word(PacmanMachine *m, uint16_t address);
+void memory_write_word(PacmanMachine *m, uint16_t address, uint16_t value);
 
 // I/O port functions
-uint8_t io_read_byte(uint8_t port);
-void io_write_byte(uint8_t port, uint8_t value);
+uint8_t io_read_byte(PacmanMachine *m, uint8_t port);
+void io_write_byte(PacmanMachine *m, uint8_t port, uint8_t value);
 
 // Memory access for other components
-uint8_t* memory_get_vram(void);
-uint8_t* memory_get_cram(void);
-uint8_t* memory_get_charset(void);
-uint8_t* memory_get_spritedata(void);
-uint32_t* memory_get_palette(void);
+uint8_t* memory_get_ram(PacmanMachine *m);
+uint8_t* memory_get_vram(PacmanMachine *m);
+uint8_t* memory_get_cram(PacmanMachine *m);
+uint8_t* memory_get_charset(PacmanMachine *m);
+uint8_t* memory_get_spritedata(PacmanMachine *m);
+uint32_t* memory_get_palette(PacmanMachine *m);
 
 // Set input ports - for external input handling
-void memory_set_input_port(uint8_t port, uint8_t value);
+void memory_set_input_port(PacmanMachine *m, uint8_t port, uint8_t value);
 
 #endif // MEMORY_H
\ No newline at end of file
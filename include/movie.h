@@ -0,0 +1,96 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Input movies (--record, --replay): the input ports of every frame of a
+// run from power on, so the run can be repeated exactly, e.g. headless at
+// full speed as a benchmark workload. A movie also holds checkpoints, hashes
+// of the board's memory and of the framebuffer every few frames, which a
+// replay compares to catch changes that alter what the emulator does.
+//
+// Movie file: a MovieHeader, then one entry per frame on which something
+// happens, all little endian:
+//   varint  frames since the previous entry (since power on for the first)
+//   uint8   MOVIE_ENTRY_* flags
+//   uint8   input port 1, if MOVIE_ENTRY_PORT1
+//   uint8   input port 2, if MOVIE_ENTRY_PORT2
+//   uint64  memory hash, if MOVIE_ENTRY_CHECK
+//   uint64  framebuffer hash, if MOVIE_ENTRY_FRAMEBUFFER
+// Port values take effect on that frame; a checkpoint describes the board
+// before the frame runs, so the one at the movie's length is its final
+// state.
+
+#define MOVIE_MAGIC         0x564D4D50u     // "PMMV" little endian
+#define MOVIE_VERSION       1
+
+// Frames between checkpoints unless --verify-every says otherwise
+#define MOVIE_DEFAULT_VERIFY    60
+
+// Entry flags
+#define MOVIE_ENTRY_PORT1       0x01
+#define MOVIE_ENTRY_PORT2       0x02
+#define MOVIE_ENTRY_CHECK       0x04
+#define MOVIE_ENTRY_FRAMEBUFFER 0x08
+
+// Header flags
+#define MOVIE_FLAG_WATCHDOG     0x0001      // Recorded with --watchdog
+
+// File header
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;             // MOVIE_FLAG_*
+    uint32_t rom_hash;          // movie_rom_hash() of the recording machine
+    uint32_t frames;            // Length in frames
+    uint32_t verify_interval;   // Frames between checkpoints (0 = final state only)
+    uint32_t reserved;
+} MovieHeader;
+
+typedef struct Movie Movie;
+
+// Start recording m, which must be at power on. verify_interval is the
+// number of frames between checkpoints (0 = only the final state). The
+// file is written by movie_finish().
+Movie* movie_record(const char *path, const PacmanMachine *m, int verify_interval);
+
+// Load a movie to replay on m, which must be at power on with the ROMs the
+// movie was recorded with. Applies the movie's watchdog setting. Returns
+// NULL if the file is missing or damaged or the ROMs differ.
+Movie* movie_replay(const char *path, PacmanMachine *m);
+
+// Call before each emulated frame: records m's input ports, or sets them
+// from the movie, and records or compares a checkpoint when one is due
+void movie_frame(Movie *movie, PacmanMachine *m);
+
+// Record and compare the framebuffer at checkpoints (the default) or only
+// memory, for runs whose framebuffer does not show the frame being checked:
+// replays that keep one without rendering every frame, run-ahead, overlays.
+// Runs without a software framebuffer (see video_get_framebuffer()) only
+// ever check memory.
+void movie_check_framebuffer(Movie *movie, bool check);
+
+// Frames in a replayed movie, or recorded so far
+long movie_length(const Movie *movie);
+
+// True while every checkpoint of a replay so far matched
+bool movie_matches(const Movie *movie);
+
+// End the movie after the last frame: recordings add a checkpoint of the
+// final state and are written out, replays that reached the movie's end
+// compare it and report. Frees the movie. Returns false if the file could
+// not be written or the replay diverged.
+bool movie_finish(Movie *movie, PacmanMachine *m);
+
+// Free a movie without writing a recording or checking a replay (NULL is
+// ignored)
+void movie_close(Movie *movie);
+
+// Fingerprint of the ROMs a movie belongs to
+uint32_t movie_rom_hash(const PacmanMachine *m);
+
+#endif // MOVIE_H
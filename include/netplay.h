@@ -0,0 +1,68 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Two-player netplay over UDP with rollback. Both peers run the whole game
+// from the same starting state. Each frame, a peer sends its own joystick
+// and button state and runs the frame at once with a prediction (the last
+// input received) for the other player. When the real input for a frame
+// arrives and differs from the prediction, the peer loads the save state
+// from that frame (see state.h) and re-runs the frames since then, muted
+// and unrendered, before running the current one. cpu_execute_frame()
+// depends only on the machine state and the input ports, so both peers
+// arrive at the same state.
+//
+// The player who listens (--net-listen) is player 1 and the one who
+// connects (--net-connect) is player 2. Either player's arrow keys or WASD
+// drive their own joystick; coin, start and service buttons work on both.
+
+// Furthest a peer runs ahead of the last input it has from the other one.
+// Beyond it the peer waits, so a rollback never re-runs more frames.
+#define NETPLAY_MAX_ROLLBACK    8
+
+// Default number of frames local inputs are held back before they take
+// effect (--net-delay). One frame hides most network latency from the
+// other peer's predictions at the cost of one frame of input lag.
+#define NETPLAY_DEFAULT_DELAY   1
+#define NETPLAY_MAX_DELAY       4
+
+// Disconnect after this long without hearing from the other peer
+#define NETPLAY_TIMEOUT_MS      5000
+
+typedef struct Netplay Netplay;
+
+// Wait for a peer to connect to the UDP port, as player 1. m must be in
+// the state both peers start from: the peers check that their ROMs and
+// memory match. Returns NULL on socket errors, a mismatch, or after
+// timeout_ms without a peer (0 = wait forever).
+Netplay* netplay_listen(PacmanMachine *m, uint16_t port, int delay, int timeout_ms);
+
+// Connect to a peer listening on host:port, as player 2. Same conditions
+// as netplay_listen().
+Netplay* netplay_connect(PacmanMachine *m, const char *host, uint16_t port, int delay,
+                         int timeout_ms);
+
+// Close the session (NULL is ignored)
+void netplay_destroy(Netplay *np);
+
+// Run the next frame of the session, taking this peer's input from the
+// machine's input ports (as set by input_process_event()). Returns false
+// without running a frame when this peer is NETPLAY_MAX_ROLLBACK frames
+// ahead of the other one's input; call again on the next display frame.
+bool netplay_frame(Netplay *np, PacmanMachine *m);
+
+// False once the other peer has not been heard from in NETPLAY_TIMEOUT_MS
+bool netplay_connected(const Netplay *np);
+
+// Frames run so far
+uint32_t netplay_frame_count(const Netplay *np);
+
+// Log rollback and re-simulation statistics for the session so far
+void netplay_report(const Netplay *np);
+
+#endif // NETPLAY_H
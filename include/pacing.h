@@ -0,0 +1,64 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scheduler.h"
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Frame pacing: decides when the main loop may start the next frame and
+// measures how evenly frames are actually released. Uses the timer.h clock
+// (QueryPerformanceCounter / CLOCK_MONOTONIC), so it works without SDL.
+
+// Length of one emulated frame: 50,688 CPU cycles at 3.072 MHz = 16.5ms
+#define PACE_FRAME_NS       ((uint64_t)CPU_CYCLES_PER_FRAME * 1000000000ULL / CPU_CLOCK_HZ)
+
+// How pacing_wait() waits
+typedef enum {
+    PACE_AUTO = 0,  // Audio when an output is open, timer otherwise
+    PACE_TIMER,     // Sleep, then spin for the last stretch, to each deadline
+    PACE_VSYNC,     // Presenting blocks on the display refresh (runs at its rate)
+    PACE_AUDIO,     // Keep the audio ring filled to a fixed latency
+    PACE_OFF,       // No waiting (--uncapped)
+    PACE_MODE_COUNT
+} PaceMode;
+
+// Frame-to-frame timing over a reporting window
+typedef struct {
+    uint64_t frames;        // Intervals measured
+    uint64_t late;          // Frames that were already past their deadline
+    double sum_ns;          // Sum of intervals
+    double sum_sq_ns;       // Sum of squared intervals
+    uint64_t max_dev_ns;    // Largest |interval - frame period|
+} PaceStats;
+
+// Pacer state for one main loop
+typedef struct {
+    PaceMode mode;          // Resolved mode (never PACE_AUTO)
+    uint64_t period_ns;     // Target frame period
+    uint64_t next_ns;       // Deadline of the next frame (0 = not started)
+    uint64_t last_ns;       // When the previous frame was released
+    PaceStats window;       // Since the last periodic report
+    PaceStats total;        // Whole run
+} Pacer;
+
+// Set up a pacer. PACE_AUTO picks PACE_AUDIO if m has an audio output
+// open, PACE_TIMER otherwise (m may be NULL).
+void pacing_init(Pacer *p, PaceMode mode, PacmanMachine *m);
+
+// Block until the next frame should start. presented says whether the
+// frame just finished was actually presented: vsync mode only gets its
+// timing from presents and falls back to the timer for skipped ones.
+void pacing_wait(Pacer *p, PacmanMachine *m, bool presented);
+
+// Log the jitter statistics for the whole run
+void pacing_report(const Pacer *p);
+
+// Look up a mode by name ("auto", "timer", "vsync", "audio", "off")
+bool pacing_parse_mode(const char *name, PaceMode *mode);
+const char* pacing_mode_name(PaceMode mode);
+
+#endif // PACING_H
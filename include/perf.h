@@ -0,0 +1,128 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Frame instrumentation, compiled in with make PERF=1 (PERF_ENABLED). Each
+// machine times the stages of every frame with timer_now_ns() and counts
+// instructions, accepted interrupts and bus reads/writes by region; at the
+// end of a frame the stage times go into fixed-bucket histograms. The
+// results can be drawn over the game (video_render) and written
+// out as JSON or Prometheus text. Without PERF_ENABLED every macro and
+// function below compiles to nothing.
+//
+// Counters are only touched by the thread running the machine.
+
+// Stages of a frame
+typedef enum {
+    PERF_STAGE_INPUT = 0,       // Polling and handling window events
+    PERF_STAGE_CPU,             // cpu_execute_frame()
+    PERF_STAGE_BACKGROUND,      // video_render(): redrawing changed tiles
+    PERF_STAGE_SPRITES,         // video_render(): background copy, sprites, overlays
+    PERF_STAGE_UPLOAD,          // Locking/unlocking or updating the texture
+    PERF_STAGE_PRESENT,         // video_present()
+    PERF_STAGE_SLEEP,           // pacing_wait()
+    PERF_STAGE_FRAME,           // The whole frame, end to end
+    PERF_STAGE_COUNT
+} PerfStage;
+
+// Bus regions reads and writes are counted by
+typedef enum {
+    PERF_REGION_ROM = 0,        // 0000-3FFF (opcode fetches from ROM are not counted)
+    PERF_REGION_TILE,           // 4000-47FF video and color RAM
+    PERF_REGION_RAM,            // 4800-4FFF work RAM and sprite attributes
+    PERF_REGION_IO,             // 5000-50FF inputs, DIP switches, sound, sprite coordinates
+    PERF_REGION_OTHER,          // Everything else (unmapped, mirrors)
+    PERF_REGION_COUNT
+} PerfRegion;
+
+// Histogram buckets: bucket i holds samples under 2^i microseconds, the
+// last one everything from 16.4ms up
+#define PERF_BUCKETS    16
+
+// Seconds between reports written with --perf-dump
+#define PERF_DEFAULT_INTERVAL   10
+
+typedef struct {
+    uint64_t buckets[PERF_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} PerfHistogram;
+
+// Counters of one frame (or sums over many)
+typedef struct {
+    uint64_t stage_ns[PERF_STAGE_COUNT];
+    uint64_t instructions;                  // Executed
+    uint64_t skipped;                       // Fast-forwarded over (HALT, busy-wait loops)
+    uint64_t interrupts;
+    uint64_t reads[PERF_REGION_COUNT];
+    uint64_t writes[PERF_REGION_COUNT];
+} PerfFrame;
+
+// Instrumentation state of one machine
+typedef struct {
+    // Bus accesses of the current frame per 256-byte page, folded into
+    // regions at the end of the frame
+    uint32_t page_reads[MEM_PAGE_COUNT];
+    uint32_t page_writes[MEM_PAGE_COUNT];
+
+    PerfFrame current;          // Frame being measured
+    PerfFrame last;             // Last complete frame (overlay)
+    PerfFrame total;            // Whole run
+    PerfHistogram stages[PERF_STAGE_COUNT];
+    uint64_t frames;
+    uint64_t frame_start_ns;
+    bool overlay;               // Draw the overlay (see perf_draw_overlay)
+} PerfStats;
+
+#ifdef PERF_ENABLED
+
+#include "timer.h"
+
+#define PERF_START()                    timer_now_ns()
+#define PERF_STOP(m, stage, start)      ((m)->perf.current.stage_ns[stage] += timer_now_ns() - (start))
+#define PERF_COUNT(m, field, n)         ((m)->perf.current.field += (n))
+#define PERF_COUNT_READ(m, address)     ((m)->perf.page_reads[(address) >> MEM_PAGE_SHIFT]++)
+#define PERF_COUNT_WRITE(m, address)    ((m)->perf.page_writes[(address) >> MEM_PAGE_SHIFT]++)
+
+// Finish the current frame: fold it into the histograms and totals and
+// start the next one
+void perf_frame_end(PacmanMachine *m);
+
+// Draw the last frame's stage times and counters into the frame being
+// composed (called by video_render)
+void perf_draw_overlay(PacmanMachine *m);
+
+// Write the statistics of count machines, labelled by names, to path:
+// Prometheus text format if it ends in ".prom", JSON otherwise. Written to
+// a temporary file first and renamed, so readers never see half a file.
+bool perf_dump(const char *path, PacmanMachine *const *machines, const char *const *names,
+               int count);
+
+#else
+
+#define PERF_START()                    ((uint64_t)0)
+#define PERF_STOP(m, stage, start)      ((void)(start))
+#define PERF_COUNT(m, field, n)         ((void)(n))
+#define PERF_COUNT_READ(m, address)     ((void)0)
+#define PERF_COUNT_WRITE(m, address)    ((void)0)
+
+static inline void perf_frame_end(PacmanMachine *m) { (void)m; }
+static inline void perf_draw_overlay(PacmanMachine *m) { (void)m; }
+static inline bool perf_dump(const char *path, PacmanMachine *const *machines,
+                             const char *const *names, int count) {
+    (void)path; (void)machines; (void)names; (void)count;
+    return false;
+}
+
+#endif
+
+#endif // PERF_H
@@ -0,0 +1,51 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pacing.h"
+#include "video.h"
+
+// Machine context (see machine.h) and rewind history (see rewind.h)
+typedef struct PacmanMachine PacmanMachine;
+typedef struct Rewind Rewind;
+
+// Pipelined mode (--pipeline): the emulated machine runs and paces its
+// frames on its own thread, and the thread that owns the window renders
+// and presents. After each frame the emulation thread captures the video
+// state (a VideoSnapshot) into a triple buffer; the render thread applies
+// the newest one to a display machine holding the same ROMs and draws it.
+// Frame N+1 is emulated while frame N is composited and presented, and a
+// present that waits for vsync never holds up the CPU. Frames the display
+// is too slow for are skipped, not queued.
+//
+// Inputs go the other way: the render thread handles the window events
+// and hands the resulting input ports to the emulation thread, which picks
+// them up at the start of each frame.
+
+typedef struct Pipeline Pipeline;
+
+// Start emulating m on a new thread. Frames are paced with mode (PACE_VSYNC
+// falls back to the timer, as the emulation thread never presents). The
+// thread records each frame in history if given and steps back through it
+// while the rewind key is held. It stops by itself after max_frames frames
+// (0 = never). Returns NULL if the thread could not be started.
+Pipeline* pipeline_start(PacmanMachine *m, Rewind *history, PaceMode mode, long max_frames);
+
+// Stop the emulation thread and wait for it. m belongs to the caller
+// again afterwards. Logs the frame counts.
+void pipeline_stop(Pipeline *p);
+
+// Pass the input ports and rewind key of display (where the window events
+// were applied) to the emulation thread
+void pipeline_set_input(Pipeline *p, const PacmanMachine *display);
+
+// Wait up to timeout_ns for a frame newer than the last one taken. Returns
+// it (valid until the next call), or NULL on timeout.
+const VideoSnapshot* pipeline_acquire(Pipeline *p, uint64_t timeout_ns);
+
+// False once the emulation thread has stopped by itself (max_frames)
+bool pipeline_running(Pipeline *p);
+
+#endif // PIPELINE_H
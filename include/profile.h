@@ -0,0 +1,25 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Profiles of the emulated program (--profile, make PROFILE=1). The Z80
+// core counts every instruction by address and by opcode and samples the
+// chain of calls leading to it (see z80_profile in z80.h); this writes the
+// counts out as a report and as stacks for a flamegraph. In builds without
+// Z80_PROFILE the core has no hooks and profile_start() fails.
+
+// Start counting m's instructions in a fresh profile. Returns false if the
+// core was built without Z80_PROFILE or the profile could not be allocated.
+bool profile_start(PacmanMachine *m);
+
+// Write the profiles of count machines, added together, to two files:
+// PREFIX.txt, a report of the hottest addresses, routines and opcodes, and
+// PREFIX.folded, the sampled call stacks in the folded format read by
+// flamegraph.pl and speedscope. Machines without a profile are skipped.
+bool profile_write(PacmanMachine *const *machines, int count, const char *prefix);
+
+#endif // PROFILE_H
@@ -0,0 +1,51 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Rewind history: a bounded ring of per-frame save states (see state.h).
+// Every REWIND_KEY_INTERVAL frames a keyframe is stored; every other frame
+// is stored as the XOR of its snapshot against that keyframe, run-length
+// encoded over 64-bit words. Little of the state changes within a second,
+// so most frames take a few hundred bytes, and any frame decodes from its
+// keyframe plus one delta.
+//
+// The oldest history is dropped (a whole keyframe group at a time) when
+// either limit given to rewind_create() is reached.
+
+#define REWIND_KEY_INTERVAL     60
+
+// Defaults for the windowed emulator (--rewind, --rewind-mb)
+#define REWIND_DEFAULT_SECONDS  60
+#define REWIND_DEFAULT_MB       2
+
+typedef struct Rewind Rewind;
+
+// Create a history of at most max_frames frames in at most max_bytes of
+// encoded data. Returns NULL on allocation failure.
+Rewind* rewind_create(int max_frames, size_t max_bytes);
+
+// Release a history (NULL is ignored)
+void rewind_destroy(Rewind *r);
+
+// Record the machine's state after a frame
+void rewind_push(Rewind *r, const PacmanMachine *m);
+
+// Go back one frame: drop the newest entry and load the one before it into
+// m, keeping m's current input ports. Returns false (m unchanged) when there
+// is nothing older left.
+bool rewind_step_back(Rewind *r, PacmanMachine *m);
+
+// Forget all recorded frames
+void rewind_clear(Rewind *r);
+
+// Frames currently held and encoded bytes in use
+int rewind_frame_count(const Rewind *r);
+size_t rewind_bytes_used(const Rewind *r);
+
+#endif // REWIND_H
@@ -0,0 +1,49 @@
+#ifndef ROMSET_H
+#define ROMSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Where ROM files come from: a MAME set directory, or the same set packed
+// in a .zip (stored or deflated entries, found by file name in any folder
+// of the archive). memory.c reads sets through this; the zip's central
+// directory gives every file's CRC-32 without inflating anything, which
+// is what the decoded ROM cache is keyed by (see memory_set_rom_cache()).
+
+typedef struct RomSource RomSource;
+
+// Open a set directory or zip. Returns NULL if path is neither.
+RomSource* romset_open(const char *path);
+
+// Release a source (NULL is ignored)
+void romset_close(RomSource *src);
+
+// True for zip sources
+bool romset_is_zip(const RomSource *src);
+
+// Look up a file's size and CRC-32. Returns false if it is not in the set.
+// Directories read the file to compute the CRC.
+bool romset_stat(RomSource *src, const char *name, size_t *size, uint32_t *crc);
+
+// Read up to size bytes of a file into buffer. Returns the number of bytes
+// read, 0 if the file is missing, unreadable or fails its CRC check.
+size_t romset_read(RomSource *src, const char *name, uint8_t *buffer, size_t size);
+
+// Update a CRC-32 (start from 0) with size bytes
+uint32_t romset_crc32(uint32_t crc, const void *data, size_t size);
+
+// A read-only memory mapped file
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    void *handle;           // Platform mapping handle
+} MappedFile;
+
+// Map a whole file. Returns false if it cannot be opened or is empty.
+bool romset_map(const char *path, MappedFile *file);
+
+// Unmap a file mapped by romset_map()
+void romset_unmap(MappedFile *file);
+
+#endif // ROMSET_H
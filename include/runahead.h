@@ -0,0 +1,37 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Run-ahead: hides the board's own input lag. The game reads the joystick
+// during one frame and only draws the result a frame or more later, so
+// after each real frame the machine is saved (see state.h), run the given
+// number of frames further with the inputs held now, muted and unrendered
+// except for the last one, which is what gets shown. Then the save is
+// loaded again, so the speculative frames never affect the real run.
+
+// Upper limit for --run-ahead; each frame ahead costs one more emulated frame
+#define RUNAHEAD_MAX_FRAMES     8
+
+// Run-ahead state for one machine
+typedef struct {
+    int frames;             // Frames to run ahead (0 = off)
+    uint8_t *snapshot;      // state_size() bytes, NULL when off
+} RunAhead;
+
+// Set up run-ahead by frames (0 turns it off). Returns false if the
+// snapshot buffer could not be allocated.
+bool runahead_init(RunAhead *ra, int frames);
+
+// Release the snapshot buffer
+void runahead_free(RunAhead *ra);
+
+// Render the frame the game will show ra->frames frames from now, leaving
+// m as it was. With run-ahead off this is just video_render().
+void runahead_render(RunAhead *ra, PacmanMachine *m);
+
+#endif // RUNAHEAD_H
@@ -0,0 +1,31 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <stdbool.h>
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Thread pool that runs independent jobs on all cores. Each worker owns a
+// contiguous slice of the jobs and steals from the other slices once its
+// own is exhausted, so uneven jobs still keep every core busy.
+typedef struct Runner Runner;
+
+// Job callback, called once for every index in [0, count)
+typedef void (*RunnerJob)(void *userdata, int index);
+
+// Create a runner with num_threads threads in total (the calling thread
+// counts as one). num_threads <= 0 uses one thread per online CPU.
+Runner* runner_create(int num_threads);
+void runner_destroy(Runner *r);
+int runner_thread_count(const Runner *r);
+
+// Run job(userdata, i) for every i in [0, count) and wait for all of them
+void runner_parallel_for(Runner *r, int count, RunnerJob job, void *userdata);
+
+// Step every machine for the given number of frames, rendering each frame
+// into the machine's software framebuffer if render is set
+void runner_step_machines(Runner *r, PacmanMachine **machines, int count,
+                          int frames, bool render);
+
+#endif // RUNNER_H
@@ -0,0 +1,71 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Output scaler (--scale, --filter): enlarges each composed frame by an
+// integer factor between video_render() and the present, optionally with
+// a filter. On the CPU the frame is split into bands of rows that run on a
+// thread pool (see runner.h), using the SIMD row kernels of gfx_kernels.h.
+// All buffers are allocated when the scaler is created and reused for
+// every frame.
+//
+// The renderer can do some of this itself (see video_set_filter()): the
+// plain scale is a nearest-neighbour texture stretch, and the scanline and
+// CRT filters are a mask texture blended over it in modulate mode.
+
+// Filters
+typedef enum {
+    SCALER_NEAREST = 0,     // Plain pixel replication
+    SCALER_SCANLINES,       // Darkened gaps between the rows of each pixel
+    SCALER_CRT,             // Scanlines and an RGB aperture grille
+    SCALER_EPX,             // Edge-smoothing Scale2x/Scale3x (AdvMAME), then replication
+    SCALER_FILTER_COUNT
+} ScalerFilter;
+
+// Where the scaling happens
+typedef enum {
+    SCALER_PATH_AUTO = 0,   // The renderer if it can do the filter, else the CPU
+    SCALER_PATH_CPU,
+    SCALER_PATH_GPU
+} ScalerPath;
+
+// Largest scale factor
+#define SCALER_MAX_SCALE    16
+
+typedef struct Scaler Scaler;
+
+// Create a scaler for width x height frames. threads is the size of its
+// thread pool, counting the caller (1 = none, <= 0 = one per CPU).
+// Returns NULL if scale does not suit the filter (1 to SCALER_MAX_SCALE for
+// nearest, at least 2 for the others, and for EPX a multiple of 2 or 3) or
+// out of memory.
+Scaler* scaler_create(ScalerFilter filter, int scale, int width, int height, int threads);
+
+// Free a scaler (NULL is ignored)
+void scaler_destroy(Scaler *s);
+
+// Scale a width x height frame into dst, which holds width * scale by
+// height * scale pixels. Pitches are in pixels. Blocks until done; only
+// one thread may run a given scaler at a time.
+void scaler_run(Scaler *s, const uint32_t *src, int src_pitch, uint32_t *dst, int dst_pitch);
+
+// Fill dst (width * scale by height * scale) with the filter's per-pixel
+// brightness weights, as used by the CPU path: 0xFFFFFFFF where a pixel is
+// kept as it is. Returns false for filters that are not a plain mask.
+bool scaler_draw_mask(const Scaler *s, uint32_t *dst, int dst_pitch);
+
+// Settings of a scaler
+ScalerFilter scaler_filter(const Scaler *s);
+int scaler_scale(const Scaler *s);
+
+// Filter by name ("nearest", "scanlines", "crt", "epx"). Returns false for
+// an unknown name.
+bool scaler_parse_filter(const char *name, ScalerFilter *filter);
+const char* scaler_filter_name(ScalerFilter filter);
+
+// Path by name ("auto", "cpu", "gpu")
+bool scaler_parse_path(const char *name, ScalerPath *path);
+
+#endif // SCALER_H
@@ -0,0 +1,53 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Board timing. The 6.144 MHz master clock drives the pixel counter
+// (384 pixels x 264 lines per frame) and is halved for the Z80.
+#define CPU_CLOCK_HZ          3072000
+#define CPU_CYCLES_PER_FRAME  (384 * 264 / 2)   // 50,688 cycles, 60.606 Hz
+
+// Frames without a watchdog write (0x50C0) before the board resets
+#define WATCHDOG_FRAMES       16
+
+// Kinds of timed events. Events due at the same cycle fire in this order.
+typedef enum {
+    SCHED_VBLANK = 0,   // Start of vertical blank: IRQ, end of frame
+    SCHED_WATCHDOG,     // Watchdog counter tick
+    SCHED_SOUND,        // Render the next block of audio (dropped without an output)
+    SCHED_EVENT_COUNT
+} SchedEventType;
+
+// One pending event
+typedef struct {
+    uint64_t time;      // Absolute CPU cycle the event is due at
+    SchedEventType type;
+} SchedEvent;
+
+// Binary min-heap of pending events ordered by (time, type), plus the
+// emulated time it is measured against. The CPU runs in slices up to the
+// earliest event, so nothing has to be polled per instruction.
+typedef struct {
+    uint64_t now;                           // CPU cycles run so far
+    SchedEvent heap[SCHED_EVENT_COUNT * 2];
+    int count;
+} Scheduler;
+
+// Remove all events and restart the clock at cycle 0
+void scheduler_init(Scheduler *s);
+
+// Queue an event at an absolute cycle. Returns false if the heap is full.
+bool scheduler_add(Scheduler *s, SchedEventType type, uint64_t time);
+
+// Cycle the earliest event is due at (UINT64_MAX if none is queued)
+uint64_t scheduler_next_time(const Scheduler *s);
+
+// Check whether an event of this type is queued
+bool scheduler_pending(const Scheduler *s, SchedEventType type);
+
+// Remove the earliest event if it is due at or before the current time
+bool scheduler_pop_due(Scheduler *s, SchedEvent *event);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,85 @@
+#ifndef SOUND_H
+#define SOUND_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scheduler.h"
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Namco WSG (waveform sound generator): 3 voices stepping through 32-sample,
+// 4-bit waveforms from the sound PROM, clocked at 96 kHz (CPU clock / 32)
+#define SOUND_VOICES        3
+#define SOUND_REG_COUNT     0x20    // 0x5040-0x505F, low nibble only
+#define SOUND_WAVEFORMS     8
+#define SOUND_WAVE_SAMPLES  32
+#define SOUND_PROM_SIZE     (SOUND_WAVEFORMS * SOUND_WAVE_SAMPLES)  // 82s126.1m
+#define SOUND_CHIP_HZ       (CPU_CLOCK_HZ / 32)
+
+// Output: mono signed 16-bit at half the chip rate, rendered in blocks of a
+// quarter frame (198 samples) from a scheduler event
+#define SOUND_SAMPLE_RATE       (SOUND_CHIP_HZ / 2)
+#define SOUND_BLOCKS_PER_FRAME  4
+#define SOUND_BLOCK_CYCLES      (CPU_CYCLES_PER_FRAME / SOUND_BLOCKS_PER_FRAME)
+#define SOUND_BLOCK_SAMPLES     (SOUND_BLOCK_CYCLES / 64)
+
+// Ring between the emulation thread and the audio callback (power of two,
+// about 85ms of audio)
+#define SOUND_RING_SIZE     4096
+
+// One voice as decoded from the registers
+typedef struct {
+    uint32_t frequency;     // 20-bit phase increment per chip clock
+    uint32_t accumulator;   // 20-bit phase, the top 5 bits index the waveform
+    uint8_t waveform;       // 0-7
+    uint8_t volume;         // 0-15
+} SoundVoice;
+
+// Single-producer/single-consumer sample queue. The emulation thread only
+// writes head and the audio thread only writes tail, so neither side ever
+// takes a lock.
+typedef struct {
+    _Atomic uint32_t head;  // Next slot written by the producer
+    _Atomic uint32_t tail;  // Next slot read by the consumer
+    int16_t samples[SOUND_RING_SIZE];
+} SoundRing;
+
+// Queue up to count samples. Returns how many fit; the rest are dropped.
+uint32_t sound_ring_write(SoundRing *ring, const int16_t *samples, uint32_t count);
+
+// Dequeue up to count samples. Returns how many were available.
+uint32_t sound_ring_read(SoundRing *ring, int16_t *samples, uint32_t count);
+
+// Samples currently queued
+uint32_t sound_ring_available(SoundRing *ring);
+
+// Silence all voices (register state is part of the machine, so this is
+// also all a reset needs)
+void sound_reset(PacmanMachine *m);
+
+// Handle a write to sound register 0x00-0x1F (0x5040-0x505F)
+void sound_write_register(PacmanMachine *m, uint8_t reg, uint8_t value);
+
+// Render count samples of the current voice state into out and advance the
+// voices. Writes silence while the game has sound disabled (0x5001).
+void sound_render(PacmanMachine *m, int16_t *out, int count);
+
+// Render one block into the audio ring, if an output is open. Called from
+// the scheduler every SOUND_BLOCK_CYCLES.
+void sound_render_block(PacmanMachine *m);
+
+// Open the default SDL audio device and start feeding it from this machine.
+// Without an open output nothing is rendered. Returns false if there is no
+// audio device (or in headless builds).
+bool sound_open(PacmanMachine *m);
+
+// Samples queued for the audio device (0 without an open output)
+uint32_t sound_queued(PacmanMachine *m);
+
+// Stop and close the audio output (safe to call when none is open)
+void sound_close(PacmanMachine *m);
+
+#endif // SOUND_H
@@ -0,0 +1,47 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Save states. A snapshot is a small header followed by the machine's
+// emulated state (CPU, scheduler, RAM, VRAM, CRAM, I/O registers, sound
+// voices) copied verbatim as one block of a few KB, so saving and loading a
+// state are a single memcpy each and never allocate. ROMs, decoded graphics
+// and host resources are not part of it; a state is loaded into a machine
+// that already has the same ROMs.
+//
+// The layout is that of PacmanMachine in this build. Bump STATE_VERSION
+// whenever the snapshot fields change; the size check catches most misses.
+
+#define STATE_MAGIC     0x54534D50u     // "PMST" little endian
+#define STATE_VERSION   3
+
+// Blob header
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;   // sizeof(StateHeader)
+    uint32_t state_size;    // MACHINE_STATE_SIZE of the saving build
+    uint32_t reserved;
+} StateHeader;
+
+// Size of a complete snapshot in bytes
+size_t state_size(void);
+
+// Write a snapshot of m into blob, which must hold state_size() bytes
+void state_save(const PacmanMachine *m, void *blob);
+
+// Restore a snapshot. Returns false (and leaves m untouched) if the blob
+// is too small or was saved by an incompatible build.
+bool state_load(PacmanMachine *m, const void *blob, size_t size);
+
+// Save or load a snapshot file. Return false on I/O or format errors.
+bool state_save_file(const PacmanMachine *m, const char *path);
+bool state_load_file(PacmanMachine *m, const char *path);
+
+#endif // STATE_H
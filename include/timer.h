@@ -0,0 +1,15 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// Host timing helpers that do not depend on SDL, so headless runs can pace
+// (or measure) frames without initializing any SDL subsystem.
+
+// Monotonic time in nanoseconds (arbitrary epoch)
+uint64_t timer_now_ns(void);
+
+// Sleep for roughly the given number of nanoseconds
+void timer_sleep_ns(uint64_t ns);
+
+#endif // TIMER_H
@@ -0,0 +1,76 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../src/z80/z80.h"
+
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
+// Execution traces for chasing rare hangs (--trace, make TRACE=1). The Z80
+// core writes a 32-byte record of every instruction (address, bytes,
+// registers, t-states) into a ring in memory, see z80_trace in z80.h.
+// Nothing is formatted or written out while the game runs. When a trigger
+// fires, the ring is saved once a quarter of it has been filled after the
+// trigger. A trigger is an instruction at a watched address, a write to a
+// watched address, or the watchdog expiring. trace-dump (src/trace_dump.c)
+// decodes the saved files offline.
+
+// Records held by default (2MB)
+#define TRACE_DEFAULT_RECORDS   (1u << 16)
+
+// Files saved per machine before the trace stops re-arming
+#define TRACE_MAX_DUMPS         16
+
+// Saved trace: this header, then the records oldest first
+#define TRACE_FILE_MAGIC        0x5430385Au     // "Z80T" little endian
+#define TRACE_FILE_VERSION      1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;       // sizeof(TraceFileHeader)
+    uint16_t record_size;       // sizeof(z80_trace_record)
+    uint16_t trigger;           // Z80_TRIGGER_*
+    uint16_t trigger_addr;      // Address executed or written, PC for the watchdog
+    uint16_t reserved;
+    uint32_t count;             // Records that follow
+    uint32_t trigger_index;     // Record the trigger fired at (count if it was not kept)
+} TraceFileHeader;
+
+// Start tracing m into a ring of records (rounded up to a power of two),
+// saving triggered rings as PREFIX-001.z80t, PREFIX-002.z80t and so on.
+// Returns false if the core was built without Z80_TRACE or the ring could
+// not be allocated.
+bool trace_start(PacmanMachine *m, const char *prefix, uint32_t records);
+
+// Fire the trace on instructions in [first, last], or writes to it
+void trace_watch_pc(PacmanMachine *m, uint16_t first, uint16_t last);
+void trace_watch_write(PacmanMachine *m, uint16_t first, uint16_t last);
+
+// Save the ring if it has stopped after a trigger and arm it again. Called
+// by cpu_execute_frame() after every frame.
+void trace_poll(PacmanMachine *m);
+
+// Save the ring if a trigger has fired, even if fewer records than usual
+// followed it (at the end of a run)
+void trace_finish(PacmanMachine *m);
+
+// Release the ring (machine_destroy() does this)
+void trace_stop(PacmanMachine *m);
+
+// Name of a trigger (Z80_TRIGGER_*). Inline so bin/trace-dump, which only
+// includes this header, shares it.
+static inline const char* trace_trigger_name(int trigger) {
+    switch (trigger) {
+        case Z80_TRIGGER_NONE:  return "none";
+        case Z80_TRIGGER_PC:    return "pc";
+        case Z80_TRIGGER_WRITE: return "write";
+        case Z80_TRIGGER_HOST:  return "watchdog";
+        default:                return "unknown";
+    }
+}
+
+#endif // TRACE_H
@@ -1,14 +1,18 @@
 #ifndef VIDEO_H
 #define VIDEO_H
 
-#ifdef _WIN32
+#ifndef NO_SDL
     #include <SDL2/SDL.h>
 #else
-    #include <SDL2/SDL.h>
+    // Headless-only builds never create a renderer
+    typedef struct SDL_Renderer SDL_Renderer;
 #endif
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "memory.h"
+#include "scaler.h"
+
 // Pacman video constants (based on MAME implementation)
 #define SCREEN_WIDTH    224
 #define SCREEN_HEIGHT   288
@@ -31,14 +35,78 @@
 #define REG_PALETTE_BANK 0      // Palette bank (used by some games)
 #define REG_FLIP_SCREEN 0       // Flip screen bit
 
+// Machine context (see machine.h)
+typedef struct PacmanMachine PacmanMachine;
+
 // Function prototypes
-bool video_init(SDL_Renderer *renderer, int scale_factor);
-void video_cleanup(void);
-void video_render(void);
-void video_update_palette(uint8_t index, uint8_t value);
+// Passing a NULL renderer sets up a software-only framebuffer (headless mode)
+bool video_init(PacmanMachine *m, SDL_Renderer *renderer, int scale_factor);
+void video_cleanup(PacmanMachine *m);
+
+// Compose the current frame. In windowed mode it is drawn straight into the
+// streaming texture; frames identical to the previous one are skipped.
+void video_render(PacmanMachine *m);
+
+// Show the last rendered frame if it changed since the last present (or the
+// window was exposed). Returns true if the renderer was presented.
+bool video_present(PacmanMachine *m);
+
+// Present again on the next video_present(), e.g. after the window was
+// uncovered or resized
+void video_expose(PacmanMachine *m);
+
+// Scale the output by video_init()'s scale factor with a filter (see
+// scaler.h). The CPU path composes frames in the software framebuffer and
+// scales them on threads threads (<= 0 = one per CPU) into a texture of
+// the window's size; the GPU path stretches the texture and blends the
+// filter's mask over it. Returns false (keeping the plain stretch) without
+// a renderer, if the path cannot do the filter or on failure.
+bool video_set_filter(PacmanMachine *m, ScalerFilter filter, ScalerPath path, int threads);
+
+void video_update_palette(PacmanMachine *m, uint8_t index, uint8_t value);
+
+// Redraw the whole background on the next video_render(). Call this after
+// changing VRAM, CRAM, the charset or the palette without going through
+// the bus (memory_write_byte / video_update_palette track their own changes).
+void video_invalidate(PacmanMachine *m);
+
+// Software framebuffer (SCREEN_WIDTH x SCREEN_HEIGHT RGBA pixels). Only
+// kept up to date when there is no renderer (headless mode), with the CPU
+// scaler or after video_keep_framebuffer(); NULL otherwise, and before
+// video_init().
+const uint32_t* video_get_framebuffer(PacmanMachine *m);
+
+// Keep the software framebuffer up to date in windowed mode too: frames are
+// composed there and uploaded to the texture, one extra copy per changed
+// frame. Used by consumers of the finished frame, e.g. export.h, movie.h.
+void video_keep_framebuffer(PacmanMachine *m, bool keep);
+
+// Everything video_render() reads from the emulated board, captured at the
+// end of a frame so another machine (with the same ROMs) can draw it, e.g.
+// on a render thread (see pipeline.h). About 2KB.
+typedef struct {
+    uint8_t vram[VRAM_SIZE];
+    uint8_t cram[CRAM_SIZE];
+    uint8_t sprite_attrs[MAX_SPRITES * 2];      // 0x4FF0-0x4FFF: code/flip, color
+    uint8_t sprite_coords[MAX_SPRITES * 2];     // 0x5060-0x506F: x, y
+    uint8_t flip_screen;
+} VideoSnapshot;
+
+// Capture m's video state
+void video_capture(PacmanMachine *m, VideoSnapshot *snapshot);
+
+// Copy VRAM_SIZE bytes of tile and CRAM_SIZE of color RAM into m, marking
+// only the tiles that differ as dirty (see video_apply, state_load)
+void video_load_tiles(PacmanMachine *m, const uint8_t *vram, const uint8_t *cram);
+
+// Load a captured video state into m for the next video_render(), marking
+// only the tiles that differ as dirty
+void video_apply(PacmanMachine *m, const VideoSnapshot *snapshot);
 
 // Debugging functions
-void video_enable_debug(bool enable);
-void video_draw_debug_info(void);
+void video_enable_debug(PacmanMachine *m, bool enable);
+
+// Draw the debug overlay into the frame being composed (called by video_render)
+void video_draw_debug_info(PacmanMachine *m);
 
 #endif // VIDEO_H
\ No newline at end of file
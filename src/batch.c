@@ -0,0 +1,255 @@
+#include "../include/batch.h"
+#include "../include/machine.h"
+#include "../include/cpu.h"
+#include "../include/memory.h"
+#include "../include/input.h"
+#include "../include/video.h"
+#include "../include/runner.h"
+#include "../include/state.h"
+#include "../include/log.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Player 1's score: six BCD digits, lowest pair first
+#define SCORE_ADDRESS   0x4E80
+#define SCORE_BYTES     3
+
+struct PacmanBatch {
+    Runner *runner;
+    PacmanMachine **machines;
+    int count;
+    int frame_skip;
+    BatchObsType obs;
+    int downsample;
+    size_t obs_size;
+
+    uint8_t *start_state;   // Snapshot every machine starts (and resets) from
+    uint32_t *scores;       // Score at the end of the last step, per machine
+};
+
+// Arguments shared by the step jobs of one call
+typedef struct {
+    PacmanBatch *batch;
+    const uint8_t *actions;     // NULL = observe only
+    uint8_t *obs_out;
+    float *rewards_out;
+} BatchStep;
+
+// Read player 1's score
+static uint32_t read_score(PacmanMachine *m) {
+    uint32_t score = 0;
+    for (int i = SCORE_BYTES - 1; i >= 0; i--) {
+        uint8_t bcd = memory_read_byte(m, (uint16_t)(SCORE_ADDRESS + i));
+        score = score * 100 + (bcd >> 4) * 10 + (bcd & 0x0F);
+    }
+    return score;
+}
+
+// Average factor x factor blocks of the ARGB framebuffer into gray bytes.
+// Each row of blocks is summed per channel first (red and blue share a
+// word, 16 pixels cannot overflow their halves), then converted to luma
+// once per output pixel. Inlined with a constant factor so the loops
+// unroll and the average is a shift.
+static inline void downsample_gray_by(const uint32_t *pixels, uint8_t *out, const int factor,
+                                      const int shift) {
+    const int width = SCREEN_WIDTH / factor;
+    const int height = SCREEN_HEIGHT / factor;
+    uint32_t rb[SCREEN_WIDTH];
+    uint32_t g[SCREEN_WIDTH];
+
+    for (int y = 0; y < height; y++) {
+        memset(rb, 0, width * sizeof(uint32_t));
+        memset(g, 0, width * sizeof(uint32_t));
+        for (int dy = 0; dy < factor; dy++) {
+            const uint32_t *row = &pixels[(y * factor + dy) * SCREEN_WIDTH];
+            for (int x = 0; x < width; x++) {
+                for (int dx = 0; dx < factor; dx++) {
+                    uint32_t c = row[x * factor + dx];
+                    rb[x] += c & 0x00FF00FF;
+                    g[x] += c & 0x0000FF00;
+                }
+            }
+        }
+
+        // Rec. 601 luma in 8.8 fixed point
+        for (int x = 0; x < width; x++) {
+            uint32_t sum = (rb[x] >> 16) * 77 + (g[x] >> 8) * 150 + (rb[x] & 0xFFFF) * 29;
+            out[y * width + x] = (uint8_t)(sum >> (8 + shift));
+        }
+    }
+}
+
+static void downsample_gray(const uint32_t *pixels, int factor, uint8_t *out) {
+    switch (factor) {
+        case 1:  downsample_gray_by(pixels, out, 1, 0); break;
+        case 2:  downsample_gray_by(pixels, out, 2, 2); break;
+        default: downsample_gray_by(pixels, out, 4, 4); break;
+    }
+}
+
+// Write one machine's observation
+static void write_obs(PacmanBatch *batch, PacmanMachine *m, uint8_t *out) {
+    switch (batch->obs) {
+        case BATCH_OBS_MEMORY:
+            memcpy(out, m->ram, RAM_SIZE);
+            memcpy(out + RAM_SIZE, m->vram, VRAM_SIZE);
+            memcpy(out + RAM_SIZE + VRAM_SIZE, m->cram, CRAM_SIZE);
+            break;
+        case BATCH_OBS_PIXELS:
+            video_render(m);
+            downsample_gray(video_get_framebuffer(m), batch->downsample, out);
+            break;
+        default:
+            break;
+    }
+}
+
+// Step (or just observe) one machine
+static void step_job(void *userdata, int index) {
+    BatchStep *step = (BatchStep *)userdata;
+    PacmanBatch *batch = step->batch;
+    PacmanMachine *m = batch->machines[index];
+
+    if (step->actions) {
+        m->input_port1 = (uint8_t)~step->actions[index];
+        for (int f = 0; f < batch->frame_skip; f++) {
+            cpu_execute_frame(m);
+        }
+
+        uint32_t score = read_score(m);
+        if (step->rewards_out) {
+            step->rewards_out[index] = (float)((int64_t)score - (int64_t)batch->scores[index]);
+        }
+        batch->scores[index] = score;
+    }
+
+    if (step->obs_out) {
+        write_obs(batch, m, step->obs_out + (size_t)index * batch->obs_size);
+    }
+}
+
+// Create a batch
+PacmanBatch* pacman_batch_create(const BatchConfig *config) {
+    if (!config || !config->rom_path || config->count <= 0 || config->frame_skip < 1 ||
+        (config->obs == BATCH_OBS_PIXELS && config->downsample != 1 &&
+         config->downsample != 2 && config->downsample != 4)) {
+        LOG_ERROR(LOG_CAT_MAIN, "Invalid batch settings");
+        return NULL;
+    }
+
+    PacmanBatch *batch = (PacmanBatch *)calloc(1, sizeof(PacmanBatch));
+    if (!batch) {
+        return NULL;
+    }
+    batch->count = config->count;
+    batch->frame_skip = config->frame_skip;
+    batch->obs = config->obs;
+    batch->downsample = config->obs == BATCH_OBS_PIXELS ? config->downsample : 1;
+    switch (config->obs) {
+        case BATCH_OBS_MEMORY:
+            batch->obs_size = BATCH_MEMORY_OBS_SIZE;
+            break;
+        case BATCH_OBS_PIXELS:
+            batch->obs_size = (size_t)(SCREEN_WIDTH / batch->downsample) *
+                              (size_t)(SCREEN_HEIGHT / batch->downsample);
+            break;
+        default:
+            batch->obs_size = 0;
+            break;
+    }
+
+    batch->machines = (PacmanMachine **)calloc(batch->count, sizeof(PacmanMachine *));
+    batch->scores = (uint32_t *)calloc(batch->count, sizeof(uint32_t));
+    batch->start_state = (uint8_t *)malloc(state_size());
+    batch->runner = runner_create(config->threads);
+    if (!batch->machines || !batch->scores || !batch->start_state || !batch->runner) {
+        pacman_batch_destroy(batch);
+        return NULL;
+    }
+
+    for (int i = 0; i < batch->count; i++) {
+        PacmanMachine *m = machine_create();
+        batch->machines[i] = m;
+        if (!m || !memory_init(m, config->rom_path)) {
+            LOG_ERROR(LOG_CAT_MAIN, "Failed to load ROM: %s", config->rom_path);
+            pacman_batch_destroy(batch);
+            return NULL;
+        }
+        cpu_init(m);
+        input_init(m);
+        if (!cpu_set_engine(m, config->engine) ||
+            (config->obs == BATCH_OBS_PIXELS && !video_init(m, NULL, 1))) {
+            pacman_batch_destroy(batch);
+            return NULL;
+        }
+    }
+
+    // Every machine loaded the same ROMs, so they all start from one state
+    state_save(batch->machines[0], batch->start_state);
+    batch->scores[0] = read_score(batch->machines[0]);
+    for (int i = 1; i < batch->count; i++) {
+        batch->scores[i] = batch->scores[0];
+    }
+
+    LOG_INFO(LOG_CAT_MAIN, "Batch of %d machines on %d threads", batch->count,
+             runner_thread_count(batch->runner));
+    return batch;
+}
+
+// Release a batch
+void pacman_batch_destroy(PacmanBatch *batch) {
+    if (!batch) return;
+
+    if (batch->machines) {
+        for (int i = 0; i < batch->count; i++) {
+            machine_destroy(batch->machines[i]);
+        }
+    }
+    runner_destroy(batch->runner);
+    free(batch->machines);
+    free(batch->scores);
+    free(batch->start_state);
+    free(batch);
+}
+
+// Machines in the batch
+int pacman_batch_count(const PacmanBatch *batch) {
+    return batch->count;
+}
+
+// Bytes of observation per machine
+size_t pacman_batch_obs_size(const PacmanBatch *batch) {
+    return batch->obs_size;
+}
+
+// Advance every machine by one step
+void pacman_batch_step(PacmanBatch *batch, const uint8_t *actions, uint8_t *obs_out,
+                       float *rewards_out) {
+    BatchStep step = { batch, actions, batch->obs_size > 0 ? obs_out : NULL, rewards_out };
+    runner_parallel_for(batch->runner, batch->count, step_job, &step);
+}
+
+// Write the current observations without stepping
+void pacman_batch_observe(PacmanBatch *batch, uint8_t *obs_out) {
+    if (!obs_out || batch->obs_size == 0) {
+        return;
+    }
+    BatchStep step = { batch, NULL, obs_out, NULL };
+    runner_parallel_for(batch->runner, batch->count, step_job, &step);
+}
+
+// Put machines back in the starting state
+void pacman_batch_reset(PacmanBatch *batch, int index) {
+    int first = index < 0 ? 0 : index;
+    int end = index < 0 ? batch->count : index + 1;
+    for (int i = first; i < end && i < batch->count; i++) {
+        PacmanMachine *m = batch->machines[i];
+        state_load(m, batch->start_state, state_size());
+        batch->scores[i] = read_score(m);
+    }
+}
+
+// Player 1's score on one machine
+uint32_t pacman_batch_score(const PacmanBatch *batch, int index) {
+    return read_score(batch->machines[index]);
+}
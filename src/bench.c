@@ -0,0 +1,550 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../include/cpu.h"
+#include "../include/memory.h"
+#include "../include/video.h"
+#include "../include/input.h"
+#include "../include/timer.h"
+#include "../include/machine.h"
+#include "../include/log.h"
+#include "../include/batch.h"
+#include "../include/movie.h"
+#include "../include/scaler.h"
+
+// Headless throughput benchmark. Runs each ROM (a single image or a MAME
+// set directory) unpaced in three modes and prints the results as JSON:
+//   cpu      - cpu_execute_frame() only
+//   render   - video_render() only, with the whole background redrawn
+//              every frame so each frame does the full amount of work
+//   combined - emulation and rendering, as in --headless --render
+// With --batch N, each ROM is also stepped as a batch environment of N
+// machines (see batch.h) with memory and with pixel observations.
+// With --movie FILE, the cpu and combined runs replay an input movie (see
+// movie.h) from power on, so the game is played the same way in every run,
+// and fail if the replay diverges from it.
+// With --scale N, each ROM's last rendered frame is also run through the
+// output scaler (see scaler.h) with --filter, on --threads threads.
+
+#define DEFAULT_FRAMES  3000
+#define DEFAULT_WARMUP  120
+#define DEFAULT_ROM     "data/test.rom"
+#define DEFAULT_FRAME_SKIP  4
+
+typedef enum {
+    BENCH_CPU = 0,
+    BENCH_RENDER,
+    BENCH_COMBINED,
+    BENCH_MODE_COUNT
+} BenchMode;
+
+static const char *mode_names[BENCH_MODE_COUNT] = { "cpu", "render", "combined" };
+
+// Results of one ROM/mode run
+typedef struct {
+    long frames;
+    double seconds;
+    unsigned long instructions;     // Executed
+    unsigned long cycles;           // Executed
+    unsigned long skipped_instructions; // Fast-forwarded over (HALT, busy-wait loops)
+    unsigned long skipped_cycles;
+    double mean_us;
+    double p50_us;
+    double p99_us;
+    double max_us;
+    int movie;          // -1 = no movie, 0 = replay diverged, 1 = matched
+} BenchResult;
+
+// Print usage information
+static void print_usage(const char *program_name) {
+    printf("Usage: %s [options] [rom_path_or_dir ...]\n", program_name);
+    printf("Options:\n");
+    printf("  --frames N    Timed frames per run (default: %d)\n", DEFAULT_FRAMES);
+    printf("  --warmup N    Untimed frames before each run (default: %d)\n", DEFAULT_WARMUP);
+    printf("  --engine NAME CPU engine: interp (default) or blocks\n");
+    printf("  --batch N     Also step N machines as a batch environment\n");
+    printf("  --frame-skip N  Batch: frames per step (default: %d)\n", DEFAULT_FRAME_SKIP);
+    printf("  --json FILE   Write the JSON report to FILE instead of stdout\n");
+    printf("  --movie FILE  Replay an input movie in the cpu and combined runs\n");
+    printf("  --scale N     Also time the output scaler at scale N (1-%d)\n", SCALER_MAX_SCALE);
+    printf("  --filter NAME Scaler filter: nearest (default), scanlines, crt or epx\n");
+    printf("  --threads N   Scaler threads (default: one per CPU)\n");
+    printf("  --help        Show this help message\n");
+    printf("Without ROM arguments %s is used.\n", DEFAULT_ROM);
+}
+
+// Create a machine with a software framebuffer
+static PacmanMachine* create_machine(const char *rom_path, CpuEngine engine) {
+    PacmanMachine *m = machine_create();
+    if (!m) {
+        return NULL;
+    }
+
+    if (!memory_init(m, rom_path) || !video_init(m, NULL, 1)) {
+        machine_destroy(m);
+        return NULL;
+    }
+
+    cpu_init(m);
+    input_init(m);
+    if (!cpu_set_engine(m, engine)) {
+        machine_destroy(m);
+        return NULL;
+    }
+    return m;
+}
+
+// Run one benchmark frame in the given mode
+static void step_frame(PacmanMachine *m, BenchMode mode) {
+    switch (mode) {
+        case BENCH_CPU:
+            cpu_execute_frame(m);
+            break;
+        case BENCH_RENDER:
+            video_invalidate(m);
+            video_render(m);
+            break;
+        default:
+            cpu_execute_frame(m);
+            video_render(m);
+            break;
+    }
+}
+
+// Sort helper for frame times
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted frame times, in microseconds
+static double percentile_us(const uint64_t *sorted, long count, double p) {
+    long rank = (long)(p / 100.0 * count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1] / 1e3;
+}
+
+// Run one ROM in one mode. Returns false if the ROM could not be loaded.
+static bool run_bench(const char *rom_path, CpuEngine engine, BenchMode mode, long frames,
+                      long warmup, const char *movie_path, BenchResult *result) {
+    PacmanMachine *m = create_machine(rom_path, engine);
+    if (!m) {
+        return false;
+    }
+
+    // Render-only runs never emulate; cpu runs keep a stale framebuffer.
+    // ROMs the movie was not recorded with run without it.
+    Movie *movie = NULL;
+    if (movie_path && mode != BENCH_RENDER) {
+        movie = movie_replay(movie_path, m);
+        if (movie) {
+            movie_check_framebuffer(movie, mode == BENCH_COMBINED);
+        } else if (mode == BENCH_CPU) {
+            fprintf(stderr, "%s: cannot replay %s here, running without it\n", rom_path, movie_path);
+        }
+    }
+
+    uint64_t *times = (uint64_t *)malloc(frames * sizeof(uint64_t));
+    if (!times) {
+        machine_destroy(m);
+        return false;
+    }
+
+    // Warm up: let the game get past its boot screens (render-only runs keep
+    // drawing this state, so it should be a typical screen)
+    for (long i = 0; i < warmup; i++) {
+        if (movie) {
+            movie_frame(movie, m);
+        }
+        cpu_execute_frame(m);
+        if (mode != BENCH_CPU) {
+            video_render(m);
+        }
+    }
+
+    unsigned long start_steps = m->cpu.steps;
+    unsigned long start_cyc = m->cpu.cyc;
+    unsigned long start_skipped = m->cpu.skipped;
+    unsigned long start_skipped_cyc = m->cpu.skipped_cyc;
+    uint64_t start = timer_now_ns();
+    uint64_t last = start;
+
+    for (long i = 0; i < frames; i++) {
+        if (movie) {
+            movie_frame(movie, m);
+        }
+        step_frame(m, mode);
+        uint64_t now = timer_now_ns();
+        times[i] = now - last;
+        last = now;
+    }
+
+    result->frames = frames;
+    result->seconds = (last - start) / 1e9;
+    result->instructions = m->cpu.steps - start_steps;
+    result->skipped_instructions = m->cpu.skipped - start_skipped;
+    result->skipped_cycles = m->cpu.skipped_cyc - start_skipped_cyc;
+    result->cycles = m->cpu.cyc - start_cyc - result->skipped_cycles;
+    result->mean_us = frames > 0 ? (last - start) / 1e3 / frames : 0.0;
+
+    qsort(times, frames, sizeof(uint64_t), compare_u64);
+    result->p50_us = percentile_us(times, frames, 50.0);
+    result->p99_us = percentile_us(times, frames, 99.0);
+    result->max_us = times[frames - 1] / 1e3;
+    result->movie = movie ? movie_finish(movie, m) : -1;
+
+    free(times);
+    machine_destroy(m);
+    return true;
+}
+
+// Scale a rendered frame over and over. Returns false if the ROM could not
+// be loaded or the scaler not created.
+static bool run_scale_bench(const char *rom_path, CpuEngine engine, ScalerFilter filter, int scale,
+                            int threads, long frames, long warmup, BenchResult *result) {
+    PacmanMachine *m = create_machine(rom_path, engine);
+    if (!m) {
+        return false;
+    }
+
+    Scaler *scaler = scaler_create(filter, scale, SCREEN_WIDTH, SCREEN_HEIGHT, threads);
+    int out_pitch = SCREEN_WIDTH * scale;
+    uint32_t *out = (uint32_t *)malloc((size_t)out_pitch * SCREEN_HEIGHT * scale * sizeof(uint32_t));
+    uint64_t *times = (uint64_t *)malloc(frames * sizeof(uint64_t));
+    if (!scaler || !out || !times) {
+        scaler_destroy(scaler);
+        free(out);
+        free(times);
+        machine_destroy(m);
+        return false;
+    }
+
+    // Scale a typical screen, with the game past its boot screens
+    for (long i = 0; i < warmup; i++) {
+        cpu_execute_frame(m);
+        video_render(m);
+    }
+    const uint32_t *frame = video_get_framebuffer(m);
+    scaler_run(scaler, frame, SCREEN_WIDTH, out, out_pitch);
+
+    uint64_t start = timer_now_ns();
+    uint64_t last = start;
+    for (long i = 0; i < frames; i++) {
+        scaler_run(scaler, frame, SCREEN_WIDTH, out, out_pitch);
+        uint64_t now = timer_now_ns();
+        times[i] = now - last;
+        last = now;
+    }
+
+    memset(result, 0, sizeof(*result));
+    result->frames = frames;
+    result->seconds = (last - start) / 1e9;
+    result->mean_us = (last - start) / 1e3 / frames;
+    qsort(times, frames, sizeof(uint64_t), compare_u64);
+    result->p50_us = percentile_us(times, frames, 50.0);
+    result->p99_us = percentile_us(times, frames, 99.0);
+    result->max_us = times[frames - 1] / 1e3;
+    result->movie = -1;
+
+    scaler_destroy(scaler);
+    free(out);
+    free(times);
+    machine_destroy(m);
+    return true;
+}
+
+// Write a JSON string literal
+static void write_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// Write one result object
+static void write_json_result(FILE *out, const char *rom_path, BenchMode mode,
+                              const BenchResult *r) {
+    double seconds = r->seconds > 0 ? r->seconds : 1e-9;
+
+    fprintf(out, "    {\"rom\": ");
+    write_json_string(out, rom_path);
+    fprintf(out, ", \"mode\": \"%s\", \"frames\": %ld, \"seconds\": %.6f,\n",
+            mode_names[mode], r->frames, r->seconds);
+    fprintf(out, "     \"fps\": %.2f, \"instructions\": %lu, \"instructions_per_sec\": %.0f,\n",
+            r->frames / seconds, r->instructions, r->instructions / seconds);
+    fprintf(out, "     \"cycles\": %lu, \"cycles_per_sec\": %.0f,\n",
+            r->cycles, r->cycles / seconds);
+    fprintf(out, "     \"skipped_instructions\": %lu, \"skipped_cycles\": %lu,\n",
+            r->skipped_instructions, r->skipped_cycles);
+    fprintf(out, "     \"frame_us\": {\"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+            r->mean_us, r->p50_us, r->p99_us, r->max_us);
+    if (r->movie >= 0) {
+        fprintf(out, ",\n     \"movie\": \"%s\"", r->movie ? "matched" : "diverged");
+    }
+    fprintf(out, "}");
+}
+
+// Write one scaler result as a JSON object
+static void write_json_scale_result(FILE *out, const char *rom_path, ScalerFilter filter, int scale,
+                                    int threads, const BenchResult *r) {
+    double seconds = r->seconds > 0 ? r->seconds : 1e-9;
+    double pixels = (double)SCREEN_WIDTH * scale * SCREEN_HEIGHT * scale;
+
+    fprintf(out, "    {\"rom\": ");
+    write_json_string(out, rom_path);
+    fprintf(out, ", \"mode\": \"scale\", \"filter\": \"%s\", \"scale\": %d, \"threads\": %d,\n",
+            scaler_filter_name(filter), scale, threads);
+    fprintf(out, "     \"frames\": %ld, \"seconds\": %.6f, \"fps\": %.2f, \"megapixels_per_sec\": %.1f,\n",
+            r->frames, r->seconds, r->frames / seconds, r->frames * pixels / seconds / 1e6);
+    fprintf(out, "     \"frame_us\": {\"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}}",
+            r->mean_us, r->p50_us, r->p99_us, r->max_us);
+}
+
+// Batch timings of one run
+typedef struct {
+    long steps;
+    double seconds;
+} BatchResult;
+
+// Step a batch environment for about the given number of frames per
+// machine. Returns false if the batch could not be created.
+static bool run_batch_bench(const char *rom_path, CpuEngine engine, BatchObsType obs, int count,
+                            int frame_skip, long frames, long warmup, BatchResult *result) {
+    BatchConfig config = {
+        .rom_path = rom_path,
+        .count = count,
+        .threads = 0,
+        .frame_skip = frame_skip,
+        .obs = obs,
+        .downsample = 2,
+        .engine = engine
+    };
+    PacmanBatch *batch = pacman_batch_create(&config);
+    if (!batch) {
+        return false;
+    }
+
+    uint8_t *actions = (uint8_t *)calloc(count, 1);
+    uint8_t *obs_out = (uint8_t *)malloc(pacman_batch_obs_size(batch) * count);
+    float *rewards = (float *)malloc(count * sizeof(float));
+    bool ok = actions && obs_out && rewards;
+
+    long steps = frames / frame_skip > 0 ? frames / frame_skip : 1;
+    for (long i = 0; ok && i < warmup / frame_skip; i++) {
+        pacman_batch_step(batch, actions, NULL, NULL);
+    }
+
+    uint64_t start = timer_now_ns();
+    for (long i = 0; ok && i < steps; i++) {
+        // Cycle through the joystick directions so the game sees input
+        memset(actions, 1 << (i & 3), count);
+        pacman_batch_step(batch, actions, obs_out, rewards);
+    }
+    result->steps = steps;
+    result->seconds = (timer_now_ns() - start) / 1e9;
+    if (result->seconds <= 0) {
+        result->seconds = 1e-9;
+    }
+
+    free(actions);
+    free(obs_out);
+    free(rewards);
+    pacman_batch_destroy(batch);
+    return ok;
+}
+
+// Write one batch result as a JSON object
+static void write_json_batch_result(FILE *out, const char *rom_path, BatchObsType obs, int count,
+                                    int frame_skip, const BatchResult *r) {
+    fprintf(out, "    {\"rom\": ");
+    write_json_string(out, rom_path);
+    fprintf(out, ", \"mode\": \"%s\", \"machines\": %d, \"frame_skip\": %d, \"steps\": %ld,\n",
+            obs == BATCH_OBS_PIXELS ? "batch_pixels" : "batch_memory", count, frame_skip, r->steps);
+    fprintf(out, "     \"seconds\": %.6f, \"env_steps_per_sec\": %.0f, \"fps\": %.0f}",
+            r->seconds, r->steps * count / r->seconds, r->steps * count * frame_skip / r->seconds);
+}
+
+int main(int argc, char *argv[]) {
+    long frames = DEFAULT_FRAMES;
+    long warmup = DEFAULT_WARMUP;
+    const char *json_path = NULL;
+    const char *movie_path = NULL;
+    CpuEngine engine = CPU_ENGINE_INTERP;
+    int batch_count = 0;
+    int frame_skip = DEFAULT_FRAME_SKIP;
+    int scale = 0;
+    ScalerFilter filter = SCALER_NEAREST;
+    int threads = 0;
+    const char **roms = (const char **)calloc(argc + 1, sizeof(const char *));
+    int rom_count = 0;
+
+    if (!roms) {
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            free(roms);
+            return 0;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = strtol(argv[++i], NULL, 10);
+            if (frames <= 0) {
+                fprintf(stderr, "Invalid frame count: %s\n", argv[i]);
+                free(roms);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmup = strtol(argv[++i], NULL, 10);
+            if (warmup < 0) {
+                fprintf(stderr, "Invalid warmup count: %s\n", argv[i]);
+                free(roms);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            if (!cpu_parse_engine(argv[++i], &engine)) {
+                fprintf(stderr, "Unknown CPU engine: %s\n", argv[i]);
+                free(roms);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_count = (int)strtol(argv[++i], NULL, 10);
+            if (batch_count < 0) {
+                fprintf(stderr, "Invalid batch size: %s\n", argv[i]);
+                free(roms);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--frame-skip") == 0 && i + 1 < argc) {
+            frame_skip = (int)strtol(argv[++i], NULL, 10);
+            if (frame_skip <= 0) {
+                fprintf(stderr, "Invalid frame skip: %s\n", argv[i]);
+                free(roms);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = (int)strtol(argv[++i], NULL, 10);
+            if (scale < 0 || scale > SCALER_MAX_SCALE) {
+                fprintf(stderr, "Invalid scale: %s\n", argv[i]);
+                free(roms);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            if (!scaler_parse_filter(argv[++i], &filter)) {
+                fprintf(stderr, "Unknown filter: %s\n", argv[i]);
+                free(roms);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = (int)strtol(argv[++i], NULL, 10);
+            if (threads < 0) {
+                fprintf(stderr, "Invalid thread count: %s\n", argv[i]);
+                free(roms);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--movie") == 0 && i + 1 < argc) {
+            movie_path = argv[++i];
+        } else if (argv[i][0] != '-') {
+            roms[rom_count++] = argv[i];
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            free(roms);
+            return 1;
+        }
+    }
+
+    if (rom_count == 0) {
+        roms[rom_count++] = DEFAULT_ROM;
+    }
+
+    // Keep stdout for the report; warnings still reach debug.log
+    log_set_console(false);
+    log_configure("warn");
+
+    FILE *out = stdout;
+    if (json_path) {
+        out = fopen(json_path, "w");
+        if (!out) {
+            fprintf(stderr, "Failed to open %s\n", json_path);
+            free(roms);
+            return 1;
+        }
+    }
+
+    int status = 0;
+    bool first = true;
+
+    fprintf(out, "{\n  \"engine\": \"%s\",\n  \"frames\": %ld,\n  \"warmup\": %ld,\n  \"results\": [\n",
+            cpu_engine_name(engine), frames, warmup);
+    for (int r = 0; r < rom_count; r++) {
+        for (int mode = 0; mode < BENCH_MODE_COUNT; mode++) {
+            BenchResult result;
+            if (!run_bench(roms[r], engine, (BenchMode)mode, frames, warmup, movie_path, &result)) {
+                fprintf(stderr, "Failed to run ROM: %s\n", roms[r]);
+                status = 1;
+                break;
+            }
+            if (result.movie == 0) {
+                fprintf(stderr, "%s: %s run diverged from the movie\n", roms[r], mode_names[mode]);
+                status = 1;
+            }
+
+            fprintf(out, first ? "" : ",\n");
+            write_json_result(out, roms[r], (BenchMode)mode, &result);
+            first = false;
+            fflush(out);
+        }
+
+        if (scale > 0) {
+            BenchResult result;
+            if (run_scale_bench(roms[r], engine, filter, scale, threads, frames, warmup, &result)) {
+                fprintf(out, first ? "" : ",\n");
+                write_json_scale_result(out, roms[r], filter, scale, threads, &result);
+                first = false;
+                fflush(out);
+            } else {
+                fprintf(stderr, "Failed to scale ROM %s with %s at x%d\n",
+                        roms[r], scaler_filter_name(filter), scale);
+                status = 1;
+            }
+        }
+
+        for (int obs = 0; batch_count > 0 && obs < 2; obs++) {
+            BatchResult result;
+            if (!run_batch_bench(roms[r], engine, (BatchObsType)obs, batch_count, frame_skip,
+                                 frames, warmup, &result)) {
+                fprintf(stderr, "Failed to create a batch for ROM: %s\n", roms[r]);
+                status = 1;
+                break;
+            }
+
+            fprintf(out, first ? "" : ",\n");
+            write_json_batch_result(out, roms[r], (BatchObsType)obs, batch_count, frame_skip,
+                                    &result);
+            first = false;
+            fflush(out);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(roms);
+    log_shutdown();
+    return status;
+}
@@ -1,126 +1,240 @@
 #include "../include/cpu.h"
 #include "../include/memory.h"
+#include "../include/machine.h"
+#include "../include/log.h"
+#include "../include/video.h"
+#include "../include/scheduler.h"
+#include "../include/sound.h"
+#include "../include/trace.h"
 #include "../src/z80/z80.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
-#include <SDL2/SDL.h>  // For SDL_Delay
 
-// External declaration of debug_log function
-extern void debug_log(const char *format, ...);
-
-// Z80 CPU instance
-static z80 cpu;
-static bool interrupt_pending = false;
 
 // Memory read callback for Z80
 static uint8_t cpu_read_callback(void* userdata, uint16_t address) {
-    (void)userdata; // Silence unused parameter warning
-    return memory_read_byte(address);
+    return memory_read_byte((PacmanMachine *)userdata, address);
 }
 
 // Memory write callback for Z80
 static void cpu_write_callback(void* userdata, uint16_t address, uint8_t data) {
-    (void)userdata; // Silence unused parameter warning
-    memory_write_byte(address, data);
+    memory_write_byte((PacmanMachine *)userdata, address, data);
 }
 
 // IO read callback for Z80
 static uint8_t cpu_port_in(z80* const z, uint8_t port) {
-    (void)z; // Silence unused parameter warning
-    return io_read_byte(port);
+    return io_read_byte((PacmanMachine *)z->userdata, port);
 }
 
 // IO write callback for Z80
 static void cpu_port_out(z80* const z, uint8_t port, uint8_t data) {
-    (void)z; // Silence unused parameter warning
-    io_write_byte(port, data);
+    io_write_byte((PacmanMachine *)z->userdata, port, data);
+}
+
+// Connect the Z80 to this machine's bus (z80_init clears all of this)
+static void cpu_bind_bus(PacmanMachine *m) {
+    m->cpu.read_byte = cpu_read_callback;
+    m->cpu.write_byte = cpu_write_callback;
+    m->cpu.port_in = cpu_port_in;
+    m->cpu.port_out = cpu_port_out;
+    m->cpu.userdata = m; // Callbacks find their machine through userdata
+    
+    // Opcode and operand fetches from ROM skip the bus entirely
+    m->cpu.fetch_base = m->rom;
+    m->cpu.fetch_limit = ROM_END + 1;
+    m->cpu.profile = m->cpu_profile;
+    m->cpu.trace = m->cpu_trace;
+    
+    // The ROM may have been reloaded since the blocks were decoded
+    if (m->cpu_blocks) {
+        z80_blocks_flush(m->cpu_blocks);
+    }
+}
+
+// Restart emulated time with the first VBLANK one frame away
+static void cpu_schedule_start(PacmanMachine *m) {
+    scheduler_init(&m->sched);
+    scheduler_add(&m->sched, SCHED_VBLANK, CPU_CYCLES_PER_FRAME);
+    scheduler_add(&m->sched, SCHED_WATCHDOG, CPU_CYCLES_PER_FRAME);
+    scheduler_add(&m->sched, SCHED_SOUND, SOUND_BLOCK_CYCLES);
+    m->watchdog_counter = 0;
 }
 
 // CPU initialization
-void cpu_init(void) {
+void cpu_init(PacmanMachine *m) {
     // Initialize the Z80 CPU
-    z80_init(&cpu);
+    z80_init(&m->cpu);
     
     // Set up memory and IO callbacks
-    cpu.read_byte = cpu_read_callback;
-    cpu.write_byte = cpu_write_callback;
-    cpu.port_in = cpu_port_in;
-    cpu.port_out = cpu_port_out;
-    cpu.userdata = NULL; // We don't need any user data for now
+    cpu_bind_bus(m);
+    cpu_schedule_start(m);
     
-    debug_log("Z80 CPU initialized using superzazu's Z80");
+    LOG_INFO(LOG_CAT_CPU, "Z80 CPU initialized using superzazu's Z80");
 }
 
-// Reset the CPU to initial state
-void cpu_reset(void) {
+// Reset the Z80 registers, leaving the schedule running
+static void cpu_reset_registers(PacmanMachine *m) {
     // Initialize the Z80 CPU - this also resets the CPU
-    z80_init(&cpu);
+    z80_init(&m->cpu);
     
-    // Set up callbacks again (in case they were lost during init)
-    cpu.read_byte = cpu_read_callback;
-    cpu.write_byte = cpu_write_callback;
-    cpu.port_in = cpu_port_in;
-    cpu.port_out = cpu_port_out;
+    // Set up callbacks again (init clears them)
+    cpu_bind_bus(m);
     
     // Set some initial values
-    cpu.pc = 0;         // Start at address 0 (ROM)
-    cpu.sp = 0xF000;    // Initial stack pointer in high RAM
-    
-    interrupt_pending = false;
+    m->cpu.pc = 0;         // Start at address 0 (ROM)
+    m->cpu.sp = 0xF000;    // Initial stack pointer in high RAM
+}
+
+// Reset the CPU to initial state
+void cpu_reset(PacmanMachine *m) {
+    cpu_reset_registers(m);
+    cpu_schedule_start(m);
     
-    debug_log("Z80 CPU reset");
+    LOG_INFO(LOG_CAT_CPU, "Z80 CPU reset");
 }
 
 // Read byte from memory
-uint8_t cpu_read_byte(uint16_t address) {
-    return memory_read_byte(address);
+uint8_t cpu_read_byte(PacmanMachine *m, uint16_t address) {
+    return memory_read_byte(m, address);
 }
 
 // Write byte to memory
-void cpu_write_byte(uint16_t address, uint8_t value) {
-    memory_write_byte(address, value);
+void cpu_write_byte(PacmanMachine *m, uint16_t address, uint8_t value) {
+    memory_write_byte(m, address, value);
 }
 
-// Handle interrupt request
-void cpu_interrupt(void) {
-    if (cpu.iff1) {
+// Raise the VBLANK interrupt if the game has enabled it (0x5000). The line
+// stays asserted until the Z80 accepts it or the game clears the enable.
+void cpu_interrupt(PacmanMachine *m) {
+    if (memory_get_interrupt_enable(m)) {
         // Generate an interrupt with data 0xFF (RST 38h)
-        z80_gen_int(&cpu, 0xFF);
-        debug_log("Z80 interrupt requested");
+        z80_gen_int(&m->cpu, 0xFF);
+        LOG_TRACE(LOG_CAT_CPU, "Z80 interrupt requested");
+    }
+}
+
+// Count a frame on the watchdog; the game has to write 0x50C0 regularly
+static void cpu_watchdog_tick(PacmanMachine *m) {
+    if (m->watchdog_counter < UINT8_MAX) {
+        m->watchdog_counter++;
+    }
+    if (m->watchdog_counter < WATCHDOG_FRAMES) {
+        return;
+    }
+    
+    // A trace shows what the game was doing instead of kicking the watchdog
+    if (m->cpu_trace && (m->watchdog_enabled || m->watchdog_counter == WATCHDOG_FRAMES)) {
+        z80_trace_fire(m->cpu_trace, Z80_TRIGGER_HOST, m->cpu.pc);
+    }
+    
+    if (m->watchdog_enabled) {
+        LOG_WARN(LOG_CAT_CPU, "Watchdog expired at PC=0x%04X, resetting CPU", m->cpu.pc);
+        cpu_reset_registers(m);
+        m->watchdog_counter = 0;
+    } else if (m->watchdog_counter == WATCHDOG_FRAMES) {
+        LOG_DEBUG(LOG_CAT_CPU, "Watchdog expired at PC=0x%04X (reset disabled)", m->cpu.pc);
     }
 }
 
-// Process a pending interrupt - this is handled by libz80 now
-static void handle_interrupt(void) {
-    // Nothing to do here, libz80 handles interrupts internally
+// Handle one due event and queue its next occurrence. Returns true at the
+// VBLANK that ends the frame.
+static bool cpu_handle_event(PacmanMachine *m, const SchedEvent *event) {
+    switch (event->type) {
+        case SCHED_VBLANK:
+            cpu_interrupt(m);
+            scheduler_add(&m->sched, SCHED_VBLANK, event->time + CPU_CYCLES_PER_FRAME);
+            return true;
+        case SCHED_WATCHDOG:
+            cpu_watchdog_tick(m);
+            scheduler_add(&m->sched, SCHED_WATCHDOG, event->time + CPU_CYCLES_PER_FRAME);
+            return false;
+        case SCHED_SOUND:
+            // Runs with or without an audio output, so that the slices the
+            // frame is cut into never depend on the host
+            sound_render_block(m);
+            scheduler_add(&m->sched, SCHED_SOUND, event->time + SOUND_BLOCK_CYCLES);
+            return false;
+        default:
+            return false;
+    }
 }
 
-// Execute CPU instructions for one frame (~16.6ms)
-void cpu_execute_frame(void) {
-    // Pacman Z80 runs at 3.072 MHz, so one frame is about 50,000 cycles
-    const uint32_t CYCLES_PER_FRAME = 50000;
+// Run the Z80 up to the next event and advance emulated time
+static void cpu_run_slice(PacmanMachine *m) {
+    uint64_t next = scheduler_next_time(&m->sched);
+    if (next <= m->sched.now) {
+        return;
+    }
     
-    // Initialize test pattern at first run
-    static bool initialized_vram = false;
-    static bool first_execution = true;
-    static bool executed_rom = false;
+    unsigned long budget = (unsigned long)(next - m->sched.now);
+    if (m->cpu_engine == CPU_ENGINE_BLOCKS) {
+        m->sched.now += z80_run_blocks(&m->cpu, m->cpu_blocks, budget);
+    } else {
+        m->sched.now += z80_run(&m->cpu, budget);
+    }
+}
+
+// Engine names, indexed by CpuEngine
+static const char *engine_names[CPU_ENGINE_COUNT] = { "interp", "blocks" };
+
+// Select the engine used by cpu_execute_frame()
+bool cpu_set_engine(PacmanMachine *m, CpuEngine engine) {
+    if (engine == CPU_ENGINE_BLOCKS && !m->cpu_blocks) {
+        m->cpu_blocks = z80_blocks_create();
+        if (!m->cpu_blocks) {
+            return false;
+        }
+        
+        // Bus reads have no side effects and inputs only change between
+        // frames, so busy-wait loops can be skipped until the next interrupt
+        z80_blocks_skip_idle(m->cpu_blocks, true);
+    }
     
-    if (first_execution) {
-        first_execution = false;
-        debug_log("ROM starting bytes: %02X %02X %02X %02X", 
-                 cpu_read_callback(NULL, 0), cpu_read_callback(NULL, 1),
-                 cpu_read_callback(NULL, 2), cpu_read_callback(NULL, 3));
-        debug_log("Z80 emulation starting");
+    m->cpu_engine = engine;
+    LOG_DEBUG(LOG_CAT_CPU, "CPU engine: %s", engine_names[engine]);
+    return true;
+}
+
+// Look up an engine by name
+bool cpu_parse_engine(const char *name, CpuEngine *engine) {
+    for (int i = 0; i < CPU_ENGINE_COUNT; i++) {
+        if (strcmp(name, engine_names[i]) == 0) {
+            *engine = (CpuEngine)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Name of an engine
+const char* cpu_engine_name(CpuEngine engine) {
+    return engine < CPU_ENGINE_COUNT ? engine_names[engine] : "unknown";
+}
+
+// Execute CPU instructions for one frame (~16.5ms), up to the next VBLANK
+void cpu_execute_frame(PacmanMachine *m) {
+    uint64_t perf_start = PERF_START();
+    unsigned long start_steps = m->cpu.steps;
+    unsigned long start_skipped = m->cpu.skipped;
+    unsigned long start_interrupts = m->cpu.interrupts;
+    
+    // Initialize test pattern at first run (state is kept per machine)
+    if (!m->first_execution_done) {
+        m->first_execution_done = true;
+        LOG_INFO(LOG_CAT_CPU, "ROM starting bytes: %02X %02X %02X %02X", 
+                 memory_read_byte(m, 0), memory_read_byte(m, 1),
+                 memory_read_byte(m, 2), memory_read_byte(m, 3));
+        LOG_INFO(LOG_CAT_CPU, "Z80 emulation starting");
     }
     
-    if (!initialized_vram) {
-        debug_log("Initializing test pattern in VRAM");
+    if (!m->demo_vram_initialized) {
+        LOG_INFO(LOG_CAT_CPU, "Initializing test pattern in VRAM");
         
         // Get VRAM and CRAM memory
-        uint8_t *vram = memory_get_vram();
-        uint8_t *cram = memory_get_cram();
+        uint8_t *vram = memory_get_vram(m);
+        uint8_t *cram = memory_get_cram(m);
         
         if (vram && cram) {
             // First, clear VRAM and CRAM to all zeros
@@ -131,6 +245,7 @@ void cpu_execute_frame(void) {
             for (int y = 0; y < 36; y++) {
                 for (int x = 0; x < 28; x++) {
                     int tile_index = y * 32 + x; // 32 columns in VRAM
+                    if (tile_index >= VRAM_SIZE) break; // Last rows don't fit in 1KB
                     
                     // Border around the screen
                     if (x == 0 || x == 27 || y == 0 || y == 35) {
@@ -166,6 +281,7 @@ void cpu_execute_frame(void) {
                 0x01, 0x02, 0x03, 0x03, 0x04, 0x00, 
                 0x05, 0x04, 0x06, 0x03, 0x07  // HELLO WORLD
             };
+            size_t hello_world_len = sizeof(hello_world);
             
             int text_y = 15;  // Middle of screen
             int text_x = 9;   // Center horizontally
@@ -194,81 +310,85 @@ void cpu_execute_frame(void) {
                 cram[ghost_positions[i]] = i + 1; // Different colors for each ghost
             }
             
-            // Set sprite data for the 8 sprites (in VRAM at 0x4FF0-0x4FFF)
+            // Set sprite data for the 8 sprites (in work RAM at 0x4FF0-0x4FFF)
             // Each sprite has 2 bytes: sprite number, color
             for (int i = 0; i < 8; i++) {
-                vram[0xFF0 + i*2] = (i << 2); // sprite number, no flip
-                vram[0xFF1 + i*2] = i % 7 + 1; // color (1-7, avoid black)
+                memory_write_byte(m, SPRITES_START + i*2, (i << 2)); // sprite number, no flip
+                memory_write_byte(m, SPRITES_START + i*2 + 1, i % 7 + 1); // color (1-7, avoid black)
             }
             
             // Set sprite positions (in I/O ports 0x5060-0x506F)
             for (int i = 0; i < 8; i++) {
-                memory_set_input_port(0x60 + i*2, 100 + i*20); // X positions
-                memory_set_input_port(0x61 + i*2, 100 + i*20); // Y positions
+                memory_set_input_port(m, 0x60 + i*2, 100 + i*20); // X positions
+                memory_set_input_port(m, 0x61 + i*2, 100 + i*20); // Y positions
             }
             
-            debug_log("VRAM test pattern initialized");
-            initialized_vram = true;
+            video_invalidate(m);  // Written directly, not through the bus
+            LOG_INFO(LOG_CAT_CPU, "VRAM test pattern initialized");
+            m->demo_vram_initialized = true;
         } else {
-            debug_log("ERROR: Could not get VRAM/CRAM pointers");
+            LOG_ERROR(LOG_CAT_CPU, "Could not get VRAM/CRAM pointers");
         }
     }
     
     // Try to execute the ROM code if we haven't done so yet
-    if (!executed_rom) {
-        debug_log("Attempting to execute ROM code");
+    if (!m->executed_rom) {
+        LOG_INFO(LOG_CAT_CPU, "Attempting to execute ROM code");
         
         // Set PC to beginning of ROM
-        cpu.pc = 0x0000;
+        m->cpu.pc = 0x0000;
         
         // Enable interrupts for the game to run
-        cpu.iff1 = true;
-        cpu.iff2 = true;
+        m->cpu.iff1 = true;
+        m->cpu.iff2 = true;
         
         // Mark as executed so we don't try again
-        executed_rom = true;
-        debug_log("ROM execution initialized");
+        m->executed_rom = true;
+        LOG_INFO(LOG_CAT_CPU, "ROM execution initialized");
     }
     
-    // Now execute some CPU cycles for this frame
-    uint32_t executed_cycles = 0;
-    
-    // Execute Z80 instructions until we reach the required number of cycles
-    unsigned long start_cyc = cpu.cyc;
+    // A machine that was never initialized has no events queued yet
+    if (m->sched.count == 0) {
+        cpu_schedule_start(m);
+    }
     
-    while ((cpu.cyc - start_cyc) < CYCLES_PER_FRAME) {
-        // Execute one Z80 instruction
-        z80_step(&cpu);
+    // Run the Z80 in slices between timed events until VBLANK ends the frame.
+    // An instruction may run a few cycles past an event; the next slice is
+    // measured from the event's own time, so the overshoot does not drift.
+    uint64_t frame_start = m->sched.now;
+    bool frame_done = false;
+    while (!frame_done) {
+        cpu_run_slice(m);
         
-        // Avoid infinite loops by limiting iterations
-        if ((cpu.cyc - start_cyc) > CYCLES_PER_FRAME * 2) {
-            debug_log("Warning: Breaking out of CPU loop - too many cycles");
-            break;
+        SchedEvent event;
+        while (scheduler_pop_due(&m->sched, &event)) {
+            frame_done |= cpu_handle_event(m, &event);
         }
     }
+    uint32_t executed_cycles = (uint32_t)(m->sched.now - frame_start);
     
-    executed_cycles = cpu.cyc - start_cyc;
+    // Save the trace ring once it has stopped after a trigger
+    if (m->cpu_trace) {
+        trace_poll(m);
+    }
     
     // Add a debugging log every 60 frames
-    static int frame_counter = 0;
-    frame_counter++;
+    m->frame_counter++;
     
-    if (frame_counter % 60 == 0) {
-        debug_log("Z80 PC=0x%04X, SP=0x%04X, A=0x%02X executed %lu cycles",
-                cpu.pc, cpu.sp, cpu.a, executed_cycles);
+    if (m->frame_counter % 60 == 0) {
+        LOG_DEBUG(LOG_CAT_CPU, "Z80 PC=0x%04X, SP=0x%04X, A=0x%02X executed %u cycles",
+                m->cpu.pc, m->cpu.sp, m->cpu.a, (unsigned)executed_cycles);
     }
     
     // Get VRAM and CRAM for display
-    uint8_t *vram = memory_get_vram();
-    uint8_t *cram = memory_get_cram();
+    uint8_t *vram = memory_get_vram(m);
+    uint8_t *cram = memory_get_cram(m);
     
     if (vram && cram) {
         // Set up a more elaborate test pattern that looks like Pacman
-        static bool first_frame = true;
-        
-        if (first_frame) {
-            debug_log("Creating elaborate Pacman test display");
-            first_frame = false;
+        if (!m->demo_screen_created) {
+            LOG_INFO(LOG_CAT_CPU, "Creating elaborate Pacman test display");
+            m->demo_screen_created = true;
             
             // Clear VRAM and CRAM
             memset(vram, 0, 0x0400);
@@ -278,6 +398,7 @@ void cpu_execute_frame(void) {
             for (int y = 0; y < 36; y++) {
                 for (int x = 0; x < 28; x++) {
                     int idx = y * 32 + x;  // VRAM layout is 32 columns wide
+                    if (idx >= VRAM_SIZE) break;  // Last rows don't fit in 1KB
                     
                     // Border
                     if (x == 0 || x == 27 || y == 0 || y == 35) {
@@ -342,77 +463,73 @@ void cpu_execute_frame(void) {
                 cram[idx] = ghost_colors[i];
             }
             
-            // Set up sprites in VRAM
-            // In Pacman, sprites data is at 0x4FF0-0x4FFF (last 16 bytes of VRAM)
+            // Set up sprites in work RAM
+            // In Pacman, sprites data is at 0x4FF0-0x4FFF (last 16 bytes of work RAM)
             // Each sprite is 2 bytes: sprite number + flags, color
             for (int i = 0; i < 8; i++) {
                 if (i < 5) {  // Only 5 sprites: Pacman + 4 ghosts
-                    vram[0xFF0 + i*2] = i << 2;  // Sprite number, no flip flags
-                    vram[0xFF1 + i*2] = (i == 0) ? 0x05 : ghost_colors[i-1];  // Color (Pacman yellow, ghosts per color)
+                    memory_write_byte(m, SPRITES_START + i*2, i << 2);  // Sprite number, no flip flags
+                    memory_write_byte(m, SPRITES_START + i*2 + 1, (i == 0) ? 0x05 : ghost_colors[i-1]);  // Color (Pacman yellow, ghosts per color)
                 } else {
-                    vram[0xFF0 + i*2] = 0;
-                    vram[0xFF1 + i*2] = 0;
+                    memory_write_byte(m, SPRITES_START + i*2, 0);
+                    memory_write_byte(m, SPRITES_START + i*2 + 1, 0);
                 }
             }
             
             // Set sprite positions in I/O ports
             // Pacman centered slightly lower
-            memory_set_input_port(0x60, 112);  // Pacman X
-            memory_set_input_port(0x61, 180);  // Pacman Y
+            memory_set_input_port(m, 0x60, 112);  // Pacman X
+            memory_set_input_port(m, 0x61, 180);  // Pacman Y
             
             // Ghosts in cardinal positions around Pacman
-            memory_set_input_port(0x62, 80);   // Ghost 1 X (left)
-            memory_set_input_port(0x63, 180);  // Ghost 1 Y
-            memory_set_input_port(0x64, 144);  // Ghost 2 X (right)
-            memory_set_input_port(0x65, 180);  // Ghost 2 Y
-            memory_set_input_port(0x66, 112);  // Ghost 3 X (up)
-            memory_set_input_port(0x67, 140);  // Ghost 3 Y
-            memory_set_input_port(0x68, 112);  // Ghost 4 X (down)
-            memory_set_input_port(0x69, 220);  // Ghost 4 Y
+            memory_set_input_port(m, 0x62, 80);   // Ghost 1 X (left)
+            memory_set_input_port(m, 0x63, 180);  // Ghost 1 Y
+            memory_set_input_port(m, 0x64, 144);  // Ghost 2 X (right)
+            memory_set_input_port(m, 0x65, 180);  // Ghost 2 Y
+            memory_set_input_port(m, 0x66, 112);  // Ghost 3 X (up)
+            memory_set_input_port(m, 0x67, 140);  // Ghost 3 Y
+            memory_set_input_port(m, 0x68, 112);  // Ghost 4 X (down)
+            memory_set_input_port(m, 0x69, 220);  // Ghost 4 Y
             
-            debug_log("Pacman demo screen created");
+            video_invalidate(m);  // Written directly, not through the bus
+            LOG_INFO(LOG_CAT_CPU, "Pacman demo screen created");
         }
         
         // Move sprites a bit each frame for animation
-        static int frame_counter = 0;
-        frame_counter++;
+        int frame_counter = ++m->demo_frame_counter;
         
         if (frame_counter % 5 == 0) {  // Every 5 frames
             // Make Pacman move in a circle
-            int pacman_x = io_read_byte(0x60);
-            int pacman_y = io_read_byte(0x61);
+            int pacman_x = io_read_byte(m, 0x60);
+            int pacman_y = io_read_byte(m, 0x61);
             
             // Calculate new position in a circular path
             double angle = (frame_counter % 120) * 3.14159 * 2.0 / 120.0;
             pacman_x = 112 + (int)(30.0 * cos(angle));
             pacman_y = 180 + (int)(30.0 * sin(angle));
             
-            memory_set_input_port(0x60, pacman_x);
-            memory_set_input_port(0x61, pacman_y);
+            memory_set_input_port(m, 0x60, pacman_x);
+            memory_set_input_port(m, 0x61, pacman_y);
             
             // Move ghosts slightly to create movement
             for (int i = 1; i < 4; i++) {
-                int ghost_x = io_read_byte(0x60 + i*2);
-                int ghost_y = io_read_byte(0x61 + i*2);
+                int ghost_x = io_read_byte(m, 0x60 + i*2);
+                int ghost_y = io_read_byte(m, 0x61 + i*2);
                 
                 // Each ghost has a different movement pattern
                 double ghost_angle = (frame_counter % 120) * 3.14159 * 2.0 / 120.0 + i * 3.14159 / 2.0;
                 ghost_x = 112 + (int)(50.0 * cos(ghost_angle));
                 ghost_y = 180 + (int)(50.0 * sin(ghost_angle));
                 
-                memory_set_input_port(0x60 + i*2, ghost_x);
-                memory_set_input_port(0x61 + i*2, ghost_y);
+                memory_set_input_port(m, 0x60 + i*2, ghost_x);
+                memory_set_input_port(m, 0x61 + i*2, ghost_y);
             }
         }
     }
     
-    // Nothing more to do here, CPU execution is complete
-    
-    // Handle interrupts at the end of the frame
-    if (cpu.iff1) {
-        // Generate interrupt at VBLANK (end of frame)
-        cpu_interrupt();
-    }
-    
-    // End of frame
+    // End of frame (the VBLANK interrupt was raised by the scheduler)
+    PERF_COUNT(m, instructions, m->cpu.steps - start_steps);
+    PERF_COUNT(m, skipped, m->cpu.skipped - start_skipped);
+    PERF_COUNT(m, interrupts, m->cpu.interrupts - start_interrupts);
+    PERF_STOP(m, PERF_STAGE_CPU, perf_start);
 }
\ No newline at end of file
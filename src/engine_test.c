@@ -0,0 +1,539 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../include/machine.h"
+#include "../include/memory.h"
+#include "../include/cpu.h"
+#include "../include/input.h"
+#include "../include/log.h"
+#include "../src/z80/z80.h"
+
+// Self-test for the block engine (make test). Runs two machines in lockstep
+// on the same synthetic program, one with z80_run() and one with
+// z80_run_blocks(), and compares every register, all of memory and the
+// board's registers after each slice of each frame. The program is random straight-line code cut
+// into chunks by branches, loops, calls, halts and busy-wait loops (which
+// the block engine skips), plus code in RAM that the program rewrites
+// before running it, and a routine that runs off the end of the fetch
+// window into RAM with an instruction split across the boundary. Between
+// frames the harness patches ROM opcodes (flushing the cache, as a ROM
+// reload does) and moves the end of the fetch window.
+//
+// Usage: engine-test WORK_DIR (the program's ROM is written there)
+
+#define SEEDS           6
+#define FRAMES          120
+#define FRAME_CYCLES    51200       // 3.072 MHz / 60
+#define MAX_SLICE       4000        // Longest run between interrupt checks
+#define PATCHES         64          // ROM opcodes changed every fourth frame
+
+// Where the test program keeps things (see memory.h for the map)
+#define FETCH_END       (ROM_END + 1)
+#define SHORT_LIMIT     0x3000      // Fetch window end on some frames
+#define MAIN_START      0x0100
+#define MAIN_END        0x3E00      // Chunks stop before here
+#define EDGE_START      0x3FF0      // Routine running off the window into RAM
+#define EDGE_RAM        VRAM_START  // Its RAM half (operand of the split ld a,n)
+#define SMC_RAM         WRAM_START  // Routine rewritten before each call
+#define FLAG            0x4810      // Set by the interrupt handler
+#define COUNTER         0x4811      // Loop counter
+#define SCRATCH         0x4100      // Tile RAM the random code reads and writes
+#define SCRATCH_SIZE    0x0600
+#define STACK_TOP       SPRITES_START
+
+#define MAX_PATCH_SITES 4096
+
+// xorshift32, so every run tests the same program
+static uint32_t rng_state;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Program generator
+typedef struct {
+    uint8_t *rom;
+    unsigned pc;
+    uint16_t patch_sites[MAX_PATCH_SITES];     // One-byte register ops
+    int patch_count;
+} Emitter;
+
+// One-byte, four t-state instructions that only touch registers (the
+// opcodes ROM patches swap between)
+static const uint8_t reg_ops[] = {
+    0x04, 0x05, 0x0C, 0x0D, 0x14, 0x15, 0x1C, 0x1D, 0x24, 0x25, 0x2C, 0x2D, 0x3C, 0x3D,
+    0x07, 0x0F, 0x17, 0x1F, 0x2F, 0x37, 0x3F, 0x00, 0x78, 0x41, 0x53, 0x6A, 0x80, 0x89,
+    0x92, 0x9B, 0xA4, 0xAD, 0xB3, 0xBA
+};
+
+static void emit(Emitter *e, uint8_t byte) {
+    e->rom[e->pc++] = byte;
+}
+
+static void emit_word(Emitter *e, uint16_t word) {
+    emit(e, word & 0xFF);
+    emit(e, word >> 8);
+}
+
+// Address in the scratch area
+static uint16_t scratch(void) {
+    return SCRATCH + rng() % SCRATCH_SIZE;
+}
+
+static void emit_reg_op(Emitter *e) {
+    if (e->patch_count < MAX_PATCH_SITES) {
+        e->patch_sites[e->patch_count++] = (uint16_t)e->pc;
+    }
+    emit(e, reg_ops[rng() % sizeof(reg_ops)]);
+}
+
+// Whether unprefixed op reads or writes (hl), which DD/FD turn into (iz+d)
+static bool uses_hl(uint8_t op) {
+    if (op == 0x34 || op == 0x35 || op == 0x36) return true;
+    if (op < 0x40 || op >= 0xC0 || op == 0x76) return false;
+    return (op & 7) == 6 || (op >= 0x70 && op < 0x78);
+}
+
+// An unprefixed opcode that does not branch, halt, move the stack or
+// disable interrupts
+static uint8_t plain_op(void) {
+    static const uint8_t high[] = {
+        0xC6, 0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE, 0xEB, 0xD9, 0xD3, 0xDB, 0xFB
+    };
+    for (;;) {
+        uint8_t op = (uint8_t)rng();
+        if (op >= 0xC0) {
+            return high[op % sizeof(high)];
+        }
+        if ((op >= 0x10 && (op & 7) == 0) || op == 0x31 || op == 0x33 || op == 0x3B ||
+            op == 0x76) {
+            continue;       // djnz, jr, ld/inc/dec sp, halt
+        }
+        return op;
+    }
+}
+
+// The operands of unprefixed op, addresses pointing at the scratch area
+static void emit_operands(Emitter *e, uint8_t op) {
+    if ((op & 0xCF) == 0x01 || op == 0x22 || op == 0x2A || op == 0x32 || op == 0x3A) {
+        emit_word(e, scratch());
+    } else if ((op < 0x40 && (op & 7) == 6) || (op >= 0xC0 && (op & 7) == 6) ||
+               op == 0xD3 || op == 0xDB) {
+        emit(e, (uint8_t)rng());
+    }
+}
+
+// One random instruction that falls through to the next
+static void emit_random(Emitter *e) {
+    uint8_t op;
+    switch (rng() % 12) {
+        case 0: case 1: case 2:
+            emit_reg_op(e);
+            break;
+        case 3: case 4: case 5:
+            op = plain_op();
+            emit(e, op);
+            emit_operands(e, op);
+            break;
+        case 6:
+            emit(e, 0xCB);
+            emit(e, (uint8_t)rng());
+            break;
+        case 7:
+            // Everything in ED 40-7F but retn/reti, im, ld sp,(**) and
+            // the two undefined nops (block instructions are case 11)
+            op = (uint8_t)(0x40 | rng() % 0x40);
+            if ((op & 7) == 5 || (op & 7) == 6 || op == 0x77 || op == 0x7B || op == 0x7F) {
+                op = 0x44;
+            }
+            emit(e, 0xED);
+            emit(e, op);
+            if ((op & 7) == 3) {
+                emit_word(e, scratch());
+            }
+            break;
+        case 8: case 9:
+            op = plain_op();
+            if (op == 0xDD || op == 0xFD || op == 0xED || op == 0xCB) {
+                op = 0x23;
+            }
+            emit(e, rng() & 1 ? 0xDD : 0xFD);
+            emit(e, op);
+            if (uses_hl(op)) {
+                emit(e, (uint8_t)rng());
+            }
+            emit_operands(e, op);
+            break;
+        case 10:
+            emit(e, rng() & 1 ? 0xDD : 0xFD);
+            emit(e, 0xCB);
+            emit(e, (uint8_t)rng());
+            emit(e, (uint8_t)rng());
+            break;
+        default:
+            // ldi/ldir, cpi, ini, outi and the rest on a short count (in B
+            // for the I/O ones, in BC for the others)
+            op = (uint8_t)(0xA0 | (rng() % 4) | (rng() & 0x18));
+            emit(e, 0x01);
+            if ((op & 3) >= 2) {
+                emit(e, (uint8_t)rng());
+                emit(e, (uint8_t)(1 + rng() % 8));
+            } else {
+                emit_word(e, (uint16_t)(1 + rng() % 8));
+            }
+            emit(e, 0x21);
+            emit_word(e, (scratch() & 0xFF00) + 0x80);
+            emit(e, 0x11);
+            emit_word(e, (scratch() & 0xFF00) + 0x80);
+            emit(e, 0xED);
+            emit(e, op);
+            break;
+    }
+}
+
+// A chunk: pointers reset into the scratch area, random code, and one of
+// the ways a program moves on
+static void emit_chunk(Emitter *e) {
+    emit(e, 0x21);
+    emit_word(e, scratch());
+    emit(e, 0xDD);
+    emit(e, 0x21);
+    emit_word(e, scratch() & 0xFF00);
+    emit(e, 0xFD);
+    emit(e, 0x21);
+    emit_word(e, (scratch() & 0xFF00) + 0x80);
+
+    bool push = rng() % 4 == 0;
+    if (push) {
+        emit(e, (uint8_t)(0xC5 | (rng() % 4) << 4));
+    }
+    int count = 1 + rng() % 16;
+    for (int i = 0; i < count; i++) {
+        emit_random(e);
+    }
+    if (push) {
+        emit(e, (uint8_t)(0xC1 | (rng() % 4) << 4));
+    }
+
+    unsigned start, patch;
+    uint8_t op;
+    switch (rng() % 16) {
+        case 0: case 1: case 2:
+            // Conditional jr over a few instructions
+            emit(e, (uint8_t)(0x20 | (rng() % 4) << 3));
+            patch = e->pc;
+            emit(e, 0);
+            for (int i = 1 + rng() % 4; i > 0; i--) {
+                emit_random(e);
+            }
+            e->rom[patch] = (uint8_t)(e->pc - patch - 1);
+            break;
+        case 3: case 4:
+            // Loop on a counter in memory
+            emit(e, 0x3E);
+            emit(e, (uint8_t)(1 + rng() % 6));
+            emit(e, 0x32);
+            emit_word(e, COUNTER);
+            start = e->pc;
+            for (int i = 1 + rng() % 6; i > 0; i--) {
+                emit_random(e);
+            }
+            emit(e, 0x21);
+            emit_word(e, COUNTER);
+            emit(e, 0x35);                                  // dec (hl)
+            emit(e, 0x20);
+            emit(e, (uint8_t)(start - (e->pc + 1)));
+            break;
+        case 5:
+            // djnz around register ops that leave B alone
+            emit(e, 0x06);
+            emit(e, (uint8_t)(1 + rng() % 20));
+            start = e->pc;
+            for (int i = 1 + rng() % 4; i > 0; i--) {
+                emit(e, (uint8_t[]){ 0x3C, 0x07, 0x2C, 0x87, 0x00, 0xA9 }[rng() % 6]);
+            }
+            emit(e, 0x10);
+            emit(e, (uint8_t)(start - (e->pc + 1)));
+            break;
+        case 6: case 7:
+            // Subroutine in ROM, called always or on a condition
+            emit(e, 0x18);
+            patch = e->pc;
+            emit(e, 0);
+            start = e->pc;
+            for (int i = 1 + rng() % 8; i > 0; i--) {
+                emit_random(e);
+            }
+            emit(e, 0xC9);
+            e->rom[patch] = (uint8_t)(e->pc - patch - 1);
+            emit(e, rng() & 1 ? 0xCD : (uint8_t)(0xC4 | (rng() % 4) << 3));
+            emit_word(e, (uint16_t)start);
+            break;
+        case 8: case 9:
+            // Rewrite the RAM routine (two byte op) and call it
+            op = (uint8_t[]){ 0x3E, 0xC6, 0xD6, 0xEE, 0x06, 0x0E, 0x2E }[rng() % 7];
+            emit(e, 0x3E);
+            emit(e, op);
+            emit(e, 0x32);
+            emit_word(e, SMC_RAM);
+            emit(e, 0x3E);
+            emit(e, (uint8_t)rng());
+            emit(e, 0x32);
+            emit_word(e, SMC_RAM + 1);
+            emit(e, 0xCD);
+            emit_word(e, SMC_RAM);
+            break;
+        case 10: case 11:
+            emit(e, 0xCD);
+            emit_word(e, EDGE_START);
+            break;
+        case 12:
+            // Busy-wait for the interrupt handler
+            emit(e, 0xFB);
+            emit(e, 0xAF);
+            emit(e, 0x32);
+            emit_word(e, FLAG);
+            start = e->pc;
+            emit(e, 0x3A);
+            emit_word(e, FLAG);
+            emit(e, 0xA7);
+            emit(e, 0x28);
+            emit(e, (uint8_t)(start - (e->pc + 1)));
+            break;
+        case 13:
+            emit(e, 0xFB);
+            emit(e, 0x76);
+            break;
+        default:
+            break;
+    }
+}
+
+// Build the program into rom (ROM_SIZE bytes)
+static void build_program(Emitter *e, uint8_t *rom) {
+    memset(rom, 0, ROM_SIZE);
+    e->rom = rom;
+    e->patch_count = 0;
+
+    // Reset: di / ld sp,STACK_TOP / im 1 / ei / jp MAIN_START
+    e->pc = 0;
+    emit(e, 0xF3);
+    emit(e, 0x31);
+    emit_word(e, STACK_TOP);
+    emit(e, 0xED);
+    emit(e, 0x56);
+    emit(e, 0xFB);
+    emit(e, 0xC3);
+    emit_word(e, MAIN_START);
+
+    // Interrupt: push af / ld a,1 / ld (FLAG),a / pop af / ei / reti
+    e->pc = 0x38;
+    emit(e, 0xF5);
+    emit(e, 0x3E);
+    emit(e, 0x01);
+    emit(e, 0x32);
+    emit_word(e, FLAG);
+    emit(e, 0xF1);
+    emit(e, 0xFB);
+    emit(e, 0xED);
+    emit(e, 0x4D);
+
+    // NMI: retn
+    e->pc = 0x66;
+    emit(e, 0xED);
+    emit(e, 0x45);
+
+    e->pc = MAIN_START;
+    while (e->pc < MAIN_END - 0x200) {
+        emit_chunk(e);
+    }
+    emit(e, 0xC3);
+    emit_word(e, MAIN_START);
+
+    // Register ops up to the last ROM byte, which is the opcode of an
+    // ld a,n whose operand is the first RAM byte (see edge_ram)
+    e->pc = EDGE_START;
+    while (e->pc < ROM_END) {
+        emit_reg_op(e);
+    }
+    emit(e, 0x3E);
+}
+
+// The RAM half of the routine at EDGE_START. It increments the operand of
+// the split ld a,n and switches the opcode after it between ld b,n and
+// ld c,n, so code past the end of the window changes under the cache:
+//   inc a / ld (EDGE_RAM),a / ld a,(EDGE_RAM + 13) / xor 8
+//   ld (EDGE_RAM + 13),a / ld b,0 / ret
+static const uint8_t edge_ram[] = {
+    0x00, 0x3C, 0x32, EDGE_RAM & 0xFF, EDGE_RAM >> 8,
+    0x3A, (EDGE_RAM + 13) & 0xFF, (EDGE_RAM + 13) >> 8, 0xEE, 0x08,
+    0x32, (EDGE_RAM + 13) & 0xFF, (EDGE_RAM + 13) >> 8, 0x06, 0x00, 0xC9
+};
+
+// Power on a machine with the program, and the RAM routines in place
+static PacmanMachine* create_machine(const char *rom_path) {
+    PacmanMachine *m = machine_create();
+    if (!m || !memory_init(m, rom_path)) {
+        machine_destroy(m);
+        return NULL;
+    }
+    cpu_init(m);
+    input_init(m);
+
+    for (size_t i = 0; i < sizeof(edge_ram); i++) {
+        cpu_write_byte(m, (uint16_t)(EDGE_RAM + i), edge_ram[i]);
+    }
+    // ld a,n / ret, rewritten by the program before each call
+    cpu_write_byte(m, SMC_RAM, 0x3E);
+    cpu_write_byte(m, SMC_RAM + 2, 0xC9);
+    return m;
+}
+
+// Name of the first register that differs, NULL if none
+static const char* compare_cpu(const z80 *a, const z80 *b) {
+#define SAME(field) if (a->field != b->field) return #field
+    SAME(cyc);
+    SAME(pc); SAME(sp); SAME(ix); SAME(iy); SAME(mem_ptr);
+    SAME(a); SAME(b); SAME(c); SAME(d); SAME(e); SAME(h); SAME(l);
+    SAME(a_); SAME(b_); SAME(c_); SAME(d_); SAME(e_); SAME(h_); SAME(l_); SAME(f_);
+    SAME(i); SAME(r);
+    SAME(sf); SAME(zf); SAME(yf); SAME(hf); SAME(xf); SAME(pf); SAME(nf); SAME(cf);
+    SAME(lf_op); SAME(lf_a); SAME(lf_b); SAME(lf_res); SAME(lf_c); SAME(lf_cf);
+    SAME(iff_delay); SAME(interrupt_mode); SAME(int_data); SAME(iff1); SAME(iff2);
+    SAME(halted); SAME(int_pending); SAME(nmi_pending); SAME(interrupts);
+#undef SAME
+    if (a->steps + a->skipped != b->steps + b->skipped) return "steps + skipped";
+    return NULL;
+}
+
+// What differs between the two machines after a slice, NULL if nothing.
+// Memory and the board's registers are the snapshot range after the CPU.
+static const char* compare_machines(const PacmanMachine *interp, const PacmanMachine *block) {
+    const char *field = compare_cpu(&interp->cpu, &block->cpu);
+    if (field) {
+        return field;
+    }
+    size_t start = offsetof(PacmanMachine, ram);
+    if (memcmp((const uint8_t *)interp + start, (const uint8_t *)block + start,
+               MACHINE_STATE_SIZE - start) != 0) {
+        return "memory";
+    }
+    return NULL;
+}
+
+// Run one program on both engines. Returns the failure count (0 or 1).
+static int run_program(uint32_t seed, bool skip_idle, const char *rom_path,
+                       const Emitter *program, z80_blocks *blocks) {
+    PacmanMachine *interp = create_machine(rom_path);
+    PacmanMachine *block = create_machine(rom_path);
+    if (!interp || !block) {
+        printf("FAIL seed %u: cannot create the machines\n", seed);
+        machine_destroy(interp);
+        machine_destroy(block);
+        return 1;
+    }
+    z80_blocks_flush(blocks);
+    z80_blocks_skip_idle(blocks, skip_idle);
+    rng_state = seed ^ 0x9E3779B9u;
+
+    int failures = 0;
+    for (int frame = 0; frame < FRAMES && !failures; frame++) {
+        // Patch ROM opcodes in both, as if the ROM were reloaded
+        if (frame % 4 == 3 && program->patch_count > 0) {
+            for (int i = 0; i < PATCHES; i++) {
+                uint16_t site = program->patch_sites[rng() % program->patch_count];
+                uint8_t op = reg_ops[rng() % sizeof(reg_ops)];
+                interp->rom[site] = op;
+                block->rom[site] = op;
+            }
+            z80_blocks_flush(blocks);
+        }
+
+        // Move the end of the fetch window for a few frames
+        uint16_t limit = frame % 30 >= 20 ? SHORT_LIMIT : FETCH_END;
+        interp->cpu.fetch_limit = limit;
+        block->cpu.fetch_limit = limit;
+
+        unsigned long done = 0;
+        for (int slice = 0; done < FRAME_CYCLES; slice++) {
+            unsigned long budget = 1 + rng() % MAX_SLICE;
+            if (budget > FRAME_CYCLES - done) {
+                budget = FRAME_CYCLES - done;
+            }
+            unsigned long ran = z80_run(&interp->cpu, budget);
+            unsigned long ran_blocks = z80_run_blocks(&block->cpu, blocks, budget);
+            done += ran;
+
+            const char *field = ran != ran_blocks ? "cycles run" : compare_machines(interp, block);
+            if (field) {
+                printf("FAIL seed %u%s, frame %d slice %d: %s differs (interp pc %04X, blocks pc %04X)\n",
+                       seed, skip_idle ? " with idle skip" : "", frame, slice, field,
+                       interp->cpu.pc, block->cpu.pc);
+                failures = 1;
+                break;
+            }
+        }
+
+        // VBLANK, and now and then an NMI
+        z80_gen_int(&interp->cpu, 0xFF);
+        z80_gen_int(&block->cpu, 0xFF);
+        if (frame % 16 == 5) {
+            z80_gen_nmi(&interp->cpu);
+            z80_gen_nmi(&block->cpu);
+        }
+    }
+
+    machine_destroy(interp);
+    machine_destroy(block);
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        printf("Usage: %s WORK_DIR\n", argv[0]);
+        return 1;
+    }
+    log_set_console(false);
+
+    z80_blocks *blocks = z80_blocks_create();
+    if (!blocks) {
+        printf("Block engine not built (COMPUTED_GOTO=0), nothing to compare\n");
+        return 0;
+    }
+
+    char rom_path[1024];
+    snprintf(rom_path, sizeof(rom_path), "%s/engine-test.rom", argv[1]);
+
+    static uint8_t rom[ROM_SIZE];
+    static Emitter program;
+    int failures = 0;
+    for (uint32_t seed = 1; seed <= SEEDS; seed++) {
+        rng_state = seed * 2654435761u;
+        build_program(&program, rom);
+
+        FILE *file = fopen(rom_path, "wb");
+        if (!file || fwrite(rom, sizeof(rom), 1, file) != 1) {
+            printf("Cannot write %s\n", rom_path);
+            if (file) fclose(file);
+            failures++;
+            break;
+        }
+        fclose(file);
+
+        for (int skip = 0; skip < 2; skip++) {
+            failures += run_program(seed, skip, rom_path, &program, blocks);
+        }
+    }
+    printf("%d programs run for %d frames on interp and blocks, %d failures\n",
+           SEEDS, FRAMES, failures);
+
+    remove(rom_path);
+    z80_blocks_destroy(blocks);
+    log_shutdown();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,257 @@
+#include "../include/export.h"
+#include "../include/machine.h"
+#include "../include/memory.h"
+#include "../include/video.h"
+#include "../include/timer.h"
+#include "../include/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// The two processes share these through plain loads and stores
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2, "export needs lock-free 32-bit atomics");
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "export needs lock-free 64-bit atomics");
+
+// Slots and pixel rows start on cache lines
+#define EXPORT_ALIGN        64
+#define ALIGN_UP(x)         (((x) + EXPORT_ALIGN - 1) & ~(size_t)(EXPORT_ALIGN - 1))
+
+#define PIXELS_OFFSET       ALIGN_UP(sizeof(ExportFrameInfo))
+#define SLOT_SIZE           ALIGN_UP(PIXELS_OFFSET + SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t))
+#define SLOTS_OFFSET        ALIGN_UP(sizeof(ExportHeader))
+#define BLOCK_SIZE          (SLOTS_OFFSET + EXPORT_SLOTS * SLOT_SIZE)
+
+// A mapped shared block
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    char name[256];
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+} SharedBlock;
+
+struct FrameExport {
+    SharedBlock block;
+    uint32_t slot;          // Slot being written, owned by the writer
+};
+
+struct ExportReader {
+    SharedBlock block;
+};
+
+// Shared memory names: POSIX ones must start with a slash
+static void make_name(char *out, size_t size, const char *name) {
+#ifdef _WIN32
+    snprintf(out, size, "%s", name);
+#else
+    snprintf(out, size, "%s%s", name[0] == '/' ? "" : "/", name);
+#endif
+}
+
+// Create or open a named block and map it read-write
+static bool map_block(SharedBlock *b, const char *name, size_t size, bool create) {
+    make_name(b->name, sizeof(b->name), name);
+#ifdef _WIN32
+    if (create) {
+        b->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                        0, (DWORD)size, b->name);
+    } else {
+        b->mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, b->name);
+    }
+    if (!b->mapping) {
+        return false;
+    }
+    b->base = (uint8_t *)MapViewOfFile(b->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!b->base) {
+        CloseHandle(b->mapping);
+        return false;
+    }
+#else
+    int fd;
+    if (create) {
+        // A block left behind by a crashed run may have another size
+        shm_unlink(b->name);
+        fd = shm_open(b->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0 && ftruncate(fd, (off_t)size) != 0) {
+            close(fd);
+            shm_unlink(b->name);
+            return false;
+        }
+    } else {
+        fd = shm_open(b->name, O_RDWR, 0);
+        struct stat st;
+        if (fd >= 0 && (fstat(fd, &st) != 0 || (size_t)st.st_size < size)) {
+            close(fd);
+            return false;
+        }
+    }
+    if (fd < 0) {
+        return false;
+    }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        if (create) {
+            shm_unlink(b->name);
+        }
+        return false;
+    }
+    b->base = (uint8_t *)base;
+#endif
+    b->size = size;
+    return true;
+}
+
+// Unmap a block, removing its name too if asked
+static void unmap_block(SharedBlock *b, bool remove) {
+#ifdef _WIN32
+    (void)remove;
+    UnmapViewOfFile(b->base);
+    CloseHandle(b->mapping);
+#else
+    munmap(b->base, b->size);
+    if (remove) {
+        shm_unlink(b->name);
+    }
+#endif
+}
+
+// Slot by index
+static uint8_t* slot_at(const SharedBlock *b, uint32_t index) {
+    return b->base + SLOTS_OFFSET + (size_t)index * SLOT_SIZE;
+}
+
+// Create the shared block
+FrameExport* export_create(const char *name) {
+    FrameExport *e = (FrameExport *)calloc(1, sizeof(FrameExport));
+    if (!e) {
+        return NULL;
+    }
+    if (!map_block(&e->block, name, BLOCK_SIZE, true)) {
+        LOG_ERROR(LOG_CAT_VIDEO, "Failed to create shared memory for frame export: %s", name);
+        free(e);
+        return NULL;
+    }
+
+    // Fresh mappings are zeroed, so every slot starts as a black frame 0.
+    // The writer starts on slot 0, the reader on slot 2.
+    ExportHeader *h = (ExportHeader *)e->block.base;
+    h->version = EXPORT_VERSION;
+    h->header_size = sizeof(ExportHeader);
+    h->slot_count = EXPORT_SLOTS;
+    h->slot_size = (uint32_t)SLOT_SIZE;
+    h->slots_offset = (uint32_t)SLOTS_OFFSET;
+    h->pixels_offset = (uint32_t)PIXELS_OFFSET;
+    h->width = SCREEN_WIDTH;
+    h->height = SCREEN_HEIGHT;
+    h->pitch = SCREEN_WIDTH * sizeof(uint32_t);
+    h->pixel_format = EXPORT_FORMAT_ARGB8888;
+    h->reader_slot = 2;
+    atomic_init(&h->middle, 1);
+    atomic_init(&h->published, 0);
+    e->slot = 0;
+
+    // Readers check the magic last
+    atomic_thread_fence(memory_order_release);
+    h->magic = EXPORT_MAGIC;
+
+    LOG_INFO(LOG_CAT_VIDEO, "Exporting frames to shared memory %s (%zu bytes)",
+             e->block.name, (size_t)BLOCK_SIZE);
+    return e;
+}
+
+// Remove the shared block
+void export_destroy(FrameExport *e) {
+    if (!e) return;
+
+    unmap_block(&e->block, true);
+    free(e);
+}
+
+// Publish the current frame
+void export_publish(FrameExport *e, PacmanMachine *m, uint64_t frame) {
+    ExportHeader *h = (ExportHeader *)e->block.base;
+    uint8_t *slot = slot_at(&e->block, e->slot);
+
+    ExportFrameInfo *info = (ExportFrameInfo *)slot;
+    info->frame = frame;
+    info->time_ns = timer_now_ns();
+    memcpy(info->io_ports, m->io_ports, sizeof(info->io_ports));
+    info->interrupt_enable = memory_get_interrupt_enable(m);
+    info->sound_enable = memory_get_sound_enable(m);
+    info->flip_screen = memory_get_flip_screen(m);
+    info->lamp1 = memory_get_lamp1(m);
+    info->lamp2 = memory_get_lamp2(m);
+    info->coin_lockout = memory_get_coin_lockout(m);
+    info->coin_counter = memory_get_coin_counter(m);
+    info->input_port1 = m->input_port1;
+    info->input_port2 = m->input_port2;
+
+    const uint32_t *pixels = video_get_framebuffer(m);
+    if (pixels) {
+        memcpy(slot + PIXELS_OFFSET, pixels, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+    }
+
+    // Hand the slot over and take back whichever one the reader left
+    uint32_t old = atomic_exchange_explicit(&h->middle, e->slot | EXPORT_FRESH,
+                                            memory_order_acq_rel);
+    e->slot = old & EXPORT_SLOT_MASK;
+    atomic_fetch_add_explicit(&h->published, 1, memory_order_relaxed);
+}
+
+// Map an existing block for reading
+ExportReader* export_attach(const char *name) {
+    ExportReader *r = (ExportReader *)calloc(1, sizeof(ExportReader));
+    if (!r) {
+        return NULL;
+    }
+    if (!map_block(&r->block, name, BLOCK_SIZE, false)) {
+        free(r);
+        return NULL;
+    }
+
+    const ExportHeader *h = (const ExportHeader *)r->block.base;
+    bool valid = h->magic == EXPORT_MAGIC;
+    atomic_thread_fence(memory_order_acquire);
+    if (!valid || h->version != EXPORT_VERSION || h->header_size != sizeof(ExportHeader) ||
+        h->slot_size != SLOT_SIZE || h->pixels_offset != PIXELS_OFFSET ||
+        h->reader_slot >= EXPORT_SLOTS) {
+        unmap_block(&r->block, false);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+// Unmap a reader's view
+void export_detach(ExportReader *r) {
+    if (!r) return;
+
+    unmap_block(&r->block, false);
+    free(r);
+}
+
+// Take the newest published frame
+bool export_acquire(ExportReader *r, const ExportFrameInfo **info, const uint32_t **pixels) {
+    ExportHeader *h = (ExportHeader *)r->block.base;
+    bool fresh = (atomic_load_explicit(&h->middle, memory_order_relaxed) & EXPORT_FRESH) != 0;
+    if (fresh) {
+        uint32_t old = atomic_exchange_explicit(&h->middle, h->reader_slot, memory_order_acq_rel);
+        h->reader_slot = old & EXPORT_SLOT_MASK;
+    }
+
+    const uint8_t *slot = slot_at(&r->block, h->reader_slot);
+    *info = (const ExportFrameInfo *)slot;
+    *pixels = (const uint32_t *)(slot + PIXELS_OFFSET);
+    return fresh;
+}
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../include/machine.h"
+#include "../include/memory.h"
+#include "../include/cpu.h"
+#include "../include/log.h"
+
+// Self-test for the lazy flag mode (make test). Runs the same random
+// instruction sequences on two machines, one with the core as built and one
+// with a second copy of it built in the other flag mode (flags_test_core.c),
+// and compares the registers and memory after every
+// instruction. Each sequence ends in push af, so the flags are compared
+// wherever the lazy mode left them pending. Instructions come from every
+// prefix (unprefixed, CB, ED, DD/FD and DDCB/FDCB) on random registers,
+// memory and input ports, with extra weight on the ones whose flags are
+// hard to get right: DAA, BIT n,(HL) and BIT n,(IX+d), which take X and Y
+// from the address, the block instructions and SCF/CCF.
+
+#define CASES           200000
+#define MAX_INSNS       8
+#define MAX_STEPS       256         // Repeating block instructions stop here
+#define MAX_FAILURES    10
+
+// Where sequences run and what they point at (see memory.h for the map).
+// Sequences are put in ROM so stray stores cannot change them.
+#define CODE            0x1000
+#define DATA_START      0x4080      // Pointers land here, so (iz+d) stays in RAM
+#define DATA_SIZE       0x0B00
+#define STATE_START     offsetof(PacmanMachine, ram)
+
+// Flag modes of the build's core and of the copy in flags_test_core.c
+#ifdef Z80_LAZY_FLAGS
+#define CORE_MODE   "lazy"
+#define OTHER_MODE  "eager"
+#else
+#define CORE_MODE   "eager"
+#define OTHER_MODE  "lazy"
+#endif
+void other_z80_step(z80* const z);
+
+// xorshift32, so every run tests the same sequences
+static uint32_t rng_state = 0x0BADF1A6;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// A pointer into the data area
+static uint16_t data_pointer(void) {
+    return DATA_START + rng() % DATA_SIZE;
+}
+
+// Sequence being generated
+typedef struct {
+    uint8_t bytes[MAX_INSNS * 4 + 1];
+    int length;
+} Sequence;
+
+static void emit(Sequence *s, uint8_t byte) {
+    s->bytes[s->length++] = byte;
+}
+
+static void emit_word(Sequence *s, uint16_t word) {
+    emit(s, word & 0xFF);
+    emit(s, word >> 8);
+}
+
+// Whether unprefixed op reads or writes (hl), which DD/FD turn into (iz+d)
+static bool uses_hl(uint8_t op) {
+    if (op == 0x34 || op == 0x35 || op == 0x36) return true;
+    if (op < 0x40 || op >= 0xC0 || op == 0x76) return false;
+    return (op & 7) == 6 || (op >= 0x70 && op < 0x78);
+}
+
+// An unprefixed opcode that does not leave the sequence: no halt, ret, rst
+// or jumps through registers (the other jumps and calls go to the next
+// instruction, see emit_unprefixed)
+static uint8_t unprefixed_op(void) {
+    for (;;) {
+        uint8_t op = (uint8_t)rng();
+        if (op == 0x76 || op == 0xC9 || op == 0xE9 || op == 0xCB || op == 0xDD ||
+            op == 0xED || op == 0xFD) {
+            continue;
+        }
+        if (op >= 0xC0 && ((op & 7) == 0 || (op & 7) == 7)) {
+            continue;       // ret cc, rst
+        }
+        return op;
+    }
+}
+
+// op and its operands, prefixed by a DD/FD prefix if there is one
+static void emit_unprefixed(Sequence *s, uint8_t op, uint8_t prefix) {
+    if (prefix) {
+        emit(s, prefix);
+    }
+    emit(s, op);
+    if (prefix && uses_hl(op)) {
+        emit(s, (uint8_t)rng());
+    }
+
+    if (op == 0xC3 || op == 0xCD || (op >= 0xC0 && ((op & 7) == 2 || (op & 7) == 4))) {
+        emit_word(s, (uint16_t)(CODE + s->length + 2));    // jp/call (cc) to the next one
+    } else if (op >= 0x10 && op < 0x40 && (op & 7) == 0) {
+        emit(s, 0);                                         // djnz/jr (cc) to the next one
+    } else if ((op & 0xCF) == 0x01 || op == 0x22 || op == 0x2A || op == 0x32 || op == 0x3A) {
+        emit_word(s, data_pointer());
+    } else if ((op < 0x40 && (op & 7) == 6) || (op >= 0xC0 && (op & 7) == 6) ||
+               op == 0xD3 || op == 0xDB) {
+        emit(s, (uint8_t)rng());
+    }
+}
+
+// Instructions with tricky flags
+static void emit_focus(Sequence *s) {
+    static const uint8_t block_ops[] = {
+        0xA0, 0xA1, 0xA2, 0xA3, 0xA8, 0xA9, 0xAA, 0xAB,
+        0xB0, 0xB1, 0xB2, 0xB3, 0xB8, 0xB9, 0xBA, 0xBB
+    };
+    switch (rng() % 6) {
+        case 0:
+            emit(s, (uint8_t[]){ 0x27, 0x37, 0x3F, 0x2F }[rng() % 4]);   // daa, scf, ccf, cpl
+            break;
+        case 1:
+            emit(s, 0xCB);
+            emit(s, (uint8_t)(0x46 | (rng() % 8) << 3));               // bit n,(hl)
+            break;
+        case 2:
+            emit(s, rng() & 1 ? 0xDD : 0xFD);
+            emit(s, 0xCB);
+            emit(s, (uint8_t)rng());
+            emit(s, (uint8_t)(0x40 | rng() % 0x40));                   // bit n,(iz+d)
+            break;
+        case 3: case 4:
+            emit(s, 0xED);
+            emit(s, block_ops[rng() % sizeof(block_ops)]);
+            break;
+        default:
+            emit(s, 0xED);
+            emit(s, (uint8_t[]){ 0x44, 0x57, 0x5F, 0x67, 0x6F, 0x70, 0x4A, 0x42 }[rng() % 8]);
+            break;
+    }
+}
+
+// One random instruction that falls through to the next
+static void emit_random(Sequence *s) {
+    uint8_t op;
+    switch (rng() % 8) {
+        case 0: case 1:
+            emit_unprefixed(s, unprefixed_op(), 0);
+            break;
+        case 2:
+            emit(s, 0xCB);
+            emit(s, (uint8_t)rng());
+            break;
+        case 3:
+            // ED 40-7F but retn/reti and the undocumented im and nops,
+            // which the core does not decode
+            op = (uint8_t)(0x40 | rng() % 0x40);
+            if ((op & 7) == 5 || op == 0x4E || op == 0x6E || op == 0x77 || op == 0x7F) {
+                op = 0x44;
+            }
+            emit(s, 0xED);
+            emit(s, op);
+            if ((op & 7) == 3) {
+                emit_word(s, data_pointer());
+            }
+            break;
+        case 4:
+            emit_unprefixed(s, unprefixed_op(), rng() & 1 ? 0xDD : 0xFD);
+            break;
+        case 5:
+            emit(s, rng() & 1 ? 0xDD : 0xFD);
+            emit(s, 0xCB);
+            emit(s, (uint8_t)rng());
+            emit(s, (uint8_t)rng());
+            break;
+        default:
+            emit_focus(s);
+            break;
+    }
+}
+
+// Random registers, with the flags up to date (lf_op 0 in both modes)
+static void randomize_cpu(z80 *z) {
+    z->a = (uint8_t)rng(); z->b = (uint8_t)rng(); z->c = (uint8_t)rng();
+    z->d = (uint8_t)rng(); z->e = (uint8_t)rng();
+    z->a_ = (uint8_t)rng(); z->b_ = (uint8_t)rng(); z->c_ = (uint8_t)rng();
+    z->d_ = (uint8_t)rng(); z->e_ = (uint8_t)rng(); z->h_ = (uint8_t)rng();
+    z->l_ = (uint8_t)rng(); z->f_ = (uint8_t)rng();
+    uint16_t hl = data_pointer();
+    z->h = hl >> 8;
+    z->l = hl & 0xFF;
+    z->ix = data_pointer();
+    z->iy = data_pointer();
+    z->sp = data_pointer();
+    z->mem_ptr = (uint16_t)rng();
+    z->i = (uint8_t)rng();
+    z->r = (uint8_t)rng();
+
+    uint8_t f = (uint8_t)rng();
+    z->cf = f & 1; z->nf = f >> 1 & 1; z->pf = f >> 2 & 1; z->xf = f >> 3 & 1;
+    z->hf = f >> 4 & 1; z->yf = f >> 5 & 1; z->zf = f >> 6 & 1; z->sf = f >> 7 & 1;
+    z->lf_op = 0;
+
+    z->iff1 = z->iff2 = rng() & 1;
+    z->iff_delay = 0;
+    z->interrupt_mode = 1;
+    z->halted = false;
+    z->pc = CODE;
+    z->cyc = 0;
+    z->steps = 0;
+}
+
+// Name of the first register that differs, NULL if none. The flags are left
+// out: the lazy mode only has to produce them when they are read.
+static const char* compare_registers(const z80 *a, const z80 *b) {
+#define SAME(field) if (a->field != b->field) return #field
+    SAME(cyc); SAME(steps);
+    SAME(pc); SAME(sp); SAME(ix); SAME(iy); SAME(mem_ptr);
+    SAME(a); SAME(b); SAME(c); SAME(d); SAME(e); SAME(h); SAME(l);
+    SAME(a_); SAME(b_); SAME(c_); SAME(d_); SAME(e_); SAME(h_); SAME(l_); SAME(f_);
+    SAME(i); SAME(r);
+    SAME(iff_delay); SAME(interrupt_mode); SAME(iff1); SAME(iff2); SAME(halted);
+#undef SAME
+    return NULL;
+}
+
+// Report a mismatch, returns 1 so callers can count failures
+static int report(int n, const Sequence *s, int step, const char *what) {
+    printf("FAIL case %d, step %d: %s differs in", n, step, what);
+    for (int i = 0; i < s->length; i++) {
+        printf(" %02X", s->bytes[i]);
+    }
+    printf("\n");
+    return 1;
+}
+
+// Run one sequence on both machines. Returns the failure count (0 or 1).
+static int run_case(int n, PacmanMachine *core, PacmanMachine *other) {
+    Sequence s = { .length = 0 };
+    for (int i = 1 + rng() % MAX_INSNS; i > 0; i--) {
+        emit_random(&s);
+    }
+    emit(&s, 0xF5);                                     // push af
+
+    // The same memory, ports and registers in both, whatever an earlier
+    // failure left behind
+    for (int i = 0; i < DATA_SIZE + 0x100; i++) {
+        memory_write_byte(core, (uint16_t)(DATA_START - 0x80 + i), (uint8_t)rng());
+    }
+    for (int port = 0; port < 256; port++) {
+        memory_set_input_port(core, (uint8_t)port, (uint8_t)rng());
+    }
+    core->input_port1 = (uint8_t)rng();
+    core->input_port2 = (uint8_t)rng();
+    memcpy((uint8_t *)other + STATE_START, (uint8_t *)core + STATE_START,
+           MACHINE_STATE_SIZE - STATE_START);
+    memcpy(&core->rom[CODE], s.bytes, s.length);
+    memcpy(&other->rom[CODE], s.bytes, s.length);
+    uint32_t seed = rng();
+    rng_state = seed;
+    randomize_cpu(&core->cpu);
+    rng_state = seed;
+    randomize_cpu(&other->cpu);
+
+    // Step both until the push af has run
+    uint16_t end = CODE + s.length;
+    for (int step = 0; step < MAX_STEPS && core->cpu.pc != end; step++) {
+        z80_step(&core->cpu);
+        other_z80_step(&other->cpu);
+
+        const char *field = compare_registers(&core->cpu, &other->cpu);
+        if (field) {
+            return report(n, &s, step, field);
+        }
+        if (memcmp((uint8_t *)core + STATE_START, (uint8_t *)other + STATE_START,
+                   MACHINE_STATE_SIZE - STATE_START) != 0) {
+            if (core->cpu.pc != end) {
+                return report(n, &s, step, "memory");
+            }
+            char flags[64];
+            snprintf(flags, sizeof(flags), "F (" CORE_MODE " %02X, " OTHER_MODE " %02X)",
+                     memory_read_byte(core, core->cpu.sp), memory_read_byte(other, other->cpu.sp));
+            return report(n, &s, step, flags);
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    log_set_console(false);
+
+    PacmanMachine *core = machine_create();
+    PacmanMachine *other = machine_create();
+    if (!core || !other) {
+        printf("Cannot create the machines\n");
+        return 1;
+    }
+    cpu_init(core);
+    cpu_init(other);
+
+    // Stop after a few failures, the first ones tell the most
+    int n, failures = 0;
+    for (n = 0; n < CASES && failures < MAX_FAILURES; n++) {
+        failures += run_case(n, core, other);
+    }
+    printf("%d sequences run on " CORE_MODE " and " OTHER_MODE " flags, %d failures\n",
+           n, failures);
+
+    machine_destroy(core);
+    machine_destroy(other);
+    log_shutdown();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,24 @@
+// The Z80 core again for flags_test.c, in the other flag mode than the
+// build's, with its functions renamed so they do not clash with the
+// build's copy (flags_test.c only uses other_z80_step)
+#define z80_init            other_z80_init
+#define z80_step            other_z80_step
+#define z80_run             other_z80_run
+#define z80_debug_output    other_z80_debug_output
+#define z80_gen_nmi         other_z80_gen_nmi
+#define z80_gen_int         other_z80_gen_int
+#define z80_blocks_create   other_z80_blocks_create
+#define z80_blocks_destroy  other_z80_blocks_destroy
+#define z80_blocks_flush    other_z80_blocks_flush
+#define z80_blocks_skip_idle other_z80_blocks_skip_idle
+#define z80_run_blocks      other_z80_run_blocks
+#define z80_profile_reset   other_z80_profile_reset
+#define z80_opcode_cycles   other_z80_opcode_cycles
+#define z80_trace_fire      other_z80_trace_fire
+#define z80_trace_rearm     other_z80_trace_rearm
+#ifdef Z80_LAZY_FLAGS
+#undef Z80_LAZY_FLAGS
+#else
+#define Z80_LAZY_FLAGS
+#endif
+#include "z80/z80.c"
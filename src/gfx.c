@@ -0,0 +1,102 @@
+#include "../include/gfx.h"
+#include "../include/machine.h"
+#include "../include/gfx_kernels.h"
+#include "../include/video.h"
+
+// Pen of one pixel in the raw sprite data, using the same layout as the
+// renderer always has: four 8x8 tiles (2x2), 8 bytes each, starting at
+// sprite_index * 16. Bytes past the end of the sprite data read as 0.
+static uint8_t raw_sprite_pen(const uint8_t *sprites, int sprite_index, int x, int y) {
+    int tile_index = (y / 8) * 2 + (x / 8);
+    int offset = sprite_index * 16 + tile_index * 8 + (y % 8);
+    if (offset >= SPRITEDATA_SIZE) {
+        return 0;
+    }
+    return (sprites[offset] & (0x80 >> (x % 8))) ? 1 : 0;
+}
+
+// Rebuild the decoded caches from the machine's charset and sprite data
+void gfx_decode(PacmanMachine *m) {
+    // Characters: 8 bytes per character, one byte per row, MSB on the left
+    for (int c = 0; c < GFX_TILE_COUNT; c++) {
+        const uint8_t *char_data = &m->charset[c * 8];
+        uint8_t *pens = m->tile_pens[c];
+        
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+                pens[y * 8 + x] = (char_data[y] & (0x80 >> x)) ? 1 : 0;
+            }
+        }
+    }
+    
+    // Sprites in all four flip variants
+    for (int s = 0; s < GFX_SPRITE_COUNT; s++) {
+        for (int flip = 0; flip < GFX_FLIP_VARIANTS; flip++) {
+            uint8_t *pens = m->sprite_pens[flip][s];
+            
+            for (int y = 0; y < SPRITE_HEIGHT; y++) {
+                int src_y = (flip & 2) ? (SPRITE_HEIGHT - 1 - y) : y;
+                for (int x = 0; x < SPRITE_WIDTH; x++) {
+                    int src_x = (flip & 1) ? (SPRITE_WIDTH - 1 - x) : x;
+                    pens[y * SPRITE_WIDTH + x] = raw_sprite_pen(m->sprites, s, src_x, src_y);
+                }
+            }
+        }
+    }
+}
+
+// Clip a size x size block at (x, y) against the screen. Returns false if
+// nothing is visible, otherwise the visible range in block coordinates.
+static bool clip_block(int x, int y, int size, int *x0, int *x1, int *y0, int *y1) {
+    *x0 = x < 0 ? -x : 0;
+    *y0 = y < 0 ? -y : 0;
+    *x1 = (x + size > SCREEN_WIDTH) ? SCREEN_WIDTH - x : size;
+    *y1 = (y + size > SCREEN_HEIGHT) ? SCREEN_HEIGHT - y : size;
+    return *x0 < *x1 && *y0 < *y1;
+}
+
+// Draw an opaque 8x8 tile
+void gfx_draw_tile(uint32_t *dst, int pitch, int x, int y, const uint8_t *pens, uint32_t fg) {
+    int x0, x1, y0, y1;
+    if (!clip_block(x, y, 8, &x0, &x1, &y0, &y1)) return;
+    
+    // Fully visible tiles (nearly all of them) go through the block kernel
+    if (x0 == 0 && x1 == 8 && y0 == 0 && y1 == 8) {
+        gfx_kernels()->tile(&dst[y * pitch + x], pitch, pens, fg);
+        return;
+    }
+    
+    const uint32_t colors[2] = { 0, fg };
+    
+    for (int row = y0; row < y1; row++) {
+        const uint8_t *src = &pens[row * 8];
+        uint32_t *out = &dst[(y + row) * pitch];
+        for (int col = x0; col < x1; col++) {
+            out[x + col] = colors[src[col]];
+        }
+    }
+}
+
+// Draw a transparent 16x16 sprite
+void gfx_draw_sprite(uint32_t *dst, int pitch, int x, int y, const uint8_t *pens, uint32_t fg) {
+    int x0, x1, y0, y1;
+    if (!clip_block(x, y, SPRITE_WIDTH, &x0, &x1, &y0, &y1)) return;
+    
+    // Full-width rows go through the block kernel; only horizontally
+    // clipped sprites need the per-pixel loop
+    if (x0 == 0 && x1 == SPRITE_WIDTH) {
+        gfx_kernels()->sprite(&dst[(y + y0) * pitch + x], pitch,
+                              &pens[y0 * SPRITE_WIDTH], y1 - y0, fg);
+        return;
+    }
+    
+    for (int row = y0; row < y1; row++) {
+        const uint8_t *src = &pens[row * SPRITE_WIDTH];
+        uint32_t *out = &dst[(y + row) * pitch];
+        for (int col = x0; col < x1; col++) {
+            // pen 1 -> all ones mask, pen 0 -> keep what is underneath
+            uint32_t mask = 0u - (uint32_t)src[col];
+            out[x + col] = (fg & mask) | (out[x + col] & ~mask);
+        }
+    }
+}
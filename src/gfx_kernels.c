@@ -0,0 +1,382 @@
+#include "../include/gfx_kernels.h"
+#include "../include/log.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define GFX_HAVE_X86 1
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+    #include <arm_neon.h>
+    #define GFX_HAVE_NEON 1
+#endif
+
+// ---------------------------------------------------------------------------
+// Scalar kernels (reference implementation)
+
+static void tile_scalar(uint32_t *dst, int stride, const uint8_t *pens, uint32_t fg) {
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            dst[x] = pens[x] ? fg : 0;
+        }
+        dst += stride;
+        pens += 8;
+    }
+}
+
+static void sprite_scalar(uint32_t *dst, int stride, const uint8_t *pens, int rows, uint32_t fg) {
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < 16; x++) {
+            if (pens[x]) {
+                dst[x] = fg;
+            }
+        }
+        dst += stride;
+        pens += 16;
+    }
+}
+
+static void widen_scalar(uint32_t *dst, const uint32_t *src, int count, int factor) {
+    for (int x = 0; x < count; x++) {
+        uint32_t c = src[x];
+        for (int k = 0; k < factor; k++) {
+            dst[k] = c;
+        }
+        dst += factor;
+    }
+}
+
+static void modulate_scalar(uint32_t *dst, const uint32_t *src, const uint32_t *weights, int count) {
+    for (int x = 0; x < count; x++) {
+        uint32_t c = src[x];
+        uint32_t w = weights[x];
+        uint32_t out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t channel = (c >> shift) & 0xFF;
+            uint32_t weight = ((w >> shift) & 0xFF) + 1;
+            out |= ((channel * weight) >> 8) << shift;
+        }
+        dst[x] = out;
+    }
+}
+
+static const GfxKernels kernels_scalar = {
+    "scalar", tile_scalar, sprite_scalar, widen_scalar, modulate_scalar
+};
+
+#ifdef GFX_HAVE_X86
+// ---------------------------------------------------------------------------
+// SSE2 kernels: zero-extend pens to 32-bit lanes and select with a compare mask
+
+__attribute__((target("sse2")))
+static void tile_sse2(uint32_t *dst, int stride, const uint8_t *pens, uint32_t fg) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i color = _mm_set1_epi32((int)fg);
+    
+    for (int y = 0; y < 8; y++) {
+        __m128i p8 = _mm_loadl_epi64((const __m128i *)pens);
+        __m128i p16 = _mm_unpacklo_epi8(p8, zero);
+        __m128i lo = _mm_unpacklo_epi16(p16, zero);
+        __m128i hi = _mm_unpackhi_epi16(p16, zero);
+        
+        // pen 0 -> all ones -> andnot clears the color
+        _mm_storeu_si128((__m128i *)dst, _mm_andnot_si128(_mm_cmpeq_epi32(lo, zero), color));
+        _mm_storeu_si128((__m128i *)(dst + 4), _mm_andnot_si128(_mm_cmpeq_epi32(hi, zero), color));
+        
+        dst += stride;
+        pens += 8;
+    }
+}
+
+// Blend 4 pixels: keep dst where pen is 0, fg elsewhere
+__attribute__((target("sse2")))
+static inline void sprite_quad_sse2(uint32_t *dst, __m128i pens32, __m128i color, __m128i zero) {
+    __m128i clear = _mm_cmpeq_epi32(pens32, zero);
+    __m128i under = _mm_loadu_si128((const __m128i *)dst);
+    __m128i out = _mm_or_si128(_mm_and_si128(clear, under), _mm_andnot_si128(clear, color));
+    _mm_storeu_si128((__m128i *)dst, out);
+}
+
+__attribute__((target("sse2")))
+static void sprite_sse2(uint32_t *dst, int stride, const uint8_t *pens, int rows, uint32_t fg) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i color = _mm_set1_epi32((int)fg);
+    
+    for (int y = 0; y < rows; y++) {
+        __m128i p8 = _mm_loadu_si128((const __m128i *)pens);
+        __m128i p16lo = _mm_unpacklo_epi8(p8, zero);
+        __m128i p16hi = _mm_unpackhi_epi8(p8, zero);
+        
+        sprite_quad_sse2(dst, _mm_unpacklo_epi16(p16lo, zero), color, zero);
+        sprite_quad_sse2(dst + 4, _mm_unpackhi_epi16(p16lo, zero), color, zero);
+        sprite_quad_sse2(dst + 8, _mm_unpacklo_epi16(p16hi, zero), color, zero);
+        sprite_quad_sse2(dst + 12, _mm_unpackhi_epi16(p16hi, zero), color, zero);
+        
+        dst += stride;
+        pens += 16;
+    }
+}
+
+// Factor 2 interleaves a vector with itself; larger factors store a
+// broadcast of each pixel, whole vectors at a time. A store may run into the
+// next pixel's run, which that pixel then overwrites; the pixels whose
+// stores would run past the row are left to the scalar kernel.
+__attribute__((target("sse2")))
+static void widen_sse2(uint32_t *dst, const uint32_t *src, int count, int factor) {
+    int x = 0;
+    if (factor == 2) {
+        for (; x + 4 <= count; x += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(src + x));
+            _mm_storeu_si128((__m128i *)(dst + x * 2), _mm_unpacklo_epi32(p, p));
+            _mm_storeu_si128((__m128i *)(dst + x * 2 + 4), _mm_unpackhi_epi32(p, p));
+        }
+    } else {
+        int span = (factor + 3) & ~3;
+        for (; x * factor + span <= count * factor; x++) {
+            __m128i p = _mm_set1_epi32((int)src[x]);
+            for (int k = 0; k < span; k += 4) {
+                _mm_storeu_si128((__m128i *)(dst + x * factor + k), p);
+            }
+        }
+    }
+    widen_scalar(dst + x * factor, src + x, count - x, factor);
+}
+
+// Widen bytes to 16 bits, multiply by weight + 1, keep the high byte
+__attribute__((target("sse2")))
+static void modulate_sse2(uint32_t *dst, const uint32_t *src, const uint32_t *weights, int count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i w = _mm_loadu_si128((const __m128i *)(weights + x));
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), _mm_add_epi16(_mm_unpacklo_epi8(w, zero), one));
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), _mm_add_epi16(_mm_unpackhi_epi8(w, zero), one));
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+    modulate_scalar(dst + x, src + x, weights + x, count - x);
+}
+
+static const GfxKernels kernels_sse2 = {
+    "sse2", tile_sse2, sprite_sse2, widen_sse2, modulate_sse2
+};
+
+// ---------------------------------------------------------------------------
+// AVX2 kernels: one 8-pixel row per 256-bit register
+
+__attribute__((target("avx2")))
+static void tile_avx2(uint32_t *dst, int stride, const uint8_t *pens, uint32_t fg) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i color = _mm256_set1_epi32((int)fg);
+    
+    for (int y = 0; y < 8; y++) {
+        __m256i p = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)pens));
+        _mm256_storeu_si256((__m256i *)dst, _mm256_andnot_si256(_mm256_cmpeq_epi32(p, zero), color));
+        dst += stride;
+        pens += 8;
+    }
+}
+
+__attribute__((target("avx2")))
+static void sprite_avx2(uint32_t *dst, int stride, const uint8_t *pens, int rows, uint32_t fg) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i color = _mm256_set1_epi32((int)fg);
+    
+    for (int y = 0; y < rows; y++) {
+        for (int half = 0; half < 16; half += 8) {
+            __m256i p = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(pens + half)));
+            __m256i clear = _mm256_cmpeq_epi32(p, zero);
+            __m256i under = _mm256_loadu_si256((const __m256i *)(dst + half));
+            _mm256_storeu_si256((__m256i *)(dst + half), _mm256_blendv_epi8(color, under, clear));
+        }
+        dst += stride;
+        pens += 16;
+    }
+}
+
+__attribute__((target("avx2")))
+static void widen_avx2(uint32_t *dst, const uint32_t *src, int count, int factor) {
+    int x = 0;
+    if (factor == 2) {
+        // Each pixel zero-extended to 64 bits, then copied into the high half
+        for (; x + 4 <= count; x += 4) {
+            __m256i p = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)(src + x)));
+            _mm256_storeu_si256((__m256i *)(dst + x * 2), _mm256_or_si256(p, _mm256_slli_epi64(p, 32)));
+        }
+    } else {
+        int span = (factor + 7) & ~7;
+        for (; x * factor + span <= count * factor; x++) {
+            __m256i p = _mm256_set1_epi32((int)src[x]);
+            for (int k = 0; k < span; k += 8) {
+                _mm256_storeu_si256((__m256i *)(dst + x * factor + k), p);
+            }
+        }
+    }
+    widen_scalar(dst + x * factor, src + x, count - x, factor);
+}
+
+__attribute__((target("avx2")))
+static void modulate_avx2(uint32_t *dst, const uint32_t *src, const uint32_t *weights, int count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+    
+    // Unpacking and packing both work within 128-bit lanes, so the pixel
+    // order comes back unchanged
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + x));
+        __m256i w = _mm256_loadu_si256((const __m256i *)(weights + x));
+        __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(c, zero),
+                                        _mm256_add_epi16(_mm256_unpacklo_epi8(w, zero), one));
+        __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(c, zero),
+                                        _mm256_add_epi16(_mm256_unpackhi_epi8(w, zero), one));
+        _mm256_storeu_si256((__m256i *)(dst + x),
+                            _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)));
+    }
+    modulate_scalar(dst + x, src + x, weights + x, count - x);
+}
+
+static const GfxKernels kernels_avx2 = {
+    "avx2", tile_avx2, sprite_avx2, widen_avx2, modulate_avx2
+};
+#endif // GFX_HAVE_X86
+
+#ifdef GFX_HAVE_NEON
+// ---------------------------------------------------------------------------
+// NEON kernels: widen pens to 32-bit lanes, vtst gives the nonzero mask
+
+static void tile_neon(uint32_t *dst, int stride, const uint8_t *pens, uint32_t fg) {
+    const uint32x4_t color = vdupq_n_u32(fg);
+    
+    for (int y = 0; y < 8; y++) {
+        uint16x8_t p16 = vmovl_u8(vld1_u8(pens));
+        uint32x4_t lo = vmovl_u16(vget_low_u16(p16));
+        uint32x4_t hi = vmovl_u16(vget_high_u16(p16));
+        vst1q_u32(dst, vandq_u32(vtstq_u32(lo, lo), color));
+        vst1q_u32(dst + 4, vandq_u32(vtstq_u32(hi, hi), color));
+        dst += stride;
+        pens += 8;
+    }
+}
+
+static void sprite_neon(uint32_t *dst, int stride, const uint8_t *pens, int rows, uint32_t fg) {
+    const uint32x4_t color = vdupq_n_u32(fg);
+    
+    for (int y = 0; y < rows; y++) {
+        uint8x16_t p8 = vld1q_u8(pens);
+        uint16x8_t halves[2] = { vmovl_u8(vget_low_u8(p8)), vmovl_u8(vget_high_u8(p8)) };
+        
+        for (int h = 0; h < 2; h++) {
+            uint32x4_t quads[2] = { vmovl_u16(vget_low_u16(halves[h])), vmovl_u16(vget_high_u16(halves[h])) };
+            for (int q = 0; q < 2; q++) {
+                uint32_t *out = dst + h * 8 + q * 4;
+                uint32x4_t set = vtstq_u32(quads[q], quads[q]);
+                vst1q_u32(out, vbslq_u32(set, color, vld1q_u32(out)));
+            }
+        }
+        dst += stride;
+        pens += 16;
+    }
+}
+
+static void widen_neon(uint32_t *dst, const uint32_t *src, int count, int factor) {
+    int x = 0;
+    if (factor == 2) {
+        for (; x + 4 <= count; x += 4) {
+            uint32x4_t p = vld1q_u32(src + x);
+            uint32x4x2_t pairs = vzipq_u32(p, p);
+            vst1q_u32(dst + x * 2, pairs.val[0]);
+            vst1q_u32(dst + x * 2 + 4, pairs.val[1]);
+        }
+    } else {
+        int span = (factor + 3) & ~3;
+        for (; x * factor + span <= count * factor; x++) {
+            uint32x4_t p = vdupq_n_u32(src[x]);
+            for (int k = 0; k < span; k += 4) {
+                vst1q_u32(dst + x * factor + k, p);
+            }
+        }
+    }
+    widen_scalar(dst + x * factor, src + x, count - x, factor);
+}
+
+// src * weight + src, high byte of each 16-bit product
+static void modulate_neon(uint32_t *dst, const uint32_t *src, const uint32_t *weights, int count) {
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        uint8x16_t c = vld1q_u8((const uint8_t *)(src + x));
+        uint8x16_t w = vld1q_u8((const uint8_t *)(weights + x));
+        uint16x8_t lo = vaddw_u8(vmull_u8(vget_low_u8(c), vget_low_u8(w)), vget_low_u8(c));
+        uint16x8_t hi = vaddw_u8(vmull_u8(vget_high_u8(c), vget_high_u8(w)), vget_high_u8(c));
+        vst1q_u8((uint8_t *)(dst + x), vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+    }
+    modulate_scalar(dst + x, src + x, weights + x, count - x);
+}
+
+static const GfxKernels kernels_neon = {
+    "neon", tile_neon, sprite_neon, widen_neon, modulate_neon
+};
+#endif // GFX_HAVE_NEON
+
+// ---------------------------------------------------------------------------
+// Runtime selection
+
+static _Atomic(const GfxKernels *) active_kernels = NULL;
+
+// Kernel sets available on this CPU, best last
+int gfx_available_kernels(const GfxKernels **list, int max) {
+    int count = 0;
+    
+    if (count < max) list[count++] = &kernels_scalar;
+#ifdef GFX_HAVE_X86
+    __builtin_cpu_init();
+    if (count < max && __builtin_cpu_supports("sse2")) list[count++] = &kernels_sse2;
+    if (count < max && __builtin_cpu_supports("avx2")) list[count++] = &kernels_avx2;
+#endif
+#ifdef GFX_HAVE_NEON
+    // NEON is part of the baseline on AArch64 (and required by __ARM_NEON)
+    if (count < max) list[count++] = &kernels_neon;
+#endif
+    
+    return count;
+}
+
+// Use the named kernel set, or the best available for "auto"
+bool gfx_use_kernels(const char *name) {
+    const GfxKernels *list[8];
+    int count = gfx_available_kernels(list, 8);
+    const GfxKernels *chosen = NULL;
+    
+    if (strcmp(name, "auto") == 0) {
+        chosen = list[count - 1];
+    } else {
+        for (int i = 0; i < count; i++) {
+            if (strcmp(list[i]->name, name) == 0) {
+                chosen = list[i];
+            }
+        }
+    }
+    
+    if (!chosen) {
+        return false;
+    }
+    
+    atomic_store_explicit(&active_kernels, chosen, memory_order_release);
+    LOG_INFO(LOG_CAT_VIDEO, "Using %s graphics kernels", chosen->name);
+    return true;
+}
+
+// Kernels currently in use
+const GfxKernels* gfx_kernels(void) {
+    const GfxKernels *k = atomic_load_explicit(&active_kernels, memory_order_acquire);
+    if (!k) {
+        gfx_use_kernels("auto");
+        k = atomic_load_explicit(&active_kernels, memory_order_acquire);
+    }
+    return k;
+}
@@ -1,52 +1,54 @@
 #include "../include/input.h"
+#include "../include/machine.h"
 #include <stdio.h>
 
-// Input state
-static uint8_t input_port1 = 0xFF; // Active low logic (0 = pressed, 1 = released)
-static uint8_t input_port2 = 0xFF;
+// Input state lives in the machine (active low logic: 0 = pressed, 1 = released)
 
+#ifndef NO_SDL
 // Key mappings
 static const struct {
     SDL_Keycode key;
-    uint8_t *port;
+    int port;       // 1 = input_port1, 2 = input_port2, 0 = end of table
     uint8_t mask;
 } key_mappings[] = {
     // Player 1 controls
-    {SDLK_UP,     &input_port1, INPUT_P1_UP},
-    {SDLK_LEFT,   &input_port1, INPUT_P1_LEFT},
-    {SDLK_RIGHT,  &input_port1, INPUT_P1_RIGHT},
-    {SDLK_DOWN,   &input_port1, INPUT_P1_DOWN},
+    {SDLK_UP,     1, INPUT_P1_UP},
+    {SDLK_LEFT,   1, INPUT_P1_LEFT},
+    {SDLK_RIGHT,  1, INPUT_P1_RIGHT},
+    {SDLK_DOWN,   1, INPUT_P1_DOWN},
     
     // Player 2 controls (WASD)
-    {SDLK_w,      &input_port2, INPUT_P2_UP},
-    {SDLK_a,      &input_port2, INPUT_P2_LEFT},
-    {SDLK_d,      &input_port2, INPUT_P2_RIGHT},
-    {SDLK_s,      &input_port2, INPUT_P2_DOWN},
+    {SDLK_w,      2, INPUT_P2_UP},
+    {SDLK_a,      2, INPUT_P2_LEFT},
+    {SDLK_d,      2, INPUT_P2_RIGHT},
+    {SDLK_s,      2, INPUT_P2_DOWN},
     
     // System controls
-    {SDLK_5,      &input_port1, INPUT_COIN},      // Insert coin
-    {SDLK_1,      &input_port1, INPUT_P1_START},  // Player 1 start
-    {SDLK_2,      &input_port1, INPUT_P2_START},  // Player 2 start
-    {SDLK_F1,     &input_port1, INPUT_SERVICE},   // Service button
+    {SDLK_5,      1, INPUT_COIN},      // Insert coin
+    {SDLK_1,      1, INPUT_P1_START},  // Player 1 start
+    {SDLK_2,      1, INPUT_P2_START},  // Player 2 start
+    {SDLK_F1,     1, INPUT_SERVICE},   // Service button
     
     // Terminator
-    {SDLK_UNKNOWN, NULL, 0}
+    {SDLK_UNKNOWN, 0, 0}
 };
+#endif
 
 // Initialize input system
-void input_init(void) {
-    input_reset();
+void input_init(PacmanMachine *m) {
+    input_reset(m);
 }
 
 // Reset input state
-void input_reset(void) {
-    input_port1 = 0xFF;
-    input_port2 = 0xFF;
+void input_reset(PacmanMachine *m) {
+    m->input_port1 = 0xFF;
+    m->input_port2 = 0xFF;
 }
 
+#ifndef NO_SDL
 // Process an SDL input event
-void input_process_event(SDL_Event *event) {
-    if (!event) return;
+void input_process_event(PacmanMachine *m, SDL_Event *event) {
+    if (!m || !event) return;
     
     switch (event->type) {
         case SDL_KEYDOWN:
@@ -56,15 +58,23 @@ void input_process_event(SDL_Event *event) {
                 SDL_Keycode keycode = key_event->keysym.sym;
                 bool pressed = (event->type == SDL_KEYDOWN);
                 
+                // Rewind while held (see rewind.h)
+                if (keycode == SDLK_BACKSPACE) {
+                    m->rewind_held = pressed;
+                    break;
+                }
+                
                 // Find the key in our mapping table
-                for (int i = 0; key_mappings[i].port != NULL; i++) {
+                for (int i = 0; key_mappings[i].port != 0; i++) {
                     if (key_mappings[i].key == keycode) {
+                        uint8_t *port = (key_mappings[i].port == 1) ?
+                                        &m->input_port1 : &m->input_port2;
                         if (pressed) {
                             // Key pressed - clear the bit (active low)
-                            *(key_mappings[i].port) &= ~key_mappings[i].mask;
+                            *port &= ~key_mappings[i].mask;
                         } else {
                             // Key released - set the bit
-                            *(key_mappings[i].port) |= key_mappings[i].mask;
+                            *port |= key_mappings[i].mask;
                         }
                         break;
                     }
@@ -75,13 +85,14 @@ void input_process_event(SDL_Event *event) {
         // Add joystick/gamepad support here if needed
     }
 }
+#endif
 
 // Read input port 1 (player 1 controls, coins, start buttons)
-uint8_t input_read_port1(void) {
-    return input_port1;
+uint8_t input_read_port1(PacmanMachine *m) {
+    return m->input_port1;
 }
 
 // Read input port 2 (player 2 controls, DIP switches)
-uint8_t input_read_port2(void) {
-    return input_port2;
+uint8_t input_read_port2(PacmanMachine *m) {
+    return m->input_port2;
 }
\ No newline at end of file
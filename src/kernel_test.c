@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../include/gfx_kernels.h"
+#include "../include/log.h"
+
+// Self-test for the graphics kernels (make test). Runs every kernel of
+// every set this CPU supports on random pens and pixels and checks that
+// the output is bit-identical to the scalar set's, including the pixels
+// around each block that must be left alone.
+
+#define ROUNDS      2000
+#define STRIDE      40          // Framebuffer pitch of the blit tests
+#define MAX_COUNT   67          // Longest row of the widen/modulate tests
+#define MAX_FACTOR  16
+#define GUARD       16          // Canary pixels after each row buffer
+
+// xorshift32, so every run tests the same inputs
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void fill_random(uint32_t *p, int count) {
+    for (int i = 0; i < count; i++) {
+        p[i] = rng();
+    }
+}
+
+// Pens as the decoder produces them: 0 or 1
+static void fill_pens(uint8_t *p, int count) {
+    for (int i = 0; i < count; i++) {
+        p[i] = rng() & 1;
+    }
+}
+
+// Report a mismatch, returns 1 so callers can count failures
+static int report(const char *set, const char *kernel, int round, const char *detail) {
+    printf("FAIL %s %s (round %d): %s\n", set, kernel, round, detail);
+    return 1;
+}
+
+// Compare one kernel set against the reference. Returns the failure count.
+static int test_set(const GfxKernels *ref, const GfxKernels *k) {
+    static uint32_t fb_ref[STRIDE * 20], fb_out[STRIDE * 20];
+    static uint32_t src[MAX_COUNT], weights[MAX_COUNT];
+    static uint32_t row_ref[MAX_COUNT * MAX_FACTOR + GUARD], row_out[MAX_COUNT * MAX_FACTOR + GUARD];
+    static uint8_t pens[16 * 16];
+    int failures = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        uint32_t fg = rng();
+        int x = (int)(rng() % (STRIDE - 16));
+
+        // Opaque tiles
+        fill_random(fb_ref, STRIDE * 20);
+        memcpy(fb_out, fb_ref, sizeof(fb_ref));
+        fill_pens(pens, 8 * 8);
+        ref->tile(fb_ref + STRIDE + x, STRIDE, pens, fg);
+        k->tile(fb_out + STRIDE + x, STRIDE, pens, fg);
+        if (memcmp(fb_ref, fb_out, sizeof(fb_ref)) != 0) {
+            failures += report(k->name, "tile", round, "framebuffers differ");
+        }
+
+        // Transparent sprites, any number of rows
+        int rows = 1 + (int)(rng() % 16);
+        fill_random(fb_ref, STRIDE * 20);
+        memcpy(fb_out, fb_ref, sizeof(fb_ref));
+        fill_pens(pens, 16 * 16);
+        ref->sprite(fb_ref + STRIDE + x, STRIDE, pens, rows, fg);
+        k->sprite(fb_out + STRIDE + x, STRIDE, pens, rows, fg);
+        if (memcmp(fb_ref, fb_out, sizeof(fb_ref)) != 0) {
+            failures += report(k->name, "sprite", round, "framebuffers differ");
+        }
+
+        // Row widening, checking nothing is written past the row
+        int count = (int)(rng() % (MAX_COUNT + 1));
+        int factor = 2 + (int)(rng() % (MAX_FACTOR - 1));
+        fill_random(src, count);
+        fill_random(row_ref, MAX_COUNT * MAX_FACTOR + GUARD);
+        memcpy(row_out, row_ref, sizeof(row_ref));
+        ref->widen(row_ref, src, count, factor);
+        k->widen(row_out, src, count, factor);
+        if (memcmp(row_ref, row_out, sizeof(row_ref)) != 0) {
+            failures += report(k->name, "widen", round, "rows differ");
+        }
+
+        // Modulation, into another buffer and in place
+        fill_random(src, count);
+        fill_random(weights, count);
+        fill_random(row_ref, MAX_COUNT + GUARD);
+        memcpy(row_out, row_ref, sizeof(row_ref));
+        ref->modulate(row_ref, src, weights, count);
+        k->modulate(row_out, src, weights, count);
+        if (memcmp(row_ref, row_out, sizeof(row_ref)) != 0) {
+            failures += report(k->name, "modulate", round, "rows differ");
+        }
+
+        memcpy(row_ref, src, count * sizeof(uint32_t));
+        memcpy(row_out, src, count * sizeof(uint32_t));
+        ref->modulate(row_ref, row_ref, weights, count);
+        k->modulate(row_out, row_out, weights, count);
+        if (memcmp(row_ref, row_out, count * sizeof(uint32_t)) != 0) {
+            failures += report(k->name, "modulate", round, "in-place rows differ");
+        }
+    }
+
+    return failures;
+}
+
+int main(void) {
+    log_set_console(false);
+
+    const GfxKernels *list[8];
+    int count = gfx_available_kernels(list, 8);
+    int failures = 0;
+
+    // The scalar set comes first and is the reference
+    for (int i = 1; i < count; i++) {
+        int f = test_set(list[0], list[i]);
+        printf("%-8s %s\n", list[i]->name, f ? "FAIL" : "ok");
+        failures += f;
+    }
+    printf("%d kernel sets checked against %s, %d failures\n", count - 1, list[0]->name, failures);
+
+    log_shutdown();
+    return failures ? 1 : 0;
+}
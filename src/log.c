@@ -0,0 +1,250 @@
+#include "../include/log.h"
+#include "../include/timer.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Ring buffer geometry (slot count must be a power of two)
+#define LOG_RING_SLOTS  2048
+#define LOG_TEXT_SIZE   (256 - 16)
+
+// Writer thread poll interval while the ring is empty
+#define LOG_IDLE_SLEEP_NS 2000000ULL
+
+// One queued record. seq implements the bounded MPMC queue by Dmitry
+// Vyukov: a slot is free for the producer at position p when seq == p, and
+// ready for the consumer when seq == p + 1.
+typedef struct {
+    atomic_uint seq;
+    uint8_t level;
+    uint8_t category;
+    uint64_t time_ns;
+    char text[LOG_TEXT_SIZE];
+} LogRecord;
+
+static LogRecord ring[LOG_RING_SLOTS];
+static atomic_uint enqueue_pos;
+static unsigned dequeue_pos;            // Only touched by the writer thread
+static atomic_uint dropped;             // Records lost because the ring was full
+
+// Writer thread state
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static pthread_t writer_thread;
+static bool writer_started = false;
+static atomic_bool accepting;
+static atomic_bool stop_requested;
+static FILE *log_file = NULL;
+static atomic_bool console_echo = true;
+static uint64_t start_time_ns;
+
+// Runtime level per category (sized by the initializers, so a category
+// added to log.h without one here fails the asserts below)
+uint8_t log_levels[] = {
+    LOG_LEVEL_INFO, LOG_LEVEL_INFO, LOG_LEVEL_INFO,
+    LOG_LEVEL_INFO, LOG_LEVEL_INFO, LOG_LEVEL_INFO,
+    LOG_LEVEL_INFO, LOG_LEVEL_INFO
+};
+
+static const char *level_names[] = { "off", "error", "warn", "info", "debug", "trace" };
+static const char *category_names[] = {
+    "main", "cpu", "memory", "video", "input", "runner", "sound", "net"
+};
+
+_Static_assert(sizeof(log_levels) / sizeof(log_levels[0]) == LOG_CAT_COUNT,
+               "log_levels needs a default level for every category");
+_Static_assert(sizeof(category_names) / sizeof(category_names[0]) == LOG_CAT_COUNT,
+               "category_names needs a name for every category");
+
+// Write every ready record to the sinks, returns the number written
+static int drain_ring(void) {
+    int count = 0;
+    
+    for (;;) {
+        LogRecord *rec = &ring[dequeue_pos & (LOG_RING_SLOTS - 1)];
+        unsigned seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+        if (seq != dequeue_pos + 1) break;
+        
+        double t = (rec->time_ns - start_time_ns) / 1e9;
+        const char *level = level_names[rec->level];
+        const char *category = category_names[rec->category];
+        if (log_file) {
+            fprintf(log_file, "[%10.6f] %-5s %-6s %s\n", t, level, category, rec->text);
+        }
+        if (atomic_load_explicit(&console_echo, memory_order_relaxed)) {
+            printf("[%-5s %s] %s\n", level, category, rec->text);
+        }
+        
+        // Hand the slot back to the producers for the next lap
+        atomic_store_explicit(&rec->seq, dequeue_pos + LOG_RING_SLOTS, memory_order_release);
+        dequeue_pos++;
+        count++;
+    }
+    
+    unsigned lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (lost > 0 && log_file) {
+        fprintf(log_file, "[log] %u records dropped (ring full)\n", lost);
+        count++;
+    }
+    
+    return count;
+}
+
+// Writer thread: drain in batches and flush once per batch
+static void* writer_main(void *arg) {
+    (void)arg;
+    
+    for (;;) {
+        if (drain_ring() > 0) {
+            if (log_file) fflush(log_file);
+            fflush(stdout);
+            continue;
+        }
+        if (atomic_load(&stop_requested)) break;
+        timer_sleep_ns(LOG_IDLE_SLEEP_NS);
+    }
+    
+    // Pick up anything published while we were stopping
+    drain_ring();
+    if (log_file) fflush(log_file);
+    fflush(stdout);
+    return NULL;
+}
+
+// Open debug.log and start the writer (runs once, on the first record)
+static void log_start(void) {
+    for (unsigned i = 0; i < LOG_RING_SLOTS; i++) {
+        atomic_init(&ring[i].seq, i);
+    }
+    start_time_ns = timer_now_ns();
+    
+    log_file = fopen("debug.log", "w");
+    if (log_file) {
+        fprintf(log_file, "=== Pacman Emulator Debug Log ===\n");
+    }
+    
+    atomic_store(&accepting, true);
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) == 0) {
+        writer_started = true;
+        atexit(log_shutdown);
+    } else {
+        // Without a writer the ring would just fill up
+        atomic_store(&accepting, false);
+        if (log_file) {
+            fprintf(log_file, "[log] failed to start writer thread, logging disabled\n");
+            fclose(log_file);
+            log_file = NULL;
+        }
+    }
+}
+
+// Format and queue one record
+void log_write(LogCategory cat, LogLevel level, const char *format, ...) {
+    pthread_once(&start_once, log_start);
+    if (!atomic_load_explicit(&accepting, memory_order_relaxed)) return;
+    
+    // Claim a slot
+    LogRecord *rec;
+    unsigned pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        rec = &ring[pos & (LOG_RING_SLOTS - 1)];
+        unsigned seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+        
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Ring full: drop rather than stall the emulation
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+    
+    // Fill it in and publish
+    rec->level = (uint8_t)level;
+    rec->category = (uint8_t)cat;
+    rec->time_ns = timer_now_ns();
+    
+    va_list args;
+    va_start(args, format);
+    vsnprintf(rec->text, sizeof(rec->text), format, args);
+    va_end(args);
+    
+    atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+}
+
+// Parse a level name, returns -1 if unknown
+static int parse_level(const char *name, size_t len) {
+    for (int i = 0; i <= LOG_LEVEL_TRACE; i++) {
+        if (strlen(level_names[i]) == len && strncmp(level_names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Set runtime levels from a spec such as "info,video=trace"
+bool log_configure(const char *spec) {
+    uint8_t levels[LOG_CAT_COUNT];
+    memcpy(levels, log_levels, sizeof(levels));
+    
+    while (*spec) {
+        const char *end = strchr(spec, ',');
+        size_t len = end ? (size_t)(end - spec) : strlen(spec);
+        const char *eq = memchr(spec, '=', len);
+        
+        if (eq) {
+            // category=level
+            size_t name_len = eq - spec;
+            int level = parse_level(eq + 1, len - name_len - 1);
+            int cat = -1;
+            for (int i = 0; i < LOG_CAT_COUNT; i++) {
+                if (strlen(category_names[i]) == name_len &&
+                    strncmp(category_names[i], spec, name_len) == 0) {
+                    cat = i;
+                }
+            }
+            if (level < 0 || cat < 0) return false;
+            levels[cat] = (uint8_t)level;
+        } else {
+            // Bare level applies to every category
+            int level = parse_level(spec, len);
+            if (level < 0) return false;
+            memset(levels, level, sizeof(levels));
+        }
+        
+        spec += len;
+        if (*spec == ',') spec++;
+    }
+    
+    memcpy(log_levels, levels, sizeof(levels));
+    return true;
+}
+
+// Echo records to stdout as well as debug.log
+void log_set_console(bool enable) {
+    atomic_store(&console_echo, enable);
+}
+
+// Drain the ring, stop the writer thread and close debug.log
+void log_shutdown(void) {
+    if (!writer_started) return;
+    writer_started = false;
+    
+    atomic_store(&accepting, false);
+    atomic_store(&stop_requested, true);
+    pthread_join(writer_thread, NULL);
+    
+    if (log_file) {
+        fclose(log_file);
+        log_file = NULL;
+    }
+}
@@ -0,0 +1,34 @@
+#include "../include/machine.h"
+#include "../include/video.h"
+#include "../include/trace.h"
+#include <stdlib.h>
+
+// Allocate a machine with all state cleared
+PacmanMachine* machine_create(void) {
+    PacmanMachine *m = (PacmanMachine *)calloc(1, sizeof(PacmanMachine));
+    if (!m) {
+        return NULL;
+    }
+    
+    // Defaults matching the hardware at power on
+    m->input_port1 = 0xFF;  // Active low, nothing pressed
+    m->input_port2 = 0xFF;
+    m->scale = 2;
+    m->cpu.userdata = m;
+    memory_map_pages(m);
+    
+    return m;
+}
+
+// Release a machine and all resources owned by it
+void machine_destroy(PacmanMachine *m) {
+    if (!m) return;
+    
+    video_cleanup(m);
+    memory_cleanup(m);
+    sound_close(m);
+    z80_blocks_destroy(m->cpu_blocks);
+    free(m->cpu_profile);
+    trace_stop(m);
+    free(m);
+}
@@ -2,14 +2,20 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include <string.h>
+
 #ifdef _WIN32
-    #include <SDL2/SDL.h>
+    #ifndef NO_SDL
+        #include <SDL2/SDL.h>
+    #endif
     #include <direct.h>
     #include <windows.h>  // For AllocConsole
     #define PATH_SEPARATOR '\\'
     #define mkdir(dir, mode) _mkdir(dir)
 #else
-    #include <SDL2/SDL.h>
+    #ifndef NO_SDL
+        #include <SDL2/SDL.h>
+    #endif
     #include <sys/stat.h>
     #define PATH_SEPARATOR '/'
 #endif
@@ -18,13 +24,85 @@
 #include "../include/memory.h"
 #include "../include/video.h"
 #include "../include/input.h"
+#include "../include/timer.h"
+#include "../include/machine.h"
+#include "../include/runner.h"
+#include "../include/sound.h"
+#include "../include/pacing.h"
+#include "../include/state.h"
+#include "../include/rewind.h"
+#include "../include/runahead.h"
+#include "../include/netplay.h"
+#include "../include/export.h"
+#include "../include/pipeline.h"
+#include "../include/perf.h"
+#include "../include/profile.h"
+#include "../include/trace.h"
+#include "../include/movie.h"
+#include "../include/log.h"
+#include "../include/gfx_kernels.h"
+#include "../include/scaler.h"
 
-// External declaration of debug_log function
-extern void debug_log(const char *format, ...);
 
 #define WINDOW_WIDTH 224
 #define WINDOW_HEIGHT 288
-#define SCALE_FACTOR 2
+#define SCALE_FACTOR 2     // Default window scale
+
+// Frames stepped per runner batch in uncapped headless runs
+#define HEADLESS_BATCH_FRAMES 60
+
+// Watched address ranges per kind for --trace-pc and --trace-write
+#define TRACE_MAX_RANGES    8
+
+// Addresses first to last
+typedef struct {
+    uint16_t first;
+    uint16_t last;
+} AddressRange;
+
+// Command line settings
+typedef struct {
+    const char *rom_path;
+    bool use_test_rom;
+    bool headless;      // Run without SDL (no window, renderer or audio)
+    bool render;        // Headless: still render into the software framebuffer
+    bool uncapped;      // Do not pace frames, run as fast as possible
+    long max_frames;    // Stop after this many frames (0 = run forever)
+    int instances;      // Headless: number of machines to run side by side
+    int threads;        // Headless runner / CPU scaler threads (0 = one per CPU)
+    int scale;          // Windowed: integer output scale (0 = largest that fits the screen)
+    ScalerFilter filter; // Windowed: output filter (see scaler.h)
+    ScalerPath scale_path; // Windowed: scale on the CPU or through the renderer
+    CpuEngine engine;   // Z80 execution engine
+    bool watchdog;      // Reset the CPU when the game stops kicking the watchdog
+    bool mute;          // Do not open an audio device
+    PaceMode pacing;    // How paced runs wait for the next frame
+    const char *load_state; // Save state to start from
+    const char *save_state; // Save state written when the run ends
+    int rewind_seconds; // Windowed: rewind history length (0 = off)
+    int rewind_mb;      // Windowed: rewind history memory limit
+    int run_ahead;      // Windowed: frames to run ahead of the shown frame
+    int net_listen;     // Windowed: UDP port to host a netplay session on (0 = none)
+    const char *net_connect; // Windowed: host:port of a netplay session to join
+    int net_delay;      // Netplay: frames local input is held back
+    const char *export_name; // Shared memory block shown frames are published to
+    bool pipeline;      // Windowed: emulate on a thread of its own, render on this one
+    const char *perf_dump; // File the frame instrumentation is written to (PERF=1 builds)
+    int perf_interval;  // Seconds between performance reports
+    bool perf_overlay;  // Draw the frame instrumentation over the game
+    const char *profile; // Z80 profile files written at exit (PROFILE=1 builds)
+    const char *trace;  // Prefix of saved execution traces (TRACE=1 builds)
+    long trace_records; // Records in the trace ring
+    AddressRange trace_pc[TRACE_MAX_RANGES];    // Instructions that fire the trace
+    int trace_pc_count;
+    AddressRange trace_write[TRACE_MAX_RANGES]; // Writes that fire the trace
+    int trace_write_count;
+    const char *record; // Input movie recorded from power on
+    const char *replay; // Input movie replayed and verified
+    int verify_every;   // Frames between recorded checkpoints
+    const char *rom_cache;  // Directory of decoded ROM sets
+    const char *write_pack; // Write the ROMs as a packed image and exit
+} Options;
 
 // Print usage information
 void print_usage(const char *program_name) {
@@ -33,55 +111,389 @@ void print_usage(const char *program_name) {
     printf("Options:\n");
     printf("  --help                Show this help message\n");
     printf("  --test                Use built-in test ROM (no external ROM needed)\n");
+    printf("  --headless            Run without a window, renderer or audio (no SDL)\n");
+    printf("  --render              Headless: render frames into a software framebuffer\n");
+    printf("  --frames N            Stop after N frames\n");
+    printf("  --uncapped            Do not limit speed to 60fps\n");
+    printf("  --pacing MODE         Frame pacing: auto (default), timer, vsync or audio\n");
+    printf("  --instances N         Headless: run N machines in parallel\n");
+    printf("  --threads N           Threads for headless machines or the CPU scaler\n");
+    printf("                        (default: one per CPU)\n");
+    printf("  --scale N             Integer window scale (default %d, 0 = fit the screen, max %d)\n",
+           SCALE_FACTOR, SCALER_MAX_SCALE);
+    printf("  --filter NAME         Output filter: nearest (default), scanlines, crt or epx\n");
+    printf("  --scale-path PATH     Scale on the cpu, the gpu or auto (default: gpu unless epx)\n");
+    printf("  --log-level SPEC      Log levels, e.g. debug or info,video=trace,cpu=off\n");
+    printf("                        (levels: off error warn info debug trace)\n");
+    printf("  --gfx-kernel NAME     Blit kernels: auto (default), scalar, sse2, avx2, neon\n");
+    printf("  --engine NAME         Z80 engine: interp (default) or blocks (ROM block cache)\n");
+    printf("  --run-ahead N         Show the frame N frames ahead to hide input lag (0-%d)\n",
+           RUNAHEAD_MAX_FRAMES);
+    printf("  --net-listen PORT     Host a two-player netplay session as player 1\n");
+    printf("  --net-connect HOST:PORT  Join a netplay session as player 2\n");
+    printf("  --net-delay N         Netplay input delay in frames (default %d, max %d)\n",
+           NETPLAY_DEFAULT_DELAY, NETPLAY_MAX_DELAY);
+    printf("  --export-shm NAME     Publish every frame to shared memory NAME (see export.h)\n");
+    printf("  --pipeline            Emulate and render on separate threads\n");
+    printf("  --perf-dump FILE      Write frame timings to FILE, JSON or Prometheus (.prom)\n");
+    printf("  --perf-interval SECS  Seconds between --perf-dump reports (default %d)\n",
+           PERF_DEFAULT_INTERVAL);
+    printf("  --perf-overlay        Draw frame timings over the game\n");
+    printf("  --profile PREFIX      Profile the Z80 program into PREFIX.txt and PREFIX.folded\n");
+    printf("  --trace PREFIX        Trace the Z80 and save PREFIX-NNN.z80t when a trigger fires\n");
+    printf("                        (the watchdog, --trace-pc, --trace-write; see trace-dump)\n");
+    printf("  --trace-pc ADDR[-ADDR]     Fire the trace on code at these hex addresses\n");
+    printf("  --trace-write ADDR[-ADDR]  Fire the trace on writes to these hex addresses\n");
+    printf("  --trace-records N     Instructions kept in the trace (default %u)\n",
+           TRACE_DEFAULT_RECORDS);
+    printf("  --record FILE         Record an input movie with checkpoints (see movie.h)\n");
+    printf("  --replay FILE         Replay an input movie and verify its checkpoints\n");
+    printf("  --verify-every N      Frames between recorded checkpoints (default %d, 0 = end only)\n",
+           MOVIE_DEFAULT_VERIFY);
+    printf("  --rom-cache DIR       Keep decoded ROM sets in DIR for fast starts\n");
+    printf("  --write-pack FILE     Write the ROMs as one packed image and exit\n");
+    printf("  --mute                Run without sound\n");
+    printf("  --load-state FILE     Start from a save state\n");
+    printf("  --save-state FILE     Write a save state when the run ends\n");
+    printf("  --rewind SECONDS      Rewind history kept while Backspace rewinds (default %d, 0 = off)\n",
+           REWIND_DEFAULT_SECONDS);
+    printf("  --rewind-mb N         Memory limit for the rewind history (default %d)\n", REWIND_DEFAULT_MB);
+    printf("  --watchdog            Reset the CPU after %d frames without a watchdog write\n", WATCHDOG_FRAMES);
     printf("\n");
-    printf("If rom_path is a directory, it will be treated as a MAME ROM set directory.\n");
+    printf("If rom_path is a directory or .zip, it will be treated as a MAME ROM set.\n");
+    printf("If rom_path is a packed image (--write-pack), it is loaded already decoded.\n");
     printf("If rom_path is a file, it will be loaded as a single ROM file.\n");
 }
 
-int main(int argc, char *argv[]) {
-    // Enable console output for Windows
-    #ifdef _WIN32
-    // Redirect console output to terminal
-    AllocConsole();
-    freopen("CONOUT$", "w", stdout);
-    freopen("CONOUT$", "w", stderr);
-    #endif
+// Parse a hex address or FIRST-LAST range into the next free slot of ranges
+static bool parse_range(const char *text, AddressRange *ranges, int *count) {
+    char *end;
+    unsigned long first = strtoul(text, &end, 16);
+    unsigned long last = first;
+    if (end != text && *end == '-') {
+        const char *second = end + 1;
+        last = strtoul(second, &end, 16);
+        if (end == second) {
+            return false;
+        }
+    }
+    if (end == text || *end != '\0' || first > last || last > 0xFFFF || *count >= TRACE_MAX_RANGES) {
+        return false;
+    }
+    ranges[(*count)++] = (AddressRange){ (uint16_t)first, (uint16_t)last };
+    return true;
+}
+
+// Start the execution trace of a machine; with several machines each one
+// saves under a prefix of its own
+static bool start_trace(const Options *opts, PacmanMachine *m, int index, int count) {
+    char prefix[1024];
+    if (count > 1) {
+        snprintf(prefix, sizeof(prefix), "%s-m%d", opts->trace, index);
+    } else {
+        snprintf(prefix, sizeof(prefix), "%s", opts->trace);
+    }
+    if (!trace_start(m, prefix, (uint32_t)opts->trace_records)) {
+        return false;
+    }
+    for (int i = 0; i < opts->trace_pc_count; i++) {
+        trace_watch_pc(m, opts->trace_pc[i].first, opts->trace_pc[i].last);
+    }
+    for (int i = 0; i < opts->trace_write_count; i++) {
+        trace_watch_write(m, opts->trace_write[i].first, opts->trace_write[i].last);
+    }
+    return true;
+}
+
+// Write the performance report when one is asked for and due: every
+// perf_interval seconds, or now if final
+static void write_perf_report(const Options *opts, PacmanMachine *const *machines,
+                              const char *const *names, int count, uint64_t *last_ns, bool final) {
+    if (!opts->perf_dump) {
+        return;
+    }
+    uint64_t now = timer_now_ns();
+    if (!final && now - *last_ns < (uint64_t)opts->perf_interval * 1000000000ULL) {
+        return;
+    }
+    *last_ns = now;
+    perf_dump(opts->perf_dump, machines, names, count);
+}
+
+// Load the ROMs and write them as a packed image (--write-pack)
+static int write_pack(const Options *opts) {
+    PacmanMachine *m = machine_create();
+    if (!m) {
+        printf("Failed to allocate machine\n");
+        return 1;
+    }
     
-    // Initialize debug logging
-    debug_log("Pacman Emulator starting up");
-    debug_log("Command line: %s", argv[0]);
+    int result = 1;
+    if (!memory_init(m, opts->rom_path)) {
+        printf("Failed to load ROM: %s\n", opts->rom_path);
+    } else if (!memory_write_pack(m, opts->write_pack)) {
+        printf("Failed to write packed ROM image: %s\n", opts->write_pack);
+    } else {
+        printf("Wrote packed ROM image: %s\n", opts->write_pack);
+        result = 0;
+    }
+    machine_destroy(m);
+    return result;
+}
+
+// Create and initialize one machine for a headless run
+static PacmanMachine* create_headless_machine(const Options *opts, int index) {
+    PacmanMachine *m = machine_create();
+    if (!m) {
+        printf("Failed to allocate machine\n");
+        return NULL;
+    }
     
-    // Default settings
-    const char *rom_path = NULL;
-    bool use_test_rom = false;
+    if (!memory_init(m, opts->rom_path)) {
+        printf("Failed to load ROM: %s\n", opts->rom_path);
+        machine_destroy(m);
+        return NULL;
+    }
     
-    // Parse command line arguments
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "--help") == 0) {
-            print_usage(argv[0]);
-            return 0;
-        } else if (strcmp(argv[i], "--test") == 0) {
-            use_test_rom = true;
-        } else if (argv[i][0] != '-') {
-            rom_path = argv[i];
-        } else {
-            printf("Unknown option: %s\n", argv[i]);
-            print_usage(argv[0]);
+    cpu_init(m);
+    input_init(m);
+    m->watchdog_enabled = opts->watchdog;
+    
+    if (!cpu_set_engine(m, opts->engine)) {
+        printf("CPU engine not available in this build: %s\n", cpu_engine_name(opts->engine));
+        machine_destroy(m);
+        return NULL;
+    }
+    
+    // The software framebuffer is optional, skip rendering entirely by default
+    if (opts->render && !video_init(m, NULL, 1)) {
+        printf("Failed to initialize software framebuffer\n");
+        machine_destroy(m);
+        return NULL;
+    }
+    
+    if (opts->load_state && !state_load_file(m, opts->load_state)) {
+        printf("Failed to load save state: %s\n", opts->load_state);
+        machine_destroy(m);
+        return NULL;
+    }
+    
+#ifdef PERF_ENABLED
+    m->perf.overlay = opts->perf_overlay;
+#endif
+    if (opts->profile && !profile_start(m)) {
+        printf("Failed to allocate the Z80 profile\n");
+        machine_destroy(m);
+        return NULL;
+    }
+    if (opts->trace && !start_trace(opts, m, index, opts->instances)) {
+        printf("Failed to allocate the Z80 trace\n");
+        machine_destroy(m);
+        return NULL;
+    }
+    return m;
+}
+
+// Release what a headless run created (any of it may be NULL). Movies
+// still open are closed without being finished.
+static void free_headless(PacmanMachine **machines, int count, Movie **movies, Runner *runner,
+                          FrameExport *exporter, char (*labels)[16], const char **names) {
+    export_destroy(exporter);
+    runner_destroy(runner);
+    for (int i = 0; machines && i < count; i++) {
+        if (movies) {
+            movie_close(movies[i]);
+        }
+        machine_destroy(machines[i]);
+    }
+    free(movies);
+    free(names);
+    free(labels);
+    free(machines);
+}
+
+// Run the emulation loop without SDL
+static int run_headless(const Options *opts) {
+    int count = opts->instances;
+    PacmanMachine **machines = (PacmanMachine **)calloc(count, sizeof(PacmanMachine *));
+    if (!machines) {
+        printf("Failed to allocate machines\n");
+        return 1;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        machines[i] = create_headless_machine(opts, i);
+        if (!machines[i]) {
+            free_headless(machines, count, NULL, NULL, NULL, NULL, NULL);
             return 1;
         }
     }
     
-    // Check if we have a ROM path or using test ROM
-    if (!rom_path && !use_test_rom) {
-        printf("Error: No ROM path specified.\n");
-        print_usage(argv[0]);
+    // Machines are labelled by index in performance reports
+    char (*labels)[16] = NULL;
+    const char **names = NULL;
+    if (opts->perf_dump) {
+        labels = calloc(count, sizeof(*labels));
+        names = (const char **)calloc(count, sizeof(*names));
+        for (int i = 0; labels && names && i < count; i++) {
+            snprintf(labels[i], sizeof(labels[i]), "%d", i);
+            names[i] = labels[i];
+        }
+    }
+    uint64_t perf_last = timer_now_ns();
+    
+    // Every machine replays the movie on its own; recording takes one machine
+    Movie **movies = NULL;
+    long max_frames = opts->max_frames;
+    if (opts->record || opts->replay) {
+        movies = (Movie **)calloc(count, sizeof(Movie *));
+        bool ok = movies != NULL;
+        for (int i = 0; ok && i < count; i++) {
+            movies[i] = opts->record ? movie_record(opts->record, machines[i], opts->verify_every)
+                                     : movie_replay(opts->replay, machines[i]);
+            ok = movies[i] != NULL;
+            if (ok) {
+                // The overlay is not part of the game's picture
+                movie_check_framebuffer(movies[i], !opts->perf_overlay);
+            }
+        }
+        if (!ok) {
+            printf("Failed to %s movie: %s\n", opts->record ? "record" : "replay",
+                   opts->record ? opts->record : opts->replay);
+            free_headless(machines, count, movies, NULL, NULL, labels, names);
+            return 1;
+        }
+        if (opts->replay && max_frames == 0) {
+            max_frames = movie_length(movies[0]);
+        }
+    }
+    
+    // A single machine runs on the calling thread unless threads are requested
+    int threads = opts->threads;
+    if (threads == 0 && count == 1) {
+        threads = 1;
+    }
+    Runner *runner = runner_create(threads);
+    if (!runner) {
+        printf("Failed to start runner threads\n");
+        free_headless(machines, count, movies, NULL, NULL, labels, names);
         return 1;
     }
     
-    // If using test ROM, set the path to our built-in test ROM
-    if (use_test_rom) {
-        rom_path = "data/test.rom";
+    // The first machine's frames are exported
+    FrameExport *exporter = NULL;
+    if (opts->export_name) {
+        exporter = export_create(opts->export_name);
+        if (!exporter) {
+            printf("Failed to create frame export: %s\n", opts->export_name);
+            free_headless(machines, count, movies, runner, NULL, labels, names);
+            return 1;
+        }
+    }
+    
+    LOG_INFO(LOG_CAT_MAIN, "Starting headless emulation loop (%d machines, %d threads)",
+              count, runner_thread_count(runner));
+    
+    // Headless runs have no audio or display to sync to
+    Pacer pacer;
+    pacing_init(&pacer, opts->uncapped ? PACE_OFF : PACE_TIMER, NULL);
+    
+    uint64_t start_time = timer_now_ns();
+    long frame_count = 0;
+    
+    while (max_frames == 0 || frame_count < max_frames) {
+        // Uncapped runs hand out several frames per batch to amortize the
+        // thread wake-up; paced and exported runs step one frame at a time
+        long batch = 1;
+        if (opts->uncapped && !exporter && !movies) {
+            batch = HEADLESS_BATCH_FRAMES;
+            if (max_frames > 0 && max_frames - frame_count < batch) {
+                batch = max_frames - frame_count;
+            }
+        }
+        
+        // Movies record or set the input of every frame
+        for (int i = 0; movies && i < count; i++) {
+            movie_frame(movies[i], machines[i]);
+        }
+
+        runner_step_machines(runner, machines, count, (int)batch, opts->render);
+        frame_count += batch;
+        if (exporter) {
+            export_publish(exporter, machines[0], (uint64_t)frame_count);
+        }
+        
+        // Pace to the board's 60.606 Hz unless running uncapped
+        if (!opts->uncapped) {
+            pacing_wait(&pacer, NULL, false);
+        }
+        
+        if (names) {
+            write_perf_report(opts, machines, names, count, &perf_last, false);
+        }
+    }
+    
+    double elapsed = (timer_now_ns() - start_time) / 1e9;
+    double fps = elapsed > 0 ? frame_count / elapsed : 0.0;
+    if (count == 1) {
+        printf("Ran %ld frames in %.3fs (%.2f fps)\n", frame_count, elapsed, fps);
+    } else {
+        printf("Ran %ld frames on %d machines with %d threads in %.3fs "
+               "(%.2f fps per machine, %.2f fps total)\n",
+               frame_count, count, runner_thread_count(runner), elapsed,
+               fps, fps * count);
+    }
+    pacing_report(&pacer);
+    LOG_INFO(LOG_CAT_MAIN, "Headless emulation loop ended");
+    if (names) {
+        write_perf_report(opts, machines, names, count, &perf_last, true);
+    }
+    if (opts->profile) {
+        profile_write(machines, count, opts->profile);
+    }
+    for (int i = 0; i < count && opts->trace; i++) {
+        trace_finish(machines[i]);
+    }
+    
+    // A replay that diverged fails the run (finishing closes the movie)
+    int result = 0;
+    for (int i = 0; movies && i < count; i++) {
+        if (!movie_finish(movies[i], machines[i])) {
+            result = 1;
+        }
+        movies[i] = NULL;
+    }
+    
+    // With several machines, the first one's state is saved
+    if (opts->save_state && !state_save_file(machines[0], opts->save_state)) {
+        printf("Failed to write save state: %s\n", opts->save_state);
+    }
+    
+    free_headless(machines, count, movies, runner, exporter, labels, names);
+    return result;
+}
+
+#ifndef NO_SDL
+// Release the machines (display may be m) and SDL objects of a windowed run
+// and shut SDL down (any of them may be NULL)
+static void close_windowed(PacmanMachine *m, PacmanMachine *display, SDL_Renderer *renderer,
+                           SDL_Window *window) {
+    if (display != m) {
+        machine_destroy(display);
+    }
+    machine_destroy(m);
+    if (renderer) {
+        SDL_DestroyRenderer(renderer);
+    }
+    if (window) {
+        SDL_DestroyWindow(window);
     }
+    SDL_Quit();
+}
+
+// Run the emulation loop in an SDL window
+static int run_windowed(const Options *opts) {
+    const char *rom_path = opts->rom_path;
     
     // Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
@@ -89,105 +501,632 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    // Scale 0 picks the largest integer scale that fits the desktop
+    int scale = opts->scale;
+    if (scale == 0) {
+        SDL_DisplayMode mode;
+        scale = SCALE_FACTOR;
+        if (SDL_GetDesktopDisplayMode(0, &mode) == 0) {
+            scale = mode.w / WINDOW_WIDTH < mode.h / WINDOW_HEIGHT ? mode.w / WINDOW_WIDTH
+                                                                   : mode.h / WINDOW_HEIGHT;
+        }
+        if (scale < 1) {
+            scale = 1;
+        } else if (scale > SCALER_MAX_SCALE) {
+            scale = SCALER_MAX_SCALE;
+        }
+        LOG_INFO(LOG_CAT_MAIN, "Window scale %d fits the screen", scale);
+    }
+    
     // Create window
     SDL_Window *window = SDL_CreateWindow(
         "Pacman Emulator",
         SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-        WINDOW_WIDTH * SCALE_FACTOR, WINDOW_HEIGHT * SCALE_FACTOR,
+        WINDOW_WIDTH * scale, WINDOW_HEIGHT * scale,
         SDL_WINDOW_SHOWN
     );
     
     if (!window) {
         printf("Window creation failed: %s\n", SDL_GetError());
-        SDL_Quit();
+        close_windowed(NULL, NULL, NULL, NULL);
         return 1;
     }
     
-    // Create renderer
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    // Create renderer (presents wait for the display refresh in vsync mode)
+    Uint32 renderer_flags = SDL_RENDERER_ACCELERATED;
+    if (opts->pacing == PACE_VSYNC && !opts->uncapped) {
+        renderer_flags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, renderer_flags);
     if (!renderer) {
         printf("Renderer creation failed: %s\n", SDL_GetError());
-        SDL_DestroyWindow(window);
-        SDL_Quit();
+        close_windowed(NULL, NULL, NULL, window);
         return 1;
     }
     
     // Initialize emulator components
-    if (!memory_init(rom_path)) {
+    PacmanMachine *m = machine_create();
+    if (!m || !memory_init(m, rom_path)) {
         printf("Failed to load ROM: %s\n", rom_path);
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
-        SDL_Quit();
+        close_windowed(m, m, renderer, window);
         return 1;
     }
     
-    cpu_init();
+    cpu_init(m);
+    m->watchdog_enabled = opts->watchdog;
+    if (!cpu_set_engine(m, opts->engine)) {
+        printf("CPU engine not available in this build: %s\n", cpu_engine_name(opts->engine));
+        close_windowed(m, m, renderer, window);
+        return 1;
+    }
+    if (opts->profile && !profile_start(m)) {
+        LOG_WARN(LOG_CAT_MAIN, "Could not allocate the Z80 profile, not profiling");
+    }
+    if (opts->trace && !start_trace(opts, m, 0, 1)) {
+        LOG_WARN(LOG_CAT_MAIN, "Could not allocate the Z80 trace, not tracing");
+    }
+    
+    // Pipelined runs draw on a second machine with the same ROMs, fed with
+    // video snapshots of the emulated one (see pipeline.h)
+    PacmanMachine *display = m;
+    if (opts->pipeline) {
+        display = machine_create();
+        if (!display || !memory_init(display, rom_path)) {
+            printf("Failed to set up the display machine\n");
+            close_windowed(m, display, renderer, window);
+            return 1;
+        }
+        input_init(display);
+    }
+#ifdef PERF_ENABLED
+    display->perf.overlay = opts->perf_overlay;
+#endif
+    
     // Enable debug mode for video
-    if (video_init(renderer, SCALE_FACTOR)) {
-        video_enable_debug(true);
-        debug_log("Video debug mode enabled");
+    if (video_init(display, renderer, scale)) {
+        video_enable_debug(display, true);
+        LOG_INFO(LOG_CAT_MAIN, "Video debug mode enabled");
+        
+        // The plain stretch needs no setup unless the CPU is asked to do it
+        if ((opts->filter != SCALER_NEAREST || opts->scale_path == SCALER_PATH_CPU) &&
+            !video_set_filter(display, opts->filter, opts->scale_path, opts->threads)) {
+            printf("Could not set up the %s filter at scale %d, showing unfiltered frames\n",
+                   scaler_filter_name(opts->filter), scale);
+        }
+    }
+    input_init(m);
+    
+    if (opts->load_state && !state_load_file(m, opts->load_state)) {
+        printf("Failed to load save state: %s\n", opts->load_state);
+    }
+    
+    // Netplay: both peers start here, from the same ROMs and state
+    Netplay *session = NULL;
+    if (opts->net_listen > 0 || opts->net_connect) {
+        if (opts->net_listen > 0) {
+            session = netplay_listen(m, (uint16_t)opts->net_listen, opts->net_delay, 0);
+        } else {
+            char host[256];
+            snprintf(host, sizeof(host), "%s", opts->net_connect);
+            char *colon = strrchr(host, ':');
+            *colon = '\0';
+            char *name = host;
+            if (name[0] == '[' && colon[-1] == ']') {
+                // [IPv6 address]:port
+                name++;
+                colon[-1] = '\0';
+            }
+            session = netplay_connect(m, name, (uint16_t)strtol(colon + 1, NULL, 10),
+                                      opts->net_delay, NETPLAY_TIMEOUT_MS * 6);
+        }
+        if (!session) {
+            printf("Failed to start netplay\n");
+            close_windowed(m, display, renderer, window);
+            return 1;
+        }
+    }
+    
+    // Movies start at power on, so they never meet netplay or a loaded state
+    Movie *movie = NULL;
+    long max_frames = opts->max_frames;
+    if (opts->record || opts->replay) {
+        movie = opts->record ? movie_record(opts->record, m, opts->verify_every)
+                             : movie_replay(opts->replay, m);
+        if (!movie) {
+            printf("Failed to %s movie: %s\n", opts->record ? "record" : "replay",
+                   opts->record ? opts->record : opts->replay);
+            netplay_destroy(session);
+            close_windowed(m, display, renderer, window);
+            return 1;
+        }
+        if (opts->replay && max_frames == 0) {
+            max_frames = movie_length(movie);
+        }
+        
+        // Checkpoints hash the software framebuffer, so frames are composed
+        // there as in headless mode. Run-ahead shows a later frame than the
+        // one checked, and the overlay is not part of the game's picture.
+        video_keep_framebuffer(m, true);
+        movie_check_framebuffer(movie, opts->run_ahead == 0 && !opts->perf_overlay);
+    }
+    
+    // Sound is optional, the game runs the same without an audio device
+    if (!opts->mute && !sound_open(m)) {
+        LOG_WARN(LOG_CAT_MAIN, "No audio output, running without sound");
+    }
+    
+    Pacer pacer;
+    pacing_init(&pacer, opts->uncapped ? PACE_OFF : opts->pacing, m);
+    
+    // Rewind history, one entry per frame (neither a netplay session nor a
+    // movie can rewind)
+    Rewind *history = NULL;
+    if (opts->rewind_seconds > 0 && !session && !movie) {
+        int frames = (int)((double)opts->rewind_seconds * 1e9 / PACE_FRAME_NS);
+        history = rewind_create(frames, (size_t)opts->rewind_mb << 20);
+        if (!history) {
+            LOG_WARN(LOG_CAT_MAIN, "Could not allocate the rewind history, rewind disabled");
+        }
+    }
+    
+    // Exported frames are composed in the software framebuffer and copied
+    // from there (the texture cannot be read back cheaply)
+    FrameExport *exporter = NULL;
+    if (opts->export_name) {
+        exporter = export_create(opts->export_name);
+        if (exporter) {
+            video_keep_framebuffer(m, true);
+        } else {
+            LOG_WARN(LOG_CAT_MAIN, "Could not create the frame export, frames are not exported");
+        }
+    }
+    
+    RunAhead ahead;
+    if (!runahead_init(&ahead, opts->run_ahead)) {
+        LOG_WARN(LOG_CAT_MAIN, "Could not allocate the run-ahead state, run-ahead disabled");
     }
-    input_init();
     
     // Main emulation loop
     bool running = true;
     SDL_Event event;
     uint32_t frame_count = 0;
-    uint32_t last_time = SDL_GetTicks();
-    uint32_t frame_time;
     
-    debug_log("Starting main emulation loop");
+    // Performance reports cover the emulated machine and, when pipelined,
+    // the display machine (the emulated one is only read once its thread
+    // has stopped)
+    PacmanMachine *perf_machines[2] = {m, display};
+    const char *perf_names[2] = {"emulation", "display"};
+    uint64_t perf_last = timer_now_ns();
     
-    while (running) {
-        uint32_t start_time = SDL_GetTicks();
+    LOG_INFO(LOG_CAT_MAIN, "Starting main emulation loop");
+    
+    Pipeline *pipe = NULL;
+    if (opts->pipeline) {
+        pipe = pipeline_start(m, history, opts->uncapped ? PACE_OFF : opts->pacing, opts->max_frames);
+        if (!pipe) {
+            printf("Failed to start the emulation thread\n");
+            running = false;
+        }
+    }
+    
+    // Pipelined: this thread only handles events and draws the newest frame
+    while (pipe && running) {
+        uint64_t perf_start = PERF_START();
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                running = false;
+            } else if (event.type == SDL_WINDOWEVENT &&
+                       (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                        event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)) {
+                video_expose(display);
+            }
+            input_process_event(display, &event);
+        }
+        pipeline_set_input(pipe, display);
+        PERF_STOP(display, PERF_STAGE_INPUT, perf_start);
+        
+        // Waiting at most two frames keeps the window responsive
+        perf_start = PERF_START();
+        const VideoSnapshot *snapshot = pipeline_acquire(pipe, 2 * PACE_FRAME_NS);
+        PERF_STOP(display, PERF_STAGE_SLEEP, perf_start);
+        if (snapshot) {
+            video_apply(display, snapshot);
+            video_render(display);
+        } else if (!pipeline_running(pipe)) {
+            running = false;
+        }
+        perf_start = PERF_START();
+        video_present(display);
+        PERF_STOP(display, PERF_STAGE_PRESENT, perf_start);
         
+        perf_frame_end(display);
+        write_perf_report(opts, &perf_machines[1], &perf_names[1], 1, &perf_last, false);
+    }
+    pipeline_stop(pipe);
+    
+    while (running) {
         // Handle input
+        uint64_t perf_start = PERF_START();
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 running = false;
+            } else if (event.type == SDL_WINDOWEVENT &&
+                       (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                        event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)) {
+                // The window contents were lost, show the last frame again
+                video_expose(m);
             }
-            input_process_event(&event);
+            input_process_event(m, &event);
         }
+        PERF_STOP(m, PERF_STAGE_INPUT, perf_start);
         
-        // Execute CPU cycles
-        cpu_execute_frame();
+        // Step back through the history while the rewind key is held,
+        // otherwise execute CPU cycles and record the new frame. Netplay
+        // runs the frame itself, or nothing while waiting for the peer.
+        if (session) {
+            netplay_frame(session, m);
+            if (!netplay_connected(session)) {
+                printf("Netplay connection lost\n");
+                running = false;
+            }
+        } else if (!(history && m->rewind_held && rewind_step_back(history, m))) {
+            if (movie) {
+                movie_frame(movie, m);
+            }
+            cpu_execute_frame(m);
+            if (history) {
+                rewind_push(history, m);
+            }
+        }
         
-        // Render screen
-        video_render();
-        SDL_RenderPresent(renderer);
+        // Render screen, possibly from a few frames ahead (unchanged frames
+        // are neither uploaded nor presented)
+        runahead_render(&ahead, m);
+        if (exporter) {
+            export_publish(exporter, m, (uint64_t)frame_count + 1);
+        }
+        perf_start = PERF_START();
+        bool presented = video_present(m);
+        PERF_STOP(m, PERF_STAGE_PRESENT, perf_start);
         
-        // Calculate FPS and adjust timing
         frame_count++;
-        frame_time = SDL_GetTicks() - start_time;
-        
-        // Every 60 frames (roughly 1 second), show FPS
-        if (frame_count % 60 == 0) {
-            uint32_t current_time = SDL_GetTicks();
-            float elapsed = (current_time - last_time) / 1000.0f;
-            float fps = 60.0f / elapsed;
-            
-            debug_log("FPS: %.2f, Frame time: %dms", fps, frame_time);
-            
-            last_time = current_time;
+        if (max_frames > 0 && (long)frame_count >= max_frames) {
+            running = false;
         }
         
-        // Dynamic frame delay to maintain ~60fps
-        if (frame_time < 16) {
-            SDL_Delay(16 - frame_time);
+        // Wait for the next frame (timing is logged every 10s at debug level)
+        perf_start = PERF_START();
+        pacing_wait(&pacer, m, presented);
+        PERF_STOP(m, PERF_STAGE_SLEEP, perf_start);
+        
+        perf_frame_end(m);
+        write_perf_report(opts, perf_machines, perf_names, 1, &perf_last, false);
+    }
+    
+    pacing_report(&pacer);
+    if (session) {
+        netplay_report(session);
+    }
+    LOG_INFO(LOG_CAT_MAIN, "Emulation loop ended");
+    write_perf_report(opts, perf_machines, perf_names, display != m ? 2 : 1, &perf_last, true);
+    if (opts->profile) {
+        profile_write(&m, 1, opts->profile);
+    }
+    if (opts->trace) {
+        trace_finish(m);
+    }
+    int result = movie_finish(movie, m) ? 0 : 1;
+    
+    if (opts->save_state && !state_save_file(m, opts->save_state)) {
+        printf("Failed to write save state: %s\n", opts->save_state);
+    }
+    
+    // Cleanup
+    netplay_destroy(session);
+    export_destroy(exporter);
+    runahead_free(&ahead);
+    rewind_destroy(history);
+    close_windowed(m, display, renderer, window);
+    
+    return result;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    // Enable console output for Windows
+    #ifdef _WIN32
+    // Redirect console output to terminal
+    AllocConsole();
+    freopen("CONOUT$", "w", stdout);
+    freopen("CONOUT$", "w", stderr);
+    #endif
+    
+    // Initialize debug logging
+    LOG_INFO(LOG_CAT_MAIN, "Pacman Emulator starting up");
+    LOG_INFO(LOG_CAT_MAIN, "Command line: %s", argv[0]);
+    
+    // Default settings
+    Options opts = {0};
+    opts.instances = 1;
+    opts.scale = SCALE_FACTOR;
+    opts.rewind_seconds = REWIND_DEFAULT_SECONDS;
+    opts.rewind_mb = REWIND_DEFAULT_MB;
+    opts.net_delay = NETPLAY_DEFAULT_DELAY;
+    opts.perf_interval = PERF_DEFAULT_INTERVAL;
+    opts.trace_records = TRACE_DEFAULT_RECORDS;
+    opts.verify_every = MOVIE_DEFAULT_VERIFY;
+    
+    // Parse command line arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "--test") == 0) {
+            opts.use_test_rom = true;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            opts.headless = true;
+        } else if (strcmp(argv[i], "--render") == 0) {
+            opts.render = true;
+        } else if (strcmp(argv[i], "--uncapped") == 0) {
+            opts.uncapped = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            opts.max_frames = strtol(argv[++i], NULL, 10);
+            if (opts.max_frames <= 0) {
+                printf("Invalid frame count: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            opts.instances = (int)strtol(argv[++i], NULL, 10);
+            if (opts.instances <= 0) {
+                printf("Invalid instance count: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            opts.threads = (int)strtol(argv[++i], NULL, 10);
+            if (opts.threads <= 0) {
+                printf("Invalid thread count: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            char *end;
+            opts.scale = (int)strtol(argv[++i], &end, 10);
+            if (end == argv[i] || opts.scale < 0 || opts.scale > SCALER_MAX_SCALE) {
+                printf("Invalid scale: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            if (!scaler_parse_filter(argv[++i], &opts.filter)) {
+                printf("Unknown filter: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--scale-path") == 0 && i + 1 < argc) {
+            if (!scaler_parse_path(argv[++i], &opts.scale_path)) {
+                printf("Unknown scale path: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            if (!log_configure(argv[++i])) {
+                printf("Invalid log level: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--gfx-kernel") == 0 && i + 1 < argc) {
+            if (!gfx_use_kernels(argv[++i])) {
+                printf("Graphics kernels not available on this CPU: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            if (!cpu_parse_engine(argv[++i], &opts.engine)) {
+                printf("Unknown CPU engine: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc) {
+            if (!pacing_parse_mode(argv[++i], &opts.pacing) || opts.pacing == PACE_OFF) {
+                printf("Unknown pacing mode: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--load-state") == 0 && i + 1 < argc) {
+            opts.load_state = argv[++i];
+        } else if (strcmp(argv[i], "--save-state") == 0 && i + 1 < argc) {
+            opts.save_state = argv[++i];
+        } else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            opts.rewind_seconds = (int)strtol(argv[++i], NULL, 10);
+            if (opts.rewind_seconds < 0) {
+                printf("Invalid rewind length: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--rewind-mb") == 0 && i + 1 < argc) {
+            opts.rewind_mb = (int)strtol(argv[++i], NULL, 10);
+            if (opts.rewind_mb <= 0) {
+                printf("Invalid rewind memory limit: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+            opts.run_ahead = (int)strtol(argv[++i], NULL, 10);
+            if (opts.run_ahead < 0 || opts.run_ahead > RUNAHEAD_MAX_FRAMES) {
+                printf("Invalid run-ahead frame count: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--net-listen") == 0 && i + 1 < argc) {
+            opts.net_listen = (int)strtol(argv[++i], NULL, 10);
+            if (opts.net_listen <= 0 || opts.net_listen > 65535) {
+                printf("Invalid netplay port: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--net-connect") == 0 && i + 1 < argc) {
+            opts.net_connect = argv[++i];
+            const char *colon = strrchr(opts.net_connect, ':');
+            long port = colon ? strtol(colon + 1, NULL, 10) : 0;
+            if (port <= 0 || port > 65535 || colon == opts.net_connect) {
+                printf("Invalid netplay address (expected HOST:PORT): %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--net-delay") == 0 && i + 1 < argc) {
+            opts.net_delay = (int)strtol(argv[++i], NULL, 10);
+            if (opts.net_delay < 0 || opts.net_delay > NETPLAY_MAX_DELAY) {
+                printf("Invalid netplay input delay: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--export-shm") == 0 && i + 1 < argc) {
+            opts.export_name = argv[++i];
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            opts.pipeline = true;
+        } else if (strcmp(argv[i], "--perf-dump") == 0 && i + 1 < argc) {
+            opts.perf_dump = argv[++i];
+        } else if (strcmp(argv[i], "--perf-interval") == 0 && i + 1 < argc) {
+            opts.perf_interval = (int)strtol(argv[++i], NULL, 10);
+            if (opts.perf_interval <= 0) {
+                printf("Invalid performance report interval: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--perf-overlay") == 0) {
+            opts.perf_overlay = true;
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            opts.profile = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            opts.trace = argv[++i];
+        } else if (strcmp(argv[i], "--trace-pc") == 0 && i + 1 < argc) {
+            if (!parse_range(argv[++i], opts.trace_pc, &opts.trace_pc_count)) {
+                printf("Invalid trace address range: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--trace-write") == 0 && i + 1 < argc) {
+            if (!parse_range(argv[++i], opts.trace_write, &opts.trace_write_count)) {
+                printf("Invalid trace address range: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--trace-records") == 0 && i + 1 < argc) {
+            opts.trace_records = strtol(argv[++i], NULL, 10);
+            if (opts.trace_records < 16 || opts.trace_records > (1L << 24)) {
+                printf("Invalid trace size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            opts.record = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            opts.replay = argv[++i];
+        } else if (strcmp(argv[i], "--verify-every") == 0 && i + 1 < argc) {
+            opts.verify_every = (int)strtol(argv[++i], NULL, 10);
+            if (opts.verify_every < 0) {
+                printf("Invalid checkpoint interval: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--rom-cache") == 0 && i + 1 < argc) {
+            opts.rom_cache = argv[++i];
+        } else if (strcmp(argv[i], "--write-pack") == 0 && i + 1 < argc) {
+            opts.write_pack = argv[++i];
+        } else if (strcmp(argv[i], "--mute") == 0) {
+            opts.mute = true;
+        } else if (strcmp(argv[i], "--watchdog") == 0) {
+            opts.watchdog = true;
+        } else if (argv[i][0] != '-') {
+            opts.rom_path = argv[i];
         } else {
-            // If frame took longer than 16ms, yield briefly to keep UI responsive
-            SDL_Delay(1);
+            printf("Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
         }
     }
     
-    debug_log("Emulation loop ended");
+    // Check if we have a ROM path or using test ROM
+    if (!opts.rom_path && !opts.use_test_rom) {
+        printf("Error: No ROM path specified.\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    // If using test ROM, set the path to our built-in test ROM
+    if (opts.use_test_rom) {
+        opts.rom_path = "data/test.rom";
+    }
     
-    // Cleanup
-    video_cleanup();
-    memory_cleanup();
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    // Headless runs only have a frame to export when they render
+    if (opts.export_name) {
+        opts.render = true;
+    }
+    
+    // Netplay runs one machine in the window
+    if (opts.net_listen > 0 || opts.net_connect) {
+#ifdef NO_SDL
+        bool windowed = false;
+#else
+        bool windowed = !opts.headless;
+#endif
+        if (!windowed || (opts.net_listen > 0 && opts.net_connect)) {
+            printf("Netplay needs the windowed emulator and one of --net-listen or --net-connect\n");
+            return 1;
+        }
+    }
     
-    return 0;
-}
\ No newline at end of file
+    // Run-ahead, netplay and the frame export draw on the emulated machine
+    // itself, which a pipelined run never renders
+    if (opts.pipeline) {
+#ifdef NO_SDL
+        bool windowed = false;
+#else
+        bool windowed = !opts.headless;
+#endif
+        if (!windowed || opts.run_ahead > 0 || opts.net_listen > 0 || opts.net_connect ||
+            opts.export_name) {
+            printf("--pipeline needs the windowed emulator and no --run-ahead, netplay or --export-shm\n");
+            return 1;
+        }
+    }
+    
+    // A movie is the input of one machine from power on
+    if (opts.record || opts.replay) {
+        if (opts.record && opts.replay) {
+            printf("--record and --replay cannot be combined\n");
+            return 1;
+        }
+        if (opts.load_state || opts.pipeline || opts.net_listen > 0 || opts.net_connect ||
+            (opts.record && opts.instances > 1)) {
+            printf("Movies start at power on and cannot be combined with --load-state, --pipeline,\n"
+                   "netplay or (when recording) --instances\n");
+            return 1;
+        }
+    }
+    
+#ifndef PERF_ENABLED
+    if (opts.perf_dump || opts.perf_overlay) {
+        printf("Frame instrumentation is not compiled in (build with make PERF=1)\n");
+        return 1;
+    }
+#endif
+#ifndef Z80_PROFILE
+    if (opts.profile) {
+        printf("The Z80 profiler is not compiled in (build with make PROFILE=1)\n");
+        return 1;
+    }
+#endif
+#ifndef Z80_TRACE
+    if (opts.trace) {
+        printf("The Z80 trace is not compiled in (build with make TRACE=1)\n");
+        return 1;
+    }
+#endif
+    if ((opts.trace_pc_count || opts.trace_write_count) && !opts.trace) {
+        printf("--trace-pc and --trace-write need --trace PREFIX\n");
+        return 1;
+    }
+    
+    if (opts.rom_cache) {
+        memory_set_rom_cache(opts.rom_cache);
+    }
+    
+    int result;
+    if (opts.write_pack) {
+        result = write_pack(&opts);
+    }
+#ifndef NO_SDL
+    else if (!opts.headless) {
+        result = run_windowed(&opts);
+    }
+#endif
+    else {
+        // Builds without SDL always run headless
+        result = run_headless(&opts);
+    }
+    
+    log_shutdown();
+    return result;
+}
@@ -1,48 +1,22 @@
 #include "../include/memory.h"
+#include "../include/machine.h"
+#include "../include/bus.h"
+#include "../include/log.h"
+#include "../include/gfx.h"
 #include "../include/video.h"  // Include video.h for video_update_palette
+#include "../include/sound.h"
+#include "../include/input.h"
+#include "../include/romset.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <dirent.h>
-#include <stdarg.h>  // For va_list, va_start, va_end
-
-// Debug log file
-static FILE *debug_file = NULL;
-
-// Initialize debug log
-static void init_debug_log(void) {
-    if (debug_file == NULL) {
-        debug_file = fopen("debug.log", "w");
-        if (debug_file) {
-            fprintf(debug_file, "=== Pacman Emulator Debug Log ===\n");
-            fflush(debug_file);
-        }
-    }
-}
-
-// Write to debug log
-void debug_log(const char *format, ...) {
-    init_debug_log();
-    
-    if (debug_file) {
-        va_list args;
-        va_start(args, format);
-        vfprintf(debug_file, format, args);
-        fprintf(debug_file, "\n");
-        fflush(debug_file);
-        va_end(args);
-        
-        // Also print to stdout for immediate feedback
-        va_start(args, format);
-        vprintf(format, args);
-        printf("\n");
-        va_end(args);
-    }
-}
 
 #ifdef _WIN32
     #include <direct.h>
+    #include <process.h>
     #define PATH_SEPARATOR '\\'
     #define MKDIR(dir, mode) _mkdir(dir)
 #else
@@ -51,26 +25,6 @@ void debug_log(const char *format, ...) {
     #define MKDIR(dir, mode) mkdir(dir, mode)
 #endif
 
-// Memory segments
-static uint8_t *rom = NULL;
-static uint8_t *ram = NULL;
-static uint8_t *vram = NULL;
-static uint8_t *cram = NULL;
-static uint8_t *charset = NULL;  // Character ROM
-static uint8_t *sprites = NULL;  // Sprite ROM
-static uint32_t *palette = NULL; // Color palette
-
-// I/O ports and hardware registers
-static uint8_t io_ports[256];
-static uint8_t interrupt_enable = 0;
-static uint8_t sound_enable = 0;
-static uint8_t flip_screen = 0;
-static uint8_t lamp1 = 0;
-static uint8_t lamp2 = 0;
-static uint8_t coin_lockout = 0;
-static uint8_t coin_counter = 0;
-static uint8_t watchdog_counter = 0;
-
 // Standard Pacman MAME ROM filenames
 static const MameRomSet pacman_roms = {
     .program1 = "pacman.6e",
@@ -81,417 +35,452 @@ static const MameRomSet pacman_roms = {
     .gfx2 = "pacman.5f",
     .palette = "82s123.7f",
     .colortable = "82s126.4a",
-    .charmap = "82s126.1m"
+    .sound = "82s126.1m"
 };
 
-// Load a single ROM file
-static bool load_rom_file(const char *filepath, uint8_t *buffer, size_t size) {
-    debug_log("Opening ROM file: %s", filepath);
-    
-    if (!buffer) {
-        debug_log("ERROR: NULL buffer in load_rom_file for %s", filepath);
-        return false;
-    }
-    
-    FILE *file = fopen(filepath, "rb");
-    if (!file) {
-        debug_log("ERROR: Failed to open ROM file: %s", filepath);
-        return false;
-    }
-    
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    debug_log("File size is %ld bytes, expecting %zu bytes", file_size, size);
-    
-    size_t read_size = fread(buffer, 1, size, file);
-    debug_log("Read %zu bytes from file", read_size);
-    
-    fclose(file);
-    
+// Settings of memory_set_rom_cache() (empty = no cache)
+static char rom_cache_dir[1024];
+
+// Bytes of a ROM image: the ROM contents and decoded graphics, rom up to
+// memory_initialized
+#define ROM_IMAGE_PAYLOAD   (offsetof(PacmanMachine, memory_initialized) - offsetof(PacmanMachine, rom))
+
+// Read a file of the set, padding a short one with 0xFF (RST 38h opcode)
+static bool read_set_file(RomSource *src, const char *name, uint8_t *buffer, size_t size) {
+    size_t read_size = romset_read(src, name, buffer, size);
     if (read_size == 0) {
-        debug_log("ERROR: Failed to read ROM file (0 bytes read): %s", filepath);
         return false;
     }
     
     if (read_size < size) {
-        debug_log("WARNING: ROM file size mismatch: %s - expected %zu bytes, read %zu bytes", 
-                filepath, size, read_size);
-        // Pad with 0xFF (RST 38h opcode)
+        LOG_WARN(LOG_CAT_MEMORY, "ROM file size mismatch: %s - expected %zu bytes, read %zu bytes",
+                name, size, read_size);
         memset(buffer + read_size, 0xFF, size - read_size);
-        debug_log("ROM padded to full size with 0xFF bytes");
+        LOG_INFO(LOG_CAT_MEMORY, "ROM padded to full size with 0xFF bytes");
     }
-    
-    // Dump first 16 bytes for verification
-    debug_log("First 16 bytes of ROM data:");
-    for (size_t i = 0; i < 16 && i < read_size; i++) {
-        debug_log("  Byte %zu: 0x%02X", i, buffer[i]);
+    LOG_DEBUG(LOG_CAT_MEMORY, "Read %zu bytes from %s", read_size, name);
+    return true;
+}
+
+// Cache key of a set: a CRC over the CRCs and sizes of its files
+static uint32_t rom_set_key(RomSource *src) {
+    const char *names[] = {
+        pacman_roms.program1, pacman_roms.program2, pacman_roms.program3, pacman_roms.program4,
+        pacman_roms.gfx1, pacman_roms.gfx2, pacman_roms.palette, pacman_roms.colortable,
+        pacman_roms.sound
+    };
+    uint32_t key = 0;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        size_t size = 0;
+        uint32_t entry[3] = {0};
+        if (romset_stat(src, names[i], &size, &entry[1])) {
+            entry[0] = 1;
+            entry[2] = (uint32_t)size;
+        }
+        key = romset_crc32(key, entry, sizeof(entry));
     }
+    return key;
+}
+
+// Path of the cache file for a key
+static void rom_cache_path(char *path, size_t size, uint32_t key) {
+    size_t dir_len = strlen(rom_cache_dir);
+    bool separator = rom_cache_dir[dir_len - 1] != PATH_SEPARATOR && rom_cache_dir[dir_len - 1] != '/';
+    snprintf(path, size, "%s%spacman-%08x.pmrom", rom_cache_dir, separator ? "/" : "", key);
+}
+
+// Registers and RAM cleared, bus mapped, before ROM contents are loaded
+static void memory_clear(PacmanMachine *m) {
+    LOG_INFO(LOG_CAT_MEMORY, "Initializing memory...");
     
-    return true;
+    memset(m->ram, 0, RAM_SIZE);
+    memset(m->vram, 0, VRAM_SIZE);
+    memset(m->cram, 0, CRAM_SIZE);
+    memset(m->io_ports, 0, sizeof(m->io_ports));
+    memory_map_pages(m);
+    
+    // Same hardware register defaults as memory_reset(), which single ROM
+    // files never go through
+    m->interrupt_enable = 1;
+    m->sound_enable = 1;
 }
 
-// Check if a file exists
-static bool file_exists(const char *filepath) {
-    if (!filepath) {
-        debug_log("ERROR: NULL filepath in file_exists");
+// Load the machine from a mapped ROM image. With a key, the image must be
+// the cache file of that set.
+static bool load_rom_image(PacmanMachine *m, const MappedFile *file, const uint32_t *key) {
+    RomImageHeader header;
+    if (file->size < sizeof(header)) {
         return false;
     }
-    
-    FILE *file = fopen(filepath, "rb");
-    if (file) {
-        fclose(file);
-        debug_log("File exists: %s", filepath);
-        return true;
+    memcpy(&header, file->data, sizeof(header));
+    if (header.magic != ROM_IMAGE_MAGIC || header.version != ROM_IMAGE_VERSION ||
+        header.header_size != sizeof(header) || header.payload_size != ROM_IMAGE_PAYLOAD ||
+        file->size - sizeof(header) < ROM_IMAGE_PAYLOAD) {
+        LOG_WARN(LOG_CAT_MEMORY, "ROM image was written by an incompatible build, ignoring it");
+        return false;
+    }
+    if (key && header.key != *key) {
+        return false;
     }
-    debug_log("File NOT found: %s", filepath);
     
-    // Additional diagnostics
-    struct stat st;
-    if (stat(filepath, &st) == 0) {
-        debug_log("  But stat() says file exists with size: %ld bytes", (long)st.st_size);
-        if (S_ISDIR(st.st_mode)) {
-            debug_log("  WARNING: Path is a directory, not a file");
-        }
+    memory_clear(m);
+    memcpy(m->rom, file->data + header.header_size, ROM_IMAGE_PAYLOAD);
+    m->rom_flags = header.flags;
+    m->memory_initialized = true;
+    
+    if (m->rom_flags & ROM_IMAGE_MAME_SET) {
+        memory_reset(m);
     } else {
-        debug_log("  stat() confirms file does not exist");
-        #ifdef _WIN32
-        debug_log("  Current directory: %s", _getcwd(NULL, 0));
-        #else
-        char cwd[1024];
-        if (getcwd(cwd, sizeof(cwd)) != NULL) {
-            debug_log("  Current directory: %s", cwd);
-        } else {
-            debug_log("  ERROR: Unable to get current directory");
-        }
-        #endif
+        video_invalidate(m);
     }
-    
-    return false;
+    return true;
 }
 
-// Build a full path
-static char* build_path(const char *dir, const char *file) {
-    size_t dir_len = strlen(dir);
-    size_t file_len = strlen(file);
-    char *path = malloc(dir_len + file_len + 2); // +2 for separator and null terminator
-    if (!path) return NULL;
-    
-    strcpy(path, dir);
+// Write the machine's ROM contents as an image, through a temporary file so
+// that concurrent instances never map a partial one
+static bool write_rom_image(const PacmanMachine *m, const char *path, uint32_t key) {
+    char temp_path[1100];
+#ifdef _WIN32
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)_getpid());
+#else
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid());
+#endif
     
-    // Add path separator if needed
-    if (dir[dir_len - 1] != PATH_SEPARATOR) {
-        path[dir_len] = PATH_SEPARATOR;
-        strcpy(path + dir_len + 1, file);
-    } else {
-        strcpy(path + dir_len, file);
+    FILE *file = fopen(temp_path, "wb");
+    if (!file) {
+        LOG_WARN(LOG_CAT_MEMORY, "Cannot write ROM image %s", temp_path);
+        return false;
     }
     
-    return path;
+    RomImageHeader header = {
+        .magic = ROM_IMAGE_MAGIC,
+        .version = ROM_IMAGE_VERSION,
+        .flags = m->rom_flags,
+        .header_size = sizeof(header),
+        .payload_size = ROM_IMAGE_PAYLOAD,
+        .key = key
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(m->rom, ROM_IMAGE_PAYLOAD, 1, file) == 1;
+    ok &= fclose(file) == 0;
+    
+    if (!ok || rename(temp_path, path) != 0) {
+        LOG_WARN(LOG_CAT_MEMORY, "Cannot write ROM image %s", path);
+        remove(temp_path);
+        return false;
+    }
+    return true;
 }
 
-// Initialize memory with a single ROM file (legacy support)
-bool memory_init(const char *rom_path) {
-    // Allocate memory
-    rom = (uint8_t *)malloc(ROM_SIZE);
-    ram = (uint8_t *)malloc(RAM_SIZE);
-    vram = (uint8_t *)malloc(VRAM_SIZE);
-    cram = (uint8_t *)malloc(CRAM_SIZE);
-    charset = (uint8_t *)malloc(256 * 8); // 256 characters, 8 bytes per character
-    sprites = (uint8_t *)malloc(64 * 16); // 64 sprites, 16 bytes per sprite
-    palette = (uint32_t *)malloc(256 * sizeof(uint32_t)); // 256 colors
+// Keep decoded ROM sets in a cache directory
+void memory_set_rom_cache(const char *dir) {
+    if (!dir || !dir[0]) {
+        rom_cache_dir[0] = '\0';
+        return;
+    }
+    snprintf(rom_cache_dir, sizeof(rom_cache_dir), "%s", dir);
     
-    // Check if allocation succeeded
-    if (!rom || !ram || !vram || !cram || !charset || !sprites || !palette) {
-        fprintf(stderr, "ERROR: Memory allocation failed\n");
-        memory_cleanup();
+    // Create it if needed (one level, like a cache under the working directory)
+    struct stat st;
+    if (stat(rom_cache_dir, &st) != 0) {
+        MKDIR(rom_cache_dir, 0755);
+    }
+}
+
+// Write the loaded ROMs as a packed image
+bool memory_write_pack(const PacmanMachine *m, const char *path) {
+    if (!m->memory_initialized) {
         return false;
     }
-    
+    return write_rom_image(m, path, 0);
+}
+
+// Set up default memory contents and placeholder graphics
+static void memory_init_defaults(PacmanMachine *m) {
     // Initialize memory to prevent uninitialized access
-    memset(rom, 0, ROM_SIZE);
-    printf("Memory allocation successful, initializing...\n");
-    
-    // Clear memory
-    memset(ram, 0, RAM_SIZE);
-    memset(vram, 0, VRAM_SIZE);
-    memset(cram, 0, CRAM_SIZE);
-    memset(io_ports, 0, sizeof(io_ports));
+    memset(m->rom, 0, ROM_SIZE);
+    memory_clear(m);
     
     // Initialize character set with better patterns for our test ROM
     // First character (0) is space - all zeros
-    memset(&charset[0], 0, 8);
+    memset(&m->charset[0], 0, 8);
     
     // Character 1 (H) - Simple H pattern
-    charset[1*8+0] = 0xC3; // 11000011
-    charset[1*8+1] = 0xC3; // 11000011
-    charset[1*8+2] = 0xC3; // 11000011
-    charset[1*8+3] = 0xFF; // 11111111
-    charset[1*8+4] = 0xFF; // 11111111
-    charset[1*8+5] = 0xC3; // 11000011
-    charset[1*8+6] = 0xC3; // 11000011
-    charset[1*8+7] = 0xC3; // 11000011
+    m->charset[1*8+0] = 0xC3; // 11000011
+    m->charset[1*8+1] = 0xC3; // 11000011
+    m->charset[1*8+2] = 0xC3; // 11000011
+    m->charset[1*8+3] = 0xFF; // 11111111
+    m->charset[1*8+4] = 0xFF; // 11111111
+    m->charset[1*8+5] = 0xC3; // 11000011
+    m->charset[1*8+6] = 0xC3; // 11000011
+    m->charset[1*8+7] = 0xC3; // 11000011
     
     // Character 2 (E) - Simple E pattern
-    charset[2*8+0] = 0xFF; // 11111111
-    charset[2*8+1] = 0xFF; // 11111111
-    charset[2*8+2] = 0xC0; // 11000000
-    charset[2*8+3] = 0xFF; // 11111111
-    charset[2*8+4] = 0xFF; // 11111111
-    charset[2*8+5] = 0xC0; // 11000000
-    charset[2*8+6] = 0xFF; // 11111111
-    charset[2*8+7] = 0xFF; // 11111111
+    m->charset[2*8+0] = 0xFF; // 11111111
+    m->charset[2*8+1] = 0xFF; // 11111111
+    m->charset[2*8+2] = 0xC0; // 11000000
+    m->charset[2*8+3] = 0xFF; // 11111111
+    m->charset[2*8+4] = 0xFF; // 11111111
+    m->charset[2*8+5] = 0xC0; // 11000000
+    m->charset[2*8+6] = 0xFF; // 11111111
+    m->charset[2*8+7] = 0xFF; // 11111111
     
     // Character 3 (L) - Simple L pattern
-    charset[3*8+0] = 0xC0; // 11000000
-    charset[3*8+1] = 0xC0; // 11000000
-    charset[3*8+2] = 0xC0; // 11000000
-    charset[3*8+3] = 0xC0; // 11000000
-    charset[3*8+4] = 0xC0; // 11000000
-    charset[3*8+5] = 0xC0; // 11000000
-    charset[3*8+6] = 0xFF; // 11111111
-    charset[3*8+7] = 0xFF; // 11111111
+    m->charset[3*8+0] = 0xC0; // 11000000
+    m->charset[3*8+1] = 0xC0; // 11000000
+    m->charset[3*8+2] = 0xC0; // 11000000
+    m->charset[3*8+3] = 0xC0; // 11000000
+    m->charset[3*8+4] = 0xC0; // 11000000
+    m->charset[3*8+5] = 0xC0; // 11000000
+    m->charset[3*8+6] = 0xFF; // 11111111
+    m->charset[3*8+7] = 0xFF; // 11111111
     
     // Character 4 (O) - Simple O pattern
-    charset[4*8+0] = 0x7E; // 01111110
-    charset[4*8+1] = 0xFF; // 11111111
-    charset[4*8+2] = 0xC3; // 11000011
-    charset[4*8+3] = 0xC3; // 11000011
-    charset[4*8+4] = 0xC3; // 11000011
-    charset[4*8+5] = 0xC3; // 11000011
-    charset[4*8+6] = 0xFF; // 11111111
-    charset[4*8+7] = 0x7E; // 01111110
+    m->charset[4*8+0] = 0x7E; // 01111110
+    m->charset[4*8+1] = 0xFF; // 11111111
+    m->charset[4*8+2] = 0xC3; // 11000011
+    m->charset[4*8+3] = 0xC3; // 11000011
+    m->charset[4*8+4] = 0xC3; // 11000011
+    m->charset[4*8+5] = 0xC3; // 11000011
+    m->charset[4*8+6] = 0xFF; // 11111111
+    m->charset[4*8+7] = 0x7E; // 01111110
     
     // Character 5 (W) - Simple W pattern
-    charset[5*8+0] = 0xC3; // 11000011
-    charset[5*8+1] = 0xC3; // 11000011
-    charset[5*8+2] = 0xC3; // 11000011
-    charset[5*8+3] = 0xC3; // 11000011
-    charset[5*8+4] = 0xDB; // 11011011
-    charset[5*8+5] = 0xFF; // 11111111
-    charset[5*8+6] = 0x66; // 01100110
-    charset[5*8+7] = 0x24; // 00100100
+    m->charset[5*8+0] = 0xC3; // 11000011
+    m->charset[5*8+1] = 0xC3; // 11000011
+    m->charset[5*8+2] = 0xC3; // 11000011
+    m->charset[5*8+3] = 0xC3; // 11000011
+    m->charset[5*8+4] = 0xDB; // 11011011
+    m->charset[5*8+5] = 0xFF; // 11111111
+    m->charset[5*8+6] = 0x66; // 01100110
+    m->charset[5*8+7] = 0x24; // 00100100
     
     // Character 6 (R) - Simple R pattern
-    charset[6*8+0] = 0xFC; // 11111100
-    charset[6*8+1] = 0xFE; // 11111110
-    charset[6*8+2] = 0xC3; // 11000011
-    charset[6*8+3] = 0xFE; // 11111110
-    charset[6*8+4] = 0xFC; // 11111100
-    charset[6*8+5] = 0xDE; // 11011110
-    charset[6*8+6] = 0xCF; // 11001111
-    charset[6*8+7] = 0xC7; // 11000111
+    m->charset[6*8+0] = 0xFC; // 11111100
+    m->charset[6*8+1] = 0xFE; // 11111110
+    m->charset[6*8+2] = 0xC3; // 11000011
+    m->charset[6*8+3] = 0xFE; // 11111110
+    m->charset[6*8+4] = 0xFC; // 11111100
+    m->charset[6*8+5] = 0xDE; // 11011110
+    m->charset[6*8+6] = 0xCF; // 11001111
+    m->charset[6*8+7] = 0xC7; // 11000111
     
     // Character 7 (D) - Simple D pattern
-    charset[7*8+0] = 0xFC; // 11111100
-    charset[7*8+1] = 0xFE; // 11111110
-    charset[7*8+2] = 0xC3; // 11000011
-    charset[7*8+3] = 0xC3; // 11000011
-    charset[7*8+4] = 0xC3; // 11000011
-    charset[7*8+5] = 0xC3; // 11000011
-    charset[7*8+6] = 0xFE; // 11111110
-    charset[7*8+7] = 0xFC; // 11111100
+    m->charset[7*8+0] = 0xFC; // 11111100
+    m->charset[7*8+1] = 0xFE; // 11111110
+    m->charset[7*8+2] = 0xC3; // 11000011
+    m->charset[7*8+3] = 0xC3; // 11000011
+    m->charset[7*8+4] = 0xC3; // 11000011
+    m->charset[7*8+5] = 0xC3; // 11000011
+    m->charset[7*8+6] = 0xFE; // 11111110
+    m->charset[7*8+7] = 0xFC; // 11111100
     
     // Fill the rest with simple patterns
     for (int i = 8; i < 256; i++) {
         for (int j = 0; j < 8; j++) {
-            charset[i * 8 + j] = ((i + j) % 8) ? 0x00 : 0xFF;
+            m->charset[i * 8 + j] = ((i + j) % 8) ? 0x00 : 0xFF;
         }
     }
     
     // Clear sprite data
-    memset(sprites, 0, 64 * 16);
+    memset(m->sprites, 0, 64 * 16);
+    
+    // Flat waveforms (the 4-bit midpoint) until a sound PROM is loaded
+    memset(m->sound_prom, 0x08, SOUND_PROM_SIZE);
     
     // Initialize palette with default colors
     for (int i = 0; i < 256; i++) {
-        palette[i] = 0xFF000000 | // Alpha
+        m->palette[i] = 0xFF000000 | // Alpha
                     ((i & 4) ? 0xFF0000 : 0) | // Red
                     ((i & 2) ? 0x00FF00 : 0) | // Green
                     ((i & 1) ? 0x0000FF : 0);  // Blue
     }
     
+    m->rom_flags = 0;
+    m->memory_initialized = true;
+    
+    // Charset, palette and tile RAM were all rewritten
+    gfx_decode(m);
+    video_invalidate(m);
+}
+
+// Initialize memory from a ROM path: a MAME set directory or zip, a packed
+// image (see memory_write_pack) or a single 16KB program ROM (legacy support)
+bool memory_init(PacmanMachine *m, const char *rom_path) {
     // Load ROM file - first check if it's a directory or a single file
     struct stat path_stat;
-    stat(rom_path, &path_stat);
-    
-    if (S_ISDIR(path_stat.st_mode)) {
+    if (stat(rom_path, &path_stat) == 0 && S_ISDIR(path_stat.st_mode)) {
         // It's a directory, try to load MAME ROM set
-        return memory_init_mame_set(rom_path);
+        m->memory_initialized = false;
+        return memory_init_mame_set(m, rom_path);
     }
     
-    // It's a file, try to load as a single ROM
-    if (!load_rom_file(rom_path, rom, ROM_SIZE)) {
-        fprintf(stderr, "Failed to load ROM file\n");
+    MappedFile file;
+    if (!romset_map(rom_path, &file)) {
+        memory_init_defaults(m);
+        LOG_ERROR(LOG_CAT_MEMORY, "Failed to open ROM file: %s", rom_path);
         return false;
     }
     
-    return true;
-}
-
-// Initialize memory with MAME ROM set
-bool memory_init_mame_set(const char *rom_dir) {
-    if (!rom || !ram || !vram || !cram || !charset || !sprites || !palette) {
-        // Memory not allocated yet, initialize it
-        if (!memory_init("/dev/null")) {
-            return false;
-        }
+    // A zip holds a MAME set
+    if (file.size >= 4 && memcmp(file.data, "PK\3\4", 4) == 0) {
+        romset_unmap(&file);
+        m->memory_initialized = false;
+        return memory_init_mame_set(m, rom_path);
     }
     
-    printf("Loading ROMs from directory: %s\n", rom_dir);
-    
-    // Load program ROMs
-    char *path;
-    bool success = true;
-    
-    debug_log("===== Loading Pacman ROM set from: %s =====", rom_dir);
-    
-    // Debug - make sure all memory is initialized properly
-    debug_log("Memory pointer check: ROM=%p, RAM=%p, VRAM=%p, CRAM=%p, charset=%p, sprites=%p, palette=%p",
-              rom, ram, vram, cram, charset, sprites, palette);
-    
-    // Pacman program ROM 1
-    path = build_path(rom_dir, pacman_roms.program1);
-    debug_log("Checking for ROM: %s", path);
-    if (file_exists(path)) {
-        debug_log("Loading ROM: %s", path);
-        success &= load_rom_file(path, rom, ROM_PACMAN1);
-        if (success) {
-            debug_log("ROM 1 loaded successfully");
-        } else {
-            debug_log("ERROR: Failed to load ROM 1");
+    // A packed image is copied straight in, already decoded
+    uint32_t magic = 0;
+    if (file.size >= sizeof(magic)) {
+        memcpy(&magic, file.data, sizeof(magic));
+    }
+    if (magic == ROM_IMAGE_MAGIC) {
+        bool loaded = load_rom_image(m, &file, NULL);
+        romset_unmap(&file);
+        if (!loaded) {
+            memory_init_defaults(m);
+            LOG_ERROR(LOG_CAT_MEMORY, "Failed to load packed ROM image: %s", rom_path);
         }
-    } else {
-        debug_log("ERROR: Program ROM not found: %s", path);
-        success = false;
+        return loaded;
     }
-    free(path);
     
-    // Pacman program ROM 2
-    path = build_path(rom_dir, pacman_roms.program2);
-    printf("Checking for ROM: %s\n", path);
-    if (file_exists(path)) {
-        printf("Loading ROM: %s\n", path);
-        success &= load_rom_file(path, rom + ROM_PACMAN1, ROM_PACMAN2);
-    } else {
-        fprintf(stderr, "Program ROM not found: %s\n", path);
-        success = false;
+    // It's a file, load it as a single ROM
+    memory_init_defaults(m);
+    size_t read_size = file.size < ROM_SIZE ? file.size : ROM_SIZE;
+    memcpy(m->rom, file.data, read_size);
+    romset_unmap(&file);
+    LOG_DEBUG(LOG_CAT_MEMORY, "Read %zu bytes from %s", read_size, rom_path);
+    
+    if (read_size < ROM_SIZE) {
+        LOG_WARN(LOG_CAT_MEMORY, "ROM file size mismatch: %s - expected %d bytes, read %zu bytes",
+                rom_path, ROM_SIZE, read_size);
+        // Pad with 0xFF (RST 38h opcode)
+        memset(m->rom + read_size, 0xFF, ROM_SIZE - read_size);
+        LOG_INFO(LOG_CAT_MEMORY, "ROM padded to full size with 0xFF bytes");
     }
-    free(path);
     
-    // Pacman program ROM 3
-    path = build_path(rom_dir, pacman_roms.program3);
-    printf("Checking for ROM: %s\n", path);
-    if (file_exists(path)) {
-        printf("Loading ROM: %s\n", path);
-        success &= load_rom_file(path, rom + ROM_PACMAN1 + ROM_PACMAN2, ROM_PACMAN3);
-    } else {
-        fprintf(stderr, "Program ROM not found: %s\n", path);
-        success = false;
+    return true;
+}
+
+// A file the set has but that could not be read (damaged zip entry)
+static bool set_file_damaged(RomSource *src, const char *name) {
+    size_t size;
+    uint32_t crc;
+    return romset_stat(src, name, &size, &crc);
+}
+
+// Load and decode a MAME set. complete is cleared when an optional file was
+// there but could not be read, so that the result is not cached.
+static bool load_mame_set(PacmanMachine *m, RomSource *src, bool *complete) {
+    if (!m->memory_initialized) {
+        // Memory not initialized yet, set up the defaults
+        memory_init_defaults(m);
     }
-    free(path);
     
-    // Pacman program ROM 4
-    path = build_path(rom_dir, pacman_roms.program4);
-    printf("Checking for ROM: %s\n", path);
-    if (file_exists(path)) {
-        printf("Loading ROM: %s\n", path);
-        success &= load_rom_file(path, rom + ROM_PACMAN1 + ROM_PACMAN2 + ROM_PACMAN3, ROM_PACMAN4);
-    } else {
-        fprintf(stderr, "Program ROM not found: %s\n", path);
-        success = false;
+    // Load program ROMs
+    bool success = true;
+    const char *programs[] = {
+        pacman_roms.program1, pacman_roms.program2, pacman_roms.program3, pacman_roms.program4
+    };
+    const size_t program_sizes[] = { ROM_PACMAN1, ROM_PACMAN2, ROM_PACMAN3, ROM_PACMAN4 };
+    size_t offset = 0;
+    for (int i = 0; i < 4; i++) {
+        if (read_set_file(src, programs[i], m->rom + offset, program_sizes[i])) {
+            LOG_INFO(LOG_CAT_MEMORY, "ROM %d loaded successfully", i + 1);
+        } else {
+            LOG_ERROR(LOG_CAT_MEMORY, "Program ROM not found or unreadable: %s", programs[i]);
+            success = false;
+        }
+        offset += program_sizes[i];
     }
-    free(path);
     
     // Load graphics ROMs
-    uint8_t *temp_buffer = (uint8_t *)malloc(0x1000); // Temp buffer for gfx ROMs
-    if (!temp_buffer) {
-        fprintf(stderr, "Failed to allocate temporary buffer\n");
-        return false;
-    }
+    uint8_t temp_buffer[0x1000];
     
     // Character ROM (gfx1)
-    path = build_path(rom_dir, pacman_roms.gfx1);
-    printf("Checking for character ROM: %s\n", path);
-    if (file_exists(path)) {
-        printf("Loading character ROM: %s\n", path);
-        if (load_rom_file(path, temp_buffer, 0x1000)) {
-            // Convert from MAME format to our format
-            for (int i = 0; i < 256; i++) {
-                for (int j = 0; j < 8; j++) {
-                    charset[i * 8 + j] = temp_buffer[i * 16 + j];
-                }
+    if (read_set_file(src, pacman_roms.gfx1, temp_buffer, sizeof(temp_buffer))) {
+        // Convert from MAME format to our format
+        for (int i = 0; i < 256; i++) {
+            for (int j = 0; j < 8; j++) {
+                m->charset[i * 8 + j] = temp_buffer[i * 16 + j];
             }
-            printf("Character ROM loaded successfully\n");
-        } else {
-            success = false;
-            printf("Failed to load character ROM\n");
         }
+        LOG_INFO(LOG_CAT_MEMORY, "Character ROM loaded successfully");
+    } else if (set_file_damaged(src, pacman_roms.gfx1)) {
+        success = false;
+        LOG_WARN(LOG_CAT_MEMORY, "Failed to load character ROM");
     } else {
-        fprintf(stderr, "Graphics ROM not found: %s\n", path);
         // Not fatal, we'll use placeholder graphics
-        printf("Using placeholder character graphics\n");
+        LOG_WARN(LOG_CAT_MEMORY, "Graphics ROM not found: %s", pacman_roms.gfx1);
+        LOG_INFO(LOG_CAT_MEMORY, "Using placeholder character graphics");
     }
-    free(path);
     
     // Sprite ROM (gfx2)
-    path = build_path(rom_dir, pacman_roms.gfx2);
-    printf("Checking for sprite ROM: %s\n", path);
-    if (file_exists(path)) {
-        printf("Loading sprite ROM: %s\n", path);
-        if (load_rom_file(path, temp_buffer, 0x1000)) {
-            // Convert from MAME format to our format
-            for (int i = 0; i < 64; i++) {
-                for (int j = 0; j < 16; j++) {
-                    sprites[i * 16 + j] = temp_buffer[i * 16 + j];
-                }
+    if (read_set_file(src, pacman_roms.gfx2, temp_buffer, sizeof(temp_buffer))) {
+        // Convert from MAME format to our format
+        for (int i = 0; i < 64; i++) {
+            for (int j = 0; j < 16; j++) {
+                m->sprites[i * 16 + j] = temp_buffer[i * 16 + j];
             }
-            printf("Sprite ROM loaded successfully\n");
-        } else {
-            success = false;
-            printf("Failed to load sprite ROM\n");
         }
+        LOG_INFO(LOG_CAT_MEMORY, "Sprite ROM loaded successfully");
+    } else if (set_file_damaged(src, pacman_roms.gfx2)) {
+        success = false;
+        LOG_WARN(LOG_CAT_MEMORY, "Failed to load sprite ROM");
     } else {
-        fprintf(stderr, "Graphics ROM not found: %s\n", path);
         // Not fatal, we'll use placeholder graphics
-        printf("Using placeholder sprite graphics\n");
+        LOG_WARN(LOG_CAT_MEMORY, "Graphics ROM not found: %s", pacman_roms.gfx2);
+        LOG_INFO(LOG_CAT_MEMORY, "Using placeholder sprite graphics");
     }
-    free(path);
     
-    free(temp_buffer);
+    // Expand the graphics ROMs into per-pixel pens once, up front
+    gfx_decode(m);
     
     // Load palette PROM
     uint8_t palette_prom[32];
-    path = build_path(rom_dir, pacman_roms.palette);
-    printf("Checking for palette PROM: %s\n", path);
-    if (file_exists(path)) {
-        printf("Loading palette PROM: %s\n", path);
-        if (load_rom_file(path, palette_prom, 32)) {
-            // Convert palette PROM to RGBA
-            for (int i = 0; i < 32; i++) {
-                uint8_t c = palette_prom[i];
-                uint8_t r = (c & 0x07) * 36;  // 3 bits of red
-                uint8_t g = ((c >> 3) & 0x07) * 36; // 3 bits of green
-                uint8_t b = ((c >> 6) & 0x03) * 85; // 2 bits of blue
-                palette[i] = 0xFF000000 | (r << 16) | (g << 8) | b;
-            }
-            printf("Palette PROM loaded successfully\n");
-        } else {
-            // Not fatal, we'll use default palette
-            printf("Using default color palette (load failed)\n");
+    if (read_set_file(src, pacman_roms.palette, palette_prom, sizeof(palette_prom))) {
+        // Convert palette PROM to RGBA
+        for (int i = 0; i < 32; i++) {
+            uint8_t c = palette_prom[i];
+            uint8_t r = (c & 0x07) * 36;  // 3 bits of red
+            uint8_t g = ((c >> 3) & 0x07) * 36; // 3 bits of green
+            uint8_t b = ((c >> 6) & 0x03) * 85; // 2 bits of blue
+            m->palette[i] = 0xFF000000 | (r << 16) | (g << 8) | b;
         }
+        LOG_INFO(LOG_CAT_MEMORY, "Palette PROM loaded successfully");
+    } else if (set_file_damaged(src, pacman_roms.palette)) {
+        // Not fatal, we'll use default palette
+        *complete = false;
+        LOG_WARN(LOG_CAT_MEMORY, "Using default color palette (load failed)");
     } else {
-        fprintf(stderr, "Palette PROM not found: %s\n", path);
         // Not fatal, we'll use default palette
-        printf("Using default color palette (file not found)\n");
+        LOG_WARN(LOG_CAT_MEMORY, "Palette PROM not found: %s", pacman_roms.palette);
+        LOG_INFO(LOG_CAT_MEMORY, "Using default color palette (file not found)");
+    }
+    
+    // Load sound PROM (8 waveforms of 32 4-bit samples)
+    if (read_set_file(src, pacman_roms.sound, m->sound_prom, SOUND_PROM_SIZE)) {
+        // Only the low nibble is wired to the DAC
+        for (int i = 0; i < SOUND_PROM_SIZE; i++) {
+            m->sound_prom[i] &= 0x0F;
+        }
+        LOG_INFO(LOG_CAT_MEMORY, "Sound PROM loaded successfully");
+    } else {
+        // Not fatal, the game just runs silently
+        memset(m->sound_prom, 0x08, SOUND_PROM_SIZE);
+        if (set_file_damaged(src, pacman_roms.sound)) {
+            *complete = false;
+            LOG_WARN(LOG_CAT_MEMORY, "Failed to load sound PROM, sound will be silent");
+        } else {
+            LOG_WARN(LOG_CAT_MEMORY, "Sound PROM not found: %s", pacman_roms.sound);
+        }
     }
-    free(path);
     
     // Print final status
-    printf("ROM loading %s\n", success ? "succeeded" : "failed");
+    LOG_INFO(LOG_CAT_MEMORY, "ROM loading %s", success ? "succeeded" : "failed");
     
     // Initialize palette with standard Pacman colors since we're missing the palette PROM
-    debug_log("Setting up default Pacman colors since palette PROM is missing");
+    LOG_INFO(LOG_CAT_MEMORY, "Setting up default Pacman colors since palette PROM is missing");
     
     // Standard Pacman colors (approximately)
     const uint32_t pacman_colors[] = {
@@ -515,234 +504,238 @@ bool memory_init_mame_set(const char *rom_dir) {
     
     // Set all 32 palette entries (16 colors repeated)
     for (int i = 0; i < 32; i++) {
-        if (palette) {
-            palette[i] = pacman_colors[i % 16];
-            debug_log("Set palette[%d] = 0x%08X", i, palette[i]);
-        }
+        m->palette[i] = pacman_colors[i % 16];
+        LOG_DEBUG(LOG_CAT_MEMORY, "Set palette[%d] = 0x%08X", i, m->palette[i]);
     }
     
     // Always call memory_reset to set up default sprite positions and other state
-    printf("Initializing memory defaults\n");
-    memory_reset();
+    m->rom_flags = ROM_IMAGE_MAME_SET;
+    LOG_INFO(LOG_CAT_MEMORY, "Initializing memory defaults");
+    memory_reset(m);
     
     return success;
 }
 
-// Clean up memory
-void memory_cleanup(void) {
-    debug_log("Cleaning up memory resources");
+// Initialize memory with a MAME ROM set, from a directory or a zip. With a
+// ROM cache the decoded set is copied from the cache when it is there, and
+// written to it when it is not.
+bool memory_init_mame_set(PacmanMachine *m, const char *rom_dir) {
+    LOG_INFO(LOG_CAT_MEMORY, "===== Loading Pacman ROM set from: %s =====", rom_dir);
     
-    if (rom) {
-        debug_log("Freeing ROM memory");
-        free(rom);
-    }
-    if (ram) {
-        debug_log("Freeing RAM memory");
-        free(ram);
-    }
-    if (vram) {
-        debug_log("Freeing VRAM memory");
-        free(vram);
-    }
-    if (cram) {
-        debug_log("Freeing CRAM memory");
-        free(cram);
-    }
-    if (charset) {
-        debug_log("Freeing charset memory");
-        free(charset);
-    }
-    if (sprites) {
-        debug_log("Freeing sprites memory");
-        free(sprites);
+    RomSource *src = romset_open(rom_dir);
+    if (!src) {
+        if (!m->memory_initialized) {
+            memory_init_defaults(m);
+        }
+        LOG_ERROR(LOG_CAT_MEMORY, "Not a ROM set directory or zip: %s", rom_dir);
+        return false;
     }
-    if (palette) {
-        debug_log("Freeing palette memory");
-        free(palette);
+    
+    // Warm start: one mapping of the cache file
+    char cache_path[1100];
+    uint32_t key = 0;
+    if (rom_cache_dir[0]) {
+        key = rom_set_key(src);
+        rom_cache_path(cache_path, sizeof(cache_path), key);
+        
+        MappedFile file;
+        if (romset_map(cache_path, &file)) {
+            bool loaded = load_rom_image(m, &file, &key);
+            romset_unmap(&file);
+            if (loaded) {
+                LOG_INFO(LOG_CAT_MEMORY, "Loaded decoded ROMs from cache: %s", cache_path);
+                romset_close(src);
+                return true;
+            }
+        }
     }
     
-    rom = NULL;
-    ram = NULL;
-    vram = NULL;
-    cram = NULL;
-    charset = NULL;
-    sprites = NULL;
-    palette = NULL;
+    bool complete = true;
+    bool success = load_mame_set(m, src, &complete);
+    romset_close(src);
     
-    // Close debug log file if open
-    if (debug_file) {
-        debug_log("Closing debug log file");
-        fclose(debug_file);
-        debug_file = NULL;
+    // Only sets that loaded cleanly are worth keeping
+    if (success && complete && rom_cache_dir[0] && write_rom_image(m, cache_path, key)) {
+        LOG_INFO(LOG_CAT_MEMORY, "Wrote decoded ROMs to cache: %s", cache_path);
     }
+    return success;
+}
+
+// Clean up memory
+void memory_cleanup(PacmanMachine *m) {
+    LOG_INFO(LOG_CAT_MEMORY, "Cleaning up memory resources");
+    
+    // All memory lives inside the machine, just mark it as unloaded
+    m->memory_initialized = false;
 }
 
 // Reset memory to initial state
-void memory_reset(void) {
-    if (ram) memset(ram, 0, RAM_SIZE);
-    if (vram) memset(vram, 0, VRAM_SIZE);
-    if (cram) memset(cram, 0, CRAM_SIZE);
-    memset(io_ports, 0, sizeof(io_ports));
+void memory_reset(PacmanMachine *m) {
+    memset(m->ram, 0, RAM_SIZE);
+    memset(m->vram, 0, VRAM_SIZE);
+    memset(m->cram, 0, CRAM_SIZE);
+    memset(m->io_ports, 0, sizeof(m->io_ports));
+    sound_reset(m);
+    video_invalidate(m);
     
     // Initialize some values for testing
-    interrupt_enable = 1;  // Enable interrupts by default for testing
-    sound_enable = 1;      // Enable sound
-    flip_screen = 0;       // No screen flip
-    
-    // Set some default sprite values near the end of VRAM
-    if (vram && VRAM_SIZE >= 0x1000) {
-        // Set sprite 0 (Pacman)
-        vram[0xFF0] = 0 << 2;  // Sprite 0, no flip
-        vram[0xFF1] = 6;       // Yellow color
-        
-        // Set sprite 1 (Ghost 1)
-        vram[0xFF2] = 1 << 2;  // Sprite 1, no flip
-        vram[0xFF3] = 4;       // Red color
-        
-        // Set sprite 2 (Ghost 2)
-        vram[0xFF4] = 2 << 2;  // Sprite 2, no flip
-        vram[0xFF5] = 1;       // Blue color
-        
-        // Set sprite 3 (Ghost 3)
-        vram[0xFF6] = 3 << 2;  // Sprite 3, no flip
-        vram[0xFF7] = 2;       // Green color
-    }
+    m->interrupt_enable = 1;  // Enable interrupts by default for testing
+    m->sound_enable = 1;      // Enable sound
+    m->flip_screen = 0;       // No screen flip
+    
+    // Set some default sprite values in the sprite area at the end of work RAM
+    uint8_t *sprite_attr = &m->ram[SPRITES_START - WRAM_START];
+    
+    // Set sprite 0 (Pacman)
+    sprite_attr[0] = 0 << 2;  // Sprite 0, no flip
+    sprite_attr[1] = 6;       // Yellow color
+    
+    // Set sprite 1 (Ghost 1)
+    sprite_attr[2] = 1 << 2;  // Sprite 1, no flip
+    sprite_attr[3] = 4;       // Red color
+    
+    // Set sprite 2 (Ghost 2)
+    sprite_attr[4] = 2 << 2;  // Sprite 2, no flip
+    sprite_attr[5] = 1;       // Blue color
+    
+    // Set sprite 3 (Ghost 3)
+    sprite_attr[6] = 3 << 2;  // Sprite 3, no flip
+    sprite_attr[7] = 2;       // Green color
     
     // Set default sprite positions in I/O ports with different positions for each
-    io_ports[0x60] = 100;      // Sprite 0 X
-    io_ports[0x61] = 100;      // Sprite 0 Y
-    io_ports[0x62] = 150;      // Sprite 1 X
-    io_ports[0x63] = 100;      // Sprite 1 Y
-    io_ports[0x64] = 100;      // Sprite 2 X
-    io_ports[0x65] = 150;      // Sprite 2 Y
-    io_ports[0x66] = 150;      // Sprite 3 X
-    io_ports[0x67] = 150;      // Sprite 3 Y
-    io_ports[0x68] = 80;       // Sprite 4 X
-    io_ports[0x69] = 80;       // Sprite 4 Y
-    io_ports[0x6A] = 170;      // Sprite 5 X
-    io_ports[0x6B] = 80;       // Sprite 5 Y
-    io_ports[0x6C] = 80;       // Sprite 6 X
-    io_ports[0x6D] = 170;      // Sprite 6 Y
-    io_ports[0x6E] = 170;      // Sprite 7 X
-    io_ports[0x6F] = 170;      // Sprite 7 Y
-    
-    debug_log("IO ports for sprite positions initialized: 0x60-0x6F");
-}
-
-// Read a byte from memory (based on MAME pacman_map implementation)
-uint8_t memory_read_byte(uint16_t address) {
+    m->io_ports[0x60] = 100;      // Sprite 0 X
+    m->io_ports[0x61] = 100;      // Sprite 0 Y
+    m->io_ports[0x62] = 150;      // Sprite 1 X
+    m->io_ports[0x63] = 100;      // Sprite 1 Y
+    m->io_ports[0x64] = 100;      // Sprite 2 X
+    m->io_ports[0x65] = 150;      // Sprite 2 Y
+    m->io_ports[0x66] = 150;      // Sprite 3 X
+    m->io_ports[0x67] = 150;      // Sprite 3 Y
+    m->io_ports[0x68] = 80;       // Sprite 4 X
+    m->io_ports[0x69] = 80;       // Sprite 4 Y
+    m->io_ports[0x6A] = 170;      // Sprite 5 X
+    m->io_ports[0x6B] = 80;       // Sprite 5 Y
+    m->io_ports[0x6C] = 80;       // Sprite 6 X
+    m->io_ports[0x6D] = 170;      // Sprite 6 Y
+    m->io_ports[0x6E] = 170;      // Sprite 7 X
+    m->io_ports[0x6F] = 170;      // Sprite 7 Y
+    
+    LOG_INFO(LOG_CAT_MEMORY, "IO ports for sprite positions initialized: 0x60-0x6F");
+}
+
+// Point the bus page tables at this machine's memory
+void memory_map_pages(PacmanMachine *m) {
     // Memory map (based on MAME documentation):
     // 0000-3FFF: ROM (16KB)
     // 4000-43FF: Video RAM (1KB)
     // 4400-47FF: Color RAM (1KB)
     // 4800-4FFF: Work RAM (2KB)
-    // 5000-5FFF: I/O Ports
-    
-    if (address <= ROM_END) {
-        // ROM (0x0000-0x3FFF)
-        return rom[address];
-    } else if (address >= VRAM_START && address <= VRAM_END) {
-        // Video RAM (0x4000-0x43FF)
-        return vram[address - VRAM_START];
-    } else if (address >= CRAM_START && address <= CRAM_END) {
-        // Color RAM (0x4400-0x47FF)
-        return cram[address - CRAM_START];
-    } else if (address >= WRAM_START && address <= WRAM_END) {
-        // Work RAM (0x4800-0x4FFF)
-        return ram[address - WRAM_START];
-    } else if (address == IO_IN0) {
-        // Input port 0 (0x5000) - Player 1 controls, coin, service
-        return io_read_byte(address & 0xFF);
-    } else if (address == IO_IN1) {
-        // Input port 1 (0x5040) - Player 2 controls
-        return io_read_byte(address & 0xFF);
-    } else if (address == IO_DSW1) {
-        // DIP switches 1 (0x5080) - Game settings
-        return io_read_byte(address & 0xFF);
-    } else if (address == IO_DSW2) {
-        // DIP switches 2 (0x50C0) - Only on some games
-        return io_read_byte(address & 0xFF);
-    } else if (address >= 0x5000 && address <= 0x50FF) {
-        // Other I/O ports (I/O range is 0x5000-0x50FF)
-        return io_read_byte(address & 0xFF);
+    // 5000-50FF: I/O Ports (handled in code)
+    // Everything else is unmapped: reads return 0xFF, writes are ignored
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        m->read_pages[page] = NULL;
+        m->write_pages[page] = NULL;
+    }
+    
+    for (int page = 0; page < (ROM_SIZE >> MEM_PAGE_SHIFT); page++) {
+        // ROM is read-only, writes fall through to the handler and are ignored
+        m->read_pages[(ROM_START >> MEM_PAGE_SHIFT) + page] = &m->rom[page << MEM_PAGE_SHIFT];
+    }
+    for (int page = 0; page < (VRAM_SIZE >> MEM_PAGE_SHIFT); page++) {
+        // Tile RAM writes go through bus_write_tile_ram() for dirty tracking
+        m->read_pages[(VRAM_START >> MEM_PAGE_SHIFT) + page] = &m->vram[page << MEM_PAGE_SHIFT];
+    }
+    for (int page = 0; page < (CRAM_SIZE >> MEM_PAGE_SHIFT); page++) {
+        m->read_pages[(CRAM_START >> MEM_PAGE_SHIFT) + page] = &m->cram[page << MEM_PAGE_SHIFT];
+    }
+    for (int page = 0; page < ((WRAM_END - WRAM_START + 1) >> MEM_PAGE_SHIFT); page++) {
+        // Only the first 2KB of ram is visible on the bus. Sprite attributes
+        // (0x4FF0-0x4FFF) are plain work RAM as well
+        m->read_pages[(WRAM_START >> MEM_PAGE_SHIFT) + page] = &m->ram[page << MEM_PAGE_SHIFT];
+        m->write_pages[(WRAM_START >> MEM_PAGE_SHIFT) + page] = &m->ram[page << MEM_PAGE_SHIFT];
+    }
+}
+
+// Read from a page without a direct pointer (I/O or unmapped)
+uint8_t memory_read_handler(PacmanMachine *m, uint16_t address) {
+    if ((address >> MEM_PAGE_SHIFT) == (IO_START >> MEM_PAGE_SHIFT)) {
+        // IN0 (0x5000), IN1 (0x5040), DSW1 (0x5080), DSW2 (0x50C0) and
+        // the other I/O locations (I/O range is 0x5000-0x50FF)
+        return io_read_byte(m, address & 0xFF);
     }
     
     // Default for unmapped addresses
-    // printf("Warning: Read from unmapped address: 0x%04X\n", address);
     return 0xFF;
 }
 
-// Write a byte to memory (based on MAME pacman_map implementation)
-void memory_write_byte(uint16_t address, uint8_t value) {
-    if (address <= ROM_END) {
-        // ROM is read-only, ignore writes
+// Write to a page without a direct pointer (ROM, I/O or unmapped)
+void memory_write_handler(PacmanMachine *m, uint16_t address, uint8_t value) {
+    if ((address >> MEM_PAGE_SHIFT) != (IO_START >> MEM_PAGE_SHIFT)) {
+        // ROM is read-only and unmapped space ignores writes
         return;
-    } else if (address >= VRAM_START && address <= VRAM_END) {
-        // Video RAM is writable (0x4000-0x43FF)
-        vram[address - VRAM_START] = value;
-    } else if (address >= CRAM_START && address <= CRAM_END) {
-        // Color RAM is writable (0x4400-0x47FF)
-        cram[address - CRAM_START] = value;
-    } else if (address >= WRAM_START && address <= WRAM_END) {
-        // Work RAM is writable (0x4800-0x4FFF)
-        ram[address - WRAM_START] = value;
-        
-        // Special case: sprite data (0x4FF0-0x4FFF)
-        // In Pacman, 8 pairs of bytes at 0x4FF0-0x4FFF define sprite attributes
-        // First byte: sprite image number (bits 2-7), Y flip (bit 0), X flip (bit 1)
-        // Second byte: color
-    } else if (address == INTERRUPT_EN) {
-        // 0x5000: Interrupt enable
-        interrupt_enable = value & 0x01;
-    } else if (address == SOUND_EN) {
-        // 0x5001: Sound enable
-        sound_enable = value & 0x01;
-    } else if (address == FLIP_SCREEN) {
-        // 0x5003: Flip screen
-        flip_screen = value & 0x01;
-    } else if (address == PLAYER1_LAMP) {
-        // 0x5004: 1 player start lamp
-        lamp1 = value & 0x01;
-    } else if (address == PLAYER2_LAMP) {
-        // 0x5005: 2 players start lamp
-        lamp2 = value & 0x01;
-    } else if (address == COIN_LOCKOUT) {
-        // 0x5006: Coin lockout
-        coin_lockout = value & 0x01;
-    } else if (address == COIN_COUNTER) {
-        // 0x5007: Coin counter
-        coin_counter = value & 0x01;
-    } else if (address >= SOUND_REG_START && address <= SOUND_REG_END) {
-        // 0x5040-0x505F: Sound registers
-        // These registers control the Namco sound hardware
-        io_write_byte((address & 0xFF), value);
-    } else if (address >= SPRITE_COORD && address <= SPRITE_COORD + 0x0F) {
-        // 0x5060-0x506F: Sprite coordinates, x/y pairs for 8 sprites
-        io_write_byte((address & 0xFF), value);
-    } else if (address == WATCHDOG) {
-        // 0x50C0: Watchdog reset
-        watchdog_counter = 0;
-    } else if (address >= 0x5000 && address <= 0x50FF) {
-        // Other I/O ports (I/O range is 0x5000-0x50FF)
-        io_write_byte((address & 0xFF), value);
     }
+    
+    switch (address) {
+        case INTERRUPT_EN:  // 0x5000: Interrupt enable
+            m->interrupt_enable = value & 0x01;
+            if (!m->interrupt_enable) {
+                m->cpu.int_pending = false;  // Also drops a VBLANK IRQ still held
+            }
+            break;
+        case SOUND_EN:      // 0x5001: Sound enable
+            m->sound_enable = value & 0x01;
+            break;
+        case FLIP_SCREEN:   // 0x5003: Flip screen
+            m->flip_screen = value & 0x01;
+            break;
+        case PLAYER1_LAMP:  // 0x5004: 1 player start lamp
+            m->lamp1 = value & 0x01;
+            break;
+        case PLAYER2_LAMP:  // 0x5005: 2 players start lamp
+            m->lamp2 = value & 0x01;
+            break;
+        case COIN_LOCKOUT:  // 0x5006: Coin lockout
+            m->coin_lockout = value & 0x01;
+            break;
+        case COIN_COUNTER:  // 0x5007: Coin counter
+            m->coin_counter = value & 0x01;
+            break;
+        case WATCHDOG:      // 0x50C0: Watchdog reset
+            m->watchdog_counter = 0;
+            break;
+        default:
+            // 0x5040-0x505F sound registers, 0x5060-0x506F sprite
+            // coordinates and the other I/O ports
+            io_write_byte(m, address & 0xFF, value);
+            break;
+    }
+}
+
+// Read a byte from memory through the page table
+uint8_t memory_read_byte(PacmanMachine *m, uint16_t address) {
+    return bus_read_byte(m, address);
+}
+
+// Write a byte to memory through the page table (based on MAME pacman_map)
+void memory_write_byte(PacmanMachine *m, uint16_t address, uint8_t value) {
+    bus_write_byte(m, address, value);
 }
 
 // Read a 16-bit word from memory
-uint16_t memory_read_word(uint16_t address) {
-    uint8_t low = memory_read_byte(address);
-    uint8_t high = memory_read_byte(address + 1);
+uint16_t memory_read_word(PacmanMachine *m, uint16_t address) {
+    uint8_t low = memory_read_byte(m, address);
+    uint8_t high = memory_read_byte(m, address + 1);
     return low | (high << 8);
 }
 
 // Write a 16-bit word to memory
-void memory_write_word(uint16_t address, uint16_t value) {
-    memory_write_byte(address, value & 0xFF);
-    memory_write_byte(address + 1, value >> 8);
+void memory_write_word(PacmanMachine *m, uint16_t address, uint16_t value) {
+    memory_write_byte(m, address, value & 0xFF);
+    memory_write_byte(m, address + 1, value >> 8);
 }
 
 // I/O port read (based on MAME implementation)
-uint8_t io_read_byte(uint8_t port) {
+uint8_t io_read_byte(PacmanMachine *m, uint8_t port) {
     // According to MAME, Pacman has the following I/O reads:
     // 0x5000 - IN0 - Player 1 controls, coin, service
     // 0x5040 - IN1 - Player 2 controls
@@ -759,7 +752,7 @@ uint8_t io_read_byte(uint8_t port) {
             // Bit 5: Start 1
             // Bit 6: Start 2
             // Bit 7: Coin
-            return io_ports[port];
+            return input_read_port1(m);
             
         case (IO_IN1 & 0xFF): // IN1 - Player 2 controls (0x40)
             // Bit 0: UP
@@ -770,7 +763,7 @@ uint8_t io_read_byte(uint8_t port) {
             // Bit 5: Not used
             // Bit 6: Not used
             // Bit 7: Not used
-            return io_ports[port];
+            return input_read_port2(m);
             
         case (IO_DSW1 & 0xFF): // DSW1 - Dipswitch settings (0x80)
             // Bits 0-1: Lives (00 = 1 life, 01 = 2 lives, 10 = 3 lives, 11 = 5 lives)
@@ -778,22 +771,22 @@ uint8_t io_read_byte(uint8_t port) {
             // Bits 3-4: Difficulty (00 = hardest, 11 = easiest)
             // Bits 5-6: Bonus (00 = 10000, 01 = 15000, 10 = 20000, 11 = no bonus)
             // Bit 7: Coin (0 = 1 coin/1 game, 1 = 1 coin/2 games)
-            return io_ports[port];
+            return m->io_ports[port];
             
         case (IO_DSW2 & 0xFF): // DSW2 - Dipswitches on some games (0xC0)
             // Game-specific switches
-            return io_ports[port];
+            return m->io_ports[port];
             
         // Note: Watchdog and DSW2 share the same address (0x50C0)
         // We handle this by priority - DSW2 for reads, Watchdog for writes
             
         default:
-            return io_ports[port];
+            return m->io_ports[port];
     }
 }
 
 // I/O port write (based on MAME implementation)
-void io_write_byte(uint8_t port, uint8_t value) {
+void io_write_byte(PacmanMachine *m, uint8_t port, uint8_t value) {
     // According to MAME, Pacman has the following I/O writes:
     // 0x5000 - Interrupt enable
     // 0x5001 - Sound enable
@@ -809,115 +802,124 @@ void io_write_byte(uint8_t port, uint8_t value) {
     
     switch (port) {
         case (INTERRUPT_EN & 0xFF): // Interrupt enable (0x00)
-            interrupt_enable = value & 0x01;
-            io_ports[port] = value;
+            m->interrupt_enable = value & 0x01;
+            if (!m->interrupt_enable) {
+                m->cpu.int_pending = false;  // Also drops a VBLANK IRQ still held
+            }
+            m->io_ports[port] = value;
             break;
             
         case (SOUND_EN & 0xFF): // Sound enable (0x01)
-            sound_enable = value & 0x01;
-            io_ports[port] = value;
+            m->sound_enable = value & 0x01;
+            m->io_ports[port] = value;
             break;
             
         case (FLIP_SCREEN & 0xFF): // Flip screen (0x03)
-            flip_screen = value & 0x01;
-            io_ports[port] = value;
+            m->flip_screen = value & 0x01;
+            m->io_ports[port] = value;
             break;
             
         case (PLAYER1_LAMP & 0xFF): // Player 1 start lamp (0x04)
-            lamp1 = value & 0x01;
-            io_ports[port] = value;
+            m->lamp1 = value & 0x01;
+            m->io_ports[port] = value;
             break;
             
         case (PLAYER2_LAMP & 0xFF): // Player 2 start lamp (0x05)
-            lamp2 = value & 0x01;
-            io_ports[port] = value;
+            m->lamp2 = value & 0x01;
+            m->io_ports[port] = value;
             break;
             
         case (COIN_LOCKOUT & 0xFF): // Coin lockout (0x06)
-            coin_lockout = value & 0x01;
-            io_ports[port] = value;
+            m->coin_lockout = value & 0x01;
+            m->io_ports[port] = value;
             break;
             
         case (COIN_COUNTER & 0xFF): // Coin counter (0x07)
-            coin_counter = value & 0x01;
-            io_ports[port] = value;
+            m->coin_counter = value & 0x01;
+            m->io_ports[port] = value;
             break;
             
         case (WATCHDOG & 0xFF): // Watchdog reset (0xC0)
-            watchdog_counter = 0;
-            io_ports[port] = value;
+            m->watchdog_counter = 0;
+            m->io_ports[port] = value;
             break;
             
         default:
             // Handle sound registers (0x40-0x5F)
             if (port >= (SOUND_REG_START & 0xFF) && port <= (SOUND_REG_END & 0xFF)) {
-                // Sound voice registers - to implement Namco sound
+                // Sound voice registers
+                sound_write_register(m, port - (SOUND_REG_START & 0xFF), value);
             }
             // Handle sprite coordinates (0x60-0x6F)
             else if (port >= (SPRITE_COORD & 0xFF) && port <= ((SPRITE_COORD & 0xFF) + 0x0F)) {
                 // Sprite coordinates
             }
             
-            io_ports[port] = value;
+            m->io_ports[port] = value;
             break;
     }
 }
 
+// Get access to work RAM (sprite attributes live at its end)
+uint8_t* memory_get_ram(PacmanMachine *m) {
+    return m->ram;
+}
+
 // Get access to VRAM for rendering
-uint8_t* memory_get_vram(void) {
-    return vram;
+uint8_t* memory_get_vram(PacmanMachine *m) {
+    return m->vram;
 }
 
 // Get access to color RAM for rendering
-uint8_t* memory_get_cram(void) {
-    return cram;
+uint8_t* memory_get_cram(PacmanMachine *m) {
+    return m->cram;
 }
 
 // Get access to character ROM
-uint8_t* memory_get_charset(void) {
-    return charset;
+uint8_t* memory_get_charset(PacmanMachine *m) {
+    return m->charset;
 }
 
 // Get access to sprite data
-uint8_t* memory_get_spritedata(void) {
-    return sprites;
+uint8_t* memory_get_spritedata(PacmanMachine *m) {
+    return m->sprites;
 }
 
 // Get access to color palette
-uint32_t* memory_get_palette(void) {
-    return palette;
+uint32_t* memory_get_palette(PacmanMachine *m) {
+    return m->palette;
 }
 
 // Getter functions for hardware flags
-uint8_t memory_get_interrupt_enable(void) {
-    return interrupt_enable;
+uint8_t memory_get_interrupt_enable(PacmanMachine *m) {
+    return m->interrupt_enable;
 }
 
-uint8_t memory_get_sound_enable(void) {
-    return sound_enable;
+uint8_t memory_get_sound_enable(PacmanMachine *m) {
+    return m->sound_enable;
 }
 
-uint8_t memory_get_flip_screen(void) {
-    return flip_screen;
+uint8_t memory_get_flip_screen(PacmanMachine *m) {
+    return m->flip_screen;
 }
 
-uint8_t memory_get_lamp1(void) {
-    return lamp1;
+uint8_t memory_get_lamp1(PacmanMachine *m) {
+    return m->lamp1;
 }
 
-uint8_t memory_get_lamp2(void) {
-    return lamp2;
+uint8_t memory_get_lamp2(PacmanMachine *m) {
+    return m->lamp2;
 }
 
-uint8_t memory_get_coin_lockout(void) {
-    return coin_lockout;
+uint8_t memory_get_coin_lockout(PacmanMachine *m) {
+    return m->coin_lockout;
 }
 
-uint8_t memory_get_coin_counter(void) {
-    return coin_counter;
+uint8_t memory_get_coin_counter(PacmanMachine *m) {
+    return m->coin_counter;
 }
 
 // Set input ports - for external input handling
-void memory_set_input_port(uint8_t port, uint8_t value) {
-    io_ports[port] = value;
+void memory_set_input_port(PacmanMachine *m, uint8_t port, uint8_t value) {
+    m->io_ports[port] = value;
 }
\ No newline at end of file
@@ -0,0 +1,385 @@
+#include "../include/movie.h"
+#include "../include/machine.h"
+#include "../include/video.h"
+#include "../include/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A movie being recorded or replayed
+struct Movie {
+    MovieHeader header;
+    bool recording;
+    char *path;                 // Recording: file written by movie_finish()
+
+    // Entries, without the header
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    size_t pos;                 // Replay: next entry to read
+
+    bool check_framebuffer;     // Record or compare framebuffer hashes
+    long frame;                 // Frames run so far
+    long entry_frame;           // Recording: frame of the last entry; replay: of the next (-1 = none)
+    uint8_t port1, port2;       // Port values as of the last entry
+
+    // Replay results
+    long checks;
+    long mismatches;
+};
+
+// 64-bit FNV-1a over a block of memory
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ bytes[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+// Hash of the board's memory and where the CPU is
+static uint64_t memory_hash(const PacmanMachine *m) {
+    uint64_t h = 14695981039346656037ull;
+    h = hash_bytes(h, m->ram, RAM_SIZE);
+    h = hash_bytes(h, m->vram, VRAM_SIZE);
+    h = hash_bytes(h, m->cram, CRAM_SIZE);
+    uint16_t regs[2] = { m->cpu.pc, m->cpu.sp };
+    return hash_bytes(h, regs, sizeof(regs));
+}
+
+// Hash of the software framebuffer
+static uint64_t framebuffer_hash(const uint32_t *pixels) {
+    return hash_bytes(14695981039346656037ull, pixels, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+}
+
+// Fingerprint of the ROMs a movie belongs to
+uint32_t movie_rom_hash(const PacmanMachine *m) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < ROM_SIZE; i++) {
+        h = (h ^ m->rom[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Append bytes to a recording
+static bool append(Movie *movie, const void *bytes, size_t size) {
+    if (movie->size + size > movie->capacity) {
+        size_t capacity = movie->capacity ? movie->capacity * 2 : 4096;
+        while (capacity < movie->size + size) {
+            capacity *= 2;
+        }
+        uint8_t *data = (uint8_t *)realloc(movie->data, capacity);
+        if (!data) {
+            return false;
+        }
+        movie->data = data;
+        movie->capacity = capacity;
+    }
+    memcpy(movie->data + movie->size, bytes, size);
+    movie->size += size;
+    return true;
+}
+
+// Append a little endian 64-bit value
+static bool append_u64(Movie *movie, uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+    return append(movie, bytes, sizeof(bytes));
+}
+
+// Read bytes of a replayed movie. Returns false past its end.
+static bool read_bytes(Movie *movie, void *bytes, size_t size) {
+    if (movie->size - movie->pos < size) {
+        return false;
+    }
+    memcpy(bytes, movie->data + movie->pos, size);
+    movie->pos += size;
+    return true;
+}
+
+// Read a little endian 64-bit value
+static bool read_u64(Movie *movie, uint64_t *value) {
+    uint8_t bytes[8];
+    if (!read_bytes(movie, bytes, sizeof(bytes))) {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < 8; i++) {
+        *value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return true;
+}
+
+// Read the frame of the next entry (-1 at the end of the movie)
+static bool read_next_frame(Movie *movie) {
+    if (movie->pos == movie->size) {
+        movie->entry_frame = -1;
+        return true;
+    }
+
+    uint64_t gap = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t byte;
+        if (!read_bytes(movie, &byte, 1)) {
+            return false;
+        }
+        gap |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            movie->entry_frame += (long)gap;
+            return movie->entry_frame <= (long)movie->header.frames;
+        }
+    }
+    return false;
+}
+
+// Write down one entry of a recording
+static bool record_entry(Movie *movie, const PacmanMachine *m, uint8_t flags) {
+    // The gap as a varint
+    uint8_t gap[5];
+    int n = 0;
+    uint32_t frames = (uint32_t)(movie->frame - movie->entry_frame);
+    do {
+        gap[n] = frames & 0x7F;
+        frames >>= 7;
+        if (frames) gap[n] |= 0x80;
+        n++;
+    } while (frames);
+    movie->entry_frame = movie->frame;
+
+    const uint32_t *framebuffer = video_get_framebuffer((PacmanMachine *)m);
+    if ((flags & MOVIE_ENTRY_CHECK) && movie->check_framebuffer && framebuffer) {
+        flags |= MOVIE_ENTRY_FRAMEBUFFER;
+    }
+
+    bool ok = append(movie, gap, n) && append(movie, &flags, 1);
+    if (flags & MOVIE_ENTRY_PORT1) {
+        ok = ok && append(movie, &movie->port1, 1);
+    }
+    if (flags & MOVIE_ENTRY_PORT2) {
+        ok = ok && append(movie, &movie->port2, 1);
+    }
+    if (flags & MOVIE_ENTRY_CHECK) {
+        ok = ok && append_u64(movie, memory_hash(m));
+    }
+    if (flags & MOVIE_ENTRY_FRAMEBUFFER) {
+        ok = ok && append_u64(movie, framebuffer_hash(framebuffer));
+    }
+    return ok;
+}
+
+// Report a checkpoint that does not match
+static void diverged(Movie *movie, const char *what) {
+    if (movie->mismatches++ == 0) {
+        LOG_ERROR(LOG_CAT_INPUT, "Replay diverged from the movie at frame %ld (%s)", movie->frame, what);
+    }
+}
+
+// Apply the entries of the current frame of a replay
+static void replay_entries(Movie *movie, PacmanMachine *m) {
+    while (movie->entry_frame == movie->frame) {
+        uint8_t flags;
+        uint64_t memory = 0, framebuffer = 0;
+        bool ok = read_bytes(movie, &flags, 1) &&
+                  (!(flags & MOVIE_ENTRY_PORT1) || read_bytes(movie, &movie->port1, 1)) &&
+                  (!(flags & MOVIE_ENTRY_PORT2) || read_bytes(movie, &movie->port2, 1)) &&
+                  (!(flags & MOVIE_ENTRY_CHECK) || read_u64(movie, &memory)) &&
+                  (!(flags & MOVIE_ENTRY_FRAMEBUFFER) || read_u64(movie, &framebuffer));
+        if (!ok) {
+            diverged(movie, "movie damaged");
+            movie->entry_frame = -1;
+            return;
+        }
+
+        // Framebuffers are only compared when both runs rendered one
+        if (flags & MOVIE_ENTRY_CHECK) {
+            movie->checks++;
+            if (memory_hash(m) != memory) {
+                diverged(movie, "memory");
+            } else if ((flags & MOVIE_ENTRY_FRAMEBUFFER) && movie->check_framebuffer &&
+                       video_get_framebuffer(m) &&
+                       framebuffer_hash(video_get_framebuffer(m)) != framebuffer) {
+                diverged(movie, "framebuffer");
+            }
+        }
+
+        if (!read_next_frame(movie)) {
+            diverged(movie, "movie damaged");
+            movie->entry_frame = -1;
+        }
+    }
+}
+
+// Start recording
+Movie* movie_record(const char *path, const PacmanMachine *m, int verify_interval) {
+    Movie *movie = (Movie *)calloc(1, sizeof(Movie));
+    char *name = (char *)malloc(strlen(path) + 1);
+    if (!movie || !name) {
+        free(movie);
+        free(name);
+        return NULL;
+    }
+    strcpy(name, path);
+
+    movie->header.magic = MOVIE_MAGIC;
+    movie->header.version = MOVIE_VERSION;
+    movie->header.flags = m->watchdog_enabled ? MOVIE_FLAG_WATCHDOG : 0;
+    movie->header.rom_hash = movie_rom_hash(m);
+    movie->header.verify_interval = (uint32_t)(verify_interval > 0 ? verify_interval : 0);
+    movie->recording = true;
+    movie->path = name;
+    movie->check_framebuffer = true;
+
+    // Replays start from released buttons, so anything held at the start
+    // goes into the first entry
+    movie->port1 = 0xFF;
+    movie->port2 = 0xFF;
+    return movie;
+}
+
+// Load a movie to replay
+Movie* movie_replay(const char *path, PacmanMachine *m) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        LOG_ERROR(LOG_CAT_INPUT, "Cannot open movie: %s", path);
+        return NULL;
+    }
+
+    Movie *movie = (Movie *)calloc(1, sizeof(Movie));
+    bool ok = movie && fread(&movie->header, sizeof(MovieHeader), 1, file) == 1 &&
+              movie->header.magic == MOVIE_MAGIC && movie->header.version == MOVIE_VERSION;
+
+    // The entries are small; read them all up front
+    if (ok) {
+        long start = ftell(file);
+        ok = fseek(file, 0, SEEK_END) == 0;
+        long end = ftell(file);
+        ok = ok && start >= 0 && end >= start && fseek(file, start, SEEK_SET) == 0;
+        movie->size = ok ? (size_t)(end - start) : 0;
+        movie->data = (uint8_t *)malloc(movie->size ? movie->size : 1);
+        ok = ok && movie->data && fread(movie->data, 1, movie->size, file) == movie->size;
+    }
+    fclose(file);
+    if (!ok) {
+        LOG_ERROR(LOG_CAT_INPUT, "Not a movie of this version: %s", path);
+    } else if (movie->header.rom_hash != movie_rom_hash(m)) {
+        LOG_ERROR(LOG_CAT_INPUT, "Movie %s was recorded with other ROMs", path);
+        ok = false;
+    } else if (!read_next_frame(movie)) {
+        LOG_ERROR(LOG_CAT_INPUT, "Movie is damaged: %s", path);
+        ok = false;
+    }
+    if (!ok) {
+        if (movie) free(movie->data);
+        free(movie);
+        return NULL;
+    }
+
+    movie->check_framebuffer = true;
+    movie->port1 = 0xFF;
+    movie->port2 = 0xFF;
+    m->input_port1 = movie->port1;
+    m->input_port2 = movie->port2;
+    m->watchdog_enabled = (movie->header.flags & MOVIE_FLAG_WATCHDOG) != 0;
+    LOG_INFO(LOG_CAT_INPUT, "Replaying %s: %u frames, checkpoints every %u", path,
+             movie->header.frames, movie->header.verify_interval);
+    return movie;
+}
+
+// Record or replay one frame's input
+void movie_frame(Movie *movie, PacmanMachine *m) {
+    if (movie->recording) {
+        uint8_t flags = 0;
+        if (m->input_port1 != movie->port1) {
+            movie->port1 = m->input_port1;
+            flags |= MOVIE_ENTRY_PORT1;
+        }
+        if (m->input_port2 != movie->port2) {
+            movie->port2 = m->input_port2;
+            flags |= MOVIE_ENTRY_PORT2;
+        }
+        uint32_t interval = movie->header.verify_interval;
+        if (interval && movie->frame > 0 && movie->frame % interval == 0) {
+            flags |= MOVIE_ENTRY_CHECK;
+        }
+        if (flags && !record_entry(movie, m, flags)) {
+            LOG_ERROR(LOG_CAT_INPUT, "Out of memory recording %s", movie->path);
+        }
+    } else {
+        // The movie's ports hold every frame, whatever the keyboard did
+        replay_entries(movie, m);
+        m->input_port1 = movie->port1;
+        m->input_port2 = movie->port2;
+    }
+    movie->frame++;
+}
+
+// Choose whether checkpoints include the framebuffer
+void movie_check_framebuffer(Movie *movie, bool check) {
+    movie->check_framebuffer = check;
+}
+
+// Frames in the movie
+long movie_length(const Movie *movie) {
+    return movie->recording ? movie->frame : (long)movie->header.frames;
+}
+
+// No mismatch so far
+bool movie_matches(const Movie *movie) {
+    return movie->mismatches == 0;
+}
+
+// Write out a recording or finish checking a replay
+bool movie_finish(Movie *movie, PacmanMachine *m) {
+    if (!movie) {
+        return true;
+    }
+
+    bool ok;
+    if (movie->recording) {
+        movie->header.frames = (uint32_t)movie->frame;
+        ok = record_entry(movie, m, MOVIE_ENTRY_CHECK);
+
+        FILE *file = fopen(movie->path, "wb");
+        ok = ok && file && fwrite(&movie->header, sizeof(MovieHeader), 1, file) == 1 &&
+             fwrite(movie->data, 1, movie->size, file) == movie->size;
+        if (file && fclose(file) != 0) {
+            ok = false;
+        }
+        if (ok) {
+            LOG_INFO(LOG_CAT_INPUT, "Recorded %ld frames to %s (%zu bytes)", movie->frame,
+                     movie->path, sizeof(MovieHeader) + movie->size);
+        } else {
+            LOG_ERROR(LOG_CAT_INPUT, "Failed to write movie: %s", movie->path);
+        }
+    } else {
+        // The final checkpoint is only meaningful at the end of the movie
+        if (movie->frame == (long)movie->header.frames) {
+            replay_entries(movie, m);
+        } else {
+            LOG_WARN(LOG_CAT_INPUT, "Replay stopped at frame %ld of %u, final state not compared",
+                     movie->frame, movie->header.frames);
+        }
+        ok = movie->mismatches == 0;
+        if (ok) {
+            LOG_INFO(LOG_CAT_INPUT, "Replay matched the movie at all %ld checkpoints", movie->checks);
+        } else {
+            LOG_ERROR(LOG_CAT_INPUT, "Replay diverged from the movie at %ld of %ld checkpoints",
+                      movie->mismatches, movie->checks);
+        }
+    }
+
+    movie_close(movie);
+    return ok;
+}
+
+// Free a movie without writing or checking anything
+void movie_close(Movie *movie) {
+    if (!movie) {
+        return;
+    }
+    free(movie->data);
+    free(movie->path);
+    free(movie);
+}
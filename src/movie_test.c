@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifndef NO_SDL
+#include <SDL2/SDL.h>
+#endif
+
+#include "../include/machine.h"
+#include "../include/memory.h"
+#include "../include/cpu.h"
+#include "../include/video.h"
+#include "../include/input.h"
+#include "../include/movie.h"
+#include "../include/runahead.h"
+#include "../include/log.h"
+
+// Self-test for input movies (make test). Records a movie with every way
+// the emulator can render and replays it with every other one: with no
+// framebuffer, the headless software framebuffer, run-ahead and, in SDL
+// builds, a renderer (as the windowed emulator sets it up for movies, and
+// drawing straight into the texture). Every replay must match; a replay
+// that compares the framebuffer of a run-ahead frame must not.
+//
+// Usage: movie-test WORK_DIR (a ROM and a movie are written there)
+
+#define FRAMES          300
+#define VERIFY_EVERY    10
+#define AHEAD_FRAMES    2
+
+// Flips the bits of each byte of tile and color RAM against the IN0 port
+// and increments it, over and over, so the inputs show on screen. The
+// interrupt vector restarts the program (IM 0 reads RST 38h off the bus).
+//   di / ld sp,4FF0h / ld hl,4000h
+//   loop: ld a,(5000h) / xor (hl) / inc a / ld (hl),a / inc hl / res 3,h / jr loop
+static const uint8_t test_program[0x3B] = {
+    0xF3, 0x31, 0xF0, 0x4F, 0x21, 0x00, 0x40,
+    0x3A, 0x00, 0x50, 0xAE, 0x3C, 0x77, 0x23, 0xCB, 0x9C, 0x18, 0xF5,
+    [0x38] = 0xC3, 0x00, 0x00      // jp 0
+};
+
+typedef enum {
+    TARGET_NONE,            // No software framebuffer (headless without --render)
+    TARGET_FRAMEBUFFER,     // Headless --render
+    TARGET_AHEAD,           // Framebuffer showing a frame AHEAD_FRAMES later
+#ifndef NO_SDL
+    TARGET_WINDOW,          // Renderer, framebuffer kept as main.c does for movies
+    TARGET_TEXTURE,         // Renderer, frames composed in the texture
+#endif
+    TARGET_COUNT
+} Target;
+
+static const char *target_names[TARGET_COUNT] = {
+    "none", "framebuffer", "ahead",
+#ifndef NO_SDL
+    "window", "texture",
+#endif
+};
+
+// A machine rendering to one target
+typedef struct {
+    Target target;
+    PacmanMachine *m;
+    RunAhead ahead;
+#ifndef NO_SDL
+    SDL_Surface *surface;
+    SDL_Renderer *renderer;
+#endif
+} Run;
+
+// xorshift32, so every run tests the same inputs
+static uint32_t rng_state = 0x2468ACE1;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Free a run (any part of it may be missing)
+static void close_run(Run *run) {
+    runahead_free(&run->ahead);
+    machine_destroy(run->m);
+#ifndef NO_SDL
+    if (run->renderer) SDL_DestroyRenderer(run->renderer);
+    if (run->surface) SDL_FreeSurface(run->surface);
+#endif
+}
+
+// Power on a machine rendering to target
+static bool open_run(Run *run, Target target, const char *rom_path) {
+    memset(run, 0, sizeof(*run));
+    run->target = target;
+    run->m = machine_create();
+    if (!run->m || !memory_init(run->m, rom_path)) {
+        return false;
+    }
+
+    bool ok = true;
+    switch (target) {
+        case TARGET_NONE:
+        default:
+            break;
+        case TARGET_FRAMEBUFFER:
+            ok = video_init(run->m, NULL, 1);
+            break;
+        case TARGET_AHEAD:
+            ok = video_init(run->m, NULL, 1) && runahead_init(&run->ahead, AHEAD_FRAMES);
+            break;
+#ifndef NO_SDL
+        case TARGET_WINDOW:
+        case TARGET_TEXTURE:
+            run->surface = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32,
+                                                          SDL_PIXELFORMAT_RGBA8888);
+            run->renderer = run->surface ? SDL_CreateSoftwareRenderer(run->surface) : NULL;
+            ok = run->renderer && video_init(run->m, run->renderer, 1);
+            break;
+#endif
+    }
+
+    cpu_init(run->m);
+    input_init(run->m);
+    return ok;
+}
+
+// Set up a movie's checkpoints the way main.c does for the run's target
+static void configure_movie(const Run *run, Movie *movie) {
+#ifndef NO_SDL
+    if (run->target == TARGET_WINDOW) {
+        video_keep_framebuffer(run->m, true);
+    }
+#endif
+    movie_check_framebuffer(movie, run->target != TARGET_AHEAD);
+}
+
+// Run one frame and render it to the run's target
+static void step(Run *run, Movie *movie) {
+    movie_frame(movie, run->m);
+    cpu_execute_frame(run->m);
+    if (run->target != TARGET_NONE) {
+        runahead_render(&run->ahead, run->m);
+    }
+}
+
+// Record FRAMES frames of random input with target
+static bool record(const char *rom_path, const char *movie_path, Target target) {
+    Run run;
+    bool ok = open_run(&run, target, rom_path);
+    Movie *movie = ok ? movie_record(movie_path, run.m, VERIFY_EVERY) : NULL;
+    if (movie) {
+        configure_movie(&run, movie);
+        for (int f = 0; f < FRAMES; f++) {
+            if ((rng() & 7) == 0) {
+                run.m->input_port1 = (uint8_t)rng();
+            }
+            if ((rng() & 7) == 0) {
+                run.m->input_port2 = (uint8_t)rng();
+            }
+            step(&run, movie);
+        }
+        ok = movie_finish(movie, run.m);
+    } else {
+        ok = false;
+    }
+    close_run(&run);
+    return ok;
+}
+
+// Replay a movie with target. Returns whether every checkpoint matched.
+static bool replay(const char *rom_path, const char *movie_path, Target target) {
+    Run run;
+    bool ok = open_run(&run, target, rom_path);
+    Movie *movie = ok ? movie_replay(movie_path, run.m) : NULL;
+    if (movie) {
+        configure_movie(&run, movie);
+        long frames = movie_length(movie);
+        for (long f = 0; f < frames; f++) {
+            step(&run, movie);
+        }
+        ok = movie_finish(movie, run.m);
+    } else {
+        ok = false;
+    }
+    close_run(&run);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        printf("Usage: %s WORK_DIR\n", argv[0]);
+        return 1;
+    }
+    log_set_console(false);
+
+#ifndef NO_SDL
+    if (SDL_Init(0) != 0) {
+        printf("SDL_Init failed: %s\n", SDL_GetError());
+        return 1;
+    }
+#endif
+
+    char rom_path[1024], movie_path[1024];
+    snprintf(rom_path, sizeof(rom_path), "%s/movie-test.rom", argv[1]);
+    snprintf(movie_path, sizeof(movie_path), "%s/movie-test.pmm", argv[1]);
+
+    FILE *rom = fopen(rom_path, "wb");
+    if (!rom || fwrite(test_program, sizeof(test_program), 1, rom) != 1) {
+        printf("Cannot write %s\n", rom_path);
+        if (rom) fclose(rom);
+        return 1;
+    }
+    fclose(rom);
+
+    int failures = 0;
+    for (int r = 0; r < TARGET_COUNT; r++) {
+        if (!record(rom_path, movie_path, (Target)r)) {
+            printf("FAIL recording with %s\n", target_names[r]);
+            failures++;
+            continue;
+        }
+
+        for (int p = 0; p < TARGET_COUNT; p++) {
+            bool matched = replay(rom_path, movie_path, (Target)p);
+            printf("%-11s -> %-11s %s\n", target_names[r], target_names[p], matched ? "ok" : "FAIL");
+            failures += !matched;
+        }
+
+        // Framebuffer checkpoints are really compared: the run-ahead frame
+        // differs from the one recorded
+        if (r == TARGET_FRAMEBUFFER) {
+            Run run;
+            bool diverged = false;
+            if (open_run(&run, TARGET_AHEAD, rom_path)) {
+                Movie *movie = movie_replay(movie_path, run.m);
+                if (movie) {
+                    for (long f = 0; f < movie_length(movie); f++) {
+                        step(&run, movie);
+                    }
+                    diverged = !movie_finish(movie, run.m);
+                }
+            }
+            close_run(&run);
+            printf("%-11s -> %-11s %s (checking the run-ahead frame must fail)\n",
+                   target_names[r], target_names[TARGET_AHEAD], diverged ? "ok" : "FAIL");
+            failures += !diverged;
+        }
+    }
+    printf("%d render targets recorded and replayed with each other, %d failures\n",
+           TARGET_COUNT, failures);
+
+    remove(movie_path);
+    remove(rom_path);
+#ifndef NO_SDL
+    SDL_Quit();
+#endif
+    log_shutdown();
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,581 @@
+#include "../include/netplay.h"
+#include "../include/machine.h"
+#include "../include/cpu.h"
+#include "../include/input.h"
+#include "../include/state.h"
+#include "../include/timer.h"
+#include "../include/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    typedef SOCKET NetSocket;
+    #define NET_INVALID_SOCKET  INVALID_SOCKET
+    #define net_close           closesocket
+#else
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netdb.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    typedef int NetSocket;
+    #define NET_INVALID_SOCKET  (-1)
+    #define net_close           close
+#endif
+
+// Packets start with a magic number, a type and a protocol version
+#define NET_MAGIC           0x54454E50u     // "PNET" little endian
+#define NET_VERSION         1
+
+enum {
+    PACKET_HELLO = 1,       // Player 2 -> 1: request to join
+    PACKET_WELCOME,         // Player 1 -> 2: join accepted
+    PACKET_INPUT            // Both ways: a run of inputs, plus an ack
+};
+
+// Per-frame inputs kept for each player (power of two). Must cover the
+// rollback window plus the inputs the other peer has not acked yet.
+#define INPUT_RING          128
+
+// Most inputs resent in one packet; lost packets are covered by resending
+// everything the other peer has not acked
+#define MAX_PACKET_INPUTS   64
+#define HEADER_SIZE         16
+#define MAX_PACKET_SIZE     (HEADER_SIZE + MAX_PACKET_INPUTS)
+
+// Player 2 repeats its hello this often until it is welcomed
+#define HELLO_INTERVAL_NS   100000000ULL
+#define POLL_INTERVAL_NS    1000000ULL
+
+// Frames between periodic debug reports (about 10 seconds)
+#define REPORT_FRAMES       600
+
+// Frames run from a state before it was saved (see snapshot())
+#define SNAPSHOT_COUNT      (NETPLAY_MAX_ROLLBACK + 1)
+
+// Input byte sent for each frame: joystick directions pressed in the low
+// nibble (INPUT_P1_* / INPUT_P2_* order), buttons on input port 1 pressed
+// in the high nibble
+#define NET_JOYSTICK        0x0F
+#define NET_BUTTONS         0xF0
+
+// Rollback counters over a reporting window
+typedef struct {
+    uint64_t frames;        // Frames run
+    uint64_t stalls;        // Display frames spent waiting for the peer
+    uint64_t rollbacks;     // Mispredictions corrected
+    uint64_t resim_frames;  // Frames re-run by those rollbacks
+    uint64_t resim_ns;      // Time spent re-running them
+    uint64_t max_resim_ns;  // Longest single rollback
+    uint32_t max_depth;     // Most frames re-run by a single rollback
+} NetStats;
+
+struct Netplay {
+    NetSocket sock;
+    struct sockaddr_storage peer;
+    socklen_t peer_len;
+    int player;             // 1 = listened, 2 = connected
+    int delay;              // Frames local inputs are held back
+    bool connected;
+    uint64_t last_heard_ns;
+    uint32_t hash;          // session_hash() of the starting machine
+
+    uint32_t frame;         // Next frame to run
+    uint32_t remote_count;  // Remote inputs received, in frame order
+    uint32_t peer_ack;      // Local inputs the peer has received
+    uint32_t rollback_from; // Earliest mispredicted frame (UINT32_MAX = none)
+
+    uint8_t local[INPUT_RING];      // Frames < frame + delay
+    uint8_t remote[INPUT_RING];     // Frames < remote_count
+    uint8_t predicted[INPUT_RING];  // Remote input each run frame used
+
+    uint8_t *snapshots;     // State at the start of each recent frame
+    size_t snapshot_size;
+
+    NetStats window;
+    NetStats total;
+};
+
+// Little endian packet fields
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Start the socket library (once per process on Windows)
+static bool net_startup(void) {
+#ifdef _WIN32
+    static bool started = false;
+    if (!started) {
+        WSADATA data;
+        if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+            return false;
+        }
+        started = true;
+    }
+#endif
+    return true;
+}
+
+// Make a socket's receives return at once when nothing is queued
+static bool set_nonblocking(NetSocket sock) {
+#ifdef _WIN32
+    u_long enable = 1;
+    return ioctlsocket(sock, FIONBIO, &enable) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Fingerprint of what both peers must agree on before the first frame:
+// the snapshot layout, the ROMs and the starting memory
+static uint32_t session_hash(const PacmanMachine *m) {
+    uint32_t h = 2166136261u;
+    const uint8_t *blocks[] = { m->rom, m->ram, m->vram, m->cram };
+    const size_t sizes[] = { ROM_SIZE, RAM_SIZE, VRAM_SIZE, CRAM_SIZE };
+    for (size_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++) {
+        for (size_t i = 0; i < sizes[b]; i++) {
+            h = (h ^ blocks[b][i]) * 16777619u;
+        }
+    }
+    return h ^ (uint32_t)state_size();
+}
+
+// Send a packet to the peer (UDP: losses are covered by resending)
+static void send_to_peer(Netplay *np, const uint8_t *packet, size_t size) {
+    sendto(np->sock, (const char *)packet, (int)size, 0,
+           (const struct sockaddr *)&np->peer, np->peer_len);
+}
+
+// Send a hello or welcome carrying the session fingerprint
+static void send_handshake(Netplay *np, uint8_t type) {
+    uint8_t packet[HEADER_SIZE] = {0};
+    put_u32(packet, NET_MAGIC);
+    packet[4] = type;
+    packet[5] = NET_VERSION;
+    put_u32(packet + 8, np->hash);
+    send_to_peer(np, packet, sizeof(packet));
+}
+
+// Send the local inputs the peer has not acked yet, and our own ack
+static void send_inputs(Netplay *np) {
+    uint32_t first = np->peer_ack;
+    uint32_t end = np->frame + (uint32_t)np->delay;
+    uint32_t count = end - first;
+    if (count > MAX_PACKET_INPUTS) {
+        count = MAX_PACKET_INPUTS;
+    }
+
+    uint8_t packet[MAX_PACKET_SIZE] = {0};
+    put_u32(packet, NET_MAGIC);
+    packet[4] = PACKET_INPUT;
+    packet[5] = NET_VERSION;
+    packet[6] = (uint8_t)count;
+    put_u32(packet + 8, first);
+    put_u32(packet + 12, np->remote_count);
+    for (uint32_t i = 0; i < count; i++) {
+        packet[HEADER_SIZE + i] = np->local[(first + i) % INPUT_RING];
+    }
+    send_to_peer(np, packet, HEADER_SIZE + count);
+}
+
+// Take in a run of remote inputs. Inputs for frames already run with a
+// different prediction schedule a rollback to the earliest of them.
+static void receive_inputs(Netplay *np, const uint8_t *packet, size_t size) {
+    uint32_t count = packet[6];
+    uint32_t first = get_u32(packet + 8);
+    uint32_t ack = get_u32(packet + 12);
+    if (size < HEADER_SIZE + count) {
+        return;
+    }
+
+    // Acks only move forward (packets may arrive out of order)
+    if (ack > np->peer_ack && ack <= np->frame + (uint32_t)np->delay) {
+        np->peer_ack = ack;
+    }
+
+    // Inputs are accepted in order only, so remote_count stays contiguous
+    if (first > np->remote_count) {
+        return;
+    }
+    for (uint32_t f = np->remote_count; f < first + count; f++) {
+        if (f >= np->frame + INPUT_RING - NETPLAY_MAX_ROLLBACK) {
+            break;     // Would overwrite inputs a rollback may still need
+        }
+        uint8_t input = packet[HEADER_SIZE + (f - first)];
+        np->remote[f % INPUT_RING] = input;
+        if (f < np->frame && np->predicted[f % INPUT_RING] != input && f < np->rollback_from) {
+            np->rollback_from = f;
+        }
+        np->remote_count = f + 1;
+    }
+}
+
+// Drain the socket
+static void receive_packets(Netplay *np) {
+    uint8_t packet[MAX_PACKET_SIZE + 16];
+    struct sockaddr_storage from;
+
+    for (;;) {
+        socklen_t from_len = sizeof(from);
+        int size = (int)recvfrom(np->sock, (char *)packet, sizeof(packet), 0,
+                                 (struct sockaddr *)&from, &from_len);
+        if (size < 0) {
+            break;
+        }
+        if (size < HEADER_SIZE || get_u32(packet) != NET_MAGIC || packet[5] != NET_VERSION) {
+            continue;
+        }
+        if (from_len != np->peer_len || memcmp(&from, &np->peer, from_len) != 0) {
+            continue;
+        }
+
+        np->last_heard_ns = timer_now_ns();
+        if (packet[4] == PACKET_INPUT) {
+            receive_inputs(np, packet, (size_t)size);
+        } else if (packet[4] == PACKET_HELLO && np->player == 1) {
+            // Our welcome was lost
+            send_handshake(np, PACKET_WELCOME);
+        }
+    }
+}
+
+// Allocate a session around an open socket
+static Netplay* session_create(PacmanMachine *m, NetSocket sock, int player, int delay) {
+    Netplay *np = (Netplay *)calloc(1, sizeof(Netplay));
+    if (!np) {
+        net_close(sock);
+        return NULL;
+    }
+
+    np->sock = sock;
+    np->player = player;
+    np->delay = delay < 0 ? 0 : (delay > NETPLAY_MAX_DELAY ? NETPLAY_MAX_DELAY : delay);
+    np->rollback_from = UINT32_MAX;
+    np->hash = session_hash(m);
+    np->snapshot_size = state_size();
+    np->snapshots = (uint8_t *)malloc(np->snapshot_size * SNAPSHOT_COUNT);
+    if (!np->snapshots) {
+        netplay_destroy(np);
+        return NULL;
+    }
+
+    // Frames before the delay has passed run with nothing pressed (the
+    // inputs are zeroed by calloc)
+    return np;
+}
+
+// Wait for a peer to connect, as player 1
+Netplay* netplay_listen(PacmanMachine *m, uint16_t port, int delay, int timeout_ms) {
+    if (!net_startup()) {
+        LOG_ERROR(LOG_CAT_NET, "Failed to start the socket library");
+        return NULL;
+    }
+
+    // Prefer a dual-stack IPv6 socket, so both address families can join
+    NetSocket sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+    bool bound = false;
+    if (sock != NET_INVALID_SOCKET) {
+        int v6only = 0;
+        setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (const char *)&v6only, sizeof(v6only));
+        struct sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port);
+        bound = bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (!bound) {
+            net_close(sock);
+        }
+    }
+    if (!bound) {
+        sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (sock != NET_INVALID_SOCKET) {
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            addr.sin_port = htons(port);
+            bound = bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+            if (!bound) {
+                net_close(sock);
+            }
+        }
+    }
+    if (!bound || !set_nonblocking(sock)) {
+        LOG_ERROR(LOG_CAT_NET, "Failed to open UDP port %u", port);
+        if (bound) {
+            net_close(sock);
+        }
+        return NULL;
+    }
+
+    Netplay *np = session_create(m, sock, 1, delay);
+    if (!np) {
+        return NULL;
+    }
+
+    LOG_INFO(LOG_CAT_NET, "Waiting for player 2 on UDP port %u", port);
+    uint64_t start = timer_now_ns();
+    uint8_t packet[MAX_PACKET_SIZE + 16];
+
+    for (;;) {
+        np->peer_len = sizeof(np->peer);
+        int size = (int)recvfrom(sock, (char *)packet, sizeof(packet), 0,
+                                 (struct sockaddr *)&np->peer, &np->peer_len);
+        if (size >= HEADER_SIZE && get_u32(packet) == NET_MAGIC && packet[4] == PACKET_HELLO) {
+            if (packet[5] != NET_VERSION || get_u32(packet + 8) != np->hash) {
+                LOG_ERROR(LOG_CAT_NET, "Player 2 runs a different version, ROM set or save state");
+                netplay_destroy(np);
+                return NULL;
+            }
+            send_handshake(np, PACKET_WELCOME);
+            break;
+        }
+
+        if (timeout_ms > 0 && timer_now_ns() - start > (uint64_t)timeout_ms * 1000000ULL) {
+            LOG_ERROR(LOG_CAT_NET, "No player 2 joined within %d ms", timeout_ms);
+            netplay_destroy(np);
+            return NULL;
+        }
+        timer_sleep_ns(POLL_INTERVAL_NS);
+    }
+
+    np->connected = true;
+    np->last_heard_ns = timer_now_ns();
+    LOG_INFO(LOG_CAT_NET, "Player 2 joined, input delay %d frame(s)", np->delay);
+    return np;
+}
+
+// Connect to a listening peer, as player 2
+Netplay* netplay_connect(PacmanMachine *m, const char *host, uint16_t port, int delay,
+                         int timeout_ms) {
+    if (!net_startup()) {
+        LOG_ERROR(LOG_CAT_NET, "Failed to start the socket library");
+        return NULL;
+    }
+
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+
+    struct addrinfo *result = NULL;
+    if (getaddrinfo(host, service, &hints, &result) != 0 || !result) {
+        LOG_ERROR(LOG_CAT_NET, "Cannot resolve %s", host);
+        return NULL;
+    }
+
+    NetSocket sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (sock == NET_INVALID_SOCKET || !set_nonblocking(sock)) {
+        LOG_ERROR(LOG_CAT_NET, "Failed to open a UDP socket");
+        if (sock != NET_INVALID_SOCKET) {
+            net_close(sock);
+        }
+        freeaddrinfo(result);
+        return NULL;
+    }
+
+    Netplay *np = session_create(m, sock, 2, delay);
+    if (!np) {
+        freeaddrinfo(result);
+        return NULL;
+    }
+    memcpy(&np->peer, result->ai_addr, result->ai_addrlen);
+    np->peer_len = (socklen_t)result->ai_addrlen;
+    freeaddrinfo(result);
+
+    LOG_INFO(LOG_CAT_NET, "Joining %s:%u as player 2", host, port);
+    uint64_t start = timer_now_ns();
+    uint64_t next_hello = start;
+    uint8_t packet[MAX_PACKET_SIZE + 16];
+
+    for (;;) {
+        uint64_t now = timer_now_ns();
+        if (now >= next_hello) {
+            send_handshake(np, PACKET_HELLO);
+            next_hello = now + HELLO_INTERVAL_NS;
+        }
+
+        int size = (int)recvfrom(sock, (char *)packet, sizeof(packet), 0, NULL, NULL);
+        if (size >= HEADER_SIZE && get_u32(packet) == NET_MAGIC && packet[4] == PACKET_WELCOME) {
+            if (packet[5] != NET_VERSION || get_u32(packet + 8) != np->hash) {
+                LOG_ERROR(LOG_CAT_NET, "Player 1 runs a different version, ROM set or save state");
+                netplay_destroy(np);
+                return NULL;
+            }
+            break;
+        }
+
+        if (timeout_ms > 0 && now - start > (uint64_t)timeout_ms * 1000000ULL) {
+            LOG_ERROR(LOG_CAT_NET, "No answer from %s:%u within %d ms", host, port, timeout_ms);
+            netplay_destroy(np);
+            return NULL;
+        }
+        timer_sleep_ns(POLL_INTERVAL_NS);
+    }
+
+    np->connected = true;
+    np->last_heard_ns = timer_now_ns();
+    LOG_INFO(LOG_CAT_NET, "Joined as player 2, input delay %d frame(s)", np->delay);
+    return np;
+}
+
+// Close the session
+void netplay_destroy(Netplay *np) {
+    if (!np) return;
+
+    net_close(np->sock);
+    free(np->snapshots);
+    free(np);
+}
+
+// Snapshot slot of a frame in the rollback window
+static uint8_t* snapshot(Netplay *np, uint32_t frame) {
+    return np->snapshots + (size_t)(frame % SNAPSHOT_COUNT) * np->snapshot_size;
+}
+
+// This peer's input from the keys held now (either joystick mapping)
+static uint8_t local_input(const PacmanMachine *m) {
+    uint8_t joystick = (uint8_t)(~m->input_port1 | ~m->input_port2) & NET_JOYSTICK;
+    uint8_t buttons = (uint8_t)~m->input_port1 & NET_BUTTONS;
+    return joystick | buttons;
+}
+
+// Run one frame with both players' inputs on the ports
+static void run_frame(Netplay *np, PacmanMachine *m, uint32_t frame, uint8_t dip_switches) {
+    uint8_t local = np->local[frame % INPUT_RING];
+    uint8_t remote = frame < np->remote_count ? np->remote[frame % INPUT_RING] :
+                     (np->remote_count > 0 ? np->remote[(np->remote_count - 1) % INPUT_RING] : 0);
+    np->predicted[frame % INPUT_RING] = remote;
+
+    uint8_t p1 = np->player == 1 ? local : remote;
+    uint8_t p2 = np->player == 1 ? remote : local;
+    m->input_port1 = (uint8_t)~((p1 & NET_JOYSTICK) | ((p1 | p2) & NET_BUTTONS));
+    m->input_port2 = (uint8_t)(dip_switches | (~p2 & NET_JOYSTICK));
+    cpu_execute_frame(m);
+}
+
+// Add a rollback to a set of statistics
+static void stats_add_rollback(NetStats *s, uint32_t depth, uint64_t ns) {
+    s->rollbacks++;
+    s->resim_frames += depth;
+    s->resim_ns += ns;
+    if (ns > s->max_resim_ns) {
+        s->max_resim_ns = ns;
+    }
+    if (depth > s->max_depth) {
+        s->max_depth = depth;
+    }
+}
+
+// Format statistics as "12 rollbacks in 600 frames (avg 2.1, max 4 frames
+// re-run), 41.3us per re-run frame, 190.2us max per display frame, 0 stalls"
+static void stats_format(const NetStats *s, char *out, size_t size) {
+    double avg_depth = s->rollbacks > 0 ? (double)s->resim_frames / s->rollbacks : 0.0;
+    double per_frame = s->resim_frames > 0 ? s->resim_ns / 1e3 / s->resim_frames : 0.0;
+    snprintf(out, size, "%llu rollbacks in %llu frames (avg %.1f, max %u frames re-run), "
+             "%.1fus per re-run frame, %.1fus max per display frame, %llu stalls",
+             (unsigned long long)s->rollbacks, (unsigned long long)s->frames, avg_depth,
+             s->max_depth, per_frame, s->max_resim_ns / 1e3, (unsigned long long)s->stalls);
+}
+
+// Run the next frame of the session
+bool netplay_frame(Netplay *np, PacmanMachine *m) {
+    receive_packets(np);
+    if (timer_now_ns() - np->last_heard_ns > (uint64_t)NETPLAY_TIMEOUT_MS * 1000000ULL) {
+        if (np->connected) {
+            LOG_WARN(LOG_CAT_NET, "Lost contact with player %d", np->player == 1 ? 2 : 1);
+        }
+        np->connected = false;
+    }
+
+    // Too far ahead of the peer: wait rather than predict further
+    if (np->frame >= np->remote_count + NETPLAY_MAX_ROLLBACK) {
+        send_inputs(np);
+        np->window.stalls++;
+        np->total.stalls++;
+        return false;
+    }
+
+    np->local[(np->frame + (uint32_t)np->delay) % INPUT_RING] = local_input(m);
+    send_inputs(np);
+
+    // The ports carry the local keyboard between frames (input.c updates
+    // them bit by bit); the frames themselves see both players
+    uint8_t keys1 = m->input_port1;
+    uint8_t keys2 = m->input_port2;
+    uint8_t dip_switches = m->input_port2 & (uint8_t)~NET_JOYSTICK;
+
+    if (np->rollback_from < np->frame) {
+        // Re-run the mispredicted frames, unheard and unrendered
+        uint64_t start = timer_now_ns();
+        uint32_t depth = np->frame - np->rollback_from;
+        struct SoundOutput *audio = m->audio;
+        m->audio = NULL;
+
+        state_load(m, snapshot(np, np->rollback_from), np->snapshot_size);
+        for (uint32_t f = np->rollback_from; f < np->frame; f++) {
+            if (f > np->rollback_from) {
+                state_save(m, snapshot(np, f));
+            }
+            run_frame(np, m, f, dip_switches);
+        }
+
+        m->audio = audio;
+        uint64_t ns = timer_now_ns() - start;
+        stats_add_rollback(&np->window, depth, ns);
+        stats_add_rollback(&np->total, depth, ns);
+    }
+    np->rollback_from = UINT32_MAX;
+
+    state_save(m, snapshot(np, np->frame));
+    run_frame(np, m, np->frame, dip_switches);
+    np->frame++;
+
+    m->input_port1 = keys1;
+    m->input_port2 = keys2;
+
+    np->window.frames++;
+    np->total.frames++;
+    if (np->window.frames >= REPORT_FRAMES) {
+        if (LOG_ENABLED(LOG_CAT_NET, LOG_LEVEL_DEBUG)) {
+            char text[200];
+            stats_format(&np->window, text, sizeof(text));
+            LOG_DEBUG(LOG_CAT_NET, "Netplay: %s", text);
+        }
+        memset(&np->window, 0, sizeof(np->window));
+    }
+    return true;
+}
+
+// Whether the peer is still heard from
+bool netplay_connected(const Netplay *np) {
+    return np->connected;
+}
+
+// Frames run so far
+uint32_t netplay_frame_count(const Netplay *np) {
+    return np->frame;
+}
+
+// Log statistics for the whole session
+void netplay_report(const Netplay *np) {
+    char text[200];
+    stats_format(&np->total, text, sizeof(text));
+    LOG_INFO(LOG_CAT_NET, "Netplay: %s", text);
+}
@@ -0,0 +1,183 @@
+#include "../include/pacing.h"
+#include "../include/machine.h"
+#include "../include/sound.h"
+#include "../include/timer.h"
+#include "../include/log.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Sleep until this close to a deadline and spin for the rest. Sleeps can
+// overshoot by a scheduler tick, which is coarser on Windows.
+#ifdef _WIN32
+    #define PACE_SPIN_NS    2000000ULL
+#else
+    #define PACE_SPIN_NS    1000000ULL
+#endif
+
+// Audio mode: start the next frame once the ring has drained to 40ms of
+// samples (two device buffers plus a frame, with some headroom)
+#define PACE_AUDIO_TARGET       (SOUND_SAMPLE_RATE / 25)
+#define PACE_AUDIO_MIN_SLEEP_NS 500000ULL
+
+// Stop waiting on an audio device that no longer consumes samples
+#define PACE_AUDIO_TIMEOUT_NS   (4 * PACE_FRAME_NS)
+
+// Frames between periodic debug reports (about 10 seconds)
+#define PACE_REPORT_FRAMES      600
+
+// Mode names, indexed by PaceMode
+static const char *mode_names[PACE_MODE_COUNT] = { "auto", "timer", "vsync", "audio", "off" };
+
+// Set up a pacer
+void pacing_init(Pacer *p, PaceMode mode, PacmanMachine *m) {
+    memset(p, 0, sizeof(*p));
+    p->period_ns = PACE_FRAME_NS;
+
+    bool audio = m && m->audio;
+    if (mode == PACE_AUTO) {
+        mode = audio ? PACE_AUDIO : PACE_TIMER;
+    } else if (mode == PACE_AUDIO && !audio) {
+        LOG_WARN(LOG_CAT_MAIN, "No audio output to pace against, using the timer");
+        mode = PACE_TIMER;
+    }
+    p->mode = mode;
+    LOG_INFO(LOG_CAT_MAIN, "Frame pacing: %s", mode_names[mode]);
+}
+
+// Sleep most of the way to a deadline, then spin until it passes
+static void wait_until(uint64_t deadline) {
+    uint64_t now = timer_now_ns();
+    if (deadline > now + PACE_SPIN_NS) {
+        timer_sleep_ns(deadline - now - PACE_SPIN_NS);
+    }
+    while (timer_now_ns() < deadline) {
+        // Spin
+    }
+}
+
+// Wait for the next timer deadline. Returns true if it had already passed.
+static bool wait_timer(Pacer *p, uint64_t now) {
+    bool late = now >= p->next_ns;
+    if (!late) {
+        wait_until(p->next_ns);
+    } else if (now - p->next_ns > p->period_ns) {
+        // More than a frame behind: drop the lost time instead of racing
+        // through frames to catch up
+        p->next_ns = now;
+    }
+    p->next_ns += p->period_ns;
+    return late;
+}
+
+// Wait until the audio ring has drained to the target fill. Returns true if
+// it was close to running dry already.
+static bool wait_audio(PacmanMachine *m, uint64_t now) {
+    uint32_t queued = sound_queued(m);
+    uint64_t give_up = now + PACE_AUDIO_TIMEOUT_NS;
+
+    while (queued > PACE_AUDIO_TARGET && now < give_up) {
+        // The device drains in whole buffers, so sleep for about the time
+        // the excess takes to play and look again
+        uint64_t ns = (uint64_t)(queued - PACE_AUDIO_TARGET) * 1000000000ULL / SOUND_SAMPLE_RATE;
+        timer_sleep_ns(ns > PACE_AUDIO_MIN_SLEEP_NS ? ns : PACE_AUDIO_MIN_SLEEP_NS);
+        queued = sound_queued(m);
+        now = timer_now_ns();
+    }
+    return queued < SOUND_BLOCK_SAMPLES;
+}
+
+// Add one frame interval to a set of statistics
+static void stats_add(PaceStats *s, uint64_t interval, uint64_t period, bool late) {
+    uint64_t dev = interval > period ? interval - period : period - interval;
+    s->frames++;
+    s->late += late;
+    s->sum_ns += (double)interval;
+    s->sum_sq_ns += (double)interval * (double)interval;
+    if (dev > s->max_dev_ns) {
+        s->max_dev_ns = dev;
+    }
+}
+
+// Format statistics as "60.61 fps, jitter 0.052ms (max 0.410ms), 0 late of 600 frames"
+static void stats_format(const PaceStats *s, char *out, size_t size) {
+    double mean = s->frames > 0 ? s->sum_ns / s->frames : 0.0;
+    double var = s->frames > 0 ? s->sum_sq_ns / s->frames - mean * mean : 0.0;
+    snprintf(out, size, "%.2f fps, jitter %.3fms (max %.3fms), %llu late of %llu frames",
+             mean > 0 ? 1e9 / mean : 0.0, var > 0 ? sqrt(var) / 1e6 : 0.0,
+             s->max_dev_ns / 1e6, (unsigned long long)s->late, (unsigned long long)s->frames);
+}
+
+// Block until the next frame should start
+void pacing_wait(Pacer *p, PacmanMachine *m, bool presented) {
+    uint64_t now = timer_now_ns();
+    bool late = false;
+
+    if (p->next_ns == 0) {
+        p->next_ns = now + p->period_ns;
+    }
+
+    switch (p->mode) {
+        case PACE_VSYNC:
+            if (presented) {
+                // The present already waited for the display
+                p->next_ns = now + p->period_ns;
+                break;
+            }
+            late = wait_timer(p, now);
+            break;
+        case PACE_TIMER:
+            late = wait_timer(p, now);
+            break;
+        case PACE_AUDIO:
+            late = wait_audio(m, now);
+            break;
+        default:
+            break;
+    }
+
+    // Measure the interval between frame releases
+    uint64_t released = timer_now_ns();
+    if (p->last_ns != 0) {
+        uint64_t interval = released - p->last_ns;
+        stats_add(&p->window, interval, p->period_ns, late);
+        stats_add(&p->total, interval, p->period_ns, late);
+    }
+    p->last_ns = released;
+
+    if (p->window.frames >= PACE_REPORT_FRAMES) {
+        if (LOG_ENABLED(LOG_CAT_MAIN, LOG_LEVEL_DEBUG)) {
+            char text[160];
+            stats_format(&p->window, text, sizeof(text));
+            LOG_DEBUG(LOG_CAT_MAIN, "Pacing (%s): %s", mode_names[p->mode], text);
+        }
+        memset(&p->window, 0, sizeof(p->window));
+    }
+}
+
+// Log the jitter statistics for the whole run
+void pacing_report(const Pacer *p) {
+    if (p->total.frames == 0) {
+        return;
+    }
+
+    char text[160];
+    stats_format(&p->total, text, sizeof(text));
+    LOG_INFO(LOG_CAT_MAIN, "Pacing (%s): %s", mode_names[p->mode], text);
+}
+
+// Look up a mode by name
+bool pacing_parse_mode(const char *name, PaceMode *mode) {
+    for (int i = 0; i < PACE_MODE_COUNT; i++) {
+        if (strcmp(name, mode_names[i]) == 0) {
+            *mode = (PaceMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Name of a mode
+const char* pacing_mode_name(PaceMode mode) {
+    return mode < PACE_MODE_COUNT ? mode_names[mode] : "unknown";
+}
@@ -0,0 +1,268 @@
+#include "../include/perf.h"
+
+#ifdef PERF_ENABLED
+
+#include "../include/machine.h"
+#include "../include/video.h"
+#include "../include/gfx.h"
+#include "../include/pacing.h"
+#include "../include/log.h"
+#include <stdio.h>
+#include <string.h>
+
+// Names used in the reports, indexed by PerfStage and PerfRegion
+static const char *stage_names[PERF_STAGE_COUNT] = {
+    "input", "cpu", "background", "sprites", "upload", "present", "sleep", "frame"
+};
+static const char *region_names[PERF_REGION_COUNT] = {
+    "rom", "tile", "ram", "io", "other"
+};
+
+// Region of a 256-byte bus page
+static PerfRegion page_region(int page) {
+    if (page < (VRAM_START >> MEM_PAGE_SHIFT)) return PERF_REGION_ROM;
+    if (page < (WRAM_START >> MEM_PAGE_SHIFT)) return PERF_REGION_TILE;
+    if (page < (IO_START >> MEM_PAGE_SHIFT)) return PERF_REGION_RAM;
+    if (page == (IO_START >> MEM_PAGE_SHIFT)) return PERF_REGION_IO;
+    return PERF_REGION_OTHER;
+}
+
+// Bucket of a duration: the smallest i with ns < 2^i us
+static int bucket_of(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int i = 0;
+    while (i < PERF_BUCKETS - 1 && us >= (1ull << i)) {
+        i++;
+    }
+    return i;
+}
+
+// Add one sample to a histogram
+static void histogram_add(PerfHistogram *h, uint64_t ns) {
+    h->buckets[bucket_of(ns)]++;
+    h->count++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+}
+
+// Finish the current frame
+void perf_frame_end(PacmanMachine *m) {
+    PerfStats *p = &m->perf;
+    PerfFrame *f = &p->current;
+    uint64_t now = timer_now_ns();
+
+    // The first frame has no start; it is counted from here on
+    if (p->frame_start_ns != 0) {
+        f->stage_ns[PERF_STAGE_FRAME] = now - p->frame_start_ns;
+    }
+    p->frame_start_ns = now;
+
+    for (int page = 0; page < MEM_PAGE_COUNT; page++) {
+        PerfRegion region = page_region(page);
+        f->reads[region] += p->page_reads[page];
+        f->writes[region] += p->page_writes[page];
+    }
+    memset(p->page_reads, 0, sizeof(p->page_reads));
+    memset(p->page_writes, 0, sizeof(p->page_writes));
+
+    for (int s = 0; s < PERF_STAGE_COUNT; s++) {
+        histogram_add(&p->stages[s], f->stage_ns[s]);
+        p->total.stage_ns[s] += f->stage_ns[s];
+    }
+    p->total.instructions += f->instructions;
+    p->total.skipped += f->skipped;
+    p->total.interrupts += f->interrupts;
+    for (int r = 0; r < PERF_REGION_COUNT; r++) {
+        p->total.reads[r] += f->reads[r];
+        p->total.writes[r] += f->writes[r];
+    }
+
+    p->last = *f;
+    memset(f, 0, sizeof(*f));
+    p->frames++;
+
+    // The overlay changes every frame even when the game's picture does not
+    if (p->overlay) {
+        m->frame_valid = false;
+    }
+}
+
+// Draw a number with the character ROM's digits (tiles 0x30-0x39)
+static void draw_number(PacmanMachine *m, int x, int y, uint64_t value, uint32_t color) {
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%llu", (unsigned long long)value);
+    for (int i = 0; i < n; i++) {
+        gfx_draw_tile(m->frame, m->frame_pitch, x + i * TILE_SIZE, y,
+                      m->tile_pens[(uint8_t)digits[i]], color);
+    }
+}
+
+// Fill a rectangle of the frame, clipped to the screen
+static void fill_rect(PacmanMachine *m, int x, int y, int w, int h, uint32_t color) {
+    for (int row = y; row < y + h && row < SCREEN_HEIGHT; row++) {
+        for (int col = x; col < x + w && col < SCREEN_WIDTH; col++) {
+            m->frame[row * m->frame_pitch + col] = color;
+        }
+    }
+}
+
+// Draw the last frame's stage times and counters
+void perf_draw_overlay(PacmanMachine *m) {
+    static const uint32_t stage_colors[PERF_STAGE_COUNT] = {
+        0xFF808080, 0xFFFF4040, 0xFF40C040, 0xFF40FFFF,
+        0xFFFFFF40, 0xFFFF40FF, 0xFF4040FF, 0xFFFFFFFF
+    };
+    const PerfFrame *f = &m->perf.last;
+
+    // One row per stage: a bar whose full width is a quarter of the frame
+    // period (sleeping and waiting for vsync run off the end), and the time
+    // in microseconds on the right
+    for (int s = 0; s < PERF_STAGE_COUNT; s++) {
+        int y = s * TILE_SIZE;
+        uint64_t width = f->stage_ns[s] * SCREEN_WIDTH * 4 / PACE_FRAME_NS;
+        if (width == 0 && f->stage_ns[s] > 0) {
+            width = 1;
+        }
+        fill_rect(m, 0, y + 1, (int)(width < SCREEN_WIDTH ? width : SCREEN_WIDTH), TILE_SIZE - 2,
+                  stage_colors[s]);
+        draw_number(m, SCREEN_WIDTH - 6 * TILE_SIZE, y, f->stage_ns[s] / 1000, stage_colors[s]);
+    }
+
+    // Then instructions, interrupts, and reads/writes of work and tile RAM
+    int y = PERF_STAGE_COUNT * TILE_SIZE + 2;
+    draw_number(m, 0, y, f->instructions, 0xFFFFFFFF);
+    draw_number(m, SCREEN_WIDTH - 2 * TILE_SIZE, y, f->interrupts, 0xFFFFFFFF);
+    y += TILE_SIZE;
+    draw_number(m, 0, y, f->reads[PERF_REGION_RAM], stage_colors[PERF_STAGE_CPU]);
+    draw_number(m, SCREEN_WIDTH / 2, y, f->writes[PERF_REGION_RAM], stage_colors[PERF_STAGE_CPU]);
+    y += TILE_SIZE;
+    draw_number(m, 0, y, f->reads[PERF_REGION_TILE], stage_colors[PERF_STAGE_BACKGROUND]);
+    draw_number(m, SCREEN_WIDTH / 2, y, f->writes[PERF_REGION_TILE],
+                stage_colors[PERF_STAGE_BACKGROUND]);
+}
+
+// Upper bound of a bucket in seconds (the last one is +Inf)
+static double bucket_bound_seconds(int i) {
+    return (double)(1ull << i) / 1e6;
+}
+
+// Write one machine's statistics as a JSON object
+static void write_json(FILE *out, const PacmanMachine *m, const char *name) {
+    const PerfStats *p = &m->perf;
+
+    fprintf(out, "    {\"name\": \"%s\", \"frames\": %llu,\n", name, (unsigned long long)p->frames);
+    fprintf(out, "     \"instructions\": %llu, \"skipped_instructions\": %llu, \"interrupts\": %llu,\n",
+            (unsigned long long)p->total.instructions, (unsigned long long)p->total.skipped,
+            (unsigned long long)p->total.interrupts);
+    for (int dir = 0; dir < 2; dir++) {
+        const uint64_t *counts = dir == 0 ? p->total.reads : p->total.writes;
+        fprintf(out, "     \"%s\": {", dir == 0 ? "reads" : "writes");
+        for (int r = 0; r < PERF_REGION_COUNT; r++) {
+            fprintf(out, "%s\"%s\": %llu", r ? ", " : "", region_names[r],
+                    (unsigned long long)counts[r]);
+        }
+        fprintf(out, "},\n");
+    }
+
+    fprintf(out, "     \"bucket_us\": [");
+    for (int i = 0; i < PERF_BUCKETS - 1; i++) {
+        fprintf(out, "%s%llu", i ? ", " : "", 1ull << i);
+    }
+    fprintf(out, ", null],\n     \"stages\": {\n");
+    for (int s = 0; s < PERF_STAGE_COUNT; s++) {
+        const PerfHistogram *h = &p->stages[s];
+        fprintf(out, "       \"%s\": {\"count\": %llu, \"mean_us\": %.3f, \"max_us\": %.3f, \"buckets\": [",
+                stage_names[s], (unsigned long long)h->count,
+                h->count ? h->sum_ns / 1000.0 / h->count : 0.0, h->max_ns / 1000.0);
+        for (int i = 0; i < PERF_BUCKETS; i++) {
+            fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)h->buckets[i]);
+        }
+        fprintf(out, "]}%s\n", s + 1 < PERF_STAGE_COUNT ? "," : "");
+    }
+    fprintf(out, "     }}");
+}
+
+// Write one machine's statistics as Prometheus samples
+static void write_prometheus(FILE *out, const PacmanMachine *m, const char *name) {
+    const PerfStats *p = &m->perf;
+
+    fprintf(out, "pacman_frames_total{machine=\"%s\"} %llu\n", name, (unsigned long long)p->frames);
+    fprintf(out, "pacman_instructions_total{machine=\"%s\"} %llu\n", name,
+            (unsigned long long)p->total.instructions);
+    fprintf(out, "pacman_skipped_instructions_total{machine=\"%s\"} %llu\n", name,
+            (unsigned long long)p->total.skipped);
+    fprintf(out, "pacman_interrupts_total{machine=\"%s\"} %llu\n", name,
+            (unsigned long long)p->total.interrupts);
+    for (int r = 0; r < PERF_REGION_COUNT; r++) {
+        fprintf(out, "pacman_bus_reads_total{machine=\"%s\",region=\"%s\"} %llu\n", name,
+                region_names[r], (unsigned long long)p->total.reads[r]);
+        fprintf(out, "pacman_bus_writes_total{machine=\"%s\",region=\"%s\"} %llu\n", name,
+                region_names[r], (unsigned long long)p->total.writes[r]);
+    }
+
+    for (int s = 0; s < PERF_STAGE_COUNT; s++) {
+        const PerfHistogram *h = &p->stages[s];
+        uint64_t cumulative = 0;
+        for (int i = 0; i < PERF_BUCKETS - 1; i++) {
+            cumulative += h->buckets[i];
+            fprintf(out, "pacman_stage_seconds_bucket{machine=\"%s\",stage=\"%s\",le=\"%g\"} %llu\n",
+                    name, stage_names[s], bucket_bound_seconds(i), (unsigned long long)cumulative);
+        }
+        fprintf(out, "pacman_stage_seconds_bucket{machine=\"%s\",stage=\"%s\",le=\"+Inf\"} %llu\n",
+                name, stage_names[s], (unsigned long long)h->count);
+        fprintf(out, "pacman_stage_seconds_sum{machine=\"%s\",stage=\"%s\"} %.9f\n",
+                name, stage_names[s], h->sum_ns / 1e9);
+        fprintf(out, "pacman_stage_seconds_count{machine=\"%s\",stage=\"%s\"} %llu\n",
+                name, stage_names[s], (unsigned long long)h->count);
+    }
+}
+
+// Write the statistics of several machines to a file
+bool perf_dump(const char *path, PacmanMachine *const *machines, const char *const *names,
+               int count) {
+    size_t len = strlen(path);
+    bool prometheus = len >= 5 && strcmp(path + len - 5, ".prom") == 0;
+
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *out = fopen(tmp_path, "w");
+    if (!out) {
+        LOG_ERROR(LOG_CAT_MAIN, "Failed to write performance report: %s", path);
+        return false;
+    }
+
+    if (prometheus) {
+        fprintf(out, "# TYPE pacman_frames_total counter\n");
+        fprintf(out, "# TYPE pacman_instructions_total counter\n");
+        fprintf(out, "# TYPE pacman_skipped_instructions_total counter\n");
+        fprintf(out, "# TYPE pacman_interrupts_total counter\n");
+        fprintf(out, "# TYPE pacman_bus_reads_total counter\n");
+        fprintf(out, "# TYPE pacman_bus_writes_total counter\n");
+        fprintf(out, "# TYPE pacman_stage_seconds histogram\n");
+        for (int i = 0; i < count; i++) {
+            write_prometheus(out, machines[i], names[i]);
+        }
+    } else {
+        fprintf(out, "{\n  \"machines\": [\n");
+        for (int i = 0; i < count; i++) {
+            write_json(out, machines[i], names[i]);
+            fprintf(out, "%s\n", i + 1 < count ? "," : "");
+        }
+        fprintf(out, "  ]\n}\n");
+    }
+
+    bool ok = fclose(out) == 0;
+#ifdef _WIN32
+    remove(path);   // rename() does not replace files on Windows
+#endif
+    if (!ok || rename(tmp_path, path) != 0) {
+        LOG_ERROR(LOG_CAT_MAIN, "Failed to write performance report: %s", path);
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,188 @@
+#include "../include/pipeline.h"
+#include "../include/machine.h"
+#include "../include/cpu.h"
+#include "../include/rewind.h"
+#include "../include/timer.h"
+#include "../include/log.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Snapshot slots: one being written, one being drawn, one in between
+#define PIPELINE_SLOTS      3
+#define SLOT_MASK           0x3u
+#define SLOT_FRESH          0x4u
+
+// Packed inputs handed to the emulation thread
+#define INPUT_REWIND        (1u << 16)
+
+struct Pipeline {
+    PacmanMachine *m;
+    Rewind *history;
+    PaceMode mode;
+    long max_frames;
+    pthread_t thread;
+
+    // Triple buffer (see export.h for the same scheme across processes)
+    VideoSnapshot slots[PIPELINE_SLOTS];
+    atomic_uint middle;         // Slot in between, SLOT_FRESH until taken
+    unsigned write_slot;        // Emulation thread's
+    unsigned read_slot;         // Render thread's
+
+    atomic_uint input;          // port1 | port2 << 8 | INPUT_REWIND
+    atomic_bool stop;
+    atomic_bool running;
+
+    // Wakes the render thread when a frame is published
+    pthread_mutex_t lock;
+    pthread_cond_t published_cond;
+    uint64_t published;         // Frames published (under lock)
+    uint64_t taken;             // Frames the render thread has taken
+};
+
+// Publish the frame the emulation thread just ran
+static void publish(Pipeline *p) {
+    video_capture(p->m, &p->slots[p->write_slot]);
+    unsigned old = atomic_exchange_explicit(&p->middle, p->write_slot | SLOT_FRESH,
+                                            memory_order_acq_rel);
+    p->write_slot = old & SLOT_MASK;
+
+    pthread_mutex_lock(&p->lock);
+    p->published++;
+    pthread_cond_signal(&p->published_cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Emulation thread: run, capture and pace frames until told to stop
+static void* emulation_main(void *arg) {
+    Pipeline *p = (Pipeline *)arg;
+    PacmanMachine *m = p->m;
+
+    // Nothing is presented here, so vsync has nothing to wait on
+    Pacer pacer;
+    pacing_init(&pacer, p->mode == PACE_VSYNC ? PACE_TIMER : p->mode, m);
+
+    long frames = 0;
+    while (!atomic_load_explicit(&p->stop, memory_order_relaxed) &&
+           (p->max_frames == 0 || frames < p->max_frames)) {
+        unsigned input = atomic_load_explicit(&p->input, memory_order_relaxed);
+        m->input_port1 = (uint8_t)input;
+        m->input_port2 = (uint8_t)(input >> 8);
+        m->rewind_held = (input & INPUT_REWIND) != 0;
+
+        if (!(p->history && m->rewind_held && rewind_step_back(p->history, m))) {
+            cpu_execute_frame(m);
+            if (p->history) {
+                rewind_push(p->history, m);
+            }
+        }
+        publish(p);
+        frames++;
+
+        uint64_t perf_start = PERF_START();
+        pacing_wait(&pacer, m, false);
+        PERF_STOP(m, PERF_STAGE_SLEEP, perf_start);
+        perf_frame_end(m);
+    }
+
+    pacing_report(&pacer);
+    atomic_store(&p->running, false);
+
+    // Wake a render thread waiting for a frame that will not come
+    pthread_mutex_lock(&p->lock);
+    pthread_cond_signal(&p->published_cond);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Start the emulation thread
+Pipeline* pipeline_start(PacmanMachine *m, Rewind *history, PaceMode mode, long max_frames) {
+    Pipeline *p = (Pipeline *)calloc(1, sizeof(Pipeline));
+    if (!p) {
+        return NULL;
+    }
+    p->m = m;
+    p->history = history;
+    p->mode = mode;
+    p->max_frames = max_frames;
+
+    // The render thread starts on a capture of the current state
+    p->write_slot = 0;
+    p->read_slot = 2;
+    video_capture(m, &p->slots[1]);
+    video_capture(m, &p->slots[2]);
+    atomic_init(&p->middle, 1);
+    atomic_init(&p->input, m->input_port1 | (unsigned)m->input_port2 << 8);
+    atomic_init(&p->stop, false);
+    atomic_init(&p->running, true);
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->published_cond, NULL);
+
+    if (pthread_create(&p->thread, NULL, emulation_main, p) != 0) {
+        LOG_ERROR(LOG_CAT_MAIN, "Failed to start the emulation thread");
+        pthread_cond_destroy(&p->published_cond);
+        pthread_mutex_destroy(&p->lock);
+        free(p);
+        return NULL;
+    }
+    LOG_INFO(LOG_CAT_MAIN, "Emulating on a separate thread from rendering");
+    return p;
+}
+
+// Stop the emulation thread
+void pipeline_stop(Pipeline *p) {
+    if (!p) return;
+
+    atomic_store(&p->stop, true);
+    pthread_join(p->thread, NULL);
+
+    LOG_INFO(LOG_CAT_MAIN, "Pipeline: %llu frames emulated, %llu drawn, %llu skipped",
+             (unsigned long long)p->published, (unsigned long long)p->taken,
+             (unsigned long long)(p->published - p->taken));
+
+    pthread_cond_destroy(&p->published_cond);
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
+
+// Hand the current inputs to the emulation thread
+void pipeline_set_input(Pipeline *p, const PacmanMachine *display) {
+    unsigned input = display->input_port1 | (unsigned)display->input_port2 << 8 |
+                     (display->rewind_held ? INPUT_REWIND : 0);
+    atomic_store_explicit(&p->input, input, memory_order_relaxed);
+}
+
+// Take the newest frame, waiting for one if needed
+const VideoSnapshot* pipeline_acquire(Pipeline *p, uint64_t timeout_ns) {
+    if (!(atomic_load_explicit(&p->middle, memory_order_relaxed) & SLOT_FRESH)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t ns = (uint64_t)deadline.tv_nsec + timeout_ns;
+        deadline.tv_sec += (time_t)(ns / 1000000000ULL);
+        deadline.tv_nsec = (long)(ns % 1000000000ULL);
+
+        pthread_mutex_lock(&p->lock);
+        while (!(atomic_load_explicit(&p->middle, memory_order_relaxed) & SLOT_FRESH) &&
+               atomic_load(&p->running)) {
+            if (pthread_cond_timedwait(&p->published_cond, &p->lock, &deadline) != 0) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        if (!(atomic_load_explicit(&p->middle, memory_order_relaxed) & SLOT_FRESH)) {
+            return NULL;
+        }
+    }
+
+    unsigned old = atomic_exchange_explicit(&p->middle, p->read_slot, memory_order_acq_rel);
+    p->read_slot = old & SLOT_MASK;
+    p->taken++;
+    return &p->slots[p->read_slot];
+}
+
+// Whether the emulation thread is still running frames
+bool pipeline_running(Pipeline *p) {
+    return atomic_load(&p->running);
+}
@@ -0,0 +1,249 @@
+#include "../include/profile.h"
+#include "../include/machine.h"
+#include "../include/memory.h"
+#include "../include/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Rows shown in each part of the report
+#define REPORT_ADDRESSES    40
+#define REPORT_ROUTINES     30
+
+// Opcode tables, indexed like z80_profile.op_count, and the prefix bytes
+// shown in front of their opcodes
+static const char *table_names[Z80_PROFILE_TABLES] = {
+    "Unprefixed", "CB", "ED", "DD/FD", "DD/FD CB"
+};
+static const char *table_prefixes[Z80_PROFILE_TABLES] = {
+    "", "CB ", "ED ", "DD ", "DD CB "
+};
+
+// One row of a sorted report
+typedef struct {
+    uint32_t key;           // Address, opcode or routine
+    uint64_t count;
+    uint64_t extra;         // T-states or total samples
+} ReportRow;
+
+// Start profiling a machine
+bool profile_start(PacmanMachine *m) {
+#ifdef Z80_PROFILE
+    if (!m->cpu_profile) {
+        m->cpu_profile = (z80_profile *)malloc(sizeof(z80_profile));
+        if (!m->cpu_profile) {
+            return false;
+        }
+    }
+    z80_profile_reset(m->cpu_profile);
+    m->cpu.profile = m->cpu_profile;
+    return true;
+#else
+    (void)m;
+    return false;
+#endif
+}
+
+// Sort rows by count, highest first
+static int compare_rows(const void *a, const void *b) {
+    const ReportRow *x = (const ReportRow *)a;
+    const ReportRow *y = (const ReportRow *)b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+// Sort sampled stacks by content, so equal stacks end up next to each other
+static int compare_stacks(const void *a, const void *b) {
+    const z80_profile_stack *x = *(const z80_profile_stack *const *)a;
+    const z80_profile_stack *y = *(const z80_profile_stack *const *)b;
+    int depth = x->depth < y->depth ? x->depth : y->depth;
+    for (int i = 0; i < depth; i++) {
+        if (x->pc[i] != y->pc[i]) {
+            return x->pc[i] < y->pc[i] ? -1 : 1;
+        }
+    }
+    return (int)x->depth - (int)y->depth;
+}
+
+// Percentage of count in total
+static double percent(uint64_t count, uint64_t total) {
+    return total ? 100.0 * (double)count / (double)total : 0.0;
+}
+
+// Write the profile files
+bool profile_write(PacmanMachine *const *machines, int count, const char *prefix) {
+    // Add up the machines' counters (the first profiled machine's ROM is
+    // shown next to the addresses)
+    z80_profile *sum = (z80_profile *)calloc(1, sizeof(z80_profile));
+    const z80_profile_stack **stacks = (const z80_profile_stack **)calloc(
+        (size_t)count * Z80_PROFILE_STACKS, sizeof(*stacks));
+    ReportRow *rows = (ReportRow *)malloc(0x10001 * sizeof(ReportRow));
+    uint64_t *self = (uint64_t *)calloc(0x10001, sizeof(uint64_t));
+    uint64_t *total = (uint64_t *)calloc(0x10001, sizeof(uint64_t));
+    if (!sum || !stacks || !rows || !self || !total) {
+        free(sum); free(stacks); free(rows); free(self); free(total);
+        return false;
+    }
+
+    const PacmanMachine *first = NULL;
+    int profiled = 0;
+    int stack_count = 0;
+    for (int i = 0; i < count; i++) {
+        const z80_profile *p = machines[i]->cpu_profile;
+        if (!p) continue;
+        if (!first) first = machines[i];
+        profiled++;
+
+        for (int pc = 0; pc < 0x10000; pc++) {
+            sum->pc_hits[pc] += p->pc_hits[pc];
+        }
+        for (int t = 0; t < Z80_PROFILE_TABLES; t++) {
+            for (int op = 0; op < 256; op++) {
+                sum->op_count[t][op] += p->op_count[t][op];
+                sum->op_cycles[t][op] += p->op_cycles[t][op];
+            }
+        }
+        for (int op = 0; op < 256; op++) {
+            sum->op_cycles[Z80_PROFILE_BASE][op] +=
+                p->op_count[Z80_PROFILE_BASE][op] * z80_opcode_cycles((uint8_t)op);
+        }
+        for (int s = 0; s < Z80_PROFILE_STACKS; s++) {
+            if (p->stacks[s].count) {
+                stacks[stack_count++] = &p->stacks[s];
+            }
+        }
+        sum->samples_dropped += p->samples_dropped;
+    }
+
+    uint64_t instructions = 0, cycles = 0, samples = 0;
+    for (int op = 0; op < 256; op++) {
+        instructions += sum->op_count[Z80_PROFILE_BASE][op];
+        for (int t = 0; t < Z80_PROFILE_TABLES; t++) {
+            cycles += sum->op_cycles[t][op];
+        }
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.folded", prefix);
+    FILE *folded = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s.txt", prefix);
+    FILE *out = fopen(path, "w");
+    bool ok = folded && out;
+
+    if (ok) {
+        // Flamegraph stacks, one line per distinct stack. Routines are named
+        // after their entry address; the root is code outside any call.
+        qsort(stacks, stack_count, sizeof(*stacks), compare_stacks);
+        for (int i = 0; i < stack_count; ) {
+            const z80_profile_stack *st = stacks[i];
+            uint64_t n = 0;
+            for (; i < stack_count && compare_stacks(&stacks[i], &st) == 0; i++) {
+                n += stacks[i]->count;
+            }
+            samples += n;
+
+            fprintf(folded, "z80");
+            for (int d = 0; d < st->depth; d++) {
+                fprintf(folded, ";sub_%04X", st->pc[d]);
+            }
+            fprintf(folded, " %llu\n", (unsigned long long)n);
+
+            // Self time goes to the innermost routine, total time once to
+            // every routine on the stack (index 0x10000: outside any call)
+            self[st->depth ? st->pc[st->depth - 1] : 0x10000] += n;
+            total[0x10000] += n;
+            for (int d = 0; d < st->depth; d++) {
+                bool repeated = false;
+                for (int e = 0; e < d && !repeated; e++) {
+                    repeated = st->pc[e] == st->pc[d];
+                }
+                if (!repeated) {
+                    total[st->pc[d]] += n;
+                }
+            }
+        }
+
+        fprintf(out, "Z80 profile of %d machine%s: %llu instructions, %llu t-states, "
+                "%llu stack samples (%llu dropped)\n",
+                profiled, profiled == 1 ? "" : "s", (unsigned long long)instructions,
+                (unsigned long long)cycles, (unsigned long long)samples,
+                (unsigned long long)sum->samples_dropped);
+
+        // Hottest addresses, with the bytes there if they are ROM
+        int n = 0;
+        for (int pc = 0; pc < 0x10000; pc++) {
+            if (sum->pc_hits[pc]) {
+                rows[n++] = (ReportRow){ (uint32_t)pc, sum->pc_hits[pc], 0 };
+            }
+        }
+        qsort(rows, n, sizeof(ReportRow), compare_rows);
+        fprintf(out, "\nHottest addresses (%d of %d executed)\n",
+                n < REPORT_ADDRESSES ? n : REPORT_ADDRESSES, n);
+        fprintf(out, "  address          hits       %%    cum%%  bytes\n");
+        uint64_t cumulative = 0;
+        for (int i = 0; i < n && i < REPORT_ADDRESSES; i++) {
+            cumulative += rows[i].count;
+            fprintf(out, "  %04X   %15llu  %6.2f  %6.2f ", rows[i].key,
+                    (unsigned long long)rows[i].count, percent(rows[i].count, instructions),
+                    percent(cumulative, instructions));
+            for (uint32_t b = rows[i].key; b < rows[i].key + 4 && b <= ROM_END; b++) {
+                fprintf(out, " %02X", first->rom[b]);
+            }
+            fprintf(out, "\n");
+        }
+
+        // Routines by sampled self time
+        n = 0;
+        for (int pc = 0; pc <= 0x10000; pc++) {
+            if (self[pc] || (pc < 0x10000 && total[pc])) {
+                rows[n++] = (ReportRow){ (uint32_t)pc, self[pc], total[pc] };
+            }
+        }
+        qsort(rows, n, sizeof(ReportRow), compare_rows);
+        fprintf(out, "\nRoutines by samples in them (self) and under them (total)\n");
+        fprintf(out, "  routine      self%%  total%%\n");
+        for (int i = 0; i < n && i < REPORT_ROUTINES; i++) {
+            if (rows[i].key == 0x10000) {
+                fprintf(out, "  (no call)  ");
+            } else {
+                fprintf(out, "  sub_%04X   ", rows[i].key);
+            }
+            fprintf(out, "%6.2f  %6.2f\n", percent(rows[i].count, samples),
+                    percent(rows[i].extra, samples));
+        }
+
+        // Opcodes of every table by count (prefix bytes are in the first)
+        for (int t = 0; t < Z80_PROFILE_TABLES; t++) {
+            n = 0;
+            for (int op = 0; op < 256; op++) {
+                if (sum->op_count[t][op]) {
+                    rows[n++] = (ReportRow){ (uint32_t)op, sum->op_count[t][op],
+                                             sum->op_cycles[t][op] };
+                }
+            }
+            if (n == 0) continue;
+            qsort(rows, n, sizeof(ReportRow), compare_rows);
+            fprintf(out, "\n%s opcodes (%d used)\n", table_names[t], n);
+            fprintf(out, "  opcode             count       %%          t-states       %%\n");
+            for (int i = 0; i < n; i++) {
+                fprintf(out, "  %-6s%02X    %15llu  %6.2f  %16llu  %6.2f\n", table_prefixes[t],
+                        rows[i].key, (unsigned long long)rows[i].count,
+                        percent(rows[i].count, instructions), (unsigned long long)rows[i].extra,
+                        percent(rows[i].extra, cycles));
+            }
+        }
+    }
+
+    if (folded && fclose(folded) != 0) ok = false;
+    if (out && fclose(out) != 0) ok = false;
+    if (!ok) {
+        LOG_ERROR(LOG_CAT_CPU, "Failed to write the Z80 profile to %s.txt/.folded", prefix);
+    } else {
+        LOG_INFO(LOG_CAT_CPU, "Z80 profile written to %s.txt and %s.folded", prefix, prefix);
+    }
+
+    free(sum); free(stacks); free(rows); free(self); free(total);
+    return ok;
+}
@@ -0,0 +1,318 @@
+#include "../include/rewind.h"
+#include "../include/machine.h"
+#include "../include/state.h"
+#include <stdlib.h>
+#include <string.h>
+
+// One recorded frame in the data ring
+typedef struct {
+    size_t offset;      // Start of the encoded frame in data
+    uint32_t size;      // Encoded bytes
+    bool key;           // Keyframe (encoded against all zeros)
+} RewindEntry;
+
+struct Rewind {
+    // Encoded frames, stored back to back and wrapping at the end
+    uint8_t *data;
+    size_t data_size;
+    size_t bytes_used;
+
+    // Entry ring, oldest at first. Sequence numbers count every frame ever
+    // kept, so a decoded keyframe can be recognized again.
+    RewindEntry *entries;
+    int max_frames;
+    int first;
+    int count;
+    uint64_t first_seq;
+
+    // Snapshot buffers, padded to whole words (the padding stays zero)
+    size_t words;
+    uint64_t *snapshot;     // State being pushed or restored
+    uint64_t *key;          // Decoded keyframe, see key_seq
+    uint64_t key_seq;       // Entry key holds (UINT64_MAX = none)
+    bool key_is_newest;     // key is the newest group's: deltas may use it
+    int since_key;          // Frames pushed since that keyframe
+
+    uint8_t *scratch;       // Encoder output
+};
+
+// Append an unsigned LEB128 value
+static uint8_t* put_varint(uint8_t *p, size_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// Read an unsigned LEB128 value
+static size_t get_varint(const uint8_t **p) {
+    size_t v = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = *(*p)++;
+        v |= (size_t)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return v;
+}
+
+// Worst case encoded size: every word literal, plus two counts per run
+static size_t max_encoded_size(size_t words) {
+    return words * 8 + (words + 1) * 6;
+}
+
+// XOR cur against ref (NULL = zeros) and write it as runs of
+// [zero word count][literal word count][literal words]. Returns the size.
+static size_t encode(const uint64_t *cur, const uint64_t *ref, size_t words, uint8_t *out) {
+    uint8_t *p = out;
+    size_t i = 0;
+
+    while (i < words) {
+        size_t z = i;
+        while (z < words && cur[z] == (ref ? ref[z] : 0)) {
+            z++;
+        }
+        size_t l = z;
+        while (l < words && cur[l] != (ref ? ref[l] : 0)) {
+            l++;
+        }
+
+        p = put_varint(p, z - i);
+        p = put_varint(p, l - z);
+        for (size_t k = z; k < l; k++) {
+            uint64_t v = cur[k] ^ (ref ? ref[k] : 0);
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+        }
+        i = l;
+    }
+    return (size_t)(p - out);
+}
+
+// Rebuild a snapshot from its encoding and reference (NULL = zeros)
+static void decode(const uint8_t *in, size_t size, const uint64_t *ref,
+                   uint64_t *out, size_t words) {
+    if (ref) {
+        memcpy(out, ref, words * sizeof(uint64_t));
+    } else {
+        memset(out, 0, words * sizeof(uint64_t));
+    }
+
+    const uint8_t *p = in;
+    const uint8_t *end = in + size;
+    size_t i = 0;
+    while (p < end) {
+        i += get_varint(&p);
+        size_t literals = get_varint(&p);
+        for (size_t k = 0; k < literals; k++) {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            p += sizeof(v);
+            out[i++] ^= v;
+        }
+    }
+}
+
+// Create a history
+Rewind* rewind_create(int max_frames, size_t max_bytes) {
+    if (max_frames < 2) {
+        max_frames = 2;
+    }
+
+    Rewind *r = (Rewind *)calloc(1, sizeof(Rewind));
+    if (!r) {
+        return NULL;
+    }
+
+    r->words = (state_size() + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    r->max_frames = max_frames;
+    r->data_size = max_bytes;
+    r->data = (uint8_t *)malloc(max_bytes);
+    r->entries = (RewindEntry *)calloc(max_frames, sizeof(RewindEntry));
+    r->snapshot = (uint64_t *)calloc(r->words, sizeof(uint64_t));
+    r->key = (uint64_t *)calloc(r->words, sizeof(uint64_t));
+    r->scratch = (uint8_t *)malloc(max_encoded_size(r->words));
+    if (!r->data || !r->entries || !r->snapshot || !r->key || !r->scratch) {
+        rewind_destroy(r);
+        return NULL;
+    }
+
+    rewind_clear(r);
+    return r;
+}
+
+// Release a history
+void rewind_destroy(Rewind *r) {
+    if (!r) return;
+
+    free(r->data);
+    free(r->entries);
+    free(r->snapshot);
+    free(r->key);
+    free(r->scratch);
+    free(r);
+}
+
+// Forget all recorded frames
+void rewind_clear(Rewind *r) {
+    r->first = 0;
+    r->count = 0;
+    r->bytes_used = 0;
+    r->key_seq = UINT64_MAX;
+    r->key_is_newest = false;
+}
+
+// Entry by age (0 = oldest)
+static RewindEntry* entry_at(Rewind *r, int index) {
+    return &r->entries[(r->first + index) % r->max_frames];
+}
+
+// Drop the oldest keyframe and the deltas that depend on it
+static void drop_oldest_group(Rewind *r) {
+    do {
+        r->bytes_used -= entry_at(r, 0)->size;
+        r->first = (r->first + 1) % r->max_frames;
+        r->first_seq++;
+        r->count--;
+    } while (r->count > 0 && !entry_at(r, 0)->key);
+}
+
+// Find room for size bytes after the newest entry, dropping old groups as
+// needed. Returns false if size does not fit even in an empty ring.
+static bool find_space(Rewind *r, size_t size, size_t *pos) {
+    if (size > r->data_size) {
+        return false;
+    }
+
+    for (;;) {
+        if (r->count == 0) {
+            *pos = 0;
+            return true;
+        }
+
+        const RewindEntry *oldest = entry_at(r, 0);
+        const RewindEntry *newest = entry_at(r, r->count - 1);
+        size_t end = newest->offset + newest->size;
+        if (newest->offset >= oldest->offset) {
+            // Live data is one run: try after it, then at the start
+            if (end + size <= r->data_size) {
+                *pos = end;
+                return true;
+            }
+            if (size <= oldest->offset) {
+                *pos = 0;
+                return true;
+            }
+        } else if (end + size <= oldest->offset) {
+            // Live data wraps: only the gap before the oldest is free
+            *pos = end;
+            return true;
+        }
+        drop_oldest_group(r);
+    }
+}
+
+// Store an encoded frame. Returns false if it does not fit at all, or if it
+// is a delta whose keyframe had to be dropped to make room.
+static bool store(Rewind *r, const uint8_t *encoded, size_t size, bool key) {
+    if (r->count == r->max_frames) {
+        drop_oldest_group(r);
+    }
+
+    size_t pos;
+    if (!find_space(r, size, &pos)) {
+        rewind_clear(r);
+        return false;
+    }
+    if (!key && r->count == 0) {
+        return false;
+    }
+
+    memcpy(r->data + pos, encoded, size);
+    RewindEntry *e = &r->entries[(r->first + r->count) % r->max_frames];
+    e->offset = pos;
+    e->size = (uint32_t)size;
+    e->key = key;
+    r->count++;
+    r->bytes_used += size;
+    return true;
+}
+
+// Record the machine's state after a frame
+void rewind_push(Rewind *r, const PacmanMachine *m) {
+    state_save(m, r->snapshot);
+
+    bool key = !r->key_is_newest || r->since_key >= REWIND_KEY_INTERVAL;
+    if (!key) {
+        size_t size = encode(r->snapshot, r->key, r->words, r->scratch);
+        if (store(r, r->scratch, size, false)) {
+            r->since_key++;
+            return;
+        }
+    }
+
+    // Start a new group; the snapshot becomes the reference for deltas
+    size_t size = encode(r->snapshot, NULL, r->words, r->scratch);
+    if (!store(r, r->scratch, size, true)) {
+        r->key_is_newest = false;
+        return;
+    }
+    memcpy(r->key, r->snapshot, r->words * sizeof(uint64_t));
+    r->key_seq = r->first_seq + r->count - 1;
+    r->key_is_newest = true;
+    r->since_key = 1;
+}
+
+// Go back one frame
+bool rewind_step_back(Rewind *r, PacmanMachine *m) {
+    if (r->count < 2) {
+        return false;
+    }
+
+    // Drop the current frame; the next push starts a fresh group
+    r->bytes_used -= entry_at(r, r->count - 1)->size;
+    r->count--;
+    r->key_is_newest = false;
+
+    int index = r->count - 1;
+    const RewindEntry *e = entry_at(r, index);
+    if (e->key) {
+        decode(r->data + e->offset, e->size, NULL, r->snapshot, r->words);
+    } else {
+        // Find the group's keyframe, decoding it only if it is not cached
+        int key_index = index;
+        while (key_index > 0 && !entry_at(r, key_index)->key) {
+            key_index--;
+        }
+        uint64_t seq = r->first_seq + key_index;
+        if (seq != r->key_seq) {
+            const RewindEntry *k = entry_at(r, key_index);
+            decode(r->data + k->offset, k->size, NULL, r->key, r->words);
+            r->key_seq = seq;
+        }
+        decode(r->data + e->offset, e->size, r->key, r->snapshot, r->words);
+    }
+
+    // The input ports follow the keys held now, not those held back then
+    uint8_t port1 = m->input_port1;
+    uint8_t port2 = m->input_port2;
+    if (!state_load(m, r->snapshot, r->words * sizeof(uint64_t))) {
+        return false;
+    }
+    m->input_port1 = port1;
+    m->input_port2 = port2;
+    return true;
+}
+
+// Frames currently held
+int rewind_frame_count(const Rewind *r) {
+    return r->count;
+}
+
+// Encoded bytes in use
+size_t rewind_bytes_used(const Rewind *r) {
+    return r->bytes_used;
+}
@@ -0,0 +1,602 @@
+#include "../include/romset.h"
+#include "../include/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #define PATH_SEPARATOR '\\'
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+    #define PATH_SEPARATOR '/'
+#endif
+
+// Zip record signatures and sizes
+#define ZIP_LOCAL_SIG       0x04034B50u
+#define ZIP_CENTRAL_SIG     0x02014B50u
+#define ZIP_END_SIG         0x06054B50u
+#define ZIP_LOCAL_SIZE      30
+#define ZIP_CENTRAL_SIZE    46
+#define ZIP_END_SIZE        22
+#define ZIP_STORED          0
+#define ZIP_DEFLATED        8
+
+// One file of a zip
+typedef struct {
+    const char *name;       // Points into the mapping, not terminated
+    size_t name_len;
+    uint16_t method;
+    uint32_t crc;
+    size_t packed_size;
+    size_t size;
+    size_t local_offset;
+} ZipEntry;
+
+struct RomSource {
+    char dir[1024];         // Directory sources
+    MappedFile zip;         // Zip sources
+    ZipEntry *entries;
+    int entry_count;
+};
+
+// CRC-32 (the zip polynomial), four bits at a time
+static const uint32_t crc_nibbles[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+// Update a CRC-32
+uint32_t romset_crc32(uint32_t crc, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc >> 4) ^ crc_nibbles[(crc ^ bytes[i]) & 0x0F];
+        crc = (crc >> 4) ^ crc_nibbles[(crc ^ (bytes[i] >> 4)) & 0x0F];
+    }
+    return ~crc;
+}
+
+// MARK: memory mapped files
+
+// Map a whole file
+bool romset_map(const char *path, MappedFile *file) {
+    memset(file, 0, sizeof(*file));
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(handle, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    CloseHandle(handle);
+    if (!mapping) {
+        return false;
+    }
+    file->data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!file->data) {
+        CloseHandle(mapping);
+        return false;
+    }
+    file->size = (size_t)size.QuadPart;
+    file->handle = mapping;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    file->data = (const uint8_t *)data;
+    file->size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+// Unmap a file
+void romset_unmap(MappedFile *file) {
+    if (!file->data) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(file->data);
+    CloseHandle((HANDLE)file->handle);
+#else
+    munmap((void *)file->data, file->size);
+#endif
+    memset(file, 0, sizeof(*file));
+}
+
+// MARK: inflate (RFC 1951)
+
+// Canonical Huffman code: symbols sorted by code length
+typedef struct {
+    uint16_t counts[16];    // Codes of each length
+    uint16_t symbols[288];
+} Huffman;
+
+// Decompressor state
+typedef struct {
+    const uint8_t *in;
+    size_t in_size;
+    size_t in_pos;
+    uint32_t bit_buffer;
+    int bit_count;
+    uint8_t *out;
+    size_t out_size;
+    size_t out_pos;
+    bool error;
+} Inflater;
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Take n bits (n <= 16), least significant first
+static uint32_t take_bits(Inflater *s, int n) {
+    while (s->bit_count < n) {
+        if (s->in_pos >= s->in_size) {
+            s->error = true;
+            return 0;
+        }
+        s->bit_buffer |= (uint32_t)s->in[s->in_pos++] << s->bit_count;
+        s->bit_count += 8;
+    }
+    uint32_t value = s->bit_buffer & ((1u << n) - 1);
+    s->bit_buffer >>= n;
+    s->bit_count -= n;
+    return value;
+}
+
+// Build a code from symbol code lengths. Returns false if over-subscribed.
+static bool build_huffman(Huffman *h, const uint8_t *lengths, int n) {
+    memset(h->counts, 0, sizeof(h->counts));
+    for (int i = 0; i < n; i++) {
+        h->counts[lengths[i]]++;
+    }
+    h->counts[0] = 0;
+
+    int left = 1;
+    uint16_t offsets[16];
+    offsets[1] = 0;
+    for (int len = 1; len < 16; len++) {
+        left = (left << 1) - h->counts[len];
+        if (left < 0) {
+            return false;
+        }
+        if (len < 15) {
+            offsets[len + 1] = offsets[len] + h->counts[len];
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (lengths[i]) {
+            h->symbols[offsets[lengths[i]]++] = (uint16_t)i;
+        }
+    }
+    return true;
+}
+
+// Decode one symbol, -1 on a bad code
+static int decode_symbol(Inflater *s, const Huffman *h) {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= (int)take_bits(s, 1);
+        int count = h->counts[len];
+        if (code - first < count) {
+            return h->symbols[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+// Inflate one block's codes up to its end of block symbol
+static bool inflate_codes(Inflater *s, const Huffman *lengths, const Huffman *dists) {
+    for (;;) {
+        int symbol = decode_symbol(s, lengths);
+        if (symbol < 0 || s->error) {
+            return false;
+        }
+        if (symbol < 256) {
+            if (s->out_pos >= s->out_size) {
+                return false;
+            }
+            s->out[s->out_pos++] = (uint8_t)symbol;
+            continue;
+        }
+        if (symbol == 256) {
+            return true;
+        }
+
+        symbol -= 257;
+        if (symbol >= 29) {
+            return false;
+        }
+        size_t len = length_base[symbol] + take_bits(s, length_extra[symbol]);
+        int dist_symbol = decode_symbol(s, dists);
+        if (dist_symbol < 0 || dist_symbol >= 30) {
+            return false;
+        }
+        size_t dist = dist_base[dist_symbol] + take_bits(s, dist_extra[dist_symbol]);
+        if (s->error || dist > s->out_pos || len > s->out_size - s->out_pos) {
+            return false;
+        }
+        for (size_t i = 0; i < len; i++, s->out_pos++) {
+            s->out[s->out_pos] = s->out[s->out_pos - dist];
+        }
+    }
+}
+
+// Inflate a block with the fixed codes
+static bool inflate_fixed(Inflater *s) {
+    uint8_t lengths[288 + 30];
+    int i = 0;
+    for (; i < 144; i++) lengths[i] = 8;
+    for (; i < 256; i++) lengths[i] = 9;
+    for (; i < 280; i++) lengths[i] = 7;
+    for (; i < 288; i++) lengths[i] = 8;
+    for (; i < 288 + 30; i++) lengths[i] = 5;
+
+    Huffman lens, dists;
+    build_huffman(&lens, lengths, 288);
+    build_huffman(&dists, lengths + 288, 30);
+    return inflate_codes(s, &lens, &dists);
+}
+
+// Inflate a block with codes sent in its header
+static bool inflate_dynamic(Inflater *s) {
+    static const uint8_t order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+    int nlen = (int)take_bits(s, 5) + 257;
+    int ndist = (int)take_bits(s, 5) + 1;
+    int ncode = (int)take_bits(s, 4) + 4;
+    if (nlen > 286 || ndist > 30) {
+        return false;
+    }
+
+    uint8_t lengths[288 + 30] = {0};
+    for (int i = 0; i < ncode; i++) {
+        lengths[order[i]] = (uint8_t)take_bits(s, 3);
+    }
+    Huffman codes;
+    if (!build_huffman(&codes, lengths, 19)) {
+        return false;
+    }
+
+    // Literal/length and distance code lengths, with runs
+    memset(lengths, 0, sizeof(lengths));
+    for (int i = 0; i < nlen + ndist; ) {
+        int symbol = decode_symbol(s, &codes);
+        if (symbol < 0 || s->error) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths[i++] = (uint8_t)symbol;
+            continue;
+        }
+        uint8_t value = 0;
+        int repeat;
+        if (symbol == 16) {
+            if (i == 0) {
+                return false;
+            }
+            value = lengths[i - 1];
+            repeat = 3 + (int)take_bits(s, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + (int)take_bits(s, 3);
+        } else {
+            repeat = 11 + (int)take_bits(s, 7);
+        }
+        if (i + repeat > nlen + ndist) {
+            return false;
+        }
+        while (repeat--) {
+            lengths[i++] = value;
+        }
+    }
+    if (lengths[256] == 0) {
+        return false;
+    }
+
+    Huffman lens, dists;
+    return build_huffman(&lens, lengths, nlen) && build_huffman(&dists, lengths + nlen, ndist) &&
+           inflate_codes(s, &lens, &dists);
+}
+
+// Inflate a raw deflate stream into exactly out_size bytes
+static bool inflate_raw(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size) {
+    Inflater s = { .in = in, .in_size = in_size, .out = out, .out_size = out_size };
+    bool last = false;
+    while (!last) {
+        last = take_bits(&s, 1) != 0;
+        uint32_t type = take_bits(&s, 2);
+        bool ok;
+        if (type == 0) {
+            // Stored: byte aligned LEN and NLEN, then the bytes
+            s.bit_buffer = 0;
+            s.bit_count = 0;
+            if (s.in_size - s.in_pos < 4) {
+                return false;
+            }
+            size_t len = s.in[s.in_pos] | (s.in[s.in_pos + 1] << 8);
+            size_t nlen = s.in[s.in_pos + 2] | (s.in[s.in_pos + 3] << 8);
+            s.in_pos += 4;
+            ok = len == (~nlen & 0xFFFF) && len <= s.in_size - s.in_pos && len <= s.out_size - s.out_pos;
+            if (ok) {
+                memcpy(s.out + s.out_pos, s.in + s.in_pos, len);
+                s.in_pos += len;
+                s.out_pos += len;
+            }
+        } else if (type == 1) {
+            ok = inflate_fixed(&s);
+        } else if (type == 2) {
+            ok = inflate_dynamic(&s);
+        } else {
+            ok = false;
+        }
+        if (!ok || s.error) {
+            return false;
+        }
+    }
+    return s.out_pos == out_size;
+}
+
+// MARK: zip archives
+
+// Little endian fields
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Read a zip's central directory
+static bool open_zip(RomSource *src) {
+    const uint8_t *data = src->zip.data;
+    size_t size = src->zip.size;
+    if (size < ZIP_END_SIZE) {
+        return false;
+    }
+
+    // The end record is followed by a comment of at most 64KB
+    size_t end = size - ZIP_END_SIZE;
+    size_t stop = end > 0xFFFF ? end - 0xFFFF : 0;
+    while (get_u32(data + end) != ZIP_END_SIG) {
+        if (end == stop) {
+            return false;
+        }
+        end--;
+    }
+
+    int count = get_u16(data + end + 10);
+    size_t offset = get_u32(data + end + 16);
+    src->entries = (ZipEntry *)calloc(count ? count : 1, sizeof(ZipEntry));
+    if (!src->entries) {
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (offset + ZIP_CENTRAL_SIZE > size || get_u32(data + offset) != ZIP_CENTRAL_SIG) {
+            return false;
+        }
+        const uint8_t *p = data + offset;
+        ZipEntry *e = &src->entries[src->entry_count++];
+        e->method = get_u16(p + 10);
+        e->crc = get_u32(p + 16);
+        e->packed_size = get_u32(p + 20);
+        e->size = get_u32(p + 24);
+        e->name_len = get_u16(p + 28);
+        e->local_offset = get_u32(p + 42);
+        e->name = (const char *)p + ZIP_CENTRAL_SIZE;
+        offset += ZIP_CENTRAL_SIZE + e->name_len + get_u16(p + 30) + get_u16(p + 32);
+        if (offset > size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Find a file in a zip by name, in any folder, ignoring case
+static const ZipEntry* find_entry(const RomSource *src, const char *name) {
+    size_t name_len = strlen(name);
+    for (int i = 0; i < src->entry_count; i++) {
+        const ZipEntry *e = &src->entries[i];
+        if (e->name_len < name_len) {
+            continue;
+        }
+        const char *base = e->name + e->name_len - name_len;
+        if (base != e->name && base[-1] != '/' && base[-1] != '\\') {
+            continue;
+        }
+        bool same = true;
+        for (size_t c = 0; c < name_len && same; c++) {
+            char a = base[c], b = name[c];
+            if (a >= 'A' && a <= 'Z') a += 'a' - 'A';
+            if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+            same = a == b;
+        }
+        if (same) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// Extract a whole zip entry into out (e->size bytes) and check its CRC
+static bool extract_entry(const RomSource *src, const ZipEntry *e, uint8_t *out) {
+    const uint8_t *data = src->zip.data;
+    size_t size = src->zip.size;
+    if (e->local_offset + ZIP_LOCAL_SIZE > size ||
+        get_u32(data + e->local_offset) != ZIP_LOCAL_SIG) {
+        return false;
+    }
+    size_t start = e->local_offset + ZIP_LOCAL_SIZE + get_u16(data + e->local_offset + 26) +
+                   get_u16(data + e->local_offset + 28);
+    if (start > size || e->packed_size > size - start) {
+        return false;
+    }
+
+    bool ok;
+    if (e->method == ZIP_STORED) {
+        ok = e->packed_size == e->size;
+        if (ok) {
+            memcpy(out, data + start, e->size);
+        }
+    } else if (e->method == ZIP_DEFLATED) {
+        ok = inflate_raw(data + start, e->packed_size, out, e->size);
+    } else {
+        LOG_WARN(LOG_CAT_MEMORY, "Unsupported zip compression method %u", e->method);
+        ok = false;
+    }
+    return ok && romset_crc32(0, out, e->size) == e->crc;
+}
+
+// MARK: sources
+
+// Open a set directory or zip
+RomSource* romset_open(const char *path) {
+    RomSource *src = (RomSource *)calloc(1, sizeof(RomSource));
+    if (!src) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        snprintf(src->dir, sizeof(src->dir), "%s", path);
+        return src;
+    }
+
+    if (romset_map(path, &src->zip) && open_zip(src)) {
+        LOG_DEBUG(LOG_CAT_MEMORY, "Zip %s has %d files", path, src->entry_count);
+        return src;
+    }
+    romset_close(src);
+    return NULL;
+}
+
+// Release a source
+void romset_close(RomSource *src) {
+    if (!src) {
+        return;
+    }
+    romset_unmap(&src->zip);
+    free(src->entries);
+    free(src);
+}
+
+// Zip or directory
+bool romset_is_zip(const RomSource *src) {
+    return src->zip.data != NULL;
+}
+
+// Read a whole file of a directory source into a new buffer
+static uint8_t* read_dir_file(const RomSource *src, const char *name, size_t *size) {
+    char path[1100];
+    size_t dir_len = strlen(src->dir);
+    if (dir_len > 0 && src->dir[dir_len - 1] != PATH_SEPARATOR) {
+        snprintf(path, sizeof(path), "%s%c%s", src->dir, PATH_SEPARATOR, name);
+    } else {
+        snprintf(path, sizeof(path), "%s%s", src->dir, name);
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        LOG_DEBUG(LOG_CAT_MEMORY, "File NOT found: %s", path);
+        return NULL;
+    }
+    uint8_t *data = NULL;
+    long file_size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        file_size = ftell(file);
+    }
+    if (file_size >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+        data = (uint8_t *)malloc(file_size ? (size_t)file_size : 1);
+    }
+    if (data && fread(data, 1, (size_t)file_size, file) != (size_t)file_size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = data ? (size_t)file_size : 0;
+    return data;
+}
+
+// Size and CRC of a file
+bool romset_stat(RomSource *src, const char *name, size_t *size, uint32_t *crc) {
+    if (romset_is_zip(src)) {
+        const ZipEntry *e = find_entry(src, name);
+        if (!e) {
+            return false;
+        }
+        *size = e->size;
+        *crc = e->crc;
+        return true;
+    }
+
+    uint8_t *data = read_dir_file(src, name, size);
+    if (!data) {
+        return false;
+    }
+    *crc = romset_crc32(0, data, *size);
+    free(data);
+    return true;
+}
+
+// Read the start of a file
+size_t romset_read(RomSource *src, const char *name, uint8_t *buffer, size_t size) {
+    uint8_t *data = NULL;
+    size_t file_size = 0;
+    if (romset_is_zip(src)) {
+        const ZipEntry *e = find_entry(src, name);
+        if (!e) {
+            return 0;
+        }
+        data = (uint8_t *)malloc(e->size ? e->size : 1);
+        if (data && !extract_entry(src, e, data)) {
+            LOG_ERROR(LOG_CAT_MEMORY, "Failed to extract %s from the zip (damaged?)", name);
+            free(data);
+            return 0;
+        }
+        file_size = e->size;
+    } else {
+        data = read_dir_file(src, name, &file_size);
+    }
+    if (!data) {
+        return 0;
+    }
+
+    size_t n = file_size < size ? file_size : size;
+    memcpy(buffer, data, n);
+    free(data);
+    return n;
+}
@@ -0,0 +1,49 @@
+#include "../include/runahead.h"
+#include "../include/machine.h"
+#include "../include/cpu.h"
+#include "../include/state.h"
+#include "../include/video.h"
+#include <stdlib.h>
+
+// Set up run-ahead
+bool runahead_init(RunAhead *ra, int frames) {
+    ra->frames = frames;
+    ra->snapshot = NULL;
+    if (frames > 0) {
+        ra->snapshot = (uint8_t *)malloc(state_size());
+        if (!ra->snapshot) {
+            ra->frames = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Release the snapshot buffer
+void runahead_free(RunAhead *ra) {
+    free(ra->snapshot);
+    ra->snapshot = NULL;
+    ra->frames = 0;
+}
+
+// Render the frame the game will show ra->frames frames from now
+void runahead_render(RunAhead *ra, PacmanMachine *m) {
+    if (ra->frames <= 0) {
+        video_render(m);
+        return;
+    }
+
+    state_save(m, ra->snapshot);
+
+    // Speculative frames must not be heard, so they run without the audio
+    // output (sound blocks are then skipped)
+    struct SoundOutput *audio = m->audio;
+    m->audio = NULL;
+    for (int i = 0; i < ra->frames; i++) {
+        cpu_execute_frame(m);
+    }
+    video_render(m);
+    m->audio = audio;
+
+    state_load(m, ra->snapshot, state_size());
+}
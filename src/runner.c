@@ -0,0 +1,253 @@
+#include "../include/runner.h"
+#include "../include/machine.h"
+#include "../include/cpu.h"
+#include "../include/video.h"
+#include "../include/perf.h"
+#include "../include/log.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
+
+
+#define CACHE_LINE 64
+
+// Range of job indices owned by one thread. Kept on its own cache line so
+// the atomic counters of different threads never share a line.
+typedef struct {
+    atomic_int next;    // Next index to hand out (may overshoot end)
+    int end;            // One past the last index of this slice
+    char pad[CACHE_LINE - sizeof(atomic_int) - sizeof(int)];
+} RunnerSlice;
+
+struct Runner {
+    int num_threads;            // Including the calling thread
+    pthread_t *threads;         // num_threads - 1 worker threads
+    void *slice_mem;            // Unaligned allocation backing slices
+    RunnerSlice *slices;        // One slice per thread, cache line aligned
+    
+    pthread_mutex_t lock;
+    pthread_cond_t start_cond;  // Signalled when a new batch is posted
+    pthread_cond_t done_cond;   // Signalled when the last worker finishes
+    unsigned generation;        // Incremented for every batch
+    int active;                 // Worker threads still running the batch
+    bool shutdown;
+    
+    RunnerJob job;
+    void *userdata;
+};
+
+// Arguments for a worker thread
+typedef struct {
+    Runner *runner;
+    int index;
+} WorkerArgs;
+
+// Number of online CPUs
+static int detect_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+// Run all jobs of our own slice, then steal from the others
+static void run_slices(Runner *r, int self) {
+    int n = r->num_threads;
+    
+    for (int k = 0; k < n; k++) {
+        RunnerSlice *slice = &r->slices[(self + k) % n];
+        
+        for (;;) {
+            int i = atomic_fetch_add_explicit(&slice->next, 1, memory_order_relaxed);
+            if (i >= slice->end) break;
+            r->job(r->userdata, i);
+        }
+    }
+}
+
+// Worker thread main loop
+static void* worker_main(void *arg) {
+    WorkerArgs args = *(WorkerArgs *)arg;
+    Runner *r = args.runner;
+    free(arg);
+    
+    // Batches are counted from runner creation, so a batch posted before
+    // this thread got to run is not missed
+    unsigned seen = 0;
+    
+    pthread_mutex_lock(&r->lock);
+    
+    for (;;) {
+        while (r->generation == seen && !r->shutdown) {
+            pthread_cond_wait(&r->start_cond, &r->lock);
+        }
+        if (r->shutdown) break;
+        seen = r->generation;
+        pthread_mutex_unlock(&r->lock);
+        
+        run_slices(r, args.index);
+        
+        pthread_mutex_lock(&r->lock);
+        if (--r->active == 0) {
+            pthread_cond_signal(&r->done_cond);
+        }
+    }
+    
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+// Create a runner with num_threads threads in total
+Runner* runner_create(int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = detect_cpu_count();
+    }
+    
+    Runner *r = (Runner *)calloc(1, sizeof(Runner));
+    if (!r) return NULL;
+    
+    r->num_threads = num_threads;
+    r->slice_mem = malloc(num_threads * sizeof(RunnerSlice) + CACHE_LINE);
+    r->threads = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+    if (!r->slice_mem || !r->threads) {
+        free(r->slice_mem);
+        free(r->threads);
+        free(r);
+        return NULL;
+    }
+    r->slices = (RunnerSlice *)(((uintptr_t)r->slice_mem + CACHE_LINE - 1) &
+                                ~(uintptr_t)(CACHE_LINE - 1));
+    for (int i = 0; i < num_threads; i++) {
+        atomic_init(&r->slices[i].next, 0);
+        r->slices[i].end = 0;
+    }
+    
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->start_cond, NULL);
+    pthread_cond_init(&r->done_cond, NULL);
+    
+    // Thread 0 is the caller of runner_parallel_for()
+    for (int i = 1; i < num_threads; i++) {
+        WorkerArgs *args = (WorkerArgs *)malloc(sizeof(WorkerArgs));
+        if (args) {
+            args->runner = r;
+            args->index = i;
+        }
+        if (!args || pthread_create(&r->threads[i], NULL, worker_main, args) != 0) {
+            free(args);
+            LOG_WARN(LOG_CAT_RUNNER, "Could only start %d of %d runner threads", i, num_threads);
+            
+            // Run with the threads we have; slices past them are stolen
+            pthread_mutex_lock(&r->lock);
+            r->num_threads = i;
+            pthread_mutex_unlock(&r->lock);
+            break;
+        }
+    }
+    
+    LOG_INFO(LOG_CAT_RUNNER, "Runner started with %d threads", r->num_threads);
+    return r;
+}
+
+// Stop all worker threads and free the runner
+void runner_destroy(Runner *r) {
+    if (!r) return;
+    
+    pthread_mutex_lock(&r->lock);
+    r->shutdown = true;
+    pthread_cond_broadcast(&r->start_cond);
+    pthread_mutex_unlock(&r->lock);
+    
+    for (int i = 1; i < r->num_threads; i++) {
+        pthread_join(r->threads[i], NULL);
+    }
+    
+    pthread_cond_destroy(&r->done_cond);
+    pthread_cond_destroy(&r->start_cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r->threads);
+    free(r->slice_mem);
+    free(r);
+}
+
+// Number of threads used by the runner, including the caller
+int runner_thread_count(const Runner *r) {
+    return r->num_threads;
+}
+
+// Run job(userdata, i) for every i in [0, count) and wait for all of them
+void runner_parallel_for(Runner *r, int count, RunnerJob job, void *userdata) {
+    if (count <= 0) return;
+    
+    // Nothing to share, skip the wake-up round trip
+    if (r->num_threads == 1 || count == 1) {
+        for (int i = 0; i < count; i++) {
+            job(userdata, i);
+        }
+        return;
+    }
+    
+    // Split the range into one contiguous slice per thread
+    int n = r->num_threads;
+    for (int t = 0; t < n; t++) {
+        atomic_store_explicit(&r->slices[t].next, (int)((long)count * t / n),
+                              memory_order_relaxed);
+        r->slices[t].end = (int)((long)count * (t + 1) / n);
+    }
+    
+    // Publish the batch (the mutex orders the slice setup before the workers)
+    pthread_mutex_lock(&r->lock);
+    r->job = job;
+    r->userdata = userdata;
+    r->active = n - 1;
+    r->generation++;
+    pthread_cond_broadcast(&r->start_cond);
+    pthread_mutex_unlock(&r->lock);
+    
+    run_slices(r, 0);
+    
+    pthread_mutex_lock(&r->lock);
+    while (r->active > 0) {
+        pthread_cond_wait(&r->done_cond, &r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+// Arguments shared by all machine stepping jobs
+typedef struct {
+    PacmanMachine **machines;
+    int frames;
+    bool render;
+} StepBatch;
+
+// Run one machine for a batch of frames
+static void step_machine_job(void *userdata, int index) {
+    StepBatch *batch = (StepBatch *)userdata;
+    PacmanMachine *m = batch->machines[index];
+    
+    for (int f = 0; f < batch->frames; f++) {
+        cpu_execute_frame(m);
+        if (batch->render) {
+            video_render(m);
+        }
+        perf_frame_end(m);
+    }
+}
+
+// Step every machine for the given number of frames
+void runner_step_machines(Runner *r, PacmanMachine **machines, int count,
+                          int frames, bool render) {
+    StepBatch batch = { machines, frames, render };
+    runner_parallel_for(r, count, step_machine_job, &batch);
+}
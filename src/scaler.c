@@ -0,0 +1,336 @@
+#include "../include/scaler.h"
+#include "../include/gfx_kernels.h"
+#include "../include/runner.h"
+#include "../include/log.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Bands per pool thread, so threads that finish early can steal the rest
+#define BANDS_PER_THREAD    4
+
+// Filter weights: scanline rows and the dimmed channels of the grille
+#define SCANLINE_LEVEL      0x80
+#define CRT_SCANLINE_LEVEL  0x60
+#define CRT_GRILLE_LEVEL    0xA0
+
+static const char *filter_names[SCALER_FILTER_COUNT] = { "nearest", "scanlines", "crt", "epx" };
+
+struct Scaler {
+    ScalerFilter filter;
+    int scale;
+    int width, height;
+    int out_width;              // width * scale
+    int pre;                    // EPX factor (2 or 3), 1 for the other filters
+
+    Runner *runner;
+    int band_count;             // Bands of source rows, one job each
+
+    // Brightness weights (scanlines, CRT): one row of out_width weights per
+    // output row within a source pixel, NULL for the other filters
+    uint32_t *mask;
+    bool mask_plain[SCALER_MAX_SCALE];  // Mask row keeps every pixel
+
+    // Per band: pre rows of width * pre EPX output, then one widened row
+    uint32_t *scratch;
+    size_t scratch_stride;
+
+    // Frame being scaled by scaler_run()
+    const uint32_t *src;
+    int src_pitch;
+    uint32_t *dst;
+    int dst_pitch;
+};
+
+// Pack channel weights in the framebuffer's layout, alpha always kept
+static uint32_t mask_weight(int r, int g, int b) {
+    return 0xFF000000u | (uint32_t)r << 16 | (uint32_t)g << 8 | (uint32_t)b;
+}
+
+// Product of two weights, as the modulate kernel computes it
+static int mask_mul(int a, int b) {
+    return (a * (b + 1)) >> 8;
+}
+
+// Fill the mask rows. The last quarter of the rows of each source pixel
+// (at least one row) is a darker scanline; CRT also cycles the columns
+// through red, green and blue phosphor stripes.
+static void build_mask(Scaler *s) {
+    int dark_rows = s->scale / 4 > 0 ? s->scale / 4 : 1;
+
+    for (int r = 0; r < s->scale; r++) {
+        uint32_t *row = &s->mask[(size_t)r * s->out_width];
+        bool dark = r >= s->scale - dark_rows;
+        int level = 0xFF;
+        if (dark) {
+            level = s->filter == SCALER_CRT ? CRT_SCANLINE_LEVEL : SCANLINE_LEVEL;
+        }
+
+        for (int x = 0; x < s->out_width; x++) {
+            if (s->filter == SCALER_CRT) {
+                int dim = mask_mul(level, CRT_GRILLE_LEVEL);
+                int phase = x % 3;
+                row[x] = mask_weight(phase == 0 ? level : dim, phase == 1 ? level : dim,
+                                     phase == 2 ? level : dim);
+            } else {
+                row[x] = mask_weight(level, level, level);
+            }
+        }
+        s->mask_plain[r] = s->filter != SCALER_CRT && !dark;
+    }
+}
+
+// Create a scaler for width x height frames
+Scaler* scaler_create(ScalerFilter filter, int scale, int width, int height, int threads) {
+    if (filter < 0 || filter >= SCALER_FILTER_COUNT || scale < 1 || scale > SCALER_MAX_SCALE ||
+        width <= 0 || height <= 0) {
+        return NULL;
+    }
+    if (filter != SCALER_NEAREST && scale < 2) {
+        return NULL;
+    }
+
+    int pre = 1;
+    if (filter == SCALER_EPX) {
+        if (scale % 2 == 0) {
+            pre = 2;
+        } else if (scale % 3 == 0) {
+            pre = 3;
+        } else {
+            return NULL;
+        }
+    }
+
+    Scaler *s = (Scaler *)calloc(1, sizeof(Scaler));
+    if (!s) {
+        return NULL;
+    }
+    s->filter = filter;
+    s->scale = scale;
+    s->width = width;
+    s->height = height;
+    s->out_width = width * scale;
+    s->pre = pre;
+
+    s->runner = runner_create(threads);
+    if (!s->runner) {
+        scaler_destroy(s);
+        return NULL;
+    }
+    s->band_count = runner_thread_count(s->runner) * BANDS_PER_THREAD;
+    if (s->band_count > height) {
+        s->band_count = height;
+    }
+
+    s->scratch_stride = (size_t)pre * width * pre + (size_t)s->out_width;
+    s->scratch = (uint32_t *)malloc(s->scratch_stride * s->band_count * sizeof(uint32_t));
+    if (!s->scratch) {
+        scaler_destroy(s);
+        return NULL;
+    }
+
+    if (filter == SCALER_SCANLINES || filter == SCALER_CRT) {
+        s->mask = (uint32_t *)malloc((size_t)s->out_width * scale * sizeof(uint32_t));
+        if (!s->mask) {
+            scaler_destroy(s);
+            return NULL;
+        }
+        build_mask(s);
+    }
+
+    LOG_INFO(LOG_CAT_VIDEO, "Scaler: %s x%d, %dx%d -> %dx%d, %d bands on %d threads",
+             filter_names[filter], scale, width, height, s->out_width, height * scale,
+             s->band_count, runner_thread_count(s->runner));
+    return s;
+}
+
+// Free a scaler
+void scaler_destroy(Scaler *s) {
+    if (!s) return;
+
+    runner_destroy(s->runner);
+    free(s->scratch);
+    free(s->mask);
+    free(s);
+}
+
+// Write count pixels of line factor times wider into factor output rows
+// starting at out_row, applying the mask if there is one. wide is scratch
+// for one output row.
+static void emit_rows(const Scaler *s, const GfxKernels *k, const uint32_t *line, int count,
+                      int factor, int out_row, uint32_t *wide) {
+    uint32_t *first = s->dst + (size_t)out_row * s->dst_pitch;
+    size_t row_bytes = (size_t)s->out_width * sizeof(uint32_t);
+
+    // Without a mask the first output row is the widened line
+    if (!s->mask) {
+        if (factor > 1) {
+            k->widen(first, line, count, factor);
+        } else {
+            memcpy(first, line, row_bytes);
+        }
+        for (int j = 1; j < factor; j++) {
+            memcpy(first + (size_t)j * s->dst_pitch, first, row_bytes);
+        }
+        return;
+    }
+
+    k->widen(wide, line, count, factor);
+    for (int j = 0; j < factor; j++) {
+        uint32_t *d = first + (size_t)j * s->dst_pitch;
+        int r = (out_row + j) % s->scale;
+        if (s->mask_plain[r]) {
+            memcpy(d, wide, row_bytes);
+        } else {
+            k->modulate(d, wide, &s->mask[(size_t)r * s->out_width], s->out_width);
+        }
+    }
+}
+
+// Scale2x (AdvMAME2x) of source row y into two rows of width * 2
+static void epx2_row(const Scaler *s, int y, uint32_t *out) {
+    const uint32_t *row = s->src + (size_t)y * s->src_pitch;
+    const uint32_t *up = y > 0 ? row - s->src_pitch : row;
+    const uint32_t *down = y < s->height - 1 ? row + s->src_pitch : row;
+    uint32_t *out0 = out;
+    uint32_t *out1 = out + s->width * 2;
+
+    for (int x = 0; x < s->width; x++) {
+        uint32_t e = row[x];
+        uint32_t b = up[x];
+        uint32_t h = down[x];
+        uint32_t d = x > 0 ? row[x - 1] : e;
+        uint32_t f = x < s->width - 1 ? row[x + 1] : e;
+
+        if (b != h && d != f) {
+            out0[x * 2]     = d == b ? d : e;
+            out0[x * 2 + 1] = b == f ? f : e;
+            out1[x * 2]     = d == h ? d : e;
+            out1[x * 2 + 1] = h == f ? f : e;
+        } else {
+            out0[x * 2] = out0[x * 2 + 1] = e;
+            out1[x * 2] = out1[x * 2 + 1] = e;
+        }
+    }
+}
+
+// Scale3x (AdvMAME3x) of source row y into three rows of width * 3
+static void epx3_row(const Scaler *s, int y, uint32_t *out) {
+    const uint32_t *row = s->src + (size_t)y * s->src_pitch;
+    const uint32_t *up = y > 0 ? row - s->src_pitch : row;
+    const uint32_t *down = y < s->height - 1 ? row + s->src_pitch : row;
+    int w = s->width * 3;
+
+    for (int x = 0; x < s->width; x++) {
+        int xl = x > 0 ? x - 1 : x;
+        int xr = x < s->width - 1 ? x + 1 : x;
+        uint32_t a = up[xl],   b = up[x],   c = up[xr];
+        uint32_t d = row[xl],  e = row[x],  f = row[xr];
+        uint32_t g = down[xl], h = down[x], i = down[xr];
+        uint32_t *o = out + x * 3;
+
+        if (b != h && d != f) {
+            o[0]         = d == b ? d : e;
+            o[1]         = (d == b && e != c) || (b == f && e != a) ? b : e;
+            o[2]         = b == f ? f : e;
+            o[w]         = (d == b && e != g) || (d == h && e != a) ? d : e;
+            o[w + 1]     = e;
+            o[w + 2]     = (b == f && e != i) || (h == f && e != c) ? f : e;
+            o[2 * w]     = d == h ? d : e;
+            o[2 * w + 1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+            o[2 * w + 2] = h == f ? f : e;
+        } else {
+            o[0] = o[1] = o[2] = e;
+            o[w] = o[w + 1] = o[w + 2] = e;
+            o[2 * w] = o[2 * w + 1] = o[2 * w + 2] = e;
+        }
+    }
+}
+
+// Scale one band of source rows
+static void band_job(void *userdata, int band) {
+    Scaler *s = (Scaler *)userdata;
+    const GfxKernels *k = gfx_kernels();
+    int y0 = (int)((long)s->height * band / s->band_count);
+    int y1 = (int)((long)s->height * (band + 1) / s->band_count);
+    uint32_t *epx = &s->scratch[s->scratch_stride * band];
+    uint32_t *wide = epx + (size_t)s->pre * s->width * s->pre;
+    int factor = s->scale / s->pre;
+
+    for (int y = y0; y < y1; y++) {
+        if (s->pre == 1) {
+            emit_rows(s, k, s->src + (size_t)y * s->src_pitch, s->width, factor, y * s->scale, wide);
+            continue;
+        }
+
+        if (s->pre == 2) {
+            epx2_row(s, y, epx);
+        } else {
+            epx3_row(s, y, epx);
+        }
+        int line_width = s->width * s->pre;
+        for (int j = 0; j < s->pre; j++) {
+            emit_rows(s, k, &epx[(size_t)j * line_width], line_width, factor,
+                      y * s->scale + j * factor, wide);
+        }
+    }
+}
+
+// Scale a frame, one band of rows per job
+void scaler_run(Scaler *s, const uint32_t *src, int src_pitch, uint32_t *dst, int dst_pitch) {
+    s->src = src;
+    s->src_pitch = src_pitch;
+    s->dst = dst;
+    s->dst_pitch = dst_pitch;
+    runner_parallel_for(s->runner, s->band_count, band_job, s);
+}
+
+// Draw the filter's weights over a whole output frame
+bool scaler_draw_mask(const Scaler *s, uint32_t *dst, int dst_pitch) {
+    if (!s->mask) {
+        return false;
+    }
+
+    for (int y = 0; y < s->height * s->scale; y++) {
+        memcpy(dst + (size_t)y * dst_pitch, &s->mask[(size_t)(y % s->scale) * s->out_width],
+               (size_t)s->out_width * sizeof(uint32_t));
+    }
+    return true;
+}
+
+// Settings of a scaler
+ScalerFilter scaler_filter(const Scaler *s) {
+    return s->filter;
+}
+
+int scaler_scale(const Scaler *s) {
+    return s->scale;
+}
+
+// Filter by name
+bool scaler_parse_filter(const char *name, ScalerFilter *filter) {
+    for (int i = 0; i < SCALER_FILTER_COUNT; i++) {
+        if (strcmp(name, filter_names[i]) == 0) {
+            *filter = (ScalerFilter)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* scaler_filter_name(ScalerFilter filter) {
+    return filter >= 0 && filter < SCALER_FILTER_COUNT ? filter_names[filter] : "unknown";
+}
+
+// Path by name
+bool scaler_parse_path(const char *name, ScalerPath *path) {
+    if (strcmp(name, "auto") == 0) {
+        *path = SCALER_PATH_AUTO;
+    } else if (strcmp(name, "cpu") == 0) {
+        *path = SCALER_PATH_CPU;
+    } else if (strcmp(name, "gpu") == 0) {
+        *path = SCALER_PATH_GPU;
+    } else {
+        return false;
+    }
+    return true;
+}
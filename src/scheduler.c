@@ -0,0 +1,80 @@
+#include "../include/scheduler.h"
+#include <string.h>
+
+// Heap order: earlier time first, then lower event type
+static bool event_before(const SchedEvent *a, const SchedEvent *b) {
+    return a->time < b->time || (a->time == b->time && a->type < b->type);
+}
+
+// Remove all events and restart the clock at cycle 0
+void scheduler_init(Scheduler *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+// Queue an event at an absolute cycle
+bool scheduler_add(Scheduler *s, SchedEventType type, uint64_t time) {
+    const int capacity = (int)(sizeof(s->heap) / sizeof(s->heap[0]));
+    if (s->count >= capacity) {
+        return false;
+    }
+
+    // Sift the new event up from the bottom of the heap
+    SchedEvent event = { time, type };
+    int i = s->count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!event_before(&event, &s->heap[parent])) {
+            break;
+        }
+        s->heap[i] = s->heap[parent];
+        i = parent;
+    }
+    s->heap[i] = event;
+    return true;
+}
+
+// Cycle the earliest event is due at
+uint64_t scheduler_next_time(const Scheduler *s) {
+    return s->count > 0 ? s->heap[0].time : UINT64_MAX;
+}
+
+// Check whether an event of this type is queued
+bool scheduler_pending(const Scheduler *s, SchedEventType type) {
+    for (int i = 0; i < s->count; i++) {
+        if (s->heap[i].type == type) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Remove the earliest event if it is due
+bool scheduler_pop_due(Scheduler *s, SchedEvent *event) {
+    if (s->count == 0 || s->heap[0].time > s->now) {
+        return false;
+    }
+
+    *event = s->heap[0];
+
+    // Sift the last event down from the root
+    SchedEvent last = s->heap[--s->count];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= s->count) {
+            break;
+        }
+        if (child + 1 < s->count && event_before(&s->heap[child + 1], &s->heap[child])) {
+            child++;
+        }
+        if (!event_before(&s->heap[child], &last)) {
+            break;
+        }
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+    if (s->count > 0) {
+        s->heap[i] = last;
+    }
+    return true;
+}
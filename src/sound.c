@@ -0,0 +1,249 @@
+#include "../include/sound.h"
+#include "../include/machine.h"
+#include "../include/scheduler.h"
+#include "../include/log.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef NO_SDL
+    #include <SDL2/SDL.h>
+#endif
+
+// Output scale: 3 voices x 2 chip clocks x (-8..7) x volume 15 stays
+// within 16 bits
+#define SOUND_GAIN      40
+
+// Phase accumulators and frequencies are 20 bits wide
+#define SOUND_PHASE_MASK 0xFFFFF
+
+// Audio device buffer size in samples (about 10ms)
+#define SOUND_DEVICE_SAMPLES 512
+
+// Open audio output: the ring the emulation thread fills and the device
+// whose callback drains it
+struct SoundOutput {
+    SoundRing ring;
+#ifndef NO_SDL
+    SDL_AudioDeviceID device;
+#endif
+};
+
+// Queue up to count samples
+uint32_t sound_ring_write(SoundRing *ring, const int16_t *samples, uint32_t count) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t space = SOUND_RING_SIZE - (head - tail);
+    if (count > space) {
+        count = space;
+    }
+
+    // Copy in at most two runs, wrapping at the end of the buffer
+    uint32_t start = head & (SOUND_RING_SIZE - 1);
+    uint32_t first = SOUND_RING_SIZE - start < count ? SOUND_RING_SIZE - start : count;
+    memcpy(&ring->samples[start], samples, first * sizeof(int16_t));
+    memcpy(ring->samples, samples + first, (count - first) * sizeof(int16_t));
+
+    // Publish the samples only after they are written
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    return count;
+}
+
+// Dequeue up to count samples
+uint32_t sound_ring_read(SoundRing *ring, int16_t *samples, uint32_t count) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (count > head - tail) {
+        count = head - tail;
+    }
+
+    uint32_t start = tail & (SOUND_RING_SIZE - 1);
+    uint32_t first = SOUND_RING_SIZE - start < count ? SOUND_RING_SIZE - start : count;
+    memcpy(samples, &ring->samples[start], first * sizeof(int16_t));
+    memcpy(samples + first, ring->samples, (count - first) * sizeof(int16_t));
+
+    // Hand the slots back to the producer
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    return count;
+}
+
+// Samples currently queued
+uint32_t sound_ring_available(SoundRing *ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return head - tail;
+}
+
+// Silence all voices
+void sound_reset(PacmanMachine *m) {
+    memset(m->sound_regs, 0, sizeof(m->sound_regs));
+    memset(m->voices, 0, sizeof(m->voices));
+}
+
+// Handle a write to sound register 0x00-0x1F. Register layout, one nibble
+// each (voice 1 has an extra low frequency nibble at 0x10):
+//   0x05, 0x0A, 0x0F          waveform of voice 1, 2, 3
+//   0x10-0x14, 0x16-0x19,
+//   0x1B-0x1E                 frequency of voice 1, 2, 3
+//   0x15, 0x1A, 0x1F          volume of voice 1, 2, 3
+// 0x00-0x04, 0x06-0x09 and 0x0B-0x0E are the voices' phase accumulators on
+// the real chip; writes to them have no audible effect and are ignored.
+void sound_write_register(PacmanMachine *m, uint8_t reg, uint8_t value) {
+    reg &= SOUND_REG_COUNT - 1;
+    value &= 0x0F;
+    if (m->sound_regs[reg] == value) {
+        return;
+    }
+    m->sound_regs[reg] = value;
+
+    int ch;
+    if (reg < 0x10) {
+        ch = (reg - 5) / 5;
+    } else if (reg == 0x10) {
+        ch = 0;
+    } else {
+        ch = (reg - 0x11) / 5;
+    }
+    if (ch < 0 || ch >= SOUND_VOICES) {
+        return;
+    }
+
+    SoundVoice *voice = &m->voices[ch];
+    const uint8_t *regs = m->sound_regs;
+    switch (reg - ch * 5) {
+        case 0x05:
+            voice->waveform = value & 0x07;
+            break;
+        case 0x10: case 0x11: case 0x12: case 0x13: case 0x14:
+            voice->frequency = (ch == 0) ? regs[0x10] : 0;
+            voice->frequency |= regs[ch * 5 + 0x11] << 4;
+            voice->frequency |= regs[ch * 5 + 0x12] << 8;
+            voice->frequency |= regs[ch * 5 + 0x13] << 12;
+            voice->frequency |= (uint32_t)regs[ch * 5 + 0x14] << 16;
+            break;
+        case 0x15:
+            voice->volume = value;
+            break;
+        default:
+            break;
+    }
+}
+
+// Render count samples of the current voice state. Each voice is rendered
+// over the whole buffer at once, two chip clocks per output sample.
+void sound_render(PacmanMachine *m, int16_t *out, int count) {
+    memset(out, 0, count * sizeof(int16_t));
+    if (!m->sound_enable) {
+        return;
+    }
+
+    for (int v = 0; v < SOUND_VOICES; v++) {
+        SoundVoice *voice = &m->voices[v];
+        uint32_t acc = voice->accumulator;
+        uint32_t freq = voice->frequency;
+
+        // Silent voices keep their phase running, nothing else to do
+        if (voice->volume == 0 || freq == 0) {
+            voice->accumulator = (acc + freq * 2 * (uint32_t)count) & SOUND_PHASE_MASK;
+            continue;
+        }
+
+        const uint8_t *wave = &m->sound_prom[voice->waveform * SOUND_WAVE_SAMPLES];
+        int gain = voice->volume * SOUND_GAIN;
+        for (int i = 0; i < count; i++) {
+            acc = (acc + freq) & SOUND_PHASE_MASK;
+            int s = wave[acc >> 15];
+            acc = (acc + freq) & SOUND_PHASE_MASK;
+            s += wave[acc >> 15];
+            out[i] = (int16_t)(out[i] + (s - 16) * gain);
+        }
+        voice->accumulator = acc;
+    }
+}
+
+// Render one block into the audio ring
+void sound_render_block(PacmanMachine *m) {
+    if (!m->audio) {
+        return;
+    }
+
+    int16_t block[SOUND_BLOCK_SAMPLES];
+    sound_render(m, block, SOUND_BLOCK_SAMPLES);
+
+    // A full ring means emulation is running ahead of the device; the
+    // newest samples are dropped rather than blocking the emulation thread
+    if (sound_ring_write(&m->audio->ring, block, SOUND_BLOCK_SAMPLES) < SOUND_BLOCK_SAMPLES) {
+        LOG_TRACE(LOG_CAT_SOUND, "Audio ring full, samples dropped");
+    }
+}
+
+#ifndef NO_SDL
+// SDL audio callback (audio thread): drain the ring, pad underruns with silence
+static void sound_device_callback(void *userdata, Uint8 *stream, int len) {
+    struct SoundOutput *output = (struct SoundOutput *)userdata;
+    int16_t *samples = (int16_t *)stream;
+    uint32_t count = (uint32_t)len / sizeof(int16_t);
+
+    uint32_t got = sound_ring_read(&output->ring, samples, count);
+    if (got < count) {
+        memset(samples + got, 0, (count - got) * sizeof(int16_t));
+    }
+}
+#endif
+
+// Open the default audio device and start feeding it from this machine
+bool sound_open(PacmanMachine *m) {
+#ifndef NO_SDL
+    if (m->audio) {
+        return true;
+    }
+
+    struct SoundOutput *output = (struct SoundOutput *)calloc(1, sizeof(struct SoundOutput));
+    if (!output) {
+        return false;
+    }
+
+    SDL_AudioSpec want;
+    memset(&want, 0, sizeof(want));
+    want.freq = SOUND_SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = SOUND_DEVICE_SAMPLES;
+    want.callback = sound_device_callback;
+    want.userdata = output;
+
+    // SDL converts to whatever the device actually supports
+    output->device = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+    if (output->device == 0) {
+        LOG_WARN(LOG_CAT_SOUND, "Failed to open audio device: %s", SDL_GetError());
+        free(output);
+        return false;
+    }
+
+    m->audio = output;
+    SDL_PauseAudioDevice(output->device, 0);
+    LOG_INFO(LOG_CAT_SOUND, "Audio output: %d Hz mono", SOUND_SAMPLE_RATE);
+    return true;
+#else
+    (void)m;
+    return false;
+#endif
+}
+
+// Samples queued for the audio device
+uint32_t sound_queued(PacmanMachine *m) {
+    return m->audio ? sound_ring_available(&m->audio->ring) : 0;
+}
+
+// Stop and close the audio output
+void sound_close(PacmanMachine *m) {
+    if (!m->audio) {
+        return;
+    }
+
+#ifndef NO_SDL
+    // Waits for a running callback to return
+    SDL_CloseAudioDevice(m->audio->device);
+#endif
+    free(m->audio);
+    m->audio = NULL;
+}
@@ -0,0 +1,113 @@
+#include "../include/state.h"
+#include "../include/machine.h"
+#include "../include/video.h"
+#include "../include/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The snapshot range starts at the CPU
+_Static_assert(offsetof(PacmanMachine, cpu) == 0, "cpu must start the snapshot range");
+
+// Size of a complete snapshot in bytes
+size_t state_size(void) {
+    return sizeof(StateHeader) + MACHINE_STATE_SIZE;
+}
+
+// Write a snapshot of m into blob
+void state_save(const PacmanMachine *m, void *blob) {
+    StateHeader header = {
+        .magic = STATE_MAGIC,
+        .version = STATE_VERSION,
+        .header_size = sizeof(StateHeader),
+        .state_size = (uint32_t)MACHINE_STATE_SIZE,
+        .reserved = 0
+    };
+
+    uint8_t *out = (uint8_t *)blob;
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), m, MACHINE_STATE_SIZE);
+}
+
+// Restore a snapshot
+bool state_load(PacmanMachine *m, const void *blob, size_t size) {
+    const uint8_t *in = (const uint8_t *)blob;
+    StateHeader header;
+
+    if (size < state_size()) {
+        return false;
+    }
+    memcpy(&header, in, sizeof(header));
+    if (header.magic != STATE_MAGIC || header.version != STATE_VERSION ||
+        header.header_size != sizeof(StateHeader) || header.state_size != MACHINE_STATE_SIZE) {
+        return false;
+    }
+
+    // Redraw only the tiles the snapshot changes. The palette and charset
+    // are not in it, and a flip change redraws everything on its own.
+    const uint8_t *state = in + sizeof(header);
+    video_load_tiles(m, state + offsetof(PacmanMachine, vram), state + offsetof(PacmanMachine, cram));
+
+    // The saved z80 carries the saving machine's bus bindings; keep ours
+    z80 bound = m->cpu;
+    memcpy(m, state, MACHINE_STATE_SIZE);
+    m->cpu.read_byte = bound.read_byte;
+    m->cpu.write_byte = bound.write_byte;
+    m->cpu.port_in = bound.port_in;
+    m->cpu.port_out = bound.port_out;
+    m->cpu.userdata = bound.userdata;
+    m->cpu.fetch_base = bound.fetch_base;
+    m->cpu.fetch_limit = bound.fetch_limit;
+    m->cpu.profile = bound.profile;
+    m->cpu.trace = bound.trace;
+    return true;
+}
+
+// Save a snapshot file
+bool state_save_file(const PacmanMachine *m, const char *path) {
+    size_t size = state_size();
+    uint8_t *blob = (uint8_t *)malloc(size);
+    if (!blob) {
+        return false;
+    }
+    state_save(m, blob);
+
+    FILE *file = fopen(path, "wb");
+    bool ok = file && fwrite(blob, 1, size, file) == size;
+    if (file && fclose(file) != 0) {
+        ok = false;
+    }
+    free(blob);
+
+    if (!ok) {
+        LOG_ERROR(LOG_CAT_MAIN, "Failed to write save state: %s", path);
+        return false;
+    }
+    LOG_INFO(LOG_CAT_MAIN, "Saved state to %s (%zu bytes)", path, size);
+    return true;
+}
+
+// Load a snapshot file
+bool state_load_file(PacmanMachine *m, const char *path) {
+    size_t size = state_size();
+    uint8_t *blob = (uint8_t *)malloc(size);
+    if (!blob) {
+        return false;
+    }
+
+    FILE *file = fopen(path, "rb");
+    size_t read_size = file ? fread(blob, 1, size, file) : 0;
+    if (file) {
+        fclose(file);
+    }
+
+    bool ok = state_load(m, blob, read_size);
+    free(blob);
+
+    if (!ok) {
+        LOG_ERROR(LOG_CAT_MAIN, "Failed to load save state (missing or from another build): %s", path);
+        return false;
+    }
+    LOG_INFO(LOG_CAT_MAIN, "Loaded state from %s", path);
+    return true;
+}
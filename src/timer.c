@@ -0,0 +1,45 @@
+#include "../include/timer.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
+
+// Monotonic time in nanoseconds (arbitrary epoch)
+uint64_t timer_now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency = {0};
+    LARGE_INTEGER counter;
+    
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    
+    // Split the conversion to avoid overflowing 64 bits
+    uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+    uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1000000000ULL + (remainder * 1000000000ULL) / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Sleep for roughly the given number of nanoseconds
+void timer_sleep_ns(uint64_t ns) {
+    if (ns == 0) return;
+    
+#ifdef _WIN32
+    // Sleep() only has millisecond granularity
+    DWORD ms = (DWORD)(ns / 1000000ULL);
+    Sleep(ms > 0 ? ms : 1);
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ns / 1000000000ULL);
+    ts.tv_nsec = (long)(ns % 1000000000ULL);
+    nanosleep(&ts, NULL);
+#endif
+}
@@ -0,0 +1,145 @@
+#include "../include/trace.h"
+#include "../include/machine.h"
+#include "../include/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Start tracing a machine
+bool trace_start(PacmanMachine *m, const char *prefix, uint32_t records) {
+#ifdef Z80_TRACE
+    uint32_t size = 1;
+    while (size < records && size < (1u << 31)) {
+        size <<= 1;
+    }
+
+    trace_stop(m);
+    z80_trace *t = (z80_trace *)calloc(1, sizeof(z80_trace));
+    char *name = (char *)malloc(strlen(prefix) + 1);
+    if (t) {
+        t->records = (z80_trace_record *)malloc((size_t)size * sizeof(z80_trace_record));
+    }
+    if (!t || !t->records || !name) {
+        if (t) free(t->records);
+        free(t);
+        free(name);
+        return false;
+    }
+    strcpy(name, prefix);
+
+    t->mask = size - 1;
+    t->post = size / 4;
+    z80_trace_rearm(t);
+
+    m->cpu_trace = t;
+    m->cpu.trace = t;
+    m->trace_prefix = name;
+    m->trace_dumps = 0;
+    return true;
+#else
+    (void)m; (void)prefix; (void)records;
+    return false;
+#endif
+}
+
+// Mark a range of addresses in a watch bitmap
+static void watch_range(uint8_t *bits, uint16_t first, uint16_t last) {
+    for (uint32_t a = first; a <= last; a++) {
+        bits[a >> 3] |= (uint8_t)(1u << (a & 7));
+    }
+}
+
+// Fire on instructions in a range
+void trace_watch_pc(PacmanMachine *m, uint16_t first, uint16_t last) {
+    if (m->cpu_trace) {
+        watch_range(m->cpu_trace->pc_watch, first, last);
+    }
+}
+
+// Fire on writes to a range
+void trace_watch_write(PacmanMachine *m, uint16_t first, uint16_t last) {
+    if (m->cpu_trace) {
+        watch_range(m->cpu_trace->write_watch, first, last);
+    }
+}
+
+// Write the ring, oldest record first
+static bool save_ring(PacmanMachine *m) {
+    const z80_trace *t = m->cpu_trace;
+    uint64_t size = (uint64_t)t->mask + 1;
+    uint64_t count = t->count < size ? t->count : size;
+    uint64_t first = t->count - count;
+
+    TraceFileHeader header = {
+        .magic = TRACE_FILE_MAGIC,
+        .version = TRACE_FILE_VERSION,
+        .header_size = sizeof(TraceFileHeader),
+        .record_size = sizeof(z80_trace_record),
+        .trigger = (uint16_t)t->trigger,
+        .trigger_addr = t->trigger_addr,
+        .count = (uint32_t)count,
+        .trigger_index = (uint32_t)(t->trigger_count >= first ? t->trigger_count - first : count),
+    };
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s-%03d.z80t", m->trace_prefix, ++m->trace_dumps);
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        LOG_ERROR(LOG_CAT_CPU, "Failed to write trace: %s", path);
+        return false;
+    }
+
+    // The ring wraps at most once between the oldest record and the end
+    uint64_t start = first & t->mask;
+    uint64_t head = count < size - start ? count : size - start;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(&t->records[start], sizeof(z80_trace_record), head, out) == head &&
+              fwrite(t->records, sizeof(z80_trace_record), count - head, out) == count - head;
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+
+    if (ok) {
+        LOG_WARN(LOG_CAT_CPU, "Trace fired (%s at 0x%04X), %llu records saved to %s",
+                 trace_trigger_name(t->trigger), t->trigger_addr, (unsigned long long)count, path);
+    } else {
+        LOG_ERROR(LOG_CAT_CPU, "Failed to write trace: %s", path);
+    }
+    return ok;
+}
+
+// Save and re-arm a ring that stopped after a trigger
+void trace_poll(PacmanMachine *m) {
+    z80_trace *t = m->cpu_trace;
+    if (!t || t->count != t->stop_at || m->trace_dumps >= TRACE_MAX_DUMPS) {
+        return;
+    }
+
+    save_ring(m);
+    if (m->trace_dumps < TRACE_MAX_DUMPS) {
+        z80_trace_rearm(t);
+    } else {
+        LOG_WARN(LOG_CAT_CPU, "Saved %d traces, not tracing any further", TRACE_MAX_DUMPS);
+    }
+}
+
+// Save a ring with a trigger in it at the end of a run
+void trace_finish(PacmanMachine *m) {
+    z80_trace *t = m->cpu_trace;
+    if (t && t->trigger != Z80_TRIGGER_NONE && m->trace_dumps < TRACE_MAX_DUMPS) {
+        save_ring(m);
+        z80_trace_rearm(t);
+    }
+}
+
+// Release the ring
+void trace_stop(PacmanMachine *m) {
+    if (m->cpu_trace) {
+        free(m->cpu_trace->records);
+        free(m->cpu_trace);
+    }
+    free(m->trace_prefix);
+    m->cpu_trace = NULL;
+    m->cpu.trace = NULL;
+    m->trace_prefix = NULL;
+}
@@ -0,0 +1,86 @@
+#include "../include/trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Decoder for the execution traces saved by --trace (see include/trace.h).
+// Prints one line per instruction in the layout of z80_debug_output(),
+// numbered relative to the record the trigger fired at.
+
+// Print usage
+static void print_usage(const char *program) {
+    printf("Usage: %s [--around N] FILE.z80t\n", program);
+    printf("  --around N            Only print N records on each side of the trigger\n");
+}
+
+// Print one record
+static void print_record(const z80_trace_record *r, long index, bool trigger) {
+    printf("%s%8ld  PC: %04X, AF: %04X, BC: %04X, DE: %04X, HL: %04X, SP: %04X, "
+           "IX: %04X, IY: %04X, I: %02X, R: %02X  %s%s\t(",
+           trigger ? ">>" : "  ", index, r->pc, r->af, r->bc, r->de, r->hl, r->sp,
+           r->ix, r->iy, r->i, r->r, (r->flags & Z80_TRACE_IFF1) ? "EI" : "DI",
+           (r->flags & Z80_TRACE_HALTED) ? " HALT" : "");
+    for (int i = 0; i < r->nbytes && i < 4; i++) {
+        printf(i ? " %02X" : "%02X", r->bytes[i]);
+    }
+    printf("), cyc: %llu\n", (unsigned long long)r->cyc);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    long around = -1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--around") == 0 && i + 1 < argc) {
+            around = atol(argv[++i]);
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 1;
+    }
+
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != TRACE_FILE_MAGIC) {
+        fprintf(stderr, "%s is not a Z80 trace\n", path);
+        fclose(in);
+        return 1;
+    }
+    if (header.version != TRACE_FILE_VERSION || header.header_size != sizeof(header) ||
+        header.record_size != sizeof(z80_trace_record)) {
+        fprintf(stderr, "%s was saved by an incompatible build (version %u, %u-byte records)\n",
+                path, header.version, header.record_size);
+        fclose(in);
+        return 1;
+    }
+
+    printf("%s: %u records, fired by %s at 0x%04X", path, header.count,
+           trace_trigger_name(header.trigger),
+           header.trigger_addr);
+    if (header.trigger_index < header.count) {
+        printf(" (record %u, marked >>)\n", header.trigger_index);
+    } else {
+        printf(" (before the oldest record)\n");
+    }
+
+    long trigger = (long)header.trigger_index;
+    z80_trace_record r;
+    for (long i = 0; i < (long)header.count && fread(&r, sizeof(r), 1, in) == 1; i++) {
+        if (around < 0 || labs(i - trigger) <= around) {
+            print_record(&r, i - trigger, i == trigger);
+        }
+    }
+
+    fclose(in);
+    return 0;
+}
@@ -1,109 +1,233 @@
 #include "../include/video.h"
 #include "../include/memory.h"
+#include "../include/machine.h"
+#include "../include/log.h"
+#include "../include/gfx.h"
+#include "../include/perf.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// External declaration of debug_log function
-extern void debug_log(const char *format, ...);
 
 // Draw a test pattern to show something when VRAM is not available
-static void draw_test_pattern(void);
-
-// Video hardware state
-static SDL_Renderer *renderer = NULL;
-static SDL_Texture *screen_texture = NULL;
-static uint32_t *pixel_buffer = NULL;
-static int scale = 2;
-static bool debug_mode = false;
-
-// Sprite data flipping tables
-static uint8_t flip_table[256];
-static bool flip_table_initialized = false;
-
-// Initialize the bit flip table
-static void init_flip_table(void) {
-    if (flip_table_initialized) return;
-    
-    for (int i = 0; i < 256; i++) {
-        uint8_t flipped = 0;
-        for (int bit = 0; bit < 8; bit++) {
-            if (i & (1 << bit)) {
-                flipped |= (1 << (7 - bit));
-            }
-        }
-        flip_table[i] = flipped;
-    }
-    
-    flip_table_initialized = true;
+static void draw_test_pattern(PacmanMachine *m);
+
+// Point m->frame at the buffer the next frame is composed in
+static bool begin_frame(PacmanMachine *m);
+
+// Hand the composed frame to the texture (no-op in headless mode)
+static void end_frame(PacmanMachine *m);
+
+// Frames are composed straight into the streaming texture, leaving
+// pixel_buffer stale
+static bool composes_in_texture(const PacmanMachine *m) {
+    return m->renderer && m->screen_texture && !m->keep_framebuffer && !m->scaler;
 }
 
+// Video hardware state (renderer, texture, pixel buffer) lives in the machine
+
 // Initialize video hardware
-bool video_init(SDL_Renderer *r, int scale_factor) {
-    debug_log("Initializing video hardware");
+bool video_init(PacmanMachine *m, SDL_Renderer *r, int scale_factor) {
+    LOG_INFO(LOG_CAT_VIDEO, "Initializing video hardware");
     
-    renderer = r;
-    scale = scale_factor;
+    m->renderer = r;
+    m->scale = scale_factor;
     
-    if (!renderer) {
-        debug_log("ERROR: NULL renderer passed to video_init");
-        return false;
+    if (!m->renderer) {
+        LOG_INFO(LOG_CAT_VIDEO, "No renderer passed to video_init, using software framebuffer only");
     }
     
-    // Initialize flip table
-    init_flip_table();
-    debug_log("Bit flip table initialized");
-    
-    // Create screen texture
-    screen_texture = SDL_CreateTexture(
-        renderer,
-        SDL_PIXELFORMAT_RGBA8888,
-        SDL_TEXTUREACCESS_STREAMING,
-        SCREEN_WIDTH,
-        SCREEN_HEIGHT
-    );
-    
-    if (!screen_texture) {
-        debug_log("ERROR: Failed to create screen texture: %s", SDL_GetError());
-        return false;
+#ifndef NO_SDL
+    // Create screen texture (windowed mode only)
+    if (m->renderer) {
+        m->screen_texture = SDL_CreateTexture(
+            m->renderer,
+            SDL_PIXELFORMAT_RGBA8888,
+            SDL_TEXTUREACCESS_STREAMING,
+            SCREEN_WIDTH,
+            SCREEN_HEIGHT
+        );
+        
+        if (!m->screen_texture) {
+            LOG_ERROR(LOG_CAT_VIDEO, "Failed to create screen texture: %s", SDL_GetError());
+            return false;
+        }
+        LOG_INFO(LOG_CAT_VIDEO, "Screen texture created successfully");
     }
-    debug_log("Screen texture created successfully");
+#endif
     
     // Create pixel buffer
-    pixel_buffer = (uint32_t *)malloc(SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
-    if (!pixel_buffer) {
-        debug_log("ERROR: Failed to allocate pixel buffer");
-        SDL_DestroyTexture(screen_texture);
-        screen_texture = NULL;
+    m->pixel_buffer = (uint32_t *)malloc(SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+    if (!m->pixel_buffer) {
+        LOG_ERROR(LOG_CAT_VIDEO, "Failed to allocate pixel buffer");
+#ifndef NO_SDL
+        if (m->screen_texture) {
+            SDL_DestroyTexture(m->screen_texture);
+            m->screen_texture = NULL;
+        }
+#endif
         return false;
     }
-    debug_log("Pixel buffer allocated successfully");
+    LOG_INFO(LOG_CAT_VIDEO, "Pixel buffer allocated successfully");
     
     // Clear pixel buffer
-    memset(pixel_buffer, 0, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+    memset(m->pixel_buffer, 0, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
+    
+    // Create the cached background layer (cleared, so unused tiles stay black)
+    m->bg_buffer = (uint32_t *)calloc(SCREEN_WIDTH * SCREEN_HEIGHT, sizeof(uint32_t));
+    if (!m->bg_buffer) {
+        LOG_ERROR(LOG_CAT_VIDEO, "Failed to allocate background buffer");
+        video_cleanup(m);
+        return false;
+    }
+    video_invalidate(m);
     
-    debug_log("Video initialization complete");
+    LOG_INFO(LOG_CAT_VIDEO, "Video initialization complete");
     return true;
 }
 
 // Clean up video resources
-void video_cleanup(void) {
-    if (pixel_buffer) {
-        free(pixel_buffer);
-        pixel_buffer = NULL;
+void video_cleanup(PacmanMachine *m) {
+    if (m->pixel_buffer) {
+        free(m->pixel_buffer);
+        m->pixel_buffer = NULL;
     }
     
-    if (screen_texture) {
-        SDL_DestroyTexture(screen_texture);
-        screen_texture = NULL;
+    if (m->bg_buffer) {
+        free(m->bg_buffer);
+        m->bg_buffer = NULL;
     }
     
-    renderer = NULL;
+    scaler_destroy(m->scaler);
+    m->scaler = NULL;
+    
+#ifndef NO_SDL
+    if (m->scaled_texture) {
+        SDL_DestroyTexture(m->scaled_texture);
+        m->scaled_texture = NULL;
+    }
+    if (m->mask_texture) {
+        SDL_DestroyTexture(m->mask_texture);
+        m->mask_texture = NULL;
+    }
+    if (m->screen_texture) {
+        SDL_DestroyTexture(m->screen_texture);
+        m->screen_texture = NULL;
+    }
+#endif
+    
+    m->renderer = NULL;
+}
+
+// Redraw the whole background on the next frame
+void video_invalidate(PacmanMachine *m) {
+    m->bg_full_redraw = true;
+}
+
+// Get the software framebuffer, if it is kept up to date
+const uint32_t* video_get_framebuffer(PacmanMachine *m) {
+    return composes_in_texture(m) ? NULL : m->pixel_buffer;
+}
+
+#ifndef NO_SDL
+// Upload the filter's mask as a texture that darkens what it is drawn over
+static bool create_mask_texture(PacmanMachine *m, ScalerFilter filter) {
+    Scaler *s = scaler_create(filter, m->scale, SCREEN_WIDTH, SCREEN_HEIGHT, 1);
+    if (!s) {
+        return false;
+    }
+    
+    int w = SCREEN_WIDTH * m->scale;
+    int h = SCREEN_HEIGHT * m->scale;
+    uint32_t *pixels = (uint32_t *)malloc((size_t)w * h * sizeof(uint32_t));
+    bool ok = pixels && scaler_draw_mask(s, pixels, w);
+    scaler_destroy(s);
+    
+    if (ok) {
+        m->mask_texture = SDL_CreateTexture(m->renderer, SDL_PIXELFORMAT_RGBA8888,
+                                            SDL_TEXTUREACCESS_STATIC, w, h);
+        ok = m->mask_texture &&
+             SDL_UpdateTexture(m->mask_texture, NULL, pixels, w * (int)sizeof(uint32_t)) == 0 &&
+             SDL_SetTextureBlendMode(m->mask_texture, SDL_BLENDMODE_MOD) == 0;
+    }
+    free(pixels);
+    return ok;
+}
+#endif
+
+// Choose where and how the output is scaled
+bool video_set_filter(PacmanMachine *m, ScalerFilter filter, ScalerPath path, int threads) {
+#ifndef NO_SDL
+    if (!m->renderer || !m->screen_texture) {
+        return false;
+    }
+    
+    // Drop the previous setup, back to the plain stretch
+    scaler_destroy(m->scaler);
+    m->scaler = NULL;
+    if (m->scaled_texture) {
+        SDL_DestroyTexture(m->scaled_texture);
+        m->scaled_texture = NULL;
+    }
+    if (m->mask_texture) {
+        SDL_DestroyTexture(m->mask_texture);
+        m->mask_texture = NULL;
+    }
+    m->frame_valid = false;
+    m->present_pending = true;
+    
+    // The renderer can only stretch and blend, EPX needs the CPU
+    if (path == SCALER_PATH_AUTO) {
+        path = filter == SCALER_EPX ? SCALER_PATH_CPU : SCALER_PATH_GPU;
+    }
+    
+    if (path == SCALER_PATH_GPU) {
+        if (filter == SCALER_EPX) {
+            LOG_ERROR(LOG_CAT_VIDEO, "The renderer cannot do the epx filter");
+            return false;
+        }
+        if (filter != SCALER_NEAREST && !create_mask_texture(m, filter)) {
+            LOG_ERROR(LOG_CAT_VIDEO, "Failed to create the %s mask texture: %s",
+                      scaler_filter_name(filter), SDL_GetError());
+            if (m->mask_texture) {
+                SDL_DestroyTexture(m->mask_texture);
+                m->mask_texture = NULL;
+            }
+            return false;
+        }
+        LOG_INFO(LOG_CAT_VIDEO, "Scaling x%d with the %s filter on the GPU",
+                 m->scale, scaler_filter_name(filter));
+        return true;
+    }
+    
+    m->scaler = scaler_create(filter, m->scale, SCREEN_WIDTH, SCREEN_HEIGHT, threads);
+    if (m->scaler) {
+        m->scaled_texture = SDL_CreateTexture(m->renderer, SDL_PIXELFORMAT_RGBA8888,
+                                              SDL_TEXTUREACCESS_STREAMING,
+                                              SCREEN_WIDTH * m->scale, SCREEN_HEIGHT * m->scale);
+    }
+    if (!m->scaler || !m->scaled_texture) {
+        LOG_ERROR(LOG_CAT_VIDEO, "Failed to set up the %s filter at x%d on the CPU",
+                  scaler_filter_name(filter), m->scale);
+        scaler_destroy(m->scaler);
+        m->scaler = NULL;
+        return false;
+    }
+    LOG_INFO(LOG_CAT_VIDEO, "Scaling x%d with the %s filter on the CPU",
+             m->scale, scaler_filter_name(filter));
+    return true;
+#else
+    (void)m;
+    (void)filter;
+    (void)path;
+    (void)threads;
+    return false;
+#endif
 }
 
 // Update palette entry based on MAME implementation
-void video_update_palette(uint8_t index, uint8_t value) {
-    uint32_t *palette = memory_get_palette();
+void video_update_palette(PacmanMachine *m, uint8_t index, uint8_t value) {
+    uint32_t *palette = memory_get_palette(m);
     if (palette) {
         // Pacman uses a resistor network for RGB values:
         // bit 7 -- 220 ohm resistor  -- BLUE
@@ -139,96 +263,46 @@ void video_update_palette(uint8_t index, uint8_t value) {
         // Store RGBA value (alpha = 0xFF)
         palette[index] = 0xFF000000 | (r << 16) | (g << 8) | b;
         
-        debug_log("Updated palette[%d] = 0x%08X from value 0x%02X", index, palette[index], value);
+        // Tiles use palette entries 0-15, redraw the ones using this entry
+        if (index < 16) {
+            m->palette_dirty |= 1 << index;
+        }
+        
+        LOG_DEBUG(LOG_CAT_VIDEO, "Updated palette[%d] = 0x%08X from value 0x%02X", index, palette[index], value);
     } else {
-        debug_log("WARNING: Tried to update palette[%d] but palette is NULL", index);
+        LOG_WARN(LOG_CAT_VIDEO, "Tried to update palette[%d] but palette is NULL", index);
     }
 }
 
 // Enable/disable debug visualization
-void video_enable_debug(bool enable) {
-    debug_mode = enable;
+void video_enable_debug(PacmanMachine *m, bool enable) {
+    m->debug_mode = enable;
 }
 
-// Draw a character from the character ROM
-static void draw_character(int x, int y, uint8_t character, uint8_t color) {
-    uint8_t *charset = memory_get_charset();
-    uint32_t *palette = memory_get_palette();
-    
-    if (!charset || !palette) return;
-    
-    uint8_t *char_data = &charset[character * 8];
-    
-    for (int cy = 0; cy < 8; cy++) {
-        uint8_t row = char_data[cy];
-        
-        for (int cx = 0; cx < 8; cx++) {
-            if (row & (0x80 >> cx)) {
-                // Character pixel is set, use foreground color
-                int pixel_x = x + cx;
-                int pixel_y = y + cy;
-                
-                if (pixel_x >= 0 && pixel_x < SCREEN_WIDTH && 
-                    pixel_y >= 0 && pixel_y < SCREEN_HEIGHT) {
-                    pixel_buffer[pixel_y * SCREEN_WIDTH + pixel_x] = palette[color & 0x0F];
-                }
-            }
-        }
-    }
+// Compose frames in the software framebuffer even with a window
+void video_keep_framebuffer(PacmanMachine *m, bool keep) {
+    m->keep_framebuffer = keep;
 }
 
-// Draw a sprite
-static void draw_sprite(int x, int y, int sprite_index, uint8_t color_index, bool h_flip, bool v_flip) {
-    uint8_t *sprites = memory_get_spritedata();
-    uint32_t *palette = memory_get_palette();
-    
-    if (!sprites || !palette) return;
-    
-    // Pacman sprites are 16x16 pixels, stored as 64 bytes per sprite
-    // Each 16x16 sprite is made up of four 8x8 tiles
-    uint8_t *sprite = &sprites[sprite_index * 16];
-    
-    for (int sy = 0; sy < SPRITE_HEIGHT; sy++) {
-        int y_offset = v_flip ? (15 - sy) : sy;
-        
-        // Determine which 8x8 tile we're in
-        int tile_y = y_offset / 8;
-        int tile_row = y_offset % 8;
-        
-        for (int sx = 0; sx < SPRITE_WIDTH; sx++) {
-            int x_offset = h_flip ? (15 - sx) : sx;
-            
-            // Determine which 8x8 tile we're in
-            int tile_x = x_offset / 8;
-            int tile_col = x_offset % 8;
-            
-            // Calculate index into sprite data
-            int tile_index = tile_y * 2 + tile_x;
-            uint8_t tile_byte = sprite[tile_index * 8 + tile_row];
-            
-            // Check if the pixel is set
-            bool pixel_set = (tile_byte & (0x80 >> tile_col)) != 0;
-            
-            if (pixel_set) {
-                int screen_x = x + sx;
-                int screen_y = y + sy;
-                
-                if (screen_x >= 0 && screen_x < SCREEN_WIDTH && 
-                    screen_y >= 0 && screen_y < SCREEN_HEIGHT) {
-                    pixel_buffer[screen_y * SCREEN_WIDTH + screen_x] = palette[color_index & 0x0F];
-                }
-            }
-        }
-    }
+// Draw a character from the character ROM into the background layer.
+// The whole 8x8 cell is written, unset pixels become black.
+static void draw_character(PacmanMachine *m, int x, int y, uint8_t character, uint8_t color) {
+    gfx_draw_tile(m->bg_buffer, SCREEN_WIDTH, x, y, m->tile_pens[character], m->palette[color & 0x0F]);
+}
+
+// Draw a sprite (16x16, made up of four 8x8 tiles in the sprite ROM)
+static void draw_sprite(PacmanMachine *m, int x, int y, int sprite_index, uint32_t fg, bool h_flip, bool v_flip) {
+    const uint8_t *pens = m->sprite_pens[GFX_FLIP(h_flip, v_flip)][sprite_index & (GFX_SPRITE_COUNT - 1)];
+    gfx_draw_sprite(m->frame, m->frame_pitch, x, y, pens, fg);
 }
 
 // Get sprite data from memory (based on MAME implementation)
-static void get_sprite_data(int sprite_num, int *sprite_code, int *sprite_color, 
+static void get_sprite_data(PacmanMachine *m, int sprite_num, int *sprite_code, int *sprite_color, 
                           int *sprite_x, int *sprite_y, bool *flip_x, bool *flip_y) {
     // In Pacman, sprites are defined at 0x4FF0-0x4FFF (8 sprites, 2 bytes each)
     // First byte: sprite code (bits 2-7), Y flip (bit 0), X flip (bit 1)
     // Second byte: color
-    uint8_t *ram = memory_get_vram(); // WorkRAM in our implementation
+    uint8_t *ram = memory_get_ram(m); // Work RAM starts at WRAM_START
     
     // For debugging, return hardcoded values if RAM is not initialized properly
     if (!ram || sprite_num >= MAX_SPRITES) {
@@ -241,24 +315,12 @@ static void get_sprite_data(int sprite_num, int *sprite_code, int *sprite_color,
         return;
     }
     
-    // Check if we're near the end of VRAM (might be out of bounds)
-    if (VRAM_SIZE < 0xFF0 + (MAX_SPRITES * 2)) {
-        // Hardcoded values for safety
-        *sprite_code = sprite_num;
-        *sprite_color = 1;
-        *sprite_x = 100 + sprite_num * 20;
-        *sprite_y = 100;
-        *flip_x = false;
-        *flip_y = false;
-        return;
-    }
-    
-    uint16_t sprites_offset = 0xFF0; // Offset in VRAM where sprite data is stored
+    uint16_t sprites_offset = SPRITES_START - WRAM_START; // Offset in work RAM
     uint8_t sprite_attr1 = ram[sprites_offset + sprite_num * 2];
     uint8_t sprite_attr2 = ram[sprites_offset + sprite_num * 2 + 1];
     
     // Debug the sprite data
-    debug_log("Sprite %d data: attr1=0x%02X, attr2=0x%02X", 
+    LOG_TRACE(LOG_CAT_VIDEO, "Sprite %d data: attr1=0x%02X, attr2=0x%02X", 
              sprite_num, sprite_attr1, sprite_attr2);
     
     // From MAME: "sprite number (bits 2-7), Y flip (bit 0), X flip (bit 1)"
@@ -271,10 +333,10 @@ static void get_sprite_data(int sprite_num, int *sprite_code, int *sprite_color,
     
     // Now we'll try to use the actual sprite position data from the I/O ports
     uint8_t port_offset = 0x60;  // Address 0x5060 in I/O space
-    uint8_t x_pos = io_read_byte(port_offset + sprite_num * 2);
-    uint8_t y_pos = io_read_byte(port_offset + sprite_num * 2 + 1);
+    uint8_t x_pos = io_read_byte(m, port_offset + sprite_num * 2);
+    uint8_t y_pos = io_read_byte(m, port_offset + sprite_num * 2 + 1);
     
-    debug_log("Sprite %d position: x=0x%02X, y=0x%02X from I/O ports", 
+    LOG_TRACE(LOG_CAT_VIDEO, "Sprite %d position: x=0x%02X, y=0x%02X from I/O ports", 
              sprite_num, x_pos, y_pos);
     
     // Use the I/O port values
@@ -284,80 +346,107 @@ static void get_sprite_data(int sprite_num, int *sprite_code, int *sprite_color,
     // Adjust for hardware quirks - MAME subtracts 16 from sprite X position
     *sprite_x -= 16;
     
-    debug_log("Sprite %d final position: x=%d, y=%d, code=%d, color=%d, flip_x=%d, flip_y=%d",
+    LOG_TRACE(LOG_CAT_VIDEO, "Sprite %d final position: x=%d, y=%d, code=%d, color=%d, flip_x=%d, flip_y=%d",
              sprite_num, *sprite_x, *sprite_y, *sprite_code, *sprite_color, *flip_x, *flip_y);
 }
 
-// Render the current frame (based on MAME implementation)
-void video_render(void) {
-    debug_log("Rendering frame");
-    
-    // Clear screen to black
-    memset(pixel_buffer, 0, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
-    
-    // Get pointers to video memory
-    uint8_t *vram = memory_get_vram();
-    uint8_t *cram = memory_get_cram();
-    uint8_t *charset = memory_get_charset();
-    uint32_t *palette = memory_get_palette();
-    
-    if (!vram || !cram) {
-        debug_log("WARNING: Video memory not initialized, rendering test pattern");
-        // If video memory is not available, just draw a test pattern
-        draw_test_pattern();
-        return;
-    }
-    
-    // Debug - dump a small part of VRAM to see what's in there
-    debug_log("VRAM content sample (first 16 bytes):");
-    for (int i = 0; i < 16; i++) {
-        debug_log("  VRAM[%d] = 0x%02X", i, vram[i]);
-    }
-    
-    debug_log("CRAM content sample (first 16 bytes):");
-    for (int i = 0; i < 16; i++) {
-        debug_log("  CRAM[%d] = 0x%02X", i, cram[i]);
-    }
-    
-    // Debug - dump a small part of the character set to see what's in there
-    if (charset) {
-        debug_log("Character set sample (first 16 bytes of first character):");
-        for (int i = 0; i < 16 && i < 8; i++) {
-            debug_log("  CHARSET[%d] = 0x%02X", i, charset[i]);
+// Capture the video state of a frame
+void video_capture(PacmanMachine *m, VideoSnapshot *snapshot) {
+    uint8_t *ram = memory_get_ram(m);
+    memcpy(snapshot->vram, memory_get_vram(m), VRAM_SIZE);
+    memcpy(snapshot->cram, memory_get_cram(m), CRAM_SIZE);
+    memcpy(snapshot->sprite_attrs, &ram[SPRITES_START - WRAM_START], sizeof(snapshot->sprite_attrs));
+    memcpy(snapshot->sprite_coords, &m->io_ports[0x60], sizeof(snapshot->sprite_coords));
+    snapshot->flip_screen = memory_get_flip_screen(m);
+}
+
+// Copy tile and color RAM into m, comparing a word at a time
+void video_load_tiles(PacmanMachine *m, const uint8_t *vram, const uint8_t *cram) {
+    for (int i = 0; i < VRAM_SIZE; i += 8) {
+        uint64_t old_v, new_v, old_c, new_c;
+        memcpy(&old_v, &m->vram[i], 8);
+        memcpy(&new_v, &vram[i], 8);
+        memcpy(&old_c, &m->cram[i], 8);
+        memcpy(&new_c, &cram[i], 8);
+        if (old_v == new_v && old_c == new_c) {
+            continue;
         }
-    }
-    
-    // Debug - dump a small part of the palette to see what's in there
-    if (palette) {
-        debug_log("Palette sample (first 8 colors):");
-        for (int i = 0; i < 8; i++) {
-            debug_log("  PALETTE[%d] = 0x%08X", i, palette[i]);
+        for (int k = i; k < i + 8; k++) {
+            if (m->vram[k] != vram[k] || m->cram[k] != cram[k]) {
+                m->tile_dirty[k >> 6] |= 1ULL << (k & 63);
+            }
         }
+        memcpy(&m->vram[i], &vram[i], 8);
+        memcpy(&m->cram[i], &cram[i], 8);
     }
-    
-    // Check if VRAM is all zeros - if so, draw a test pattern instead
-    bool vram_empty = true;
+}
+
+// Load a captured video state
+void video_apply(PacmanMachine *m, const VideoSnapshot *snapshot) {
+    video_load_tiles(m, snapshot->vram, snapshot->cram);
+
+    uint8_t *ram = memory_get_ram(m);
+    memcpy(&ram[SPRITES_START - WRAM_START], snapshot->sprite_attrs, sizeof(snapshot->sprite_attrs));
+    memcpy(&m->io_ports[0x60], snapshot->sprite_coords, sizeof(snapshot->sprite_coords));
+    m->flip_screen = snapshot->flip_screen;
+}
+
+// Check whether all of video RAM is zero
+static bool vram_is_empty(const uint8_t *vram) {
     for (int i = 0; i < VRAM_SIZE; i++) {
         if (vram[i] != 0) {
-            vram_empty = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Redraw the background tiles that changed since the last frame. Returns
+// false if bg_buffer (and bg_vram_empty) are unchanged.
+static bool update_background(PacmanMachine *m, bool flip) {
+    uint8_t *vram = memory_get_vram(m);
+    uint8_t *cram = memory_get_cram(m);
+    
+    if (flip != m->bg_flip) {
+        m->bg_flip = flip;
+        m->bg_full_redraw = true;
+    }
+    if (m->bg_full_redraw) {
+        memset(m->tile_dirty, 0xFF, sizeof(m->tile_dirty));
+        m->bg_full_redraw = false;
+    }
+    
+    bool tiles_changed = false;
+    for (size_t w = 0; w < sizeof(m->tile_dirty) / sizeof(m->tile_dirty[0]); w++) {
+        if (m->tile_dirty[w]) {
+            tiles_changed = true;
             break;
         }
     }
     
-    if (vram_empty) {
-        debug_log("VRAM is all zeros, drawing test pattern instead");
-        draw_test_pattern();
-        return;
+    if (!tiles_changed && !m->palette_dirty) {
+        return false;
     }
     
-    // Check if screen is flipped (temporarily disabled for debugging)
-    bool flip = false; // memory_get_flip_screen() != 0;
+    // The empty check can only change when tile RAM did
+    if (tiles_changed) {
+        m->bg_vram_empty = vram_is_empty(vram);
+    }
     
     // Draw background tilemap (28x36 tiles)
     for (int ty = 0; ty < TILE_ROWS; ty++) {
         for (int tx = 0; tx < TILE_COLUMNS; tx++) {
             // Compute tile index with correct memory layout (32 columns in memory)
             int tile_index = ty * 32 + tx;
+            if (tile_index >= VRAM_SIZE) continue;
+            
+            uint8_t tile = vram[tile_index];
+            uint8_t color = cram[tile_index];
+            
+            bool dirty = (m->tile_dirty[tile_index >> 6] >> (tile_index & 63)) & 1;
+            if (!dirty && !(m->palette_dirty & (1 << (color & 0x0F)))) {
+                continue;
+            }
             
             // Apply screen flipping if needed
             int screen_x, screen_y;
@@ -369,64 +458,284 @@ void video_render(void) {
                 screen_y = ty * TILE_SIZE;
             }
             
-            if (tile_index < VRAM_SIZE) {
-                uint8_t tile = vram[tile_index];
-                uint8_t color = cram[tile_index];
-                
-                // Apply palette bank (used by some games)
-                // color |= (charbank << 5) | (palettebank << 6);
-                
-                // Draw the tile character
-                draw_character(screen_x, screen_y, tile, color);
+            // Apply palette bank (used by some games)
+            // color |= (charbank << 5) | (palettebank << 6);
+            
+            // Draw the tile character
+            draw_character(m, screen_x, screen_y, tile, color);
+        }
+    }
+    
+    memset(m->tile_dirty, 0, sizeof(m->tile_dirty));
+    m->palette_dirty = 0;
+    return true;
+}
+
+// One resolved sprite of the frame being drawn
+typedef struct {
+    int code;
+    int x, y;
+    bool flip_x, flip_y;
+    uint32_t fg;
+} VideoSprite;
+
+// Mix one value into the frame hash (FNV-style multiply, then fold the
+// high half back down so every input bit reaches every output bit)
+static uint64_t hash_mix(uint64_t h, uint64_t v) {
+    h = (h ^ v) * 0x100000001B3ull;
+    return h ^ (h >> 32);
+}
+
+// Hash of everything a frame is drawn from besides the background layer
+static uint64_t frame_hash(const PacmanMachine *m, const VideoSprite *list, bool flip) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    h = hash_mix(h, ((uint64_t)m->bg_vram_empty << 2) | ((uint64_t)m->debug_mode << 1) | flip);
+    for (int i = 0; i < MAX_SPRITES; i++) {
+        const VideoSprite *s = &list[i];
+        h = hash_mix(h, (uint64_t)(uint32_t)s->code | ((uint64_t)s->fg << 32));
+        h = hash_mix(h, (uint64_t)(uint32_t)s->x | ((uint64_t)(uint32_t)s->y << 32));
+        h = hash_mix(h, ((uint64_t)s->flip_x << 1) | s->flip_y);
+    }
+    return h;
+}
+
+// Render the current frame (based on MAME implementation)
+void video_render(PacmanMachine *m) {
+    LOG_TRACE(LOG_CAT_VIDEO, "Rendering frame");
+    
+    if (!m->pixel_buffer) {
+        return;
+    }
+    
+    // Get pointers to video memory
+    uint8_t *vram = memory_get_vram(m);
+    uint8_t *cram = memory_get_cram(m);
+    uint8_t *charset = memory_get_charset(m);
+    uint32_t *palette = memory_get_palette(m);
+    
+    if (!vram || !cram) {
+        LOG_WARN(LOG_CAT_VIDEO, "Video memory not initialized, rendering test pattern");
+        // If video memory is not available, just draw a test pattern
+        if (begin_frame(m)) {
+            draw_test_pattern(m);
+            end_frame(m);
+        }
+        m->frame_valid = false;
+        return;
+    }
+    
+    // Debug dumps below are skipped entirely unless video tracing is on
+    if (LOG_ENABLED(LOG_CAT_VIDEO, LOG_LEVEL_TRACE)) {
+        // Debug - dump a small part of VRAM to see what's in there
+        LOG_TRACE(LOG_CAT_VIDEO, "VRAM content sample (first 16 bytes):");
+        for (int i = 0; i < 16; i++) {
+            LOG_TRACE(LOG_CAT_VIDEO, "  VRAM[%d] = 0x%02X", i, vram[i]);
+        }
+    
+        LOG_TRACE(LOG_CAT_VIDEO, "CRAM content sample (first 16 bytes):");
+        for (int i = 0; i < 16; i++) {
+            LOG_TRACE(LOG_CAT_VIDEO, "  CRAM[%d] = 0x%02X", i, cram[i]);
+        }
+    
+        // Debug - dump a small part of the character set to see what's in there
+        if (charset) {
+            LOG_TRACE(LOG_CAT_VIDEO, "Character set sample (first 16 bytes of first character):");
+            for (int i = 0; i < 16 && i < 8; i++) {
+                LOG_TRACE(LOG_CAT_VIDEO, "  CHARSET[%d] = 0x%02X", i, charset[i]);
+            }
+        }
+    
+        // Debug - dump a small part of the palette to see what's in there
+        if (palette) {
+            LOG_TRACE(LOG_CAT_VIDEO, "Palette sample (first 8 colors):");
+            for (int i = 0; i < 8; i++) {
+                LOG_TRACE(LOG_CAT_VIDEO, "  PALETTE[%d] = 0x%08X", i, palette[i]);
             }
         }
     }
     
-    // Draw sprites using hardware registers
-    // Pacman has 8 16x16 sprites
-    // In order of priority (lowest number = highest priority)
+    // Check if screen is flipped (temporarily disabled for debugging)
+    bool flip = false; // memory_get_flip_screen() != 0;
+    
+    // Bring the cached background up to date, redrawing only changed tiles
+    uint64_t perf_start = PERF_START();
+    bool bg_changed = update_background(m, flip);
+    PERF_STOP(m, PERF_STAGE_BACKGROUND, perf_start);
+    perf_start = PERF_START();
+    
+    // Resolve the sprite list (drawn in order of priority, lowest number = highest)
+    VideoSprite list[MAX_SPRITES];
     for (int i = 0; i < MAX_SPRITES; i++) {
-        int sprite_code, sprite_color, sprite_x, sprite_y;
-        bool flip_x, flip_y;
+        VideoSprite *s = &list[i];
+        int color;
         
         // Read sprite data from memory
-        get_sprite_data(i, &sprite_code, &sprite_color, &sprite_x, &sprite_y, &flip_x, &flip_y);
+        get_sprite_data(m, i, &s->code, &color, &s->x, &s->y, &s->flip_x, &s->flip_y);
+        s->fg = m->palette[color & 0x0F];
         
         // Apply screen flip if needed
         if (flip) {
-            sprite_x = SCREEN_WIDTH - sprite_x - SPRITE_WIDTH;
-            sprite_y = SCREEN_HEIGHT - sprite_y - SPRITE_HEIGHT;
-            flip_x = !flip_x;
-            flip_y = !flip_y;
+            s->x = SCREEN_WIDTH - s->x - SPRITE_WIDTH;
+            s->y = SCREEN_HEIGHT - s->y - SPRITE_HEIGHT;
+            s->flip_x = !s->flip_x;
+            s->flip_y = !s->flip_y;
+        }
+    }
+    
+    // The frame is a pure function of the background layer and the sprite
+    // list, so if neither changed the texture already holds this frame and
+    // the copy and present can be skipped
+    uint64_t hash = frame_hash(m, list, flip);
+    if (!bg_changed && m->frame_valid && hash == m->frame_hash) {
+        LOG_TRACE(LOG_CAT_VIDEO, "Frame unchanged, skipping");
+        PERF_STOP(m, PERF_STAGE_SPRITES, perf_start);
+        return;
+    }
+    PERF_STOP(m, PERF_STAGE_SPRITES, perf_start);
+    
+    perf_start = PERF_START();
+    bool locked = begin_frame(m);
+    PERF_STOP(m, PERF_STAGE_UPLOAD, perf_start);
+    if (!locked) {
+        return;
+    }
+    perf_start = PERF_START();
+    
+    if (m->bg_vram_empty) {
+        // If VRAM is all zeros, draw a test pattern instead
+        LOG_DEBUG(LOG_CAT_VIDEO, "VRAM is all zeros, drawing test pattern instead");
+        draw_test_pattern(m);
+    } else {
+        // Start from the background, sprites are composited on top
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            memcpy(&m->frame[y * m->frame_pitch], &m->bg_buffer[y * SCREEN_WIDTH],
+                   SCREEN_WIDTH * sizeof(uint32_t));
         }
         
-        // Draw the sprite if it's visible on screen
-        if (sprite_x >= -SPRITE_WIDTH && sprite_x < SCREEN_WIDTH &&
-            sprite_y >= -SPRITE_HEIGHT && sprite_y < SCREEN_HEIGHT) {
-            draw_sprite(sprite_x, sprite_y, sprite_code, sprite_color, flip_x, flip_y);
+        // Pacman has 8 16x16 sprites
+        for (int i = 0; i < MAX_SPRITES; i++) {
+            const VideoSprite *s = &list[i];
+            
+            // Draw the sprite if it's visible on screen
+            if (s->x >= -SPRITE_WIDTH && s->x < SCREEN_WIDTH &&
+                s->y >= -SPRITE_HEIGHT && s->y < SCREEN_HEIGHT) {
+                draw_sprite(m, s->x, s->y, s->code, s->fg, s->flip_x, s->flip_y);
+            }
+        }
+        
+        // Draw debug information if enabled
+        if (m->debug_mode) {
+            video_draw_debug_info(m);
         }
     }
     
-    // Draw debug information if enabled
-    if (debug_mode) {
-        video_draw_debug_info();
+#ifdef PERF_ENABLED
+    if (m->perf.overlay) {
+        perf_draw_overlay(m);
+    }
+#endif
+    PERF_STOP(m, PERF_STAGE_SPRITES, perf_start);
+    
+    perf_start = PERF_START();
+    end_frame(m);
+    PERF_STOP(m, PERF_STAGE_UPLOAD, perf_start);
+    m->frame_hash = hash;
+    m->frame_valid = true;
+}
+
+// Point m->frame at the buffer the next frame is composed in: the streaming
+// texture's own memory when there is a window, pixel_buffer otherwise (or
+// when the CPU scaler reads it)
+static bool begin_frame(PacmanMachine *m) {
+    m->frame = m->pixel_buffer;
+    m->frame_pitch = SCREEN_WIDTH;
+    
+#ifndef NO_SDL
+    if (composes_in_texture(m)) {
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(m->screen_texture, NULL, &pixels, &pitch) != 0) {
+            LOG_ERROR(LOG_CAT_VIDEO, "Failed to lock screen texture: %s", SDL_GetError());
+            return false;
+        }
+        m->frame = (uint32_t *)pixels;
+        m->frame_pitch = pitch / (int)sizeof(uint32_t);
+    }
+#endif
+    
+    return true;
+}
+
+// Hand the composed frame to the texture, scaling it first if the CPU
+// scaler is on (no-op in headless mode)
+static void end_frame(PacmanMachine *m) {
+#ifndef NO_SDL
+    if (m->frame != m->pixel_buffer) {
+        SDL_UnlockTexture(m->screen_texture);
+    } else if (m->scaler) {
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(m->scaled_texture, NULL, &pixels, &pitch) == 0) {
+            scaler_run(m->scaler, m->pixel_buffer, SCREEN_WIDTH, (uint32_t *)pixels,
+                       pitch / (int)sizeof(uint32_t));
+            SDL_UnlockTexture(m->scaled_texture);
+        } else {
+            LOG_ERROR(LOG_CAT_VIDEO, "Failed to lock scaled texture: %s", SDL_GetError());
+        }
+    } else if (m->renderer && m->screen_texture) {
+        SDL_UpdateTexture(m->screen_texture, NULL, m->pixel_buffer,
+                          SCREEN_WIDTH * (int)sizeof(uint32_t));
     }
+#endif
     
-    // Update the screen texture
-    SDL_UpdateTexture(screen_texture, NULL, pixel_buffer, SCREEN_WIDTH * sizeof(uint32_t));
+    m->frame = m->pixel_buffer;
+    m->frame_pitch = SCREEN_WIDTH;
+    m->present_pending = true;
+}
+
+// Show the last rendered frame if it changed since the last present
+bool video_present(PacmanMachine *m) {
+#ifndef NO_SDL
+    if (!m->renderer || !m->screen_texture || !m->present_pending) {
+        return false;
+    }
     
-    // Clear the renderer
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-    SDL_RenderClear(renderer);
+    // Only clear when the texture does not cover the whole output
+    SDL_Rect dest_rect = {0, 0, SCREEN_WIDTH * m->scale, SCREEN_HEIGHT * m->scale};
+    int out_w, out_h;
+    if (SDL_GetRendererOutputSize(m->renderer, &out_w, &out_h) != 0 ||
+        out_w > dest_rect.w || out_h > dest_rect.h) {
+        SDL_SetRenderDrawColor(m->renderer, 0, 0, 0, 255);
+        SDL_RenderClear(m->renderer);
+    }
     
-    // Draw the texture scaled to window size
-    SDL_Rect dest_rect = {0, 0, SCREEN_WIDTH * scale, SCREEN_HEIGHT * scale};
-    SDL_RenderCopy(renderer, screen_texture, NULL, &dest_rect);
+    // Draw the texture scaled to window size (the CPU scaler's output is
+    // already that size), then darken it through the filter mask
+    if (m->scaled_texture) {
+        SDL_RenderCopy(m->renderer, m->scaled_texture, NULL, &dest_rect);
+    } else {
+        SDL_RenderCopy(m->renderer, m->screen_texture, NULL, &dest_rect);
+        if (m->mask_texture) {
+            SDL_RenderCopy(m->renderer, m->mask_texture, NULL, &dest_rect);
+        }
+    }
+    SDL_RenderPresent(m->renderer);
+    m->present_pending = false;
+    return true;
+#else
+    (void)m;
+    return false;
+#endif
+}
+
+// Present again on the next video_present()
+void video_expose(PacmanMachine *m) {
+    m->present_pending = true;
 }
 
 // Draw a test pattern to show something when VRAM is not available
 // NOTE: This function must be defined before it's used in video_render!
-static void draw_test_pattern(void) {
+static void draw_test_pattern(PacmanMachine *m) {
     // Draw a colored checkerboard pattern
     for (int y = 0; y < SCREEN_HEIGHT; y++) {
         for (int x = 0; x < SCREEN_WIDTH; x++) {
@@ -442,7 +751,7 @@ static void draw_test_pattern(void) {
                 0xFFFFFF00   // Yellow
             };
             
-            pixel_buffer[y * SCREEN_WIDTH + x] = colors[color_index];
+            m->frame[y * m->frame_pitch + x] = colors[color_index];
         }
     }
     
@@ -464,7 +773,7 @@ static void draw_test_pattern(void) {
                 
                 if (x + px >= 0 && x + px < SCREEN_WIDTH && 
                     text_y + py >= 0 && text_y + py < SCREEN_HEIGHT) {
-                    pixel_buffer[(text_y + py) * SCREEN_WIDTH + (x + px)] = 0xFFFFFFFF;  // White
+                    m->frame[(text_y + py) * m->frame_pitch + (x + px)] = 0xFFFFFFFF;  // White
                 }
             }
         }
@@ -472,17 +781,17 @@ static void draw_test_pattern(void) {
 }
 
 // Draw debug information (enhanced for MAME-style debugging)
-void video_draw_debug_info(void) {
+void video_draw_debug_info(PacmanMachine *m) {
     // Draw a grid to show tile boundaries
     for (int y = 0; y < SCREEN_HEIGHT; y += TILE_SIZE) {
         for (int x = 0; x < SCREEN_WIDTH; x++) {
-            pixel_buffer[y * SCREEN_WIDTH + x] = 0xFFFF0000;  // Red
+            m->frame[y * m->frame_pitch + x] = 0xFFFF0000;  // Red
         }
     }
     
     for (int x = 0; x < SCREEN_WIDTH; x += TILE_SIZE) {
         for (int y = 0; y < SCREEN_HEIGHT; y++) {
-            pixel_buffer[y * SCREEN_WIDTH + x] = 0xFFFF0000;  // Red
+            m->frame[y * m->frame_pitch + x] = 0xFFFF0000;  // Red
         }
     }
     
@@ -491,7 +800,7 @@ void video_draw_debug_info(void) {
         int sprite_code, sprite_color, sprite_x, sprite_y;
         bool flip_x, flip_y;
         
-        get_sprite_data(i, &sprite_code, &sprite_color, &sprite_x, &sprite_y, &flip_x, &flip_y);
+        get_sprite_data(m, i, &sprite_code, &sprite_color, &sprite_x, &sprite_y, &flip_x, &flip_y);
         
         // Draw sprite bounds if visible
         if (sprite_x >= -SPRITE_WIDTH && sprite_x < SCREEN_WIDTH &&
@@ -507,14 +816,14 @@ void video_draw_debug_info(void) {
                 if (top_y >= 0 && top_y < SCREEN_HEIGHT) {
                     int px = sprite_x + x;
                     if (px >= 0 && px < SCREEN_WIDTH) {
-                        pixel_buffer[top_y * SCREEN_WIDTH + px] = outline_color;
+                        m->frame[top_y * m->frame_pitch + px] = outline_color;
                     }
                 }
                 
                 if (bottom_y >= 0 && bottom_y < SCREEN_HEIGHT) {
                     int px = sprite_x + x;
                     if (px >= 0 && px < SCREEN_WIDTH) {
-                        pixel_buffer[bottom_y * SCREEN_WIDTH + px] = outline_color;
+                        m->frame[bottom_y * m->frame_pitch + px] = outline_color;
                     }
                 }
             }
@@ -526,14 +835,14 @@ void video_draw_debug_info(void) {
                 if (left_x >= 0 && left_x < SCREEN_WIDTH) {
                     int py = sprite_y + y;
                     if (py >= 0 && py < SCREEN_HEIGHT) {
-                        pixel_buffer[py * SCREEN_WIDTH + left_x] = outline_color;
+                        m->frame[py * m->frame_pitch + left_x] = outline_color;
                     }
                 }
                 
                 if (right_x >= 0 && right_x < SCREEN_WIDTH) {
                     int py = sprite_y + y;
                     if (py >= 0 && py < SCREEN_HEIGHT) {
-                        pixel_buffer[py * SCREEN_WIDTH + right_x] = outline_color;
+                        m->frame[py * m->frame_pitch + right_x] = outline_color;
                     }
                 }
             }
@@ -549,13 +858,13 @@ void video_draw_debug_info(void) {
                             // Very basic font rendering for debug - just shows the sprite number
                             if ((i == 0 && (dx == 1 || dx == 2 || dx == 3) && (dy == 0 || dy == 6)) ||
                                 (i == 0 && (dx == 0 || dx == 4) && (dy >= 1 && dy <= 5))) {
-                                pixel_buffer[(sprite_y + dy + 1) * SCREEN_WIDTH + (sprite_x + dx + 1)] = 0xFFFFFF00;
+                                m->frame[(sprite_y + dy + 1) * m->frame_pitch + (sprite_x + dx + 1)] = 0xFFFFFF00;
                             } else if (i == 1 && (dx == 2 && dy <= 6)) {
-                                pixel_buffer[(sprite_y + dy + 1) * SCREEN_WIDTH + (sprite_x + dx + 1)] = 0xFFFFFF00;
+                                m->frame[(sprite_y + dy + 1) * m->frame_pitch + (sprite_x + dx + 1)] = 0xFFFFFF00;
                             } else if (i >= 2) {
                                 // Just a dot for other sprites to keep it simple
                                 if (dx == 2 && dy == 2) {
-                                    pixel_buffer[(sprite_y + dy + 1) * SCREEN_WIDTH + (sprite_x + dx + 1)] = 0xFFFFFF00;
+                                    m->frame[(sprite_y + dy + 1) * m->frame_pitch + (sprite_x + dx + 1)] = 0xFFFFFF00;
                                 }
                             }
                         }
@@ -1,5 +1,8 @@
 #include "z80.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 // MARK: timings
 static const uint8_t cyc_00[256] = {4, 10, 7, 6, 4, 4, 7, 4, 4, 11, 7, 6, 4, 4,
     7, 4, 8, 10, 7, 6, 4, 4, 7, 4, 12, 11, 7, 6, 4, 4, 7, 4, 7, 10, 16, 6, 4, 4,
@@ -45,22 +48,83 @@ static const uint8_t cyc_ddfd[256] = {4, 4, 4, 4, 4, 4, 4, 4, 4, 15, 4, 4, 4, 4,
 // get bit "n" of number "val"
 #define GET_BIT(n, val) (((val) >> (n)) & 1)
 
-static inline uint8_t rb(z80* const z, uint16_t addr) {
+// z80_run() dispatches through a computed goto table when the compiler
+// supports labels as values (GCC, Clang); define Z80_NO_COMPUTED_GOTO to
+// force the portable switch loop
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(Z80_NO_COMPUTED_GOTO)
+#define Z80_COMPUTED_GOTO
+#endif
+
+// z80_run() and the opcode switches are large enough that GCC stops
+// inlining even tiny helpers into them; force it for the ones on every
+// instruction's path (fetch, memory access, flag bookkeeping)
+#if defined(__GNUC__) || defined(__clang__)
+#define Z80_INLINE static inline __attribute__((always_inline))
+#else
+#define Z80_INLINE static inline
+#endif
+
+// watched writes fire the trace (see z80_trace in z80.h)
+#ifdef Z80_TRACE
+#define TRACE_WRITE(z, addr)                                              \
+  do {                                                                    \
+    if ((z)->trace != NULL &&                                             \
+        ((z)->trace->write_watch[(addr) >> 3] >> ((addr) & 7) & 1)) {     \
+      z80_trace_fire((z)->trace, Z80_TRIGGER_WRITE, addr);                \
+    }                                                                     \
+  } while (0)
+#else
+#define TRACE_WRITE(z, addr) ((void)0)
+#endif
+
+#ifdef Z80_STATIC_BUS
+// bus accesses are bound at compile time to the Pac-Man bus (include/bus.h)
+// instead of going through the read_byte/write_byte/port_in/port_out
+// pointers, so the compiler can inline the page table lookups.
+#include "../../include/bus.h"
+
+Z80_INLINE uint8_t rb(z80* const z, uint16_t addr) {
+  return bus_read_byte(BUS_MACHINE(z), addr);
+}
+
+Z80_INLINE void wb(z80* const z, uint16_t addr, uint8_t val) {
+  TRACE_WRITE(z, addr);
+  bus_write_byte(BUS_MACHINE(z), addr, val);
+}
+
+static inline uint8_t port_in(z80* const z, uint8_t port) {
+  return bus_port_in(BUS_MACHINE(z), port);
+}
+
+static inline void port_out(z80* const z, uint8_t port, uint8_t val) {
+  bus_port_out(BUS_MACHINE(z), port, val);
+}
+#else
+Z80_INLINE uint8_t rb(z80* const z, uint16_t addr) {
   return z->read_byte(z->userdata, addr);
 }
 
-static inline void wb(z80* const z, uint16_t addr, uint8_t val) {
+Z80_INLINE void wb(z80* const z, uint16_t addr, uint8_t val) {
+  TRACE_WRITE(z, addr);
   z->write_byte(z->userdata, addr, val);
 }
 
-static inline uint16_t rw(z80* const z, uint16_t addr) {
-  return (z->read_byte(z->userdata, addr + 1) << 8) |
-         z->read_byte(z->userdata, addr);
+static inline uint8_t port_in(z80* const z, uint8_t port) {
+  return z->port_in(z, port);
+}
+
+static inline void port_out(z80* const z, uint8_t port, uint8_t val) {
+  z->port_out(z, port, val);
+}
+#endif
+
+Z80_INLINE uint16_t rw(z80* const z, uint16_t addr) {
+  return (rb(z, addr + 1) << 8) | rb(z, addr);
 }
 
-static inline void ww(z80* const z, uint16_t addr, uint16_t val) {
-  z->write_byte(z->userdata, addr, val & 0xFF);
-  z->write_byte(z->userdata, addr + 1, val >> 8);
+Z80_INLINE void ww(z80* const z, uint16_t addr, uint16_t val) {
+  wb(z, addr, val & 0xFF);
+  wb(z, addr + 1, val >> 8);
 }
 
 static inline void pushw(z80* const z, uint16_t val) {
@@ -73,15 +137,183 @@ static inline uint16_t popw(z80* const z) {
   return rw(z, z->sp - 2);
 }
 
-static inline uint8_t nextb(z80* const z) {
+Z80_INLINE uint8_t nextb(z80* const z) {
+  if (z->pc < z->fetch_limit) {
+    return z->fetch_base[z->pc++];
+  }
   return rb(z, z->pc++);
 }
 
-static inline uint16_t nextw(z80* const z) {
+Z80_INLINE uint16_t nextw(z80* const z) {
   z->pc += 2;
   return rw(z, z->pc - 2);
 }
 
+// MARK: profiling and tracing
+// hooks filling in z->profile and z->trace (see z80.h). they are only
+// compiled in with Z80_PROFILE and Z80_TRACE and cost a NULL check per
+// instruction while no profile or trace is set.
+#ifdef Z80_PROFILE
+static void prof_sample(z80_profile* const p, uint64_t count);
+
+// an instruction (or n repeats of it, for skipped halts) starts at pc
+Z80_INLINE void prof_insn(
+    z80* const z, uint16_t pc, uint8_t opcode, unsigned long n) {
+  z80_profile* const p = z->profile;
+  if (p == NULL) return;
+  p->pc_hits[pc] += n;
+  p->op_count[Z80_PROFILE_BASE][opcode] += n;
+
+  if (n < p->sample_countdown) {
+    p->sample_countdown -= n;
+  } else {
+    n -= p->sample_countdown;
+    prof_sample(p, 1 + n / Z80_PROFILE_PERIOD);
+    p->sample_countdown = Z80_PROFILE_PERIOD - n % Z80_PROFILE_PERIOD;
+  }
+}
+
+// the second byte of a prefixed instruction
+Z80_INLINE void prof_op(
+    z80* const z, int table, uint8_t opcode, unsigned cycles) {
+  z80_profile* const p = z->profile;
+  if (p == NULL) return;
+  p->op_count[table][opcode]++;
+  p->op_cycles[table][opcode] += cycles;
+}
+
+// t-states an instruction takes on top of its prefix (dd/fd + opcode)
+Z80_INLINE void prof_cycles(
+    z80* const z, int table, uint8_t opcode, unsigned cycles) {
+  if (z->profile != NULL) z->profile->op_cycles[table][opcode] += cycles;
+}
+
+// a call to z->pc just pushed its return address
+Z80_INLINE void prof_call(z80* const z) {
+  z80_profile* const p = z->profile;
+  if (p == NULL || p->call_depth == Z80_PROFILE_DEPTH) return;
+  p->call_pc[p->call_depth] = z->pc;
+  p->call_sp[p->call_depth] = z->sp;
+  p->call_depth++;
+}
+
+// a return address was popped: every call whose return address was at or
+// below it has returned (code that pops its return address or reloads sp
+// is caught up with on the next return)
+Z80_INLINE void prof_ret(z80* const z) {
+  z80_profile* const p = z->profile;
+  if (p == NULL) return;
+  while (p->call_depth > 0 && p->call_sp[p->call_depth - 1] < z->sp) {
+    p->call_depth--;
+  }
+}
+
+// counts the current call stack `count` times
+static void prof_sample(z80_profile* const p, uint64_t count) {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < p->call_depth; i++) {
+    h = (h ^ p->call_pc[i]) * 16777619u;
+  }
+
+  for (int probe = 0; probe < Z80_PROFILE_STACKS; probe++) {
+    z80_profile_stack* const st =
+        &p->stacks[(h + probe) & (Z80_PROFILE_STACKS - 1)];
+    if (st->count == 0) {
+      st->depth = p->call_depth;
+      memcpy(st->pc, p->call_pc, p->call_depth * sizeof(uint16_t));
+    } else if (st->depth != p->call_depth ||
+               memcmp(st->pc, p->call_pc, p->call_depth * sizeof(uint16_t))) {
+      continue;
+    }
+    st->count += count;
+    return;
+  }
+  p->samples_dropped += count;
+}
+
+#define PROF_INSN(z, pc, opcode) prof_insn(z, pc, opcode, 1)
+#define PROF_HALT(z, n) prof_insn(z, (z)->pc, 0x00, n)
+#define PROF_OP(z, table, opcode, cycles) prof_op(z, table, opcode, cycles)
+#define PROF_CYCLES(z, table, opcode, cycles) \
+  prof_cycles(z, table, opcode, cycles)
+#define PROF_CALL(z) prof_call(z)
+#define PROF_RET(z) prof_ret(z)
+#else
+#define PROF_INSN(z, pc, opcode) ((void)0)
+#define PROF_HALT(z, n) ((void)0)
+#define PROF_OP(z, table, opcode, cycles) ((void)0)
+#define PROF_CYCLES(z, table, opcode, cycles) ((void)0)
+#define PROF_CALL(z) ((void)0)
+#define PROF_RET(z) ((void)0)
+#endif
+
+#ifdef Z80_TRACE
+static inline uint8_t get_f(z80* const z);
+
+// records the state an instruction (or a run of skipped halts) starts in
+Z80_INLINE void trace_insn(z80* const z, uint16_t pc, uint8_t opcode) {
+  z80_trace* const t = z->trace;
+  if (t == NULL || t->count == t->stop_at) return;
+  if (t->pc_watch[pc >> 3] >> (pc & 7) & 1) {
+    z80_trace_fire(t, Z80_TRIGGER_PC, pc);
+  }
+
+  z80_trace_record* const r = &t->records[t->count++ & t->mask];
+  r->cyc = z->cyc;
+  r->pc = pc;
+  r->sp = z->sp;
+  r->af = (z->a << 8) | get_f(z);
+  r->bc = (z->b << 8) | z->c;
+  r->de = (z->d << 8) | z->e;
+  r->hl = (z->h << 8) | z->l;
+  r->ix = z->ix;
+  r->iy = z->iy;
+  r->i = z->i;
+  r->r = z->r;
+  r->flags = (z->iff1 ? Z80_TRACE_IFF1 : 0) | (z->halted ? Z80_TRACE_HALTED : 0);
+  if ((unsigned)pc + 4 <= z->fetch_limit) {
+    memcpy(r->bytes, z->fetch_base + pc, 4);
+    r->nbytes = 4;
+  } else {
+    r->bytes[0] = opcode;
+    r->nbytes = 1;
+  }
+}
+
+#define TRACE_INSN(z, pc, opcode) trace_insn(z, pc, opcode)
+#else
+#define TRACE_INSN(z, pc, opcode) ((void)0)
+#endif
+
+// clears a profile for a fresh run
+void z80_profile_reset(z80_profile* const p) {
+  memset(p, 0, sizeof(*p));
+  p->sample_countdown = Z80_PROFILE_PERIOD;
+}
+
+// t-states of an unprefixed opcode
+unsigned z80_opcode_cycles(uint8_t opcode) {
+  return cyc_00[opcode];
+}
+
+// fires a trigger if the trace is armed
+void z80_trace_fire(z80_trace* const t, int trigger, uint16_t addr) {
+  if (t->stop_at != UINT64_MAX) return;
+  t->trigger = trigger;
+  t->trigger_addr = addr;
+  t->trigger_count = t->count;
+  t->stop_at = t->count + t->post;
+}
+
+// clears the ring and arms the trace again
+void z80_trace_rearm(z80_trace* const t) {
+  t->count = 0;
+  t->stop_at = UINT64_MAX;
+  t->trigger = Z80_TRIGGER_NONE;
+  t->trigger_addr = 0;
+  t->trigger_count = 0;
+}
+
 static inline uint16_t get_bc(z80* const z) {
   return (z->b << 8) | z->c;
 }
@@ -109,7 +341,186 @@ static inline void set_hl(z80* const z, uint16_t val) {
   z->l = val & 0xFF;
 }
 
+// increments R, keeping the highest byte intact
+Z80_INLINE void inc_r(z80* const z) {
+  z->r = (z->r & 0x80) | ((z->r + 1) & 0x7f);
+}
+
+// returns if there was a carry between bit "bit_no" and "bit_no - 1" when
+// executing "a + b + cy"
+static inline bool carry(int bit_no, uint16_t a, uint16_t b, bool cy) {
+  int32_t result = a + b + cy;
+  int32_t carry = result ^ a ^ b;
+  return carry & (1 << bit_no);
+}
+
+// returns the parity of byte: 0 if number of 1 bits in `val` is odd, else 1
+static inline bool parity(uint8_t val) {
+  uint8_t nb_one_bits = 0;
+  for (int i = 0; i < 8; i++) {
+    nb_one_bits += ((val >> i) & 1);
+  }
+
+  return (nb_one_bits & 1) == 0;
+}
+
+// MARK: flags
+// The eager helpers below compute every flag bit of an operation. In the
+// default build they run as part of each instruction. With Z80_LAZY_FLAGS
+// the ALU helpers only record the operation (lf_op and its operands), and
+// the bits are computed from that record the first time any flag is read
+// or partially written, which most instructions never do before the next
+// ALU operation overwrites them all again.
+
+enum {
+  LF_NONE = 0, // the flag bitfields are current
+  LF_ADD, // addb(lf_a, lf_b, lf_c)
+  LF_SUB, // subb(lf_a, lf_b, lf_c)
+  LF_CP, // cp of lf_b against lf_a
+  LF_INC, // inc(lf_a)
+  LF_DEC, // dec(lf_a)
+  LF_LOGIC, // logic op/shift with result lf_a and hf = lf_b
+};
+
+// besides the operands, every record keeps the 8-bit result (lf_res) and
+// the carry out (lf_cf), so the zero and carry flags, which conditional
+// instructions test far more often than the others, never need the full
+// materialization
+
+// flags of "a + b + cy"
+static inline void flags_add(z80* const z, uint8_t a, uint8_t b, bool cy) {
+  const uint8_t result = a + b + cy;
+  z->sf = result >> 7;
+  z->zf = result == 0;
+  z->hf = carry(4, a, b, cy);
+  z->pf = carry(7, a, b, cy) != carry(8, a, b, cy);
+  z->cf = carry(8, a, b, cy);
+  z->nf = 0;
+  z->xf = GET_BIT(3, result);
+  z->yf = GET_BIT(5, result);
+}
+
+// flags of "a - b - cy"
+static inline void flags_sub(z80* const z, uint8_t a, uint8_t b, bool cy) {
+  flags_add(z, a, ~b, !cy);
+  z->cf = !z->cf;
+  z->hf = !z->hf;
+  z->nf = 1;
+}
+
+// flags of a logic operation or shift: S, Z, Y, X and P from the result
+static inline void flags_logic(z80* const z, uint8_t result, bool hf, bool cf) {
+  z->sf = result >> 7;
+  z->zf = result == 0;
+  z->hf = hf;
+  z->pf = parity(result);
+  z->nf = 0;
+  z->cf = cf;
+  z->xf = GET_BIT(3, result);
+  z->yf = GET_BIT(5, result);
+}
+
+#ifdef Z80_LAZY_FLAGS
+// computes the flag bitfields from the recorded operation
+static void flags_materialize(z80* const z) {
+  const uint8_t a = z->lf_a;
+  const uint8_t b = z->lf_b;
+  const bool c = z->lf_c;
+
+  switch (z->lf_op) {
+  case LF_ADD: flags_add(z, a, b, c); break;
+  case LF_SUB: flags_sub(z, a, b, c); break;
+  case LF_CP:
+    flags_sub(z, a, b, 0);
+    z->yf = GET_BIT(5, b);
+    z->xf = GET_BIT(3, b);
+    break;
+  case LF_INC:
+    flags_add(z, a, 1, 0);
+    z->cf = z->lf_cf;
+    break;
+  case LF_DEC:
+    flags_sub(z, a, 1, 0);
+    z->cf = z->lf_cf;
+    break;
+  case LF_LOGIC: flags_logic(z, a, b, z->lf_cf); break;
+  default: break;
+  }
+
+  z->lf_op = LF_NONE;
+}
+
+Z80_INLINE void flags_record(z80* const z, uint8_t op, uint8_t a,
+    uint8_t b, bool c, uint8_t res, bool cf) {
+  z->lf_op = op;
+  z->lf_a = a;
+  z->lf_b = b;
+  z->lf_c = c;
+  z->lf_res = res;
+  z->lf_cf = cf;
+}
+#endif
+
+// returns z with its flag bitfields up to date. every flag access outside
+// the ALU helpers goes through this (reads and partial writes alike).
+Z80_INLINE z80* flags(z80* const z) {
+#ifdef Z80_LAZY_FLAGS
+  if (z->lf_op != LF_NONE) {
+    flags_materialize(z);
+  }
+#endif
+  return z;
+}
+
+// carry flag, without materializing the other flags
+Z80_INLINE bool get_cf(z80* const z) {
+#ifdef Z80_LAZY_FLAGS
+  if (z->lf_op != LF_NONE) {
+    return z->lf_cf;
+  }
+#endif
+  return z->cf;
+}
+
+// zero flag, without materializing the other flags
+Z80_INLINE bool get_zf(z80* const z) {
+#ifdef Z80_LAZY_FLAGS
+  if (z->lf_op != LF_NONE) {
+    return z->lf_res == 0;
+  }
+#endif
+  return z->zf;
+}
+
+// sets the flags of "a + b + cy"
+Z80_INLINE void add_flags(z80* const z, uint8_t a, uint8_t b, bool cy) {
+#ifdef Z80_LAZY_FLAGS
+  flags_record(z, LF_ADD, a, b, cy, a + b + cy, a + b + cy > 0xFF);
+#else
+  flags_add(z, a, b, cy);
+#endif
+}
+
+// sets the flags of "a - b - cy"
+Z80_INLINE void sub_flags(z80* const z, uint8_t a, uint8_t b, bool cy) {
+#ifdef Z80_LAZY_FLAGS
+  flags_record(z, LF_SUB, a, b, cy, a - b - cy, a - b - cy < 0);
+#else
+  flags_sub(z, a, b, cy);
+#endif
+}
+
+// sets the flags of a logic operation or shift
+Z80_INLINE void logic_flags(z80* const z, uint8_t result, bool hf, bool cf) {
+#ifdef Z80_LAZY_FLAGS
+  flags_record(z, LF_LOGIC, result, hf, 0, result, cf);
+#else
+  flags_logic(z, result, hf, cf);
+#endif
+}
+
 static inline uint8_t get_f(z80* const z) {
+  flags(z);
   uint8_t val = 0;
   val |= z->cf << 0;
   val |= z->nf << 1;
@@ -123,6 +534,9 @@ static inline uint8_t get_f(z80* const z) {
 }
 
 static inline void set_f(z80* const z, uint8_t val) {
+#ifdef Z80_LAZY_FLAGS
+  z->lf_op = LF_NONE;
+#endif
   z->cf = (val >> 0) & 1;
   z->nf = (val >> 1) & 1;
   z->pf = (val >> 2) & 1;
@@ -133,29 +547,6 @@ static inline void set_f(z80* const z, uint8_t val) {
   z->sf = (val >> 7) & 1;
 }
 
-// increments R, keeping the highest byte intact
-static inline void inc_r(z80* const z) {
-  z->r = (z->r & 0x80) | ((z->r + 1) & 0x7f);
-}
-
-// returns if there was a carry between bit "bit_no" and "bit_no - 1" when
-// executing "a + b + cy"
-static inline bool carry(int bit_no, uint16_t a, uint16_t b, bool cy) {
-  int32_t result = a + b + cy;
-  int32_t carry = result ^ a ^ b;
-  return carry & (1 << bit_no);
-}
-
-// returns the parity of byte: 0 if number of 1 bits in `val` is odd, else 1
-static inline bool parity(uint8_t val) {
-  uint8_t nb_one_bits = 0;
-  for (int i = 0; i < 8; i++) {
-    nb_one_bits += ((val >> i) & 1);
-  }
-
-  return (nb_one_bits & 1) == 0;
-}
-
 static void exec_opcode(z80* const z, uint8_t opcode);
 static void exec_opcode_cb(z80* const z, uint8_t opcode);
 static void exec_opcode_dcb(
@@ -184,6 +575,7 @@ static inline void call(z80* const z, uint16_t addr) {
   pushw(z, z->pc);
   z->pc = addr;
   z->mem_ptr = addr;
+  PROF_CALL(z);
 }
 
 // calls to next word in memory if condition is true
@@ -200,6 +592,7 @@ static inline void cond_call(z80* const z, bool condition) {
 static inline void ret(z80* const z) {
   z->pc = popw(z);
   z->mem_ptr = z->pc;
+  PROF_RET(z);
 }
 
 // returns from subroutine if condition is true
@@ -225,34 +618,23 @@ static inline void cond_jr(z80* const z, bool condition) {
 
 // ADD Byte: adds two bytes together
 static inline uint8_t addb(z80* const z, uint8_t a, uint8_t b, bool cy) {
-  const uint8_t result = a + b + cy;
-  z->sf = result >> 7;
-  z->zf = result == 0;
-  z->hf = carry(4, a, b, cy);
-  z->pf = carry(7, a, b, cy) != carry(8, a, b, cy);
-  z->cf = carry(8, a, b, cy);
-  z->nf = 0;
-  z->xf = GET_BIT(3, result);
-  z->yf = GET_BIT(5, result);
-  return result;
+  add_flags(z, a, b, cy);
+  return a + b + cy;
 }
 
 // SUBstract Byte: substracts two bytes (with optional carry)
 static inline uint8_t subb(z80* const z, uint8_t a, uint8_t b, bool cy) {
-  uint8_t val = addb(z, a, ~b, !cy);
-  z->cf = !z->cf;
-  z->hf = !z->hf;
-  z->nf = 1;
-  return val;
+  sub_flags(z, a, b, cy);
+  return a - b - cy;
 }
 
 // ADD Word: adds two words together
 static inline uint16_t addw(z80* const z, uint16_t a, uint16_t b, bool cy) {
   uint8_t lsb = addb(z, a, b, cy);
-  uint8_t msb = addb(z, a >> 8, b >> 8, z->cf);
+  uint8_t msb = addb(z, a >> 8, b >> 8, get_cf(z));
 
   uint16_t result = (msb << 8) | lsb;
-  z->zf = result == 0;
+  flags(z)->zf = result == 0;
   z->mem_ptr = a + 1;
   return result;
 }
@@ -260,68 +642,76 @@ static inline uint16_t addw(z80* const z, uint16_t a, uint16_t b, bool cy) {
 // SUBstract Word: substracts two words (with optional carry)
 static inline uint16_t subw(z80* const z, uint16_t a, uint16_t b, bool cy) {
   uint8_t lsb = subb(z, a, b, cy);
-  uint8_t msb = subb(z, a >> 8, b >> 8, z->cf);
+  uint8_t msb = subb(z, a >> 8, b >> 8, get_cf(z));
 
   uint16_t result = (msb << 8) | lsb;
-  z->zf = result == 0;
+  flags(z)->zf = result == 0;
   z->mem_ptr = a + 1;
   return result;
 }
 
 // adds a word to HL
 static inline void addhl(z80* const z, uint16_t val) {
-  bool sf = z->sf;
-  bool zf = z->zf;
-  bool pf = z->pf;
+  bool sf = flags(z)->sf;
+  bool zf = get_zf(z);
+  bool pf = flags(z)->pf;
   uint16_t result = addw(z, get_hl(z), val, 0);
   set_hl(z, result);
-  z->sf = sf;
-  z->zf = zf;
-  z->pf = pf;
+  flags(z)->sf = sf;
+  flags(z)->zf = zf;
+  flags(z)->pf = pf;
 }
 
 // adds a word to IX or IY
 static inline void addiz(z80* const z, uint16_t* reg, uint16_t val) {
-  bool sf = z->sf;
-  bool zf = z->zf;
-  bool pf = z->pf;
+  bool sf = flags(z)->sf;
+  bool zf = get_zf(z);
+  bool pf = flags(z)->pf;
   uint16_t result = addw(z, *reg, val, 0);
   *reg = result;
-  z->sf = sf;
-  z->zf = zf;
-  z->pf = pf;
+  flags(z)->sf = sf;
+  flags(z)->zf = zf;
+  flags(z)->pf = pf;
 }
 
 // adds a word (+ carry) to HL
 static inline void adchl(z80* const z, uint16_t val) {
-  uint16_t result = addw(z, get_hl(z), val, z->cf);
-  z->sf = result >> 15;
-  z->zf = result == 0;
+  uint16_t result = addw(z, get_hl(z), val, get_cf(z));
+  flags(z)->sf = result >> 15;
+  flags(z)->zf = result == 0;
   set_hl(z, result);
 }
 
 // substracts a word (+ carry) to HL
 static inline void sbchl(z80* const z, uint16_t val) {
-  const uint16_t result = subw(z, get_hl(z), val, z->cf);
-  z->sf = result >> 15;
-  z->zf = result == 0;
+  const uint16_t result = subw(z, get_hl(z), val, get_cf(z));
+  flags(z)->sf = result >> 15;
+  flags(z)->zf = result == 0;
   set_hl(z, result);
 }
 
 // increments a byte value
 static inline uint8_t inc(z80* const z, uint8_t a) {
+#ifdef Z80_LAZY_FLAGS
+  flags_record(z, LF_INC, a, 1, 0, a + 1, get_cf(z));
+#else
   bool cf = z->cf;
-  uint8_t result = addb(z, a, 1, 0);
+  flags_add(z, a, 1, 0);
   z->cf = cf;
-  return result;
+#endif
+  return a + 1;
 }
 
 // decrements a byte value
 static inline uint8_t dec(z80* const z, uint8_t a) {
+#ifdef Z80_LAZY_FLAGS
+  flags_record(z, LF_DEC, a, 1, 0, a - 1, get_cf(z));
+#else
   bool cf = z->cf;
-  uint8_t result = subb(z, a, 1, 0);
+  flags_sub(z, a, 1, 0);
   z->cf = cf;
-  return result;
+#endif
+  return a - 1;
 }
 
 // MARK: bitwise
@@ -329,57 +719,37 @@ static inline uint8_t dec(z80* const z, uint8_t a) {
 // executes a logic "and" between register A and a byte, then stores the
 // result in register A
 static inline void land(z80* const z, uint8_t val) {
-  const uint8_t result = z->a & val;
-  z->sf = result >> 7;
-  z->zf = result == 0;
-  z->hf = 1;
-  z->pf = parity(result);
-  z->nf = 0;
-  z->cf = 0;
-  z->xf = GET_BIT(3, result);
-  z->yf = GET_BIT(5, result);
-  z->a = result;
+  z->a &= val;
+  logic_flags(z, z->a, 1, 0);
 }
 
 // executes a logic "xor" between register A and a byte, then stores the
 // result in register A
 static inline void lxor(z80* const z, const uint8_t val) {
-  const uint8_t result = z->a ^ val;
-  z->sf = result >> 7;
-  z->zf = result == 0;
-  z->hf = 0;
-  z->pf = parity(result);
-  z->nf = 0;
-  z->cf = 0;
-  z->xf = GET_BIT(3, result);
-  z->yf = GET_BIT(5, result);
-  z->a = result;
+  z->a ^= val;
+  logic_flags(z, z->a, 0, 0);
 }
 
 // executes a logic "or" between register A and a byte, then stores the
 // result in register A
 static inline void lor(z80* const z, const uint8_t val) {
-  const uint8_t result = z->a | val;
-  z->sf = result >> 7;
-  z->zf = result == 0;
-  z->hf = 0;
-  z->pf = parity(result);
-  z->nf = 0;
-  z->cf = 0;
-  z->xf = GET_BIT(3, result);
-  z->yf = GET_BIT(5, result);
-  z->a = result;
+  z->a |= val;
+  logic_flags(z, z->a, 0, 0);
 }
 
 // compares a value with register A
 static inline void cp(z80* const z, const uint8_t val) {
-  subb(z, z->a, val, 0);
+#ifdef Z80_LAZY_FLAGS
+  flags_record(z, LF_CP, z->a, val, 0, z->a - val, z->a < val);
+#else
+  flags_sub(z, z->a, val, 0);
 
   // the only difference between cp and sub is that
   // the xf/yf are taken from the value to be substracted,
   // not the result
   z->yf = GET_BIT(5, val);
   z->xf = GET_BIT(3, val);
+#endif
 }
 
 // 0xCB opcodes
@@ -387,14 +757,7 @@ static inline void cp(z80* const z, const uint8_t val) {
 static inline uint8_t cb_rlc(z80* const z, uint8_t val) {
   const bool old = val >> 7;
   val = (val << 1) | old;
-  z->sf = val >> 7;
-  z->zf = val == 0;
-  z->pf = parity(val);
-  z->nf = 0;
-  z->hf = 0;
-  z->cf = old;
-  z->xf = GET_BIT(3, val);
-  z->yf = GET_BIT(5, val);
+  logic_flags(z, val, 0, old);
   return val;
 }
 
@@ -402,114 +765,71 @@ static inline uint8_t cb_rlc(z80* const z, uint8_t val) {
 static inline uint8_t cb_rrc(z80* const z, uint8_t val) {
   const bool old = val & 1;
   val = (val >> 1) | (old << 7);
-  z->sf = val >> 7;
-  z->zf = val == 0;
-  z->nf = 0;
-  z->hf = 0;
-  z->cf = old;
-  z->pf = parity(val);
-  z->xf = GET_BIT(3, val);
-  z->yf = GET_BIT(5, val);
+  logic_flags(z, val, 0, old);
   return val;
 }
 
 // rotate left (simple)
 static inline uint8_t cb_rl(z80* const z, uint8_t val) {
-  const bool cf = z->cf;
-  z->cf = val >> 7;
+  const bool cf = get_cf(z);
+  const bool old = val >> 7;
   val = (val << 1) | cf;
-  z->sf = val >> 7;
-  z->zf = val == 0;
-  z->nf = 0;
-  z->hf = 0;
-  z->pf = parity(val);
-  z->xf = GET_BIT(3, val);
-  z->yf = GET_BIT(5, val);
+  logic_flags(z, val, 0, old);
   return val;
 }
 
 // rotate right (simple)
 static inline uint8_t cb_rr(z80* const z, uint8_t val) {
-  const bool c = z->cf;
-  z->cf = val & 1;
+  const bool c = get_cf(z);
+  const bool old = val & 1;
   val = (val >> 1) | (c << 7);
-  z->sf = val >> 7;
-  z->zf = val == 0;
-  z->nf = 0;
-  z->hf = 0;
-  z->pf = parity(val);
-  z->xf = GET_BIT(3, val);
-  z->yf = GET_BIT(5, val);
+  logic_flags(z, val, 0, old);
   return val;
 }
 
 // shift left preserving sign
 static inline uint8_t cb_sla(z80* const z, uint8_t val) {
-  z->cf = val >> 7;
+  const bool old = val >> 7;
   val <<= 1;
-  z->sf = val >> 7;
-  z->zf = val == 0;
-  z->nf = 0;
-  z->hf = 0;
-  z->pf = parity(val);
-  z->xf = GET_BIT(3, val);
-  z->yf = GET_BIT(5, val);
+  logic_flags(z, val, 0, old);
   return val;
 }
 
 // SLL (exactly like SLA, but sets the first bit to 1)
 static inline uint8_t cb_sll(z80* const z, uint8_t val) {
-  z->cf = val >> 7;
+  const bool old = val >> 7;
   val <<= 1;
   val |= 1;
-  z->sf = val >> 7;
-  z->zf = val == 0;
-  z->nf = 0;
-  z->hf = 0;
-  z->pf = parity(val);
-  z->xf = GET_BIT(3, val);
-  z->yf = GET_BIT(5, val);
+  logic_flags(z, val, 0, old);
   return val;
 }
 
 // shift right preserving sign
 static inline uint8_t cb_sra(z80* const z, uint8_t val) {
-  z->cf = val & 1;
+  const bool old = val & 1;
   val = (val >> 1) | (val & 0x80); // 0b10000000
-  z->sf = val >> 7;
-  z->zf = val == 0;
-  z->nf = 0;
-  z->hf = 0;
-  z->pf = parity(val);
-  z->xf = GET_BIT(3, val);
-  z->yf = GET_BIT(5, val);
+  logic_flags(z, val, 0, old);
   return val;
 }
 
 // shift register right
 static inline uint8_t cb_srl(z80* const z, uint8_t val) {
-  z->cf = val & 1;
+  const bool old = val & 1;
   val >>= 1;
-  z->sf = val >> 7;
-  z->zf = val == 0;
-  z->nf = 0;
-  z->hf = 0;
-  z->pf = parity(val);
-  z->xf = GET_BIT(3, val);
-  z->yf = GET_BIT(5, val);
+  logic_flags(z, val, 0, old);
   return val;
 }
 
 // tests bit "n" from a byte
 static inline uint8_t cb_bit(z80* const z, uint8_t val, uint8_t n) {
   const uint8_t result = val & (1 << n);
-  z->sf = result >> 7;
-  z->zf = result == 0;
-  z->yf = GET_BIT(5, val);
-  z->hf = 1;
-  z->xf = GET_BIT(3, val);
-  z->pf = z->zf;
-  z->nf = 0;
+  flags(z)->sf = result >> 7;
+  flags(z)->zf = result == 0;
+  flags(z)->yf = GET_BIT(5, val);
+  flags(z)->hf = 1;
+  flags(z)->xf = GET_BIT(3, val);
+  flags(z)->pf = get_zf(z);
+  flags(z)->nf = 0;
   return result;
 }
 
@@ -527,12 +847,12 @@ static inline void ldi(z80* const z) {
   // see https://wikiti.brandonw.net/index.php?title=Z80_Instruction_Set
   // for the calculation of xf/yf on LDI
   const uint8_t result = val + z->a;
-  z->xf = GET_BIT(3, result);
-  z->yf = GET_BIT(1, result);
+  flags(z)->xf = GET_BIT(3, result);
+  flags(z)->yf = GET_BIT(1, result);
 
-  z->nf = 0;
-  z->hf = 0;
-  z->pf = get_bc(z) > 0;
+  flags(z)->nf = 0;
+  flags(z)->hf = 0;
+  flags(z)->pf = get_bc(z) > 0;
 }
 
 static inline void ldd(z80* const z) {
@@ -543,14 +863,14 @@ static inline void ldd(z80* const z) {
 }
 
 static inline void cpi(z80* const z) {
-  bool cf = z->cf;
+  bool cf = get_cf(z);
   const uint8_t result = subb(z, z->a, rb(z, get_hl(z)), 0);
   set_hl(z, get_hl(z) + 1);
   set_bc(z, get_bc(z) - 1);
-  z->xf = GET_BIT(3, result - z->hf);
-  z->yf = GET_BIT(1, result - z->hf);
-  z->pf = get_bc(z) != 0;
-  z->cf = cf;
+  flags(z)->xf = GET_BIT(3, result - flags(z)->hf);
+  flags(z)->yf = GET_BIT(1, result - flags(z)->hf);
+  flags(z)->pf = get_bc(z) != 0;
+  flags(z)->cf = cf;
   z->mem_ptr += 1;
 }
 
@@ -562,21 +882,21 @@ static inline void cpd(z80* const z) {
 }
 
 static void in_r_c(z80* const z, uint8_t* r) {
-  *r = z->port_in(z, z->c);
-  z->zf = *r == 0;
-  z->sf = *r >> 7;
-  z->pf = parity(*r);
-  z->nf = 0;
-  z->hf = 0;
+  *r = port_in(z, z->c);
+  flags(z)->zf = *r == 0;
+  flags(z)->sf = *r >> 7;
+  flags(z)->pf = parity(*r);
+  flags(z)->nf = 0;
+  flags(z)->hf = 0;
 }
 
 static void ini(z80* const z) {
-  uint8_t val = z->port_in(z, z->c);
+  uint8_t val = port_in(z, z->c);
   wb(z, get_hl(z), val);
   set_hl(z, get_hl(z) + 1);
   z->b -= 1;
-  z->zf = z->b == 0;
-  z->nf = 1;
+  flags(z)->zf = z->b == 0;
+  flags(z)->nf = 1;
   z->mem_ptr = get_bc(z) + 1;
 }
 
@@ -587,11 +907,11 @@ static void ind(z80* const z) {
 }
 
 static void outi(z80* const z) {
-  z->port_out(z, z->c, rb(z, get_hl(z)));
+  port_out(z, z->c, rb(z, get_hl(z)));
   set_hl(z, get_hl(z) + 1);
   z->b -= 1;
-  z->zf = z->b == 0;
-  z->nf = 1;
+  flags(z)->zf = z->b == 0;
+  flags(z)->nf = 1;
   z->mem_ptr = get_bc(z) + 1;
 }
 
@@ -612,29 +932,29 @@ static void daa(z80* const z) {
   // > http://z80-heaven.wikidot.com/instructions-set:daa
   uint8_t correction = 0;
 
-  if ((z->a & 0x0F) > 0x09 || z->hf) {
+  if ((z->a & 0x0F) > 0x09 || flags(z)->hf) {
     correction += 0x06;
   }
 
-  if (z->a > 0x99 || z->cf) {
+  if (z->a > 0x99 || get_cf(z)) {
     correction += 0x60;
-    z->cf = 1;
+    flags(z)->cf = 1;
   }
 
-  const bool substraction = z->nf;
+  const bool substraction = flags(z)->nf;
   if (substraction) {
-    z->hf = z->hf && (z->a & 0x0F) < 0x06;
+    flags(z)->hf = flags(z)->hf && (z->a & 0x0F) < 0x06;
     z->a -= correction;
   } else {
-    z->hf = (z->a & 0x0F) > 0x09;
+    flags(z)->hf = (z->a & 0x0F) > 0x09;
     z->a += correction;
   }
 
-  z->sf = z->a >> 7;
-  z->zf = z->a == 0;
-  z->pf = parity(z->a);
-  z->xf = GET_BIT(3, z->a);
-  z->yf = GET_BIT(5, z->a);
+  flags(z)->sf = z->a >> 7;
+  flags(z)->zf = z->a == 0;
+  flags(z)->pf = parity(z->a);
+  flags(z)->xf = GET_BIT(3, z->a);
+  flags(z)->yf = GET_BIT(5, z->a);
 }
 
 static inline uint16_t displace(
@@ -660,6 +980,7 @@ static inline void process_interrupts(z80* const z) {
     z->nmi_pending = 0;
     z->halted = 0;
     z->iff1 = 0;
+    z->interrupts++;
     inc_r(z);
 
     z->cyc += 11;
@@ -672,6 +993,7 @@ static inline void process_interrupts(z80* const z) {
     z->halted = 0;
     z->iff1 = 0;
     z->iff2 = 0;
+    z->interrupts++;
     inc_r(z);
 
     switch (z->interrupt_mode) {
@@ -708,8 +1030,23 @@ void z80_init(z80* const z) {
   z->port_in = NULL;
   z->port_out = NULL;
   z->userdata = NULL;
+  z->fetch_base = NULL;
+  z->fetch_limit = 0;
+  z->profile = NULL;
+  z->trace = NULL;
 
   z->cyc = 0;
+  z->steps = 0;
+  z->skipped = 0;
+  z->skipped_cyc = 0;
+  z->interrupts = 0;
+
+  z->lf_op = 0;
+  z->lf_a = 0;
+  z->lf_b = 0;
+  z->lf_c = 0;
+  z->lf_res = 0;
+  z->lf_cf = 0;
 
   z->pc = 0;
   z->sp = 0xFFFF;
@@ -739,14 +1076,14 @@ void z80_init(z80* const z) {
   z->i = 0;
   z->r = 0;
 
-  z->sf = 1;
-  z->zf = 1;
-  z->yf = 1;
-  z->hf = 1;
-  z->xf = 1;
-  z->pf = 1;
-  z->nf = 1;
-  z->cf = 1;
+  flags(z)->sf = 1;
+  flags(z)->zf = 1;
+  flags(z)->yf = 1;
+  flags(z)->hf = 1;
+  flags(z)->xf = 1;
+  flags(z)->pf = 1;
+  flags(z)->nf = 1;
+  flags(z)->cf = 1;
 
   z->iff_delay = 0;
   z->interrupt_mode = 0;
@@ -760,16 +1097,638 @@ void z80_init(z80* const z) {
 
 // executes the next instruction in memory + handles interrupts
 void z80_step(z80* const z) {
+  z->steps++;
   if (z->halted) {
+    PROF_INSN(z, z->pc, 0x00);
+    TRACE_INSN(z, z->pc, 0x00);
     exec_opcode(z, 0x00);
   } else {
     const uint8_t opcode = nextb(z);
+    PROF_INSN(z, z->pc - 1, opcode);
+    TRACE_INSN(z, z->pc - 1, opcode);
     exec_opcode(z, opcode);
   }
 
   process_interrupts(z);
 }
 
+// checks the cheap conditions under which process_interrupts() has work to
+// do, so the batch loop only calls it when an interrupt can be taken or an
+// EI delay is counting down
+static inline bool interrupts_due(z80* const z) {
+  return z->iff_delay || z->nmi_pending || (z->int_pending && z->iff1);
+}
+
+// a halted cpu executes NOPs until an interrupt is taken. when none can be
+// taken, this runs all the NOPs needed to use up `cycles` t-states at once,
+// leaving cyc and R exactly as executing them one by one would. the NOPs
+// are counted in skipped rather than steps.
+static inline void halt_skip(z80* const z, unsigned long cycles) {
+  const unsigned long n = (cycles + cyc_00[0x00] - 1) / cyc_00[0x00];
+  PROF_HALT(z, n);
+  TRACE_INSN(z, z->pc, 0x00);
+  z->cyc += n * cyc_00[0x00];
+  z->skipped += n;
+  z->skipped_cyc += n * cyc_00[0x00];
+  z->r = (z->r & 0x80) | ((z->r + n) & 0x7f);
+}
+
+// executes instructions (handling interrupts between them exactly like
+// z80_step) until at least `cycles` t-states have elapsed. returns the
+// number of t-states executed.
+unsigned long z80_run(z80* const z, unsigned long cycles) {
+  const unsigned long start = z->cyc;
+
+#ifdef Z80_COMPUTED_GOTO
+  // threaded code: every handler ends by fetching and jumping straight to
+  // the next one, so each opcode gets its own (well predicted) indirect jump
+  static const void* const op_table[256] = {
+      &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+      &&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+      &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+      &&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+      &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+      &&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+      &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+      &&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+      &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+      &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+      &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+      &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+      &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+      &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+      &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+      &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+      &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+      &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+      &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+      &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+      &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+      &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+      &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+      &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+      &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+      &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+      &&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+      &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_0xDB, &&op_0xDC, &&op_0xDD, &&op_0xDE, &&op_0xDF,
+      &&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_0xE3, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+      &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_0xEB, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_0xEF,
+      &&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+      &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_0xFC, &&op_0xFD, &&op_0xFE, &&op_0xFF};
+
+  uint8_t opcode;
+
+#define DISPATCH()                                   \
+  do {                                               \
+    if (z->cyc - start >= cycles) goto done;         \
+    if (z->halted) goto halted;                      \
+    z->steps++;                                      \
+    opcode = nextb(z);                               \
+    PROF_INSN(z, z->pc - 1, opcode);                 \
+    TRACE_INSN(z, z->pc - 1, opcode);                \
+    z->cyc += cyc_00[opcode];                        \
+    inc_r(z);                                        \
+    goto *op_table[opcode];                          \
+  } while (0)
+#define OP(n) op_##n:
+#define NEXT                                         \
+  do {                                               \
+    if (interrupts_due(z)) process_interrupts(z);    \
+    DISPATCH();                                      \
+  } while (0)
+
+  DISPATCH();
+#include "z80_opcodes.inc"
+
+halted:
+  // nothing can wake the cpu before the budget runs out unless an interrupt
+  // is already due (e.g. HALT right after EI)
+  if (!interrupts_due(z)) {
+    halt_skip(z, cycles - (z->cyc - start));
+    goto done;
+  }
+  z->steps++;
+  PROF_INSN(z, z->pc, 0x00);
+  TRACE_INSN(z, z->pc, 0x00);
+  z->cyc += cyc_00[0x00];
+  inc_r(z);
+  goto *op_table[0x00];
+
+#undef OP
+#undef NEXT
+#undef DISPATCH
+
+done:
+  return z->cyc - start;
+#else
+  while (z->cyc - start < cycles) {
+    if (z->halted && !interrupts_due(z)) {
+      halt_skip(z, cycles - (z->cyc - start));
+      break;
+    }
+    z->steps++;
+#if defined(Z80_PROFILE) || defined(Z80_TRACE)
+    const uint16_t pc = z->pc;
+#endif
+    const uint8_t opcode = z->halted ? 0x00 : nextb(z);
+    PROF_INSN(z, pc, opcode);
+    TRACE_INSN(z, pc, opcode);
+    exec_opcode(z, opcode);
+    if (interrupts_due(z)) {
+      process_interrupts(z);
+    }
+  }
+  return z->cyc - start;
+#endif
+}
+
+// MARK: block cache
+// z80_run_blocks() splits code in the fetch window into basic blocks: runs
+// of instructions that always fall through to the next one, ended by the
+// first instruction that can jump, call, return, repeat, halt or change the
+// interrupt enables. each block is decoded once into a list of handlers and
+// kept in a table indexed by its start pc. once a block is entered all of
+// its instructions execute, so the cycle budget and pending interrupts only
+// need checking between blocks: a block is only entered when no interrupt
+// is due and the whole block fits the remaining budget, and z80_gen_int()
+// and z80_gen_nmi() are called between runs, never from inside one. for the
+// same reason the cycles, R increments and step count of the opcode fetches
+// are added once on entry, leaving each decoded instruction as nothing but
+// its handler address (instructions that read or write R end a block).
+//
+// only the fetch window is cached. it holds memory that is never written
+// (ROM), so blocks never go stale while the window stays the same; code
+// elsewhere (RAM) is always interpreted. call z80_blocks_flush() if the
+// bytes behind fetch_base are replaced, the cache rebuilds itself when
+// fetch_base or fetch_limit change.
+//
+// with z80_blocks_skip_idle() the engine also skips busy-wait loops: a
+// block that jumps back to its own start and contains nothing that writes
+// memory, the stack or a port is a candidate. if one pass through it leaves
+// every register as it was, the cpu is waiting for an interrupt and each
+// further pass until then is the same, so whole passes are skipped by
+// advancing cyc, R and steps. this assumes memory reads have no side effects
+// and memory only changes through the cpu while z80_run_blocks() runs.
+#ifdef Z80_COMPUTED_GOTO
+
+#define BLOCK_MAX_OPS 64
+
+// a decoded instruction: the computed goto label of its first opcode byte
+// in z80_run_blocks(). operands are still read by the handler.
+typedef const void* z80_uop;
+
+typedef struct {
+  uint32_t first; // index of the first uop
+  uint16_t cycles; // cyc_00 of all opcodes
+  uint16_t bound; // t-states of all but the last instruction, at most
+  uint8_t count; // 0 if the instruction at the start pc does not fit
+  bool idle; // candidate busy-wait loop (see above)
+} z80_block;
+
+// registers an idle loop pass must leave unchanged (the candidates touch
+// nothing else but pc, R and the counters). f holds the flag bitfields as
+// they are, and with Z80_LAZY_FLAGS the pending operation is kept beside
+// them, so the check computes nothing z80_run() would not.
+typedef struct {
+  uint16_t sp, ix, iy, mem_ptr;
+  uint8_t a, f, b, c, d, e, h, l;
+#ifdef Z80_LAZY_FLAGS
+  uint8_t lf_op, lf_a, lf_b, lf_res;
+  bool lf_c, lf_cf;
+#endif
+} z80_idle_state;
+
+struct z80_blocks {
+  const uint8_t* base; // fetch window the blocks were decoded from
+  uint16_t limit;
+  uint16_t* map; // pc -> block index + 1, 0 if not decoded yet
+  z80_block* blocks;
+  uint32_t block_count, block_cap;
+  z80_uop* uops;
+  uint32_t uop_count, uop_cap;
+  z80_uop single[256]; // one-instruction blocks for code run uncached
+  bool skip_idle;
+};
+
+// returns whether op (unprefixed) reads or writes (hl), which a DD/FD
+// prefix turns into (iz+d) with an extra displacement byte
+static inline bool uses_hl_indirect(uint8_t op) {
+  if (op == 0x34 || op == 0x35 || op == 0x36) return true;
+  if (op < 0x40 || op >= 0xC0 || op == 0x76) return false;
+  return (op & 7) == 6 || (op >= 0x70 && op < 0x78);
+}
+
+// returns the length in bytes of the instruction at p (0 if it does not fit
+// in the n bytes available) and sets *ends if it can end a basic block
+static int insn_length(const uint8_t* p, int n, bool* ends) {
+  *ends = false;
+  if (n < 1) return 0;
+
+  const uint8_t op = p[0];
+  int len = 1;
+  if (op == 0xCB) {
+    len = 2;
+  } else if (op == 0xED) {
+    if (n < 2) return 0;
+    const uint8_t op2 = p[1];
+    len = (op2 & 0xC7) == 0x43 ? 4 : 2; // ld (**),rr / ld rr,(**)
+    *ends = (op2 & 0xC7) == 0x45 || (op2 & 0xF4) == 0xB0 || // retn, reti, *ir, *dr
+            op2 == 0x4F || op2 == 0x5F; // ld r,a / ld a,r
+  } else if (op == 0xDD || op == 0xFD) {
+    if (n < 2) return 0;
+    const uint8_t op2 = p[1];
+    if (op2 == 0xCB) {
+      len = 4;
+    } else if (op2 == 0xE9) {
+      len = 2;
+      *ends = true; // jp iz
+    } else {
+      // everything else is the unprefixed instruction (possibly with a
+      // displacement byte added)
+      const int inner = insn_length(p + 1, n - 1, ends);
+      if (inner == 0) return 0;
+      len = 1 + inner + uses_hl_indirect(op2);
+    }
+  } else if (op < 0x40) {
+    if ((op & 7) == 6) {
+      len = 2; // ld r,*
+    } else if ((op & 0xF) == 1 || (op & 0xE7) == 0x22) {
+      len = 3; // ld rr,** / ld (**),hl / ld hl,(**) / ld (**),a / ld a,(**)
+    } else if (op >= 0x10 && (op & 7) == 0) {
+      len = 2;
+      *ends = true; // djnz, jr
+    }
+  } else if (op < 0xC0) {
+    *ends = op == 0x76; // halt
+  } else {
+    switch (op & 7) {
+    case 0: *ends = true; break; // ret cc
+    case 1: *ends = op == 0xC9 || op == 0xE9; break; // ret, jp (hl)
+    case 2: len = 3; *ends = true; break; // jp cc
+    case 3:
+      if (op == 0xC3) {
+        len = 3;
+        *ends = true; // jp
+      } else if (op == 0xD3 || op == 0xDB) {
+        len = 2; // out (*),a / in a,(*)
+      } else {
+        *ends = op == 0xF3 || op == 0xFB; // di, ei
+      }
+      break;
+    case 4: len = 3; *ends = true; break; // call cc
+    case 5:
+      if (op == 0xCD) {
+        len = 3;
+        *ends = true; // call
+      }
+      break;
+    case 6: len = 2; break; // alu a,*
+    case 7: *ends = true; break; // rst
+    }
+  }
+  return len <= n ? len : 0;
+}
+
+// returns whether the fall-through instruction at p only reads memory and
+// changes nothing outside the registers in z80_idle_state (or pc)
+static bool idle_insn(const uint8_t* p) {
+  uint8_t op = p[0];
+  if (op == 0xCB) {
+    return (p[1] >= 0x40 && p[1] < 0x80) || (p[1] & 7) != 6; // bit n,* or register ops
+  }
+  if (op == 0xDD || op == 0xFD) {
+    op = p[1];
+    if (op == 0xCB) return p[3] >= 0x40 && p[3] < 0x80; // bit n,(iz+*)
+    if (op == 0xDD || op == 0xFD || op == 0xED) return false;
+  }
+  if (op < 0x40) {
+    // stores, ex af,af', inc/dec/ld (hl)
+    return op != 0x02 && op != 0x08 && op != 0x12 && op != 0x22 &&
+           op != 0x32 && op != 0x34 && op != 0x35 && op != 0x36;
+  }
+  if (op < 0xC0) return op < 0x70 || op >= 0x78; // ld (hl),r
+  return (op & 7) == 6 || op == 0xEB || op == 0xF9; // alu a,*, ex de,hl, ld sp,hl
+}
+
+// returns whether the block-ending instruction at p (at addr) is a jp or
+// jr (conditional or not) back to target
+static bool loops_to(const uint8_t* p, unsigned addr, uint16_t target) {
+  const uint8_t op = p[0];
+  if (op == 0x18 || (op >= 0x20 && (op & 0xE7) == 0x20)) {
+    return (uint16_t) (addr + 2 + (int8_t) p[1]) == target; // jr
+  }
+  if (op == 0xC3 || (op >= 0xC0 && (op & 7) == 2)) {
+    return (p[1] | (p[2] << 8)) == target; // jp
+  }
+  return false;
+}
+
+// grows an array to hold at least `need` elements of `size` bytes
+static bool reserve(void** array, uint32_t* cap, uint32_t need, size_t size) {
+  if (need <= *cap) return true;
+  uint32_t new_cap = *cap ? *cap * 2 : 256;
+  while (new_cap < need) new_cap *= 2;
+  void* grown = realloc(*array, (size_t) new_cap * size);
+  if (grown == NULL) return false;
+  *array = grown;
+  *cap = new_cap;
+  return true;
+}
+
+// decodes the block starting at pc. returns NULL when out of memory.
+static const z80_block* decode_block(
+    z80_blocks* const b, uint16_t pc, const void* const* table) {
+  if (!reserve((void**) &b->blocks, &b->block_cap, b->block_count + 1,
+          sizeof(z80_block)) ||
+      !reserve((void**) &b->uops, &b->uop_cap, b->uop_count + BLOCK_MAX_OPS,
+          sizeof(z80_uop))) {
+    return NULL;
+  }
+
+  z80_block* const blk = &b->blocks[b->block_count];
+  blk->first = b->uop_count;
+  blk->cycles = 0;
+  blk->bound = 0;
+  blk->count = 0;
+  blk->idle = false;
+
+  unsigned addr = pc;
+  unsigned total = 0, last = 0;
+  bool ends = false, idle = true;
+  while (!ends && blk->count < BLOCK_MAX_OPS) {
+    const int len = insn_length(b->base + addr, b->limit - addr, &ends);
+    if (len == 0) break;
+
+    if (ends) {
+      blk->idle = idle && loops_to(b->base + addr, addr, pc);
+    } else {
+      idle = idle && idle_insn(b->base + addr);
+    }
+
+    const uint8_t op = b->base[addr];
+    b->uops[blk->first + blk->count++] = table[op];
+    blk->cycles += cyc_00[op];
+
+    // unprefixed fall-through instructions take exactly cyc_00 t-states,
+    // prefixed ones are well under 16 per byte
+    const bool prefixed = op == 0xCB || op == 0xED || op == 0xDD || op == 0xFD;
+    last = prefixed ? 16 * len : cyc_00[op];
+    total += last;
+    addr += len;
+  }
+  blk->bound = total - last;
+
+  b->uop_count += blk->count;
+  b->map[pc] = ++b->block_count;
+  return blk;
+}
+
+// points the cache at the current fetch window, dropping all blocks if it
+// moved. returns false when out of memory.
+static bool bind_blocks(z80_blocks* const b, const z80* const z) {
+  if (b->base == z->fetch_base && b->limit == z->fetch_limit) return true;
+
+  z80_blocks_flush(b);
+  free(b->map);
+  b->map = NULL;
+  b->base = NULL;
+  b->limit = 0;
+  if (z->fetch_base == NULL || z->fetch_limit == 0) return true;
+
+  b->map = calloc(z->fetch_limit, sizeof(uint16_t));
+  if (b->map == NULL) return false;
+  b->base = z->fetch_base;
+  b->limit = z->fetch_limit;
+  return true;
+}
+
+// copies the registers an idle loop pass must leave unchanged
+static inline void save_idle_state(z80* const z, z80_idle_state* const st) {
+  st->sp = z->sp;
+  st->ix = z->ix;
+  st->iy = z->iy;
+  st->mem_ptr = z->mem_ptr;
+  st->a = z->a;
+  st->f = z->cf | z->nf << 1 | z->pf << 2 | z->xf << 3 | z->hf << 4 |
+          z->yf << 5 | z->zf << 6 | z->sf << 7;
+#ifdef Z80_LAZY_FLAGS
+  st->lf_op = z->lf_op;
+  st->lf_a = z->lf_a;
+  st->lf_b = z->lf_b;
+  st->lf_res = z->lf_res;
+  st->lf_c = z->lf_c;
+  st->lf_cf = z->lf_cf;
+#endif
+  st->b = z->b;
+  st->c = z->c;
+  st->d = z->d;
+  st->e = z->e;
+  st->h = z->h;
+  st->l = z->l;
+}
+
+// allocates an empty block cache
+z80_blocks* z80_blocks_create(void) {
+  return calloc(1, sizeof(z80_blocks));
+}
+
+// frees a block cache
+void z80_blocks_destroy(z80_blocks* const b) {
+  if (b == NULL) return;
+  free(b->map);
+  free(b->blocks);
+  free(b->uops);
+  free(b);
+}
+
+// enables or disables skipping of busy-wait loops (off by default)
+void z80_blocks_skip_idle(z80_blocks* const b, bool enable) {
+  b->skip_idle = enable;
+}
+
+// drops all decoded blocks (keeping the memory for reuse)
+void z80_blocks_flush(z80_blocks* const b) {
+  if (b->map != NULL) memset(b->map, 0, b->limit * sizeof(uint16_t));
+  b->block_count = 0;
+  b->uop_count = 0;
+}
+
+// executes instructions like z80_run(), running code in the fetch window
+// from the block cache. returns the number of t-states executed.
+unsigned long z80_run_blocks(
+    z80* const z, z80_blocks* const b, unsigned long cycles) {
+  if (!bind_blocks(b, z)) return z80_run(z, cycles);
+#ifdef Z80_PROFILE
+  if (z->profile != NULL) return z80_run(z, cycles);
+#endif
+#ifdef Z80_TRACE
+  if (z->trace != NULL) return z80_run(z, cycles);
+#endif
+
+  const unsigned long start = z->cyc;
+
+  static const void* const blk_table[256] = {
+      &&blk_0x00, &&blk_0x01, &&blk_0x02, &&blk_0x03, &&blk_0x04, &&blk_0x05, &&blk_0x06, &&blk_0x07,
+      &&blk_0x08, &&blk_0x09, &&blk_0x0A, &&blk_0x0B, &&blk_0x0C, &&blk_0x0D, &&blk_0x0E, &&blk_0x0F,
+      &&blk_0x10, &&blk_0x11, &&blk_0x12, &&blk_0x13, &&blk_0x14, &&blk_0x15, &&blk_0x16, &&blk_0x17,
+      &&blk_0x18, &&blk_0x19, &&blk_0x1A, &&blk_0x1B, &&blk_0x1C, &&blk_0x1D, &&blk_0x1E, &&blk_0x1F,
+      &&blk_0x20, &&blk_0x21, &&blk_0x22, &&blk_0x23, &&blk_0x24, &&blk_0x25, &&blk_0x26, &&blk_0x27,
+      &&blk_0x28, &&blk_0x29, &&blk_0x2A, &&blk_0x2B, &&blk_0x2C, &&blk_0x2D, &&blk_0x2E, &&blk_0x2F,
+      &&blk_0x30, &&blk_0x31, &&blk_0x32, &&blk_0x33, &&blk_0x34, &&blk_0x35, &&blk_0x36, &&blk_0x37,
+      &&blk_0x38, &&blk_0x39, &&blk_0x3A, &&blk_0x3B, &&blk_0x3C, &&blk_0x3D, &&blk_0x3E, &&blk_0x3F,
+      &&blk_0x40, &&blk_0x41, &&blk_0x42, &&blk_0x43, &&blk_0x44, &&blk_0x45, &&blk_0x46, &&blk_0x47,
+      &&blk_0x48, &&blk_0x49, &&blk_0x4A, &&blk_0x4B, &&blk_0x4C, &&blk_0x4D, &&blk_0x4E, &&blk_0x4F,
+      &&blk_0x50, &&blk_0x51, &&blk_0x52, &&blk_0x53, &&blk_0x54, &&blk_0x55, &&blk_0x56, &&blk_0x57,
+      &&blk_0x58, &&blk_0x59, &&blk_0x5A, &&blk_0x5B, &&blk_0x5C, &&blk_0x5D, &&blk_0x5E, &&blk_0x5F,
+      &&blk_0x60, &&blk_0x61, &&blk_0x62, &&blk_0x63, &&blk_0x64, &&blk_0x65, &&blk_0x66, &&blk_0x67,
+      &&blk_0x68, &&blk_0x69, &&blk_0x6A, &&blk_0x6B, &&blk_0x6C, &&blk_0x6D, &&blk_0x6E, &&blk_0x6F,
+      &&blk_0x70, &&blk_0x71, &&blk_0x72, &&blk_0x73, &&blk_0x74, &&blk_0x75, &&blk_0x76, &&blk_0x77,
+      &&blk_0x78, &&blk_0x79, &&blk_0x7A, &&blk_0x7B, &&blk_0x7C, &&blk_0x7D, &&blk_0x7E, &&blk_0x7F,
+      &&blk_0x80, &&blk_0x81, &&blk_0x82, &&blk_0x83, &&blk_0x84, &&blk_0x85, &&blk_0x86, &&blk_0x87,
+      &&blk_0x88, &&blk_0x89, &&blk_0x8A, &&blk_0x8B, &&blk_0x8C, &&blk_0x8D, &&blk_0x8E, &&blk_0x8F,
+      &&blk_0x90, &&blk_0x91, &&blk_0x92, &&blk_0x93, &&blk_0x94, &&blk_0x95, &&blk_0x96, &&blk_0x97,
+      &&blk_0x98, &&blk_0x99, &&blk_0x9A, &&blk_0x9B, &&blk_0x9C, &&blk_0x9D, &&blk_0x9E, &&blk_0x9F,
+      &&blk_0xA0, &&blk_0xA1, &&blk_0xA2, &&blk_0xA3, &&blk_0xA4, &&blk_0xA5, &&blk_0xA6, &&blk_0xA7,
+      &&blk_0xA8, &&blk_0xA9, &&blk_0xAA, &&blk_0xAB, &&blk_0xAC, &&blk_0xAD, &&blk_0xAE, &&blk_0xAF,
+      &&blk_0xB0, &&blk_0xB1, &&blk_0xB2, &&blk_0xB3, &&blk_0xB4, &&blk_0xB5, &&blk_0xB6, &&blk_0xB7,
+      &&blk_0xB8, &&blk_0xB9, &&blk_0xBA, &&blk_0xBB, &&blk_0xBC, &&blk_0xBD, &&blk_0xBE, &&blk_0xBF,
+      &&blk_0xC0, &&blk_0xC1, &&blk_0xC2, &&blk_0xC3, &&blk_0xC4, &&blk_0xC5, &&blk_0xC6, &&blk_0xC7,
+      &&blk_0xC8, &&blk_0xC9, &&blk_0xCA, &&blk_0xCB, &&blk_0xCC, &&blk_0xCD, &&blk_0xCE, &&blk_0xCF,
+      &&blk_0xD0, &&blk_0xD1, &&blk_0xD2, &&blk_0xD3, &&blk_0xD4, &&blk_0xD5, &&blk_0xD6, &&blk_0xD7,
+      &&blk_0xD8, &&blk_0xD9, &&blk_0xDA, &&blk_0xDB, &&blk_0xDC, &&blk_0xDD, &&blk_0xDE, &&blk_0xDF,
+      &&blk_0xE0, &&blk_0xE1, &&blk_0xE2, &&blk_0xE3, &&blk_0xE4, &&blk_0xE5, &&blk_0xE6, &&blk_0xE7,
+      &&blk_0xE8, &&blk_0xE9, &&blk_0xEA, &&blk_0xEB, &&blk_0xEC, &&blk_0xED, &&blk_0xEE, &&blk_0xEF,
+      &&blk_0xF0, &&blk_0xF1, &&blk_0xF2, &&blk_0xF3, &&blk_0xF4, &&blk_0xF5, &&blk_0xF6, &&blk_0xF7,
+      &&blk_0xF8, &&blk_0xF9, &&blk_0xFA, &&blk_0xFB, &&blk_0xFC, &&blk_0xFD, &&blk_0xFE, &&blk_0xFF};
+
+  const z80_uop* ins;
+  const z80_uop* end;
+  unsigned long steps = 0; // added to z->steps at the end
+
+  // idle loop candidate being watched for one pass (see above)
+  const z80_block* idle = NULL;
+  z80_idle_state idle_state;
+  unsigned long idle_cyc = 0;
+  uint16_t idle_pc = 0;
+  uint8_t idle_r = 0;
+
+  if (b->single[0] == NULL) {
+    memcpy(b->single, blk_table, sizeof(b->single));
+  }
+
+  // same handlers as z80_run(), but NEXT just moves on to the next decoded
+  // instruction of the block
+#define OP(n) blk_##n:
+#define NEXT                                         \
+  do {                                               \
+    if (++ins == end) goto block_done;               \
+    z->pc++;                                         \
+    goto **ins;                                      \
+  } while (0)
+
+  while (z->cyc - start < cycles) {
+    if (z->halted && !interrupts_due(z)) {
+      halt_skip(z, cycles - (z->cyc - start));
+      break;
+    }
+
+    if (!z->halted && z->pc < b->limit && !interrupts_due(z)) {
+      const uint16_t id = b->map[z->pc];
+      const z80_block* const blk =
+          id ? &b->blocks[id - 1] : decode_block(b, z->pc, blk_table);
+
+      if (blk != NULL && blk->count > 0 &&
+          z->cyc - start + blk->bound < cycles) {
+        if (blk->idle && b->skip_idle) {
+          idle = blk;
+          idle_pc = z->pc;
+          idle_cyc = z->cyc;
+          idle_r = z->r;
+          save_idle_state(z, &idle_state);
+        }
+
+        ins = b->uops + blk->first;
+        end = ins + blk->count;
+        steps += blk->count;
+        z->cyc += blk->cycles;
+        z->r = (z->r & 0x80) | ((z->r + blk->count) & 0x7f);
+        z->pc++;
+        goto **ins;
+      }
+    }
+
+    // outside the window, halted, interrupt due or close to the end of the
+    // budget: a block of one instruction, fetched as usual
+    {
+      const uint8_t opcode = z->halted ? 0x00 : nextb(z);
+      ins = &b->single[opcode];
+      end = ins + 1;
+      steps++;
+      z->cyc += cyc_00[opcode];
+      inc_r(z);
+      goto **ins;
+    }
+
+#include "z80_opcodes.inc"
+
+  block_done:
+    if (idle != NULL) {
+      z80_idle_state now;
+      save_idle_state(z, &now);
+      const unsigned long pass = z->cyc - idle_cyc;
+      const unsigned long used = z->cyc - start;
+      if (z->pc == idle_pc && used < cycles && cycles - used > pass &&
+          !interrupts_due(z) && memcmp(&now, &idle_state, sizeof(now)) == 0) {
+        // skip whole passes, leaving at least one (and the end of the
+        // budget) to run normally
+        const unsigned long n = (cycles - used) / pass - 1;
+        const uint8_t dr = (z->r - idle_r) & 0x7f;
+        z->cyc += n * pass;
+        z->r = (z->r & 0x80) | ((z->r + (n & 0x7f) * dr) & 0x7f);
+        z->skipped += n * idle->count;
+        z->skipped_cyc += n * pass;
+      }
+      idle = NULL;
+    }
+    if (interrupts_due(z)) process_interrupts(z);
+  }
+
+#undef OP
+#undef NEXT
+
+  z->steps += steps;
+  return z->cyc - start;
+}
+
+#undef BLOCK_MAX_OPS
+
+#else
+
+z80_blocks* z80_blocks_create(void) {
+  return NULL;
+}
+
+void z80_blocks_destroy(z80_blocks* const b) {
+  (void) b;
+}
+
+void z80_blocks_flush(z80_blocks* const b) {
+  (void) b;
+}
+
+void z80_blocks_skip_idle(z80_blocks* const b, bool enable) {
+  (void) b;
+  (void) enable;
+}
+
+unsigned long z80_run_blocks(
+    z80* const z, z80_blocks* const b, unsigned long cycles) {
+  (void) b;
+  return z80_run(z, cycles);
+}
+
+#endif
+
 // outputs to stdout a debug trace of the emulator
 void z80_debug_output(z80* const z) {
   printf("PC: %04X, AF: %04X, BC: %04X, DE: %04X, HL: %04X, SP: %04X, "
@@ -798,447 +1757,11 @@ void exec_opcode(z80* const z, uint8_t opcode) {
   inc_r(z);
 
   switch (opcode) {
-  case 0x7F: z->a = z->a; break; // ld a,a
-  case 0x78: z->a = z->b; break; // ld a,b
-  case 0x79: z->a = z->c; break; // ld a,c
-  case 0x7A: z->a = z->d; break; // ld a,d
-  case 0x7B: z->a = z->e; break; // ld a,e
-  case 0x7C: z->a = z->h; break; // ld a,h
-  case 0x7D: z->a = z->l; break; // ld a,l
-
-  case 0x47: z->b = z->a; break; // ld b,a
-  case 0x40: z->b = z->b; break; // ld b,b
-  case 0x41: z->b = z->c; break; // ld b,c
-  case 0x42: z->b = z->d; break; // ld b,d
-  case 0x43: z->b = z->e; break; // ld b,e
-  case 0x44: z->b = z->h; break; // ld b,h
-  case 0x45: z->b = z->l; break; // ld b,l
-
-  case 0x4F: z->c = z->a; break; // ld c,a
-  case 0x48: z->c = z->b; break; // ld c,b
-  case 0x49: z->c = z->c; break; // ld c,c
-  case 0x4A: z->c = z->d; break; // ld c,d
-  case 0x4B: z->c = z->e; break; // ld c,e
-  case 0x4C: z->c = z->h; break; // ld c,h
-  case 0x4D: z->c = z->l; break; // ld c,l
-
-  case 0x57: z->d = z->a; break; // ld d,a
-  case 0x50: z->d = z->b; break; // ld d,b
-  case 0x51: z->d = z->c; break; // ld d,c
-  case 0x52: z->d = z->d; break; // ld d,d
-  case 0x53: z->d = z->e; break; // ld d,e
-  case 0x54: z->d = z->h; break; // ld d,h
-  case 0x55: z->d = z->l; break; // ld d,l
-
-  case 0x5F: z->e = z->a; break; // ld e,a
-  case 0x58: z->e = z->b; break; // ld e,b
-  case 0x59: z->e = z->c; break; // ld e,c
-  case 0x5A: z->e = z->d; break; // ld e,d
-  case 0x5B: z->e = z->e; break; // ld e,e
-  case 0x5C: z->e = z->h; break; // ld e,h
-  case 0x5D: z->e = z->l; break; // ld e,l
-
-  case 0x67: z->h = z->a; break; // ld h,a
-  case 0x60: z->h = z->b; break; // ld h,b
-  case 0x61: z->h = z->c; break; // ld h,c
-  case 0x62: z->h = z->d; break; // ld h,d
-  case 0x63: z->h = z->e; break; // ld h,e
-  case 0x64: z->h = z->h; break; // ld h,h
-  case 0x65: z->h = z->l; break; // ld h,l
-
-  case 0x6F: z->l = z->a; break; // ld l,a
-  case 0x68: z->l = z->b; break; // ld l,b
-  case 0x69: z->l = z->c; break; // ld l,c
-  case 0x6A: z->l = z->d; break; // ld l,d
-  case 0x6B: z->l = z->e; break; // ld l,e
-  case 0x6C: z->l = z->h; break; // ld l,h
-  case 0x6D: z->l = z->l; break; // ld l,l
-
-  case 0x7E: z->a = rb(z, get_hl(z)); break; // ld a,(hl)
-  case 0x46: z->b = rb(z, get_hl(z)); break; // ld b,(hl)
-  case 0x4E: z->c = rb(z, get_hl(z)); break; // ld c,(hl)
-  case 0x56: z->d = rb(z, get_hl(z)); break; // ld d,(hl)
-  case 0x5E: z->e = rb(z, get_hl(z)); break; // ld e,(hl)
-  case 0x66: z->h = rb(z, get_hl(z)); break; // ld h,(hl)
-  case 0x6E: z->l = rb(z, get_hl(z)); break; // ld l,(hl)
-
-  case 0x77: wb(z, get_hl(z), z->a); break; // ld (hl),a
-  case 0x70: wb(z, get_hl(z), z->b); break; // ld (hl),b
-  case 0x71: wb(z, get_hl(z), z->c); break; // ld (hl),c
-  case 0x72: wb(z, get_hl(z), z->d); break; // ld (hl),d
-  case 0x73: wb(z, get_hl(z), z->e); break; // ld (hl),e
-  case 0x74: wb(z, get_hl(z), z->h); break; // ld (hl),h
-  case 0x75: wb(z, get_hl(z), z->l); break; // ld (hl),l
-
-  case 0x3E: z->a = nextb(z); break; // ld a,*
-  case 0x06: z->b = nextb(z); break; // ld b,*
-  case 0x0E: z->c = nextb(z); break; // ld c,*
-  case 0x16: z->d = nextb(z); break; // ld d,*
-  case 0x1E: z->e = nextb(z); break; // ld e,*
-  case 0x26: z->h = nextb(z); break; // ld h,*
-  case 0x2E: z->l = nextb(z); break; // ld l,*
-  case 0x36: wb(z, get_hl(z), nextb(z)); break; // ld (hl),*
-
-  case 0x0A:
-    z->a = rb(z, get_bc(z));
-    z->mem_ptr = get_bc(z) + 1;
-    break; // ld a,(bc)
-  case 0x1A:
-    z->a = rb(z, get_de(z));
-    z->mem_ptr = get_de(z) + 1;
-    break; // ld a,(de)
-  case 0x3A: {
-    const uint16_t addr = nextw(z);
-    z->a = rb(z, addr);
-    z->mem_ptr = addr + 1;
-  } break; // ld a,(**)
-
-  case 0x02:
-    wb(z, get_bc(z), z->a);
-    z->mem_ptr = (z->a << 8) | ((get_bc(z) + 1) & 0xFF);
-    break; // ld (bc),a
-
-  case 0x12:
-    wb(z, get_de(z), z->a);
-    z->mem_ptr = (z->a << 8) | ((get_de(z) + 1) & 0xFF);
-    break; // ld (de),a
-
-  case 0x32: {
-    const uint16_t addr = nextw(z);
-    wb(z, addr, z->a);
-    z->mem_ptr = (z->a << 8) | ((addr + 1) & 0xFF);
-  } break; // ld (**),a
-
-  case 0x01: set_bc(z, nextw(z)); break; // ld bc,**
-  case 0x11: set_de(z, nextw(z)); break; // ld de,**
-  case 0x21: set_hl(z, nextw(z)); break; // ld hl,**
-  case 0x31: z->sp = nextw(z); break; // ld sp,**
-
-  case 0x2A: {
-    const uint16_t addr = nextw(z);
-    set_hl(z, rw(z, addr));
-    z->mem_ptr = addr + 1;
-  } break; // ld hl,(**)
-
-  case 0x22: {
-    const uint16_t addr = nextw(z);
-    ww(z, addr, get_hl(z));
-    z->mem_ptr = addr + 1;
-  } break; // ld (**),hl
-
-  case 0xF9: z->sp = get_hl(z); break; // ld sp,hl
-
-  case 0xEB: {
-    const uint16_t de = get_de(z);
-    set_de(z, get_hl(z));
-    set_hl(z, de);
-  } break; // ex de,hl
-
-  case 0xE3: {
-    const uint16_t val = rw(z, z->sp);
-    ww(z, z->sp, get_hl(z));
-    set_hl(z, val);
-    z->mem_ptr = val;
-  } break; // ex (sp),hl
-
-  case 0x87: z->a = addb(z, z->a, z->a, 0); break; // add a,a
-  case 0x80: z->a = addb(z, z->a, z->b, 0); break; // add a,b
-  case 0x81: z->a = addb(z, z->a, z->c, 0); break; // add a,c
-  case 0x82: z->a = addb(z, z->a, z->d, 0); break; // add a,d
-  case 0x83: z->a = addb(z, z->a, z->e, 0); break; // add a,e
-  case 0x84: z->a = addb(z, z->a, z->h, 0); break; // add a,h
-  case 0x85: z->a = addb(z, z->a, z->l, 0); break; // add a,l
-  case 0x86: z->a = addb(z, z->a, rb(z, get_hl(z)), 0); break; // add a,(hl)
-  case 0xC6: z->a = addb(z, z->a, nextb(z), 0); break; // add a,*
-
-  case 0x8F: z->a = addb(z, z->a, z->a, z->cf); break; // adc a,a
-  case 0x88: z->a = addb(z, z->a, z->b, z->cf); break; // adc a,b
-  case 0x89: z->a = addb(z, z->a, z->c, z->cf); break; // adc a,c
-  case 0x8A: z->a = addb(z, z->a, z->d, z->cf); break; // adc a,d
-  case 0x8B: z->a = addb(z, z->a, z->e, z->cf); break; // adc a,e
-  case 0x8C: z->a = addb(z, z->a, z->h, z->cf); break; // adc a,h
-  case 0x8D: z->a = addb(z, z->a, z->l, z->cf); break; // adc a,l
-  case 0x8E: z->a = addb(z, z->a, rb(z, get_hl(z)), z->cf); break; // adc a,(hl)
-  case 0xCE: z->a = addb(z, z->a, nextb(z), z->cf); break; // adc a,*
-
-  case 0x97: z->a = subb(z, z->a, z->a, 0); break; // sub a,a
-  case 0x90: z->a = subb(z, z->a, z->b, 0); break; // sub a,b
-  case 0x91: z->a = subb(z, z->a, z->c, 0); break; // sub a,c
-  case 0x92: z->a = subb(z, z->a, z->d, 0); break; // sub a,d
-  case 0x93: z->a = subb(z, z->a, z->e, 0); break; // sub a,e
-  case 0x94: z->a = subb(z, z->a, z->h, 0); break; // sub a,h
-  case 0x95: z->a = subb(z, z->a, z->l, 0); break; // sub a,l
-  case 0x96: z->a = subb(z, z->a, rb(z, get_hl(z)), 0); break; // sub a,(hl)
-  case 0xD6: z->a = subb(z, z->a, nextb(z), 0); break; // sub a,*
-
-  case 0x9F: z->a = subb(z, z->a, z->a, z->cf); break; // sbc a,a
-  case 0x98: z->a = subb(z, z->a, z->b, z->cf); break; // sbc a,b
-  case 0x99: z->a = subb(z, z->a, z->c, z->cf); break; // sbc a,c
-  case 0x9A: z->a = subb(z, z->a, z->d, z->cf); break; // sbc a,d
-  case 0x9B: z->a = subb(z, z->a, z->e, z->cf); break; // sbc a,e
-  case 0x9C: z->a = subb(z, z->a, z->h, z->cf); break; // sbc a,h
-  case 0x9D: z->a = subb(z, z->a, z->l, z->cf); break; // sbc a,l
-  case 0x9E: z->a = subb(z, z->a, rb(z, get_hl(z)), z->cf); break; // sbc a,(hl)
-  case 0xDE: z->a = subb(z, z->a, nextb(z), z->cf); break; // sbc a,*
-
-  case 0x09: addhl(z, get_bc(z)); break; // add hl,bc
-  case 0x19: addhl(z, get_de(z)); break; // add hl,de
-  case 0x29: addhl(z, get_hl(z)); break; // add hl,hl
-  case 0x39: addhl(z, z->sp); break; // add hl,sp
-
-  case 0xF3:
-    z->iff1 = 0;
-    z->iff2 = 0;
-    break; // di
-  case 0xFB: z->iff_delay = 1; break; // ei
-  case 0x00: break; // nop
-  case 0x76: z->halted = 1; break; // halt
-
-  case 0x3C: z->a = inc(z, z->a); break; // inc a
-  case 0x04: z->b = inc(z, z->b); break; // inc b
-  case 0x0C: z->c = inc(z, z->c); break; // inc c
-  case 0x14: z->d = inc(z, z->d); break; // inc d
-  case 0x1C: z->e = inc(z, z->e); break; // inc e
-  case 0x24: z->h = inc(z, z->h); break; // inc h
-  case 0x2C: z->l = inc(z, z->l); break; // inc l
-  case 0x34: {
-    uint8_t result = inc(z, rb(z, get_hl(z)));
-    wb(z, get_hl(z), result);
-  } break; // inc (hl)
-
-  case 0x3D: z->a = dec(z, z->a); break; // dec a
-  case 0x05: z->b = dec(z, z->b); break; // dec b
-  case 0x0D: z->c = dec(z, z->c); break; // dec c
-  case 0x15: z->d = dec(z, z->d); break; // dec d
-  case 0x1D: z->e = dec(z, z->e); break; // dec e
-  case 0x25: z->h = dec(z, z->h); break; // dec h
-  case 0x2D: z->l = dec(z, z->l); break; // dec l
-  case 0x35: {
-    uint8_t result = dec(z, rb(z, get_hl(z)));
-    wb(z, get_hl(z), result);
-  } break; // dec (hl)
-
-  case 0x03: set_bc(z, get_bc(z) + 1); break; // inc bc
-  case 0x13: set_de(z, get_de(z) + 1); break; // inc de
-  case 0x23: set_hl(z, get_hl(z) + 1); break; // inc hl
-  case 0x33: z->sp = z->sp + 1; break; // inc sp
-
-  case 0x0B: set_bc(z, get_bc(z) - 1); break; // dec bc
-  case 0x1B: set_de(z, get_de(z) - 1); break; // dec de
-  case 0x2B: set_hl(z, get_hl(z) - 1); break; // dec hl
-  case 0x3B: z->sp = z->sp - 1; break; // dec sp
-
-  case 0x27: daa(z); break; // daa
-
-  case 0x2F:
-    z->a = ~z->a;
-    z->nf = 1;
-    z->hf = 1;
-    z->xf = GET_BIT(3, z->a);
-    z->yf = GET_BIT(5, z->a);
-    break; // cpl
-
-  case 0x37:
-    z->cf = 1;
-    z->nf = 0;
-    z->hf = 0;
-    z->xf = GET_BIT(3, z->a);
-    z->yf = GET_BIT(5, z->a);
-    break; // scf
-
-  case 0x3F:
-    z->hf = z->cf;
-    z->cf = !z->cf;
-    z->nf = 0;
-    z->xf = GET_BIT(3, z->a);
-    z->yf = GET_BIT(5, z->a);
-    break; // ccf
-
-  case 0x07: {
-    z->cf = z->a >> 7;
-    z->a = (z->a << 1) | z->cf;
-    z->nf = 0;
-    z->hf = 0;
-    z->xf = GET_BIT(3, z->a);
-    z->yf = GET_BIT(5, z->a);
-  } break; // rlca (rotate left)
-
-  case 0x0F: {
-    z->cf = z->a & 1;
-    z->a = (z->a >> 1) | (z->cf << 7);
-    z->nf = 0;
-    z->hf = 0;
-    z->xf = GET_BIT(3, z->a);
-    z->yf = GET_BIT(5, z->a);
-  } break; // rrca (rotate right)
-
-  case 0x17: {
-    const bool cy = z->cf;
-    z->cf = z->a >> 7;
-    z->a = (z->a << 1) | cy;
-    z->nf = 0;
-    z->hf = 0;
-    z->xf = GET_BIT(3, z->a);
-    z->yf = GET_BIT(5, z->a);
-  } break; // rla
-
-  case 0x1F: {
-    const bool cy = z->cf;
-    z->cf = z->a & 1;
-    z->a = (z->a >> 1) | (cy << 7);
-    z->nf = 0;
-    z->hf = 0;
-    z->xf = GET_BIT(3, z->a);
-    z->yf = GET_BIT(5, z->a);
-  } break; // rra
-
-  case 0xA7: land(z, z->a); break; // and a
-  case 0xA0: land(z, z->b); break; // and b
-  case 0xA1: land(z, z->c); break; // and c
-  case 0xA2: land(z, z->d); break; // and d
-  case 0xA3: land(z, z->e); break; // and e
-  case 0xA4: land(z, z->h); break; // and h
-  case 0xA5: land(z, z->l); break; // and l
-  case 0xA6: land(z, rb(z, get_hl(z))); break; // and (hl)
-  case 0xE6: land(z, nextb(z)); break; // and *
-
-  case 0xAF: lxor(z, z->a); break; // xor a
-  case 0xA8: lxor(z, z->b); break; // xor b
-  case 0xA9: lxor(z, z->c); break; // xor c
-  case 0xAA: lxor(z, z->d); break; // xor d
-  case 0xAB: lxor(z, z->e); break; // xor e
-  case 0xAC: lxor(z, z->h); break; // xor h
-  case 0xAD: lxor(z, z->l); break; // xor l
-  case 0xAE: lxor(z, rb(z, get_hl(z))); break; // xor (hl)
-  case 0xEE: lxor(z, nextb(z)); break; // xor *
-
-  case 0xB7: lor(z, z->a); break; // or a
-  case 0xB0: lor(z, z->b); break; // or b
-  case 0xB1: lor(z, z->c); break; // or c
-  case 0xB2: lor(z, z->d); break; // or d
-  case 0xB3: lor(z, z->e); break; // or e
-  case 0xB4: lor(z, z->h); break; // or h
-  case 0xB5: lor(z, z->l); break; // or l
-  case 0xB6: lor(z, rb(z, get_hl(z))); break; // or (hl)
-  case 0xF6: lor(z, nextb(z)); break; // or *
-
-  case 0xBF: cp(z, z->a); break; // cp a
-  case 0xB8: cp(z, z->b); break; // cp b
-  case 0xB9: cp(z, z->c); break; // cp c
-  case 0xBA: cp(z, z->d); break; // cp d
-  case 0xBB: cp(z, z->e); break; // cp e
-  case 0xBC: cp(z, z->h); break; // cp h
-  case 0xBD: cp(z, z->l); break; // cp l
-  case 0xBE: cp(z, rb(z, get_hl(z))); break; // cp (hl)
-  case 0xFE: cp(z, nextb(z)); break; // cp *
-
-  case 0xC3: jump(z, nextw(z)); break; // jm **
-  case 0xC2: cond_jump(z, z->zf == 0); break; // jp nz, **
-  case 0xCA: cond_jump(z, z->zf == 1); break; // jp z, **
-  case 0xD2: cond_jump(z, z->cf == 0); break; // jp nc, **
-  case 0xDA: cond_jump(z, z->cf == 1); break; // jp c, **
-  case 0xE2: cond_jump(z, z->pf == 0); break; // jp po, **
-  case 0xEA: cond_jump(z, z->pf == 1); break; // jp pe, **
-  case 0xF2: cond_jump(z, z->sf == 0); break; // jp p, **
-  case 0xFA: cond_jump(z, z->sf == 1); break; // jp m, **
-
-  case 0x10: cond_jr(z, --z->b != 0); break; // djnz *
-  case 0x18: z->pc += (int8_t) nextb(z); break; // jr *
-  case 0x20: cond_jr(z, z->zf == 0); break; // jr nz, *
-  case 0x28: cond_jr(z, z->zf == 1); break; // jr z, *
-  case 0x30: cond_jr(z, z->cf == 0); break; // jr nc, *
-  case 0x38: cond_jr(z, z->cf == 1); break; // jr c, *
-
-  case 0xE9: z->pc = get_hl(z); break; // jp (hl)
-  case 0xCD: call(z, nextw(z)); break; // call
-
-  case 0xC4: cond_call(z, z->zf == 0); break; // cnz
-  case 0xCC: cond_call(z, z->zf == 1); break; // cz
-  case 0xD4: cond_call(z, z->cf == 0); break; // cnc
-  case 0xDC: cond_call(z, z->cf == 1); break; // cc
-  case 0xE4: cond_call(z, z->pf == 0); break; // cpo
-  case 0xEC: cond_call(z, z->pf == 1); break; // cpe
-  case 0xF4: cond_call(z, z->sf == 0); break; // cp
-  case 0xFC: cond_call(z, z->sf == 1); break; // cm
-
-  case 0xC9: ret(z); break; // ret
-  case 0xC0: cond_ret(z, z->zf == 0); break; // ret nz
-  case 0xC8: cond_ret(z, z->zf == 1); break; // ret z
-  case 0xD0: cond_ret(z, z->cf == 0); break; // ret nc
-  case 0xD8: cond_ret(z, z->cf == 1); break; // ret c
-  case 0xE0: cond_ret(z, z->pf == 0); break; // ret po
-  case 0xE8: cond_ret(z, z->pf == 1); break; // ret pe
-  case 0xF0: cond_ret(z, z->sf == 0); break; // ret p
-  case 0xF8: cond_ret(z, z->sf == 1); break; // ret m
-
-  case 0xC7: call(z, 0x00); break; // rst 0
-  case 0xCF: call(z, 0x08); break; // rst 1
-  case 0xD7: call(z, 0x10); break; // rst 2
-  case 0xDF: call(z, 0x18); break; // rst 3
-  case 0xE7: call(z, 0x20); break; // rst 4
-  case 0xEF: call(z, 0x28); break; // rst 5
-  case 0xF7: call(z, 0x30); break; // rst 6
-  case 0xFF: call(z, 0x38); break; // rst 7
-
-  case 0xC5: pushw(z, get_bc(z)); break; // push bc
-  case 0xD5: pushw(z, get_de(z)); break; // push de
-  case 0xE5: pushw(z, get_hl(z)); break; // push hl
-  case 0xF5: pushw(z, (z->a << 8) | get_f(z)); break; // push af
-
-  case 0xC1: set_bc(z, popw(z)); break; // pop bc
-  case 0xD1: set_de(z, popw(z)); break; // pop de
-  case 0xE1: set_hl(z, popw(z)); break; // pop hl
-  case 0xF1: {
-    uint16_t val = popw(z);
-    z->a = val >> 8;
-    set_f(z, val & 0xFF);
-  } break; // pop af
-
-  case 0xDB: {
-    const uint8_t port = nextb(z);
-    const uint8_t a = z->a;
-    z->a = z->port_in(z, port);
-    z->mem_ptr = (a << 8) | (z->a + 1);
-  } break; // in a,(n)
-
-  case 0xD3: {
-    const uint8_t port = nextb(z);
-    z->port_out(z, port, z->a);
-    z->mem_ptr = (port + 1) | (z->a << 8);
-  } break; // out (n), a
-
-  case 0x08: {
-    uint8_t a = z->a;
-    uint8_t f = get_f(z);
-
-    z->a = z->a_;
-    set_f(z, z->f_);
-
-    z->a_ = a;
-    z->f_ = f;
-  } break; // ex af,af'
-  case 0xD9: {
-    uint8_t b = z->b, c = z->c, d = z->d, e = z->e, h = z->h, l = z->l;
-
-    z->b = z->b_;
-    z->c = z->c_;
-    z->d = z->d_;
-    z->e = z->e_;
-    z->h = z->h_;
-    z->l = z->l_;
-
-    z->b_ = b;
-    z->c_ = c;
-    z->d_ = d;
-    z->e_ = e;
-    z->h_ = h;
-    z->l_ = l;
-  } break; // exx
-
-  case 0xCB: exec_opcode_cb(z, nextb(z)); break;
-  case 0xED: exec_opcode_ed(z, nextb(z)); break;
-  case 0xDD: exec_opcode_ddfd(z, nextb(z), &z->ix); break;
-  case 0xFD: exec_opcode_ddfd(z, nextb(z), &z->iy); break;
+#define OP(n) case n:
+#define NEXT break
+#include "z80_opcodes.inc"
+#undef OP
+#undef NEXT
 
   default: fprintf(stderr, "unknown opcode %02X\n", opcode); break;
   }
@@ -1248,6 +1771,7 @@ void exec_opcode(z80* const z, uint8_t opcode) {
 void exec_opcode_ddfd(z80* const z, uint8_t opcode, uint16_t* const iz) {
   z->cyc += cyc_ddfd[opcode];
   inc_r(z);
+  PROF_OP(z, Z80_PROFILE_DDFD, opcode, cyc_ddfd[opcode]);
 
 #define IZD displace(z, *iz, nextb(z))
 #define IZH (*iz >> 8)
@@ -1266,18 +1790,18 @@ void exec_opcode_ddfd(z80* const z, uint8_t opcode, uint16_t* const iz) {
 
   case 0x84: z->a = addb(z, z->a, IZH, 0); break; // add a,izh
   case 0x85: z->a = addb(z, z->a, *iz & 0xFF, 0); break; // add a,izl
-  case 0x8C: z->a = addb(z, z->a, IZH, z->cf); break; // adc a,izh
-  case 0x8D: z->a = addb(z, z->a, *iz & 0xFF, z->cf); break; // adc a,izl
+  case 0x8C: z->a = addb(z, z->a, IZH, get_cf(z)); break; // adc a,izh
+  case 0x8D: z->a = addb(z, z->a, *iz & 0xFF, get_cf(z)); break; // adc a,izl
 
   case 0x86: z->a = addb(z, z->a, rb(z, IZD), 0); break; // add a,(iz+*)
-  case 0x8E: z->a = addb(z, z->a, rb(z, IZD), z->cf); break; // adc a,(iz+*)
+  case 0x8E: z->a = addb(z, z->a, rb(z, IZD), get_cf(z)); break; // adc a,(iz+*)
   case 0x96: z->a = subb(z, z->a, rb(z, IZD), 0); break; // sub (iz+*)
-  case 0x9E: z->a = subb(z, z->a, rb(z, IZD), z->cf); break; // sbc (iz+*)
+  case 0x9E: z->a = subb(z, z->a, rb(z, IZD), get_cf(z)); break; // sbc (iz+*)
 
   case 0x94: z->a = subb(z, z->a, IZH, 0); break; // sub izh
   case 0x95: z->a = subb(z, z->a, *iz & 0xFF, 0); break; // sub izl
-  case 0x9C: z->a = subb(z, z->a, IZH, z->cf); break; // sbc izh
-  case 0x9D: z->a = subb(z, z->a, *iz & 0xFF, z->cf); break; // sbc izl
+  case 0x9C: z->a = subb(z, z->a, IZH, get_cf(z)); break; // sbc izh
+  case 0x9D: z->a = subb(z, z->a, *iz & 0xFF, get_cf(z)); break; // sbc izl
 
   case 0xA6: land(z, rb(z, IZD)); break; // and (iz+*)
   case 0xA4: land(z, IZH); break; // and izh
@@ -1385,6 +1909,7 @@ void exec_opcode_ddfd(z80* const z, uint8_t opcode, uint16_t* const iz) {
 
   default: {
     // any other FD/DD opcode behaves as a non-prefixed opcode:
+    PROF_CYCLES(z, Z80_PROFILE_DDFD, opcode, cyc_00[opcode]);
     exec_opcode(z, opcode);
     // R should not be incremented twice:
     z->r = (z->r & 0x80) | ((z->r - 1) & 0x7f);
@@ -1400,6 +1925,7 @@ void exec_opcode_ddfd(z80* const z, uint8_t opcode, uint16_t* const iz) {
 void exec_opcode_cb(z80* const z, uint8_t opcode) {
   z->cyc += 8;
   inc_r(z);
+  PROF_OP(z, Z80_PROFILE_CB, opcode, 8);
 
   // decoding instructions from http://z80.info/decoding.htm#cb
   uint8_t x_ = (opcode >> 6) & 3; // 0b11
@@ -1440,8 +1966,8 @@ void exec_opcode_cb(z80* const z, uint8_t opcode) {
 
     // in bit (hl), x/y flags are handled differently:
     if (z_ == 6) {
-      z->yf = GET_BIT(5, z->mem_ptr >> 8);
-      z->xf = GET_BIT(3, z->mem_ptr >> 8);
+      flags(z)->yf = GET_BIT(5, z->mem_ptr >> 8);
+      flags(z)->xf = GET_BIT(3, z->mem_ptr >> 8);
       z->cyc += 4;
     }
   } break;
@@ -1484,8 +2010,8 @@ void exec_opcode_dcb(z80* const z, uint8_t opcode, uint16_t addr) {
   } break;
   case 1: {
     result = cb_bit(z, val, y_);
-    z->yf = GET_BIT(5, addr >> 8);
-    z->xf = GET_BIT(3, addr >> 8);
+    flags(z)->yf = GET_BIT(5, addr >> 8);
+    flags(z)->xf = GET_BIT(3, addr >> 8);
   } break; // bit y,(iz+d)
   case 2: result = val & ~(1 << y_); break; // res y, (iz+d)
   case 3: result = val | (1 << y_); break; // set y, (iz+d)
@@ -1516,32 +2042,34 @@ void exec_opcode_dcb(z80* const z, uint8_t opcode, uint16_t addr) {
     wb(z, addr, result);
     z->cyc += 23;
   }
+  PROF_OP(z, Z80_PROFILE_DDCB, opcode, x_ == 1 ? 20 : 23);
 }
 
 // executes a ED opcode
 void exec_opcode_ed(z80* const z, uint8_t opcode) {
   z->cyc += cyc_ed[opcode];
   inc_r(z);
+  PROF_OP(z, Z80_PROFILE_ED, opcode, cyc_ed[opcode]);
   switch (opcode) {
   case 0x47: z->i = z->a; break; // ld i,a
   case 0x4F: z->r = z->a; break; // ld r,a
 
   case 0x57:
     z->a = z->i;
-    z->sf = z->a >> 7;
-    z->zf = z->a == 0;
-    z->hf = 0;
-    z->nf = 0;
-    z->pf = z->iff2;
+    flags(z)->sf = z->a >> 7;
+    flags(z)->zf = z->a == 0;
+    flags(z)->hf = 0;
+    flags(z)->nf = 0;
+    flags(z)->pf = z->iff2;
     break; // ld a,i
 
   case 0x5F:
     z->a = z->r;
-    z->sf = z->a >> 7;
-    z->zf = z->a == 0;
-    z->hf = 0;
-    z->nf = 0;
-    z->pf = z->iff2;
+    flags(z)->sf = z->a >> 7;
+    flags(z)->zf = z->a == 0;
+    flags(z)->hf = 0;
+    flags(z)->nf = 0;
+    flags(z)->pf = z->iff2;
     break; // ld a,r
 
   case 0x45:
@@ -1582,7 +2110,7 @@ void exec_opcode_ed(z80* const z, uint8_t opcode) {
   case 0xA9: cpd(z); break; // cpd
   case 0xB1: {
     cpi(z);
-    if (get_bc(z) != 0 && !z->zf) {
+    if (get_bc(z) != 0 && !get_zf(z)) {
       z->pc -= 2;
       z->cyc += 5;
       z->mem_ptr = z->pc + 1;
@@ -1592,7 +2120,7 @@ void exec_opcode_ed(z80* const z, uint8_t opcode) {
   } break; // cpir
   case 0xB9: {
     cpd(z);
-    if (get_bc(z) != 0 && !z->zf) {
+    if (get_bc(z) != 0 && !get_zf(z)) {
       z->pc -= 2;
       z->cyc += 5;
     } else {
@@ -1632,15 +2160,15 @@ void exec_opcode_ed(z80* const z, uint8_t opcode) {
     }
     break; // indr
 
-  case 0x41: z->port_out(z, z->c, z->b); break; // out (c), b
-  case 0x49: z->port_out(z, z->c, z->c); break; // out (c), c
-  case 0x51: z->port_out(z, z->c, z->d); break; // out (c), d
-  case 0x59: z->port_out(z, z->c, z->e); break; // out (c), e
-  case 0x61: z->port_out(z, z->c, z->h); break; // out (c), h
-  case 0x69: z->port_out(z, z->c, z->l); break; // out (c), l
-  case 0x71: z->port_out(z, z->c, 0); break; // out (c), 0
+  case 0x41: port_out(z, z->c, z->b); break; // out (c), b
+  case 0x49: port_out(z, z->c, z->c); break; // out (c), c
+  case 0x51: port_out(z, z->c, z->d); break; // out (c), d
+  case 0x59: port_out(z, z->c, z->e); break; // out (c), e
+  case 0x61: port_out(z, z->c, z->h); break; // out (c), h
+  case 0x69: port_out(z, z->c, z->l); break; // out (c), l
+  case 0x71: port_out(z, z->c, 0); break; // out (c), 0
   case 0x79:
-    z->port_out(z, z->c, z->a);
+    port_out(z, z->c, z->a);
     z->mem_ptr = get_bc(z) + 1;
     break; // out (c), a
 
@@ -1740,13 +2268,13 @@ void exec_opcode_ed(z80* const z, uint8_t opcode) {
     z->a = (a & 0xF0) | (val & 0xF);
     wb(z, get_hl(z), (val >> 4) | (a << 4));
 
-    z->nf = 0;
-    z->hf = 0;
-    z->xf = GET_BIT(3, z->a);
-    z->yf = GET_BIT(5, z->a);
-    z->zf = z->a == 0;
-    z->sf = z->a >> 7;
-    z->pf = parity(z->a);
+    flags(z)->nf = 0;
+    flags(z)->hf = 0;
+    flags(z)->xf = GET_BIT(3, z->a);
+    flags(z)->yf = GET_BIT(5, z->a);
+    flags(z)->zf = z->a == 0;
+    flags(z)->sf = z->a >> 7;
+    flags(z)->pf = parity(z->a);
     z->mem_ptr = get_hl(z) + 1;
   } break; // rrd
 
@@ -1756,13 +2284,13 @@ void exec_opcode_ed(z80* const z, uint8_t opcode) {
     z->a = (a & 0xF0) | (val >> 4);
     wb(z, get_hl(z), (val << 4) | (a & 0xF));
 
-    z->nf = 0;
-    z->hf = 0;
-    z->xf = GET_BIT(3, z->a);
-    z->yf = GET_BIT(5, z->a);
-    z->zf = z->a == 0;
-    z->sf = z->a >> 7;
-    z->pf = parity(z->a);
+    flags(z)->nf = 0;
+    flags(z)->hf = 0;
+    flags(z)->xf = GET_BIT(3, z->a);
+    flags(z)->yf = GET_BIT(5, z->a);
+    flags(z)->zf = z->a == 0;
+    flags(z)->sf = z->a >> 7;
+    flags(z)->pf = parity(z->a);
     z->mem_ptr = get_hl(z) + 1;
   } break; // rld
 
@@ -1771,3 +2299,4 @@ void exec_opcode_ed(z80* const z, uint8_t opcode) {
 }
 
 #undef GET_BIT
+#undef Z80_INLINE
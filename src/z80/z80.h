@@ -6,6 +6,8 @@
 #include <stdbool.h>
 
 typedef struct z80 z80;
+typedef struct z80_profile z80_profile;
+typedef struct z80_trace z80_trace;
 struct z80 {
   uint8_t (*read_byte)(void*, uint16_t);
   void (*write_byte)(void*, uint16_t, uint8_t);
@@ -13,7 +15,26 @@ struct z80 {
   void (*port_out)(z80*, uint8_t, uint8_t);
   void* userdata;
 
+  // optional fast path for pc-relative reads: when pc < fetch_limit, opcode
+  // and operand bytes are read straight from fetch_base instead of calling
+  // read_byte. Only set this for memory that is never written (ROM).
+  const uint8_t* fetch_base;
+  uint16_t fetch_limit;
+
+  // profile the execution is counted in when built with Z80_PROFILE (see
+  // below), NULL for none. set by the user like the callbacks.
+  z80_profile* profile;
+  // trace ring recorded into when built with Z80_TRACE, NULL for none
+  z80_trace* trace;
+
   unsigned long cyc; // cycle count (t-states)
+  unsigned long steps; // instructions executed (z80_step calls)
+  // instructions and t-states skipped over without executing them (halted
+  // NOPs and busy-wait loop passes fast-forwarded by z80_run/z80_run_blocks).
+  // cyc includes the skipped t-states, steps leaves the skipped instructions out
+  unsigned long skipped;
+  unsigned long skipped_cyc;
+  unsigned long interrupts; // interrupts accepted (nmi and int)
 
   uint16_t pc, sp, ix, iy; // special purpose registers
   uint16_t mem_ptr; // "wz" register
@@ -24,6 +45,11 @@ struct z80 {
   // flags: sign, zero, yf, half-carry, xf, parity/overflow, negative, carry
   bool sf : 1, zf : 1, yf : 1, hf : 1, xf : 1, pf : 1, nf : 1, cf : 1;
 
+  // last flag-setting operation when built with Z80_LAZY_FLAGS: the flags
+  // above are only up to date while lf_op is 0 (see z80.c)
+  uint8_t lf_op, lf_a, lf_b, lf_res;
+  bool lf_c, lf_cf;
+
   uint8_t iff_delay;
   uint8_t interrupt_mode;
   uint8_t int_data;
@@ -34,8 +60,127 @@ struct z80 {
 
 void z80_init(z80* const z);
 void z80_step(z80* const z);
+unsigned long z80_run(z80* const z, unsigned long cycles);
 void z80_debug_output(z80* const z);
 void z80_gen_nmi(z80* const z);
 void z80_gen_int(z80* const z, uint8_t data);
 
+// basic block cache for code in the fetch window: z80_run_blocks() behaves
+// like z80_run() but decodes each block of straight-line ROM code once and
+// then runs it without per-instruction budget and interrupt checks. a cache
+// belongs to one z80 at a time. z80_blocks_create() returns NULL when the
+// core is built without computed goto support.
+typedef struct z80_blocks z80_blocks;
+z80_blocks* z80_blocks_create(void);
+void z80_blocks_destroy(z80_blocks* const b);
+void z80_blocks_flush(z80_blocks* const b);
+void z80_blocks_skip_idle(z80_blocks* const b, bool enable);
+unsigned long z80_run_blocks(
+    z80* const z, z80_blocks* const b, unsigned long cycles);
+
+// execution profile, filled in while z->profile points at one in a build
+// with Z80_PROFILE (without it the hooks compile to nothing). every
+// instruction counts a hit at the address it starts at and at its opcode,
+// prefixed ones once more in the table of their prefix, with the t-states
+// from the timing tables (not the extra ones of taken branches). every
+// Z80_PROFILE_PERIOD instructions the chain of call targets on the way to
+// the current instruction is sampled (calls, rsts and interrupts push
+// one, returns pop the ones whose stack slot was released), for
+// flamegraphs. z80_run_blocks() runs the interpreter while profiling, so
+// skipped idle loops still show up. counters are plain arrays: one
+// profile per z80, only touched by the thread running it.
+enum {
+  Z80_PROFILE_BASE, // unprefixed (prefix bytes are counted here too)
+  Z80_PROFILE_CB,
+  Z80_PROFILE_ED,
+  Z80_PROFILE_DDFD,
+  Z80_PROFILE_DDCB, // dd cb and fd cb
+  Z80_PROFILE_TABLES
+};
+
+#define Z80_PROFILE_PERIOD 127 // instructions per stack sample (prime)
+#define Z80_PROFILE_DEPTH 16 // deeper calls are sampled as their caller
+#define Z80_PROFILE_STACKS 4096 // distinct sampled stacks
+
+typedef struct {
+  uint64_t count; // samples, 0 for a free entry
+  uint16_t depth;
+  uint16_t pc[Z80_PROFILE_DEPTH]; // call targets, outermost first
+} z80_profile_stack;
+
+struct z80_profile {
+  uint64_t pc_hits[0x10000];
+  uint64_t op_count[Z80_PROFILE_TABLES][256];
+  // t-states per opcode of the prefixed tables. to keep the per-instruction
+  // work down, unprefixed ones are left at 0: they are their count times
+  // z80_opcode_cycles().
+  uint64_t op_cycles[Z80_PROFILE_TABLES][256];
+
+  // sampled call stacks (open addressing on a hash of the stack)
+  z80_profile_stack stacks[Z80_PROFILE_STACKS];
+  uint64_t samples_dropped; // table full
+
+  // calls in progress, with the stack pointer each return address is at
+  uint16_t call_pc[Z80_PROFILE_DEPTH];
+  uint16_t call_sp[Z80_PROFILE_DEPTH];
+  uint16_t call_depth;
+  uint16_t sample_countdown;
+};
+
+// clears a profile for a fresh run
+void z80_profile_reset(z80_profile* const p);
+
+// t-states of an unprefixed opcode, from the core's timing table
+unsigned z80_opcode_cycles(uint8_t opcode);
+
+// execution trace, recorded while z->trace points at one in a build with
+// Z80_TRACE (without it the hooks compile to nothing). every instruction
+// writes one fixed-size record of the state it starts in into a ring
+// that keeps the last `mask + 1` of them. a trigger (an instruction
+// starting at a marked address, a write to a marked address, or
+// z80_trace_fire() from outside) lets `post` more records through and
+// then stops recording, so the ring holds what led up to the trigger and
+// what followed until someone saves it and re-arms the trace.
+enum {
+  Z80_TRIGGER_NONE,
+  Z80_TRIGGER_PC, // an instruction started at a marked address
+  Z80_TRIGGER_WRITE, // a marked address was written
+  Z80_TRIGGER_HOST // z80_trace_fire(), e.g. the watchdog
+};
+
+#define Z80_TRACE_IFF1 0x01 // flags of a record
+#define Z80_TRACE_HALTED 0x02
+
+typedef struct {
+  uint64_t cyc; // t-states before the instruction
+  uint16_t pc, sp, af, bc, de, hl, ix, iy;
+  uint8_t bytes[4]; // instruction bytes, read from the fetch window
+  uint8_t nbytes; // valid bytes (outside the window only the opcode)
+  uint8_t flags;
+  uint8_t i, r;
+} z80_trace_record;
+
+struct z80_trace {
+  z80_trace_record* records; // mask + 1 records, a power of two
+  uint32_t mask;
+  uint32_t post; // records let through after a trigger
+  uint64_t count; // records written so far
+  uint64_t stop_at; // count at which recording stops, UINT64_MAX while armed
+
+  // what fired, where, and the count at that moment
+  int trigger;
+  uint16_t trigger_addr;
+  uint64_t trigger_count;
+
+  // one bit per address
+  uint8_t pc_watch[0x10000 / 8];
+  uint8_t write_watch[0x10000 / 8];
+};
+
+// fires a trigger if the trace is armed
+void z80_trace_fire(z80_trace* const t, int trigger, uint16_t addr);
+
+// clears the ring and arms the trace again, keeping the watched addresses
+void z80_trace_rearm(z80_trace* const t);
+
 #endif // Z80_Z80_H_